@@ -0,0 +1,1837 @@
+/******************************************************************************
+ * AVLDupBenchmark.c
+ *
+ * A command line benchmark for the AVLDupTree library, with no GUI so that
+ * it can be run from scripts and the results compared between releases,
+ * machines and compile time options (like AVLDUP_NO_STATISTICS).  The speed
+ * test in the AGMSAVLTest program only does int32 keys in descending order;
+ * this one does all the data types and several kinds of workload.
+ *
+ * A run has two phases.  First the load phase adds a number of key/value
+ * pairs to an empty tree.  Then the mixed phase does a number of operations,
+ * a random mix of reads (looking up all the values for a key, or scanning a
+ * short range starting at a key), additions and deletions.  Keys are chosen
+ * from a key space of the given size using a uniform, sequential or Zipfian
+ * (a few keys are very popular) distribution, and each key can have several
+ * values, so a small key space with lots of values per key gives a duplicate
+ * heavy index.  Each operation is timed individually (which adds a few tens
+ * of nanoseconds of overhead to each one) and the results are printed as a
+ * JSON object, with throughput, latency percentiles in nanoseconds and the
+ * memory used per entry.
+ *
+ * There is also a multithreaded mode, used when --readers or --writers is
+ * given, for finding out how well the reader/writer locking scales.  After
+ * the load phase, some reader threads (doing point lookups and short scans)
+ * and some writer threads (doing additions and deletions) all work on the
+ * same tree for a fixed amount of time.  Lists of reader counts, writer
+ * counts and MaxSimultaneousReaders values can be given, and every
+ * combination is run on a freshly loaded tree.  The results have the total
+ * throughput, latency percentiles for each class of operation, and how long
+ * the writers spent waiting for the lock (writer starvation), which comes
+ * from the contention profiler for the regular tree.  If the numbers fall
+ * apart as threads are added, the index should be split into several trees.
+ *
+ * Finally there is a replay mode, for traces of real workloads recorded with
+ * AVLDupStartRecording.  The recorded calls are done again on a new tree,
+ * either as fast as possible or at the same times as in the original run,
+ * and the latencies are reported for each kind of operation.  The calls are
+ * all done by one thread, in the order they were recorded.
+ *
+ * The --micro option runs microbenchmarks of the tree's basic operations
+ * instead, see AVLDupMicroBenchmark.c.
+ *
+ * The memory footprint mode (--memory-churn-rounds) loads the tree and then
+ * reports how many bytes each entry takes, both the tree's own estimate from
+ * AVLDupGetStats (split into nodes, long string buffers, the tree header and
+ * malloc overhead) and what the heap actually grew by, where the C library
+ * can say.  Then it does rounds of churn, deleting a percentage of the pairs
+ * at random and adding the same number of new ones, and reports again, so
+ * that fragmentation of the heap after delete heavy use shows up.  Use
+ * --string-length-max to get strings of varying lengths.
+ *
+ * Use --help to see the options.  The regular tree ("avl"), the concurrent
+ * tree and the LSM tree can all be benchmarked, they share the same API.
+ *
+ * This program is released into the public domain, like AGMSAVLTest.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Measuring the heap needs mallinfo2, which glibc has since version 2.33. */
+
+#if defined (__GLIBC__) && \
+(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define HEAP_MEASUREMENT 1
+#include <malloc.h>
+#endif
+
+#include "AVLDupTree.h"
+#include "AVLDupBenchmark.h"
+
+
+/* The tree engines which can be benchmarked, all used through the same set
+of functions with a void pointer for the tree. */
+
+typedef struct EngineStruct
+{
+  const char *name;
+  void *(* allocFunction) (type_code KeyType, type_code ValueType);
+  void (* freeFunction) (void *TreePntr);
+  bool (* addFunction) (void *TreePntr,
+    AVLDupThingPointer Key, AVLDupThingPointer Value);
+  bool (* deleteFunction) (void *TreePntr,
+    AVLDupThingPointer Key, AVLDupThingPointer Value);
+  bool (* iterateFunction) (void *TreePntr,
+    AVLDupThingPointer StartKeyPntr, AVLDupThingPointer StartValuePntr,
+    bool IncludeThingEqualToStart,
+    AVLDupThingPointer EndKeyPntr, AVLDupThingPointer EndValuePntr,
+    bool IncludeThingEqualToEnd,
+    AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+    void *ExtraUserData);
+} EngineRecord, *EnginePointer;
+
+
+#define MAX_SWEEP_VALUES 16
+#define MAX_THREADS 256
+
+
+typedef enum DistributionEnum {
+  DISTRIBUTION_UNIFORM = 0,
+  DISTRIBUTION_SEQUENTIAL,
+  DISTRIBUTION_ZIPF
+} Distribution;
+
+
+/* Everything specified on the command line. */
+
+typedef struct SettingsStruct
+{
+  EnginePointer enginePntr;
+  type_code     keyType;
+  type_code     valueType;
+  Distribution  distribution;
+  double        zipfTheta;
+  uint64        keySpace;
+  uint64        valuesPerKey;
+  uint64        pairs;
+  uint64        operations;
+  int           readPercent;
+  int           deletePercent;
+  uint32        scanLength; /* Zero for point lookups. */
+  int           stringLength;
+  int           stringLengthMax; /* Same as stringLength for fixed lengths. */
+  uint64        seed;
+  uint32        maxReaders; /* MaxSimultaneousReaders for the "avl" engine. */
+
+  /* Settings for the multithreaded mode.  Each list is swept over, the
+  maxReaders setting above is ignored in favour of maxReadersList. */
+
+  bool          threadedMode;
+  int           numberOfReaderCounts;
+  uint32        readerCounts [MAX_SWEEP_VALUES];
+  int           numberOfWriterCounts;
+  uint32        writerCounts [MAX_SWEEP_VALUES];
+  int           numberOfMaxReaders;
+  uint32        maxReadersList [MAX_SWEEP_VALUES];
+  int           scanPercent; /* Reader operations which are scans. */
+  bigtime_t     duration; /* Microseconds for each combination. */
+  bigtime_t     starvationThreshold;
+
+  /* Settings for the replay mode. */
+
+  const char   *replayPathName; /* NULL if not replaying a trace. */
+  bool          originalTiming; /* Otherwise as fast as possible. */
+
+  uint64        microOperations; /* Zero if not doing microbenchmarks. */
+
+  /* Settings for the memory footprint mode. */
+
+  bool          memoryMode;
+  uint32        churnRounds;
+  int           churnPercent; /* Pairs replaced in each round of churn. */
+} SettingsRecord, *SettingsPointer;
+
+
+/* A random number generator (xorshift64*) and key chooser, one per thread
+so that the threads don't share anything. */
+
+typedef struct KeyGeneratorStruct
+{
+  SettingsPointer settingsPntr;
+  uint64          randomState;
+  uint64          sequence;
+  double          zipfZetaN; /* Constants for the Zipfian distribution. */
+  double          zipfAlpha;
+  double          zipfEta;
+  double          zipfHalfPowTheta;
+} KeyGeneratorRecord, *KeyGeneratorPointer;
+
+
+/* Passed to the read operation's iteration callback. */
+
+typedef struct ReadStateStruct
+{
+  uint32 itemsSeen;
+  uint32 itemsWanted; /* Zero for no limit. */
+} ReadStateRecord, *ReadStatePointer;
+
+
+/* One reader or writer thread in the multithreaded mode.  Each has its own
+histograms, which get added up at the end. */
+
+typedef struct WorkerStruct
+{
+  SettingsPointer              settingsPntr;
+  void                        *treePntr;
+  bool                         isWriter;
+  sem_id                       startSemaphore;
+  thread_id                    threadID;
+  KeyGeneratorRecord           generator;
+  AVLDupLatencyHistogramRecord points;
+  AVLDupLatencyHistogramRecord scans;
+  AVLDupLatencyHistogramRecord writes;
+  uint64                       itemsRead;
+} WorkerRecord, *WorkerPointer;
+
+
+/* Results for one phase of the benchmark. */
+
+typedef struct PhaseResultsStruct
+{
+  double                       seconds;
+  uint64                       operations;
+  AVLDupLatencyHistogramRecord reads;
+  AVLDupLatencyHistogramRecord adds;
+  AVLDupLatencyHistogramRecord deletes;
+  uint64                       itemsRead;
+} PhaseResultsRecord, *PhaseResultsPointer;
+
+
+
+/******************************************************************************
+ * Engine wrappers, so that all the tree types can be called the same way.
+ */
+
+static uint32 RegularTreeMaxReaders = 1000;
+static AVLDupCollation RegularTreeCollation = AVLDUP_COLLATION_BINARY;
+static bool RegularTreeInterning = false;
+
+
+static void *AllocRegularTree (type_code KeyType, type_code ValueType)
+{
+  AVLDupCollation   CollationMode;
+  AVLDupTreePointer TreePntr;
+
+  CollationMode = (KeyType == B_STRING_TYPE)
+    ? RegularTreeCollation : AVLDUP_COLLATION_BINARY;
+  TreePntr = AVLDupAllocCollatedTree (KeyType, ValueType, "Benchmark",
+    RegularTreeMaxReaders, CollationMode);
+
+  /* Interning fails harmlessly for trees without strings. */
+
+  if (TreePntr != NULL && RegularTreeInterning)
+    AVLDupEnableInterning (TreePntr, true);
+  return TreePntr;
+}
+
+static void FreeRegularTree (void *TreePntr)
+{
+  AVLDupFreeTree ((AVLDupTreePointer) TreePntr);
+}
+
+static bool AddRegularTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupAdd ((AVLDupTreePointer) TreePntr, Key, Value);
+}
+
+static bool DeleteRegularTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupDelete ((AVLDupTreePointer) TreePntr, Key, Value);
+}
+
+static bool IterateRegularTree (void *TreePntr,
+  AVLDupThingPointer StartKeyPntr, AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr, AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  return AVLDupIterate ((AVLDupTreePointer) TreePntr,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+static void *AllocConcurrentTree (type_code KeyType, type_code ValueType)
+{
+  return AVLDupConcurrentAllocTree (KeyType, ValueType, "Benchmark");
+}
+
+static void FreeConcurrentTree (void *TreePntr)
+{
+  AVLDupConcurrentFreeTree ((AVLDupConcurrentTreePointer) TreePntr);
+}
+
+static bool AddConcurrentTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupConcurrentAdd ((AVLDupConcurrentTreePointer) TreePntr,
+    Key, Value);
+}
+
+static bool DeleteConcurrentTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupConcurrentDelete ((AVLDupConcurrentTreePointer) TreePntr,
+    Key, Value);
+}
+
+static bool IterateConcurrentTree (void *TreePntr,
+  AVLDupThingPointer StartKeyPntr, AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr, AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  return AVLDupConcurrentIterate ((AVLDupConcurrentTreePointer) TreePntr,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+static void *AllocLSMTree (type_code KeyType, type_code ValueType)
+{
+  return AVLDupLSMAllocTree (KeyType, ValueType, "Benchmark",
+    RegularTreeMaxReaders, 0);
+}
+
+static void FreeLSMTree (void *TreePntr)
+{
+  AVLDupLSMFreeTree ((AVLDupLSMTreePointer) TreePntr);
+}
+
+static bool AddLSMTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupLSMAdd ((AVLDupLSMTreePointer) TreePntr, Key, Value);
+}
+
+static bool DeleteLSMTree (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupLSMDelete ((AVLDupLSMTreePointer) TreePntr, Key, Value);
+}
+
+static bool IterateLSMTree (void *TreePntr,
+  AVLDupThingPointer StartKeyPntr, AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr, AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  return AVLDupLSMIterate ((AVLDupLSMTreePointer) TreePntr,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+static EngineRecord Engines [] =
+{
+  {"avl", AllocRegularTree, FreeRegularTree,
+    AddRegularTree, DeleteRegularTree, IterateRegularTree},
+  {"concurrent", AllocConcurrentTree, FreeConcurrentTree,
+    AddConcurrentTree, DeleteConcurrentTree, IterateConcurrentTree},
+  {"lsm", AllocLSMTree, FreeLSMTree,
+    AddLSMTree, DeleteLSMTree, IterateLSMTree},
+  {NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+
+
+/******************************************************************************
+ * Utilities.
+ */
+
+/* Returns the current time in nanoseconds.  system_time() only has
+microseconds, which is too coarse for timing single tree operations. */
+
+static int64 NanoTime (void)
+{
+  struct timespec Now;
+
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return (int64) Now.tv_sec * 1000000000 + Now.tv_nsec;
+}
+
+
+
+static uint64 NextRandom (KeyGeneratorPointer GeneratorPntr)
+{
+  uint64 X;
+
+  X = GeneratorPntr->randomState;
+  X ^= X >> 12;
+  X ^= X << 25;
+  X ^= X >> 27;
+  GeneratorPntr->randomState = X;
+  return X * 2685821657736338717ULL;
+}
+
+
+
+/* Returns a random number from 0 to just under 1. */
+
+static double NextRandomFraction (KeyGeneratorPointer GeneratorPntr)
+{
+  return (NextRandom (GeneratorPntr) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+
+/* Sets up a key generator.  The Zipfian constants follow "Quickly Generating
+Billion-Record Synthetic Databases" by Jim Gray et al. (SIGMOD 1994), as used
+by the YCSB benchmark.  Finding zeta(N) takes time proportional to the key
+space, which is done once per generator. */
+
+static void InitKeyGenerator (
+  KeyGeneratorPointer GeneratorPntr,
+  SettingsPointer     SettingsPntr,
+  uint64              ThreadNumber)
+{
+  uint64 i;
+  double Theta;
+  double Zeta2;
+
+  memset (GeneratorPntr, 0, sizeof (KeyGeneratorRecord));
+  GeneratorPntr->settingsPntr = SettingsPntr;
+  GeneratorPntr->randomState =
+    (SettingsPntr->seed + 1) * 0x9E3779B97F4A7C15ULL + ThreadNumber * 7919;
+  if (GeneratorPntr->randomState == 0)
+    GeneratorPntr->randomState = 1;
+  GeneratorPntr->sequence = ThreadNumber; /* Spread out the threads. */
+
+  if (SettingsPntr->distribution == DISTRIBUTION_ZIPF)
+  {
+    Theta = SettingsPntr->zipfTheta;
+    for (i = 1; i <= SettingsPntr->keySpace; i++)
+      GeneratorPntr->zipfZetaN += 1.0 / pow ((double) i, Theta);
+    Zeta2 = 1.0 + 1.0 / pow (2.0, Theta);
+    GeneratorPntr->zipfAlpha = 1.0 / (1.0 - Theta);
+    GeneratorPntr->zipfEta =
+      (1.0 - pow (2.0 / SettingsPntr->keySpace, 1.0 - Theta)) /
+      (1.0 - Zeta2 / GeneratorPntr->zipfZetaN);
+    GeneratorPntr->zipfHalfPowTheta = 1.0 + pow (0.5, Theta);
+  }
+}
+
+
+
+/* Picks the next key number, from 0 to the key space size - 1. */
+
+static uint64 NextKeyNumber (KeyGeneratorPointer GeneratorPntr)
+{
+  uint64          KeyNumber;
+  SettingsPointer SettingsPntr;
+  double          U;
+  double          UZ;
+
+  SettingsPntr = GeneratorPntr->settingsPntr;
+
+  switch (SettingsPntr->distribution)
+  {
+    case DISTRIBUTION_SEQUENTIAL:
+      return GeneratorPntr->sequence++ % SettingsPntr->keySpace;
+
+    case DISTRIBUTION_ZIPF:
+      U = NextRandomFraction (GeneratorPntr);
+      UZ = U * GeneratorPntr->zipfZetaN;
+      if (UZ < 1.0)
+        return 0;
+      if (UZ < GeneratorPntr->zipfHalfPowTheta)
+        return 1;
+      KeyNumber = (uint64) (SettingsPntr->keySpace * pow (
+        GeneratorPntr->zipfEta * U - GeneratorPntr->zipfEta + 1.0,
+        GeneratorPntr->zipfAlpha));
+      if (KeyNumber >= SettingsPntr->keySpace)
+        KeyNumber = SettingsPntr->keySpace - 1;
+      return KeyNumber;
+
+    default:
+      return NextRandom (GeneratorPntr) % SettingsPntr->keySpace;
+  }
+}
+
+
+
+/* Makes a key or value thing out of a number.  String things use the
+caller's buffer (which needs room for the maximum string length plus a NUL)
+as a long string, which the tree copies if it needs to keep it.  If a range
+of string lengths was asked for, the length is picked from the number, so
+the same number always gives the same string. */
+
+static void MakeThing (
+  SettingsPointer    SettingsPntr,
+  type_code          ThingType,
+  uint64             Number,
+  char              *StringBuffer,
+  AVLDupThingPointer ThingPntr)
+{
+  int StringLength;
+
+  memset (ThingPntr, 0, sizeof (AVLDupThingRecord));
+
+  switch (ThingType)
+  {
+    case B_INT32_TYPE:
+      ThingPntr->int32Thing = (int32) Number;
+      break;
+
+    case B_INT64_TYPE:
+      ThingPntr->int64Thing = (int64) (Number * 1000003);
+      break;
+
+    case B_FLOAT_TYPE:
+      ThingPntr->floatThing = (float) Number;
+      break;
+
+    case B_DOUBLE_TYPE:
+      ThingPntr->doubleThing = Number + 0.5;
+      break;
+
+    case B_STRING_TYPE:
+      StringLength = SettingsPntr->stringLength;
+      if (SettingsPntr->stringLengthMax > StringLength)
+        StringLength += (int) (((Number + 1) * 0x9E3779B97F4A7C15ULL >> 33) %
+          (SettingsPntr->stringLengthMax - StringLength + 1));
+      sprintf (StringBuffer, "%0*llu", StringLength,
+        (unsigned long long) Number);
+      ThingPntr->longStringThing.stringPntr = StringBuffer;
+      ThingPntr->longStringThing.isLongString = true;
+      break;
+  }
+}
+
+
+
+static bool ReadCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  ReadStatePointer StatePntr;
+
+  (void) KeyPntr; /* Only counting them. */
+  (void) ValuePntr;
+  StatePntr = (ReadStatePointer) ExtraData;
+  StatePntr->itemsSeen++;
+  return (StatePntr->itemsWanted == 0 ||
+    StatePntr->itemsSeen < StatePntr->itemsWanted);
+}
+
+
+
+/* Does one read operation: either finds all the values for a key (if
+ScanLength is zero), or scans up to ScanLength pairs starting at the key.
+Returns the number of pairs seen. */
+
+static uint32 DoRead (
+  SettingsPointer    SettingsPntr,
+  void              *TreePntr,
+  AVLDupThingPointer KeyPntr,
+  uint32             ScanLength)
+{
+  ReadStateRecord ReadState;
+
+  ReadState.itemsSeen = 0;
+  ReadState.itemsWanted = ScanLength;
+
+  if (ScanLength == 0)
+    SettingsPntr->enginePntr->iterateFunction (TreePntr,
+      KeyPntr, NULL, true, KeyPntr, NULL, true, ReadCallback, &ReadState);
+  else
+    SettingsPntr->enginePntr->iterateFunction (TreePntr,
+      KeyPntr, NULL, true, NULL, NULL, true, ReadCallback, &ReadState);
+
+  return ReadState.itemsSeen;
+}
+
+
+
+/******************************************************************************
+ * The benchmark phases.
+ */
+
+static void RunLoadPhase (
+  SettingsPointer     SettingsPntr,
+  void               *TreePntr,
+  KeyGeneratorPointer GeneratorPntr,
+  PhaseResultsPointer ResultsPntr)
+{
+  uint64            i;
+  AVLDupThingRecord Key;
+  char             *KeyBuffer;
+  int64             OperationStart;
+  int64             PhaseStart;
+  AVLDupThingRecord Value;
+  char             *ValueBuffer;
+
+  KeyBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+  ValueBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+
+  PhaseStart = NanoTime ();
+  for (i = 0; i < SettingsPntr->pairs; i++)
+  {
+    MakeThing (SettingsPntr, SettingsPntr->keyType,
+      NextKeyNumber (GeneratorPntr), KeyBuffer, &Key);
+    MakeThing (SettingsPntr, SettingsPntr->valueType,
+      NextRandom (GeneratorPntr) % SettingsPntr->valuesPerKey,
+      ValueBuffer, &Value);
+
+    OperationStart = NanoTime ();
+    SettingsPntr->enginePntr->addFunction (TreePntr, &Key, &Value);
+    AVLDupAddToLatencyHistogram (&ResultsPntr->adds,
+      NanoTime () - OperationStart);
+  }
+
+  ResultsPntr->seconds = (NanoTime () - PhaseStart) / 1e9;
+  ResultsPntr->operations = SettingsPntr->pairs;
+}
+
+
+
+static void RunMixedPhase (
+  SettingsPointer     SettingsPntr,
+  void               *TreePntr,
+  KeyGeneratorPointer GeneratorPntr,
+  PhaseResultsPointer ResultsPntr)
+{
+  int               Choice;
+  uint64            i;
+  AVLDupThingRecord Key;
+  char             *KeyBuffer;
+  int64             OperationStart;
+  int64             PhaseStart;
+  AVLDupThingRecord Value;
+  char             *ValueBuffer;
+
+  KeyBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+  ValueBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+
+  PhaseStart = NanoTime ();
+  for (i = 0; i < SettingsPntr->operations; i++)
+  {
+    Choice = (int) (NextRandom (GeneratorPntr) % 100);
+    MakeThing (SettingsPntr, SettingsPntr->keyType,
+      NextKeyNumber (GeneratorPntr), KeyBuffer, &Key);
+
+    if (Choice < SettingsPntr->readPercent)
+    {
+      OperationStart = NanoTime ();
+      ResultsPntr->itemsRead += DoRead (SettingsPntr, TreePntr, &Key,
+        SettingsPntr->scanLength);
+      AVLDupAddToLatencyHistogram (&ResultsPntr->reads,
+        NanoTime () - OperationStart);
+      continue;
+    }
+
+    MakeThing (SettingsPntr, SettingsPntr->valueType,
+      NextRandom (GeneratorPntr) % SettingsPntr->valuesPerKey,
+      ValueBuffer, &Value);
+
+    if (Choice < SettingsPntr->readPercent + SettingsPntr->deletePercent)
+    {
+      OperationStart = NanoTime ();
+      SettingsPntr->enginePntr->deleteFunction (TreePntr, &Key, &Value);
+      AVLDupAddToLatencyHistogram (&ResultsPntr->deletes,
+        NanoTime () - OperationStart);
+    }
+    else
+    {
+      OperationStart = NanoTime ();
+      SettingsPntr->enginePntr->addFunction (TreePntr, &Key, &Value);
+      AVLDupAddToLatencyHistogram (&ResultsPntr->adds,
+        NanoTime () - OperationStart);
+    }
+  }
+
+  ResultsPntr->seconds = (NanoTime () - PhaseStart) / 1e9;
+  ResultsPntr->operations = SettingsPntr->operations;
+}
+
+
+
+/* Counts the pairs in a tree by iterating over it, since the tree types
+don't all have a count function. */
+
+static uint64 CountPairs (SettingsPointer SettingsPntr, void *TreePntr)
+{
+  ReadStateRecord ReadState;
+
+  ReadState.itemsSeen = 0;
+  ReadState.itemsWanted = 0;
+  SettingsPntr->enginePntr->iterateFunction (TreePntr,
+    NULL, NULL, true, NULL, NULL, true, ReadCallback, &ReadState);
+  return ReadState.itemsSeen;
+}
+
+
+
+/******************************************************************************
+ * Output.
+ */
+
+static const char *TypeName (type_code ThingType)
+{
+  switch (ThingType)
+  {
+    case B_INT32_TYPE: return "int32";
+    case B_INT64_TYPE: return "int64";
+    case B_FLOAT_TYPE: return "float";
+    case B_DOUBLE_TYPE: return "double";
+    case B_STRING_TYPE: return "string";
+  }
+  return "unknown";
+}
+
+
+
+/* Prints a string in quotes, escaping the characters JSON doesn't allow. */
+
+static void PrintJSONString (const char *StringPntr)
+{
+  putchar ('"');
+  for (; *StringPntr != 0; StringPntr++)
+  {
+    if (*StringPntr == '"' || *StringPntr == '\\')
+      printf ("\\%c", *StringPntr);
+    else if ((unsigned char) *StringPntr < 0x20)
+      printf ("\\u%04x", (unsigned char) *StringPntr);
+    else
+      putchar (*StringPntr);
+  }
+  putchar ('"');
+}
+
+
+
+static void PrintHistogram (
+  const char *Name,
+  AVLDupLatencyHistogramPointer HistogramPntr)
+{
+  printf ("\"%s\": {\"count\": %llu, \"meanNs\": %.1f, \"p50Ns\": %lld, "
+    "\"p90Ns\": %lld, \"p99Ns\": %lld, \"p999Ns\": %lld, \"maxNs\": %lld}",
+    Name, (unsigned long long) HistogramPntr->totalCount,
+    (HistogramPntr->totalCount == 0) ? 0.0 :
+      (double) HistogramPntr->totalTime / HistogramPntr->totalCount,
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 50.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 90.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.9),
+    (long long) HistogramPntr->maximumTime);
+}
+
+
+
+static void PrintPhase (const char *Name, PhaseResultsPointer ResultsPntr)
+{
+  printf ("  \"%s\": {\"seconds\": %.6f, \"operations\": %llu, "
+    "\"opsPerSecond\": %.0f, \"itemsRead\": %llu,\n    ", Name,
+    ResultsPntr->seconds, (unsigned long long) ResultsPntr->operations,
+    (ResultsPntr->seconds > 0) ?
+      ResultsPntr->operations / ResultsPntr->seconds : 0.0,
+    (unsigned long long) ResultsPntr->itemsRead);
+  PrintHistogram ("read", &ResultsPntr->reads);
+  printf (",\n    ");
+  PrintHistogram ("add", &ResultsPntr->adds);
+  printf (",\n    ");
+  PrintHistogram ("delete", &ResultsPntr->deletes);
+  printf ("}");
+}
+
+
+
+static void PrintUsage (const char *ProgramName)
+{
+  fprintf (stderr, "Usage: %s [options]\n"
+    "  --engine avl|concurrent|lsm   tree type (avl)\n"
+    "  --key-type TYPE               int32, int64, float, double or string "
+      "(int32)\n"
+    "  --value-type TYPE             same choices (int32)\n"
+    "  --collation C                 binary, ignore-case or dictionary order\n"
+    "                                for string keys, avl engine (binary)\n"
+    "  --intern yes|no               share equal long strings, avl engine "
+      "(no)\n"
+    "  --distribution D              uniform, sequential or zipf (uniform)\n"
+    "  --zipf-theta T                skew for zipf, not 1.0 (0.99)\n"
+    "  --key-space N                 number of different keys (1000000)\n"
+    "  --values-per-key N            different values per key (1)\n"
+    "  --pairs N                     pairs added in the load phase "
+      "(1000000)\n"
+    "  --operations N                operations in the mixed phase "
+      "(1000000)\n"
+    "  --read-percent P              reads in the mixed phase (50)\n"
+    "  --delete-percent P            deletes in the mixed phase (25),\n"
+    "                                the rest are adds\n"
+    "  --scan-length N               pairs per read, 0 for all values of "
+      "a key (0)\n"
+    "  --string-length N             digits in string keys and values (16)\n"
+    "  --string-length-max N         longest strings, lengths vary between\n"
+    "                                this and --string-length if given\n"
+    "  --max-readers N               MaxSimultaneousReaders, 0 for no "
+      "locking (1000)\n"
+    "  --seed N                      random number seed (1)\n"
+    "Multithreaded mode, used if --readers or --writers is given (lists are\n"
+    "comma separated, like 1,2,4, and every combination is run):\n"
+    "  --readers LIST                reader thread counts (4)\n"
+    "  --writers LIST                writer thread counts (1)\n"
+    "  --max-readers LIST            MaxSimultaneousReaders values (1000)\n"
+    "  --scan-percent P              reads which are scans, the rest are "
+      "point\n"
+    "                                lookups (20)\n"
+    "  --duration-ms N               run time for each combination (1000)\n"
+    "  --starvation-ms N             writer wait counted as starvation "
+      "(100)\n"
+    "Replay mode, for traces made with AVLDupStartRecording (the key and "
+      "value\n"
+    "types come from the trace):\n"
+    "  --replay FILE                 trace file to replay\n"
+    "  --replay-timing T             fast or original (fast)\n"
+    "Microbenchmarks of comparisons, copying, conversion and rebalancing:\n"
+    "  --micro N                     operations per microbenchmark\n"
+    "Memory footprint mode, loads --pairs pairs then deletes and adds some:\n"
+    "  --memory-churn-rounds N       rounds of churn, turns on the mode\n"
+    "  --churn-percent P             pairs replaced in each round (50)\n",
+    ProgramName);
+}
+
+
+
+static bool ParseType (const char *Name, type_code *TypePntr)
+{
+  if (strcmp (Name, "int32") == 0)
+    *TypePntr = B_INT32_TYPE;
+  else if (strcmp (Name, "int64") == 0)
+    *TypePntr = B_INT64_TYPE;
+  else if (strcmp (Name, "float") == 0)
+    *TypePntr = B_FLOAT_TYPE;
+  else if (strcmp (Name, "double") == 0)
+    *TypePntr = B_DOUBLE_TYPE;
+  else if (strcmp (Name, "string") == 0)
+    *TypePntr = B_STRING_TYPE;
+  else
+    return false;
+  return true;
+}
+
+
+
+/* Reads a comma separated list of numbers, like "1,2,4,8". */
+
+static bool ParseList (
+  const char *Argument,
+  uint32     *Values,
+  int        *NumberOfValuesPntr)
+{
+  char *EndPntr;
+
+  *NumberOfValuesPntr = 0;
+  while (true)
+  {
+    if (*NumberOfValuesPntr >= MAX_SWEEP_VALUES)
+      return false;
+    Values[*NumberOfValuesPntr] = strtoul (Argument, &EndPntr, 10);
+    if (EndPntr == Argument)
+      return false; /* Not a number. */
+    (*NumberOfValuesPntr)++;
+    if (*EndPntr == 0)
+      return true;
+    if (*EndPntr != ',')
+      return false;
+    Argument = EndPntr + 1;
+  }
+}
+
+
+
+static bool ParseArguments (
+  int             argc,
+  char          **argv,
+  SettingsPointer SettingsPntr)
+{
+  const char *Argument;
+  int         i;
+  uint32      MostReaders;
+  uint32      MostWriters;
+  const char *Option;
+
+  memset (SettingsPntr, 0, sizeof (SettingsRecord));
+  SettingsPntr->enginePntr = &Engines[0];
+  SettingsPntr->keyType = B_INT32_TYPE;
+  SettingsPntr->valueType = B_INT32_TYPE;
+  SettingsPntr->distribution = DISTRIBUTION_UNIFORM;
+  SettingsPntr->zipfTheta = 0.99;
+  SettingsPntr->keySpace = 1000000;
+  SettingsPntr->valuesPerKey = 1;
+  SettingsPntr->pairs = 1000000;
+  SettingsPntr->operations = 1000000;
+  SettingsPntr->readPercent = 50;
+  SettingsPntr->deletePercent = 25;
+  SettingsPntr->stringLength = 16;
+  SettingsPntr->seed = 1;
+  SettingsPntr->maxReaders = 1000;
+  SettingsPntr->numberOfReaderCounts = 1;
+  SettingsPntr->readerCounts[0] = 4;
+  SettingsPntr->numberOfWriterCounts = 1;
+  SettingsPntr->writerCounts[0] = 1;
+  SettingsPntr->numberOfMaxReaders = 1;
+  SettingsPntr->maxReadersList[0] = 1000;
+  SettingsPntr->scanPercent = 20;
+  SettingsPntr->duration = 1000000;
+  SettingsPntr->churnPercent = 50;
+
+  for (i = 1; i < argc; i += 2)
+  {
+    Option = argv[i];
+    if (i + 1 >= argc)
+      return false; /* All options take an argument. */
+    Argument = argv[i + 1];
+
+    if (strcmp (Option, "--engine") == 0)
+    {
+      for (SettingsPntr->enginePntr = Engines;
+      SettingsPntr->enginePntr->name != NULL;
+      SettingsPntr->enginePntr++)
+        if (strcmp (SettingsPntr->enginePntr->name, Argument) == 0)
+          break;
+      if (SettingsPntr->enginePntr->name == NULL)
+        return false;
+    }
+    else if (strcmp (Option, "--key-type") == 0)
+    {
+      if (!ParseType (Argument, &SettingsPntr->keyType))
+        return false;
+    }
+    else if (strcmp (Option, "--value-type") == 0)
+    {
+      if (!ParseType (Argument, &SettingsPntr->valueType))
+        return false;
+    }
+    else if (strcmp (Option, "--collation") == 0)
+    {
+      if (strcmp (Argument, "binary") == 0)
+        RegularTreeCollation = AVLDUP_COLLATION_BINARY;
+      else if (strcmp (Argument, "ignore-case") == 0)
+        RegularTreeCollation = AVLDUP_COLLATION_IGNORE_CASE;
+      else if (strcmp (Argument, "dictionary") == 0)
+        RegularTreeCollation = AVLDUP_COLLATION_DICTIONARY;
+      else
+        return false;
+    }
+    else if (strcmp (Option, "--intern") == 0)
+    {
+      if (strcmp (Argument, "yes") == 0)
+        RegularTreeInterning = true;
+      else if (strcmp (Argument, "no") == 0)
+        RegularTreeInterning = false;
+      else
+        return false;
+    }
+    else if (strcmp (Option, "--distribution") == 0)
+    {
+      if (strcmp (Argument, "uniform") == 0)
+        SettingsPntr->distribution = DISTRIBUTION_UNIFORM;
+      else if (strcmp (Argument, "sequential") == 0)
+        SettingsPntr->distribution = DISTRIBUTION_SEQUENTIAL;
+      else if (strcmp (Argument, "zipf") == 0)
+        SettingsPntr->distribution = DISTRIBUTION_ZIPF;
+      else
+        return false;
+    }
+    else if (strcmp (Option, "--zipf-theta") == 0)
+      SettingsPntr->zipfTheta = atof (Argument);
+    else if (strcmp (Option, "--key-space") == 0)
+      SettingsPntr->keySpace = strtoull (Argument, NULL, 10);
+    else if (strcmp (Option, "--values-per-key") == 0)
+      SettingsPntr->valuesPerKey = strtoull (Argument, NULL, 10);
+    else if (strcmp (Option, "--pairs") == 0)
+      SettingsPntr->pairs = strtoull (Argument, NULL, 10);
+    else if (strcmp (Option, "--operations") == 0)
+      SettingsPntr->operations = strtoull (Argument, NULL, 10);
+    else if (strcmp (Option, "--read-percent") == 0)
+      SettingsPntr->readPercent = atoi (Argument);
+    else if (strcmp (Option, "--delete-percent") == 0)
+      SettingsPntr->deletePercent = atoi (Argument);
+    else if (strcmp (Option, "--scan-length") == 0)
+      SettingsPntr->scanLength = strtoul (Argument, NULL, 10);
+    else if (strcmp (Option, "--string-length") == 0)
+      SettingsPntr->stringLength = atoi (Argument);
+    else if (strcmp (Option, "--string-length-max") == 0)
+      SettingsPntr->stringLengthMax = atoi (Argument);
+    else if (strcmp (Option, "--max-readers") == 0)
+    {
+      if (!ParseList (Argument, SettingsPntr->maxReadersList,
+      &SettingsPntr->numberOfMaxReaders))
+        return false;
+      SettingsPntr->maxReaders = SettingsPntr->maxReadersList[0];
+    }
+    else if (strcmp (Option, "--readers") == 0)
+    {
+      if (!ParseList (Argument, SettingsPntr->readerCounts,
+      &SettingsPntr->numberOfReaderCounts))
+        return false;
+      SettingsPntr->threadedMode = true;
+    }
+    else if (strcmp (Option, "--writers") == 0)
+    {
+      if (!ParseList (Argument, SettingsPntr->writerCounts,
+      &SettingsPntr->numberOfWriterCounts))
+        return false;
+      SettingsPntr->threadedMode = true;
+    }
+    else if (strcmp (Option, "--scan-percent") == 0)
+      SettingsPntr->scanPercent = atoi (Argument);
+    else if (strcmp (Option, "--duration-ms") == 0)
+      SettingsPntr->duration = atoi (Argument) * (bigtime_t) 1000;
+    else if (strcmp (Option, "--starvation-ms") == 0)
+      SettingsPntr->starvationThreshold = atoi (Argument) * (bigtime_t) 1000;
+    else if (strcmp (Option, "--replay") == 0)
+      SettingsPntr->replayPathName = Argument;
+    else if (strcmp (Option, "--replay-timing") == 0)
+    {
+      if (strcmp (Argument, "original") == 0)
+        SettingsPntr->originalTiming = true;
+      else if (strcmp (Argument, "fast") == 0)
+        SettingsPntr->originalTiming = false;
+      else
+        return false;
+    }
+    else if (strcmp (Option, "--micro") == 0)
+      SettingsPntr->microOperations = strtoull (Argument, NULL, 10);
+    else if (strcmp (Option, "--memory-churn-rounds") == 0)
+    {
+      SettingsPntr->churnRounds = strtoul (Argument, NULL, 10);
+      SettingsPntr->memoryMode = true;
+    }
+    else if (strcmp (Option, "--churn-percent") == 0)
+      SettingsPntr->churnPercent = atoi (Argument);
+    else if (strcmp (Option, "--seed") == 0)
+      SettingsPntr->seed = strtoull (Argument, NULL, 10);
+    else
+      return false;
+  }
+
+  /* Check that the settings make sense. */
+
+  if (SettingsPntr->stringLengthMax < SettingsPntr->stringLength)
+    SettingsPntr->stringLengthMax = SettingsPntr->stringLength;
+
+  if (SettingsPntr->keySpace < 1 || SettingsPntr->valuesPerKey < 1 ||
+  SettingsPntr->readPercent < 0 || SettingsPntr->deletePercent < 0 ||
+  SettingsPntr->readPercent + SettingsPntr->deletePercent > 100 ||
+  SettingsPntr->stringLength < 1 || SettingsPntr->stringLengthMax > 1000 ||
+  SettingsPntr->churnPercent < 0 || SettingsPntr->churnPercent > 100 ||
+  SettingsPntr->zipfTheta <= 0.0 || SettingsPntr->zipfTheta == 1.0)
+    return false;
+
+  if (SettingsPntr->threadedMode)
+  {
+    if (SettingsPntr->scanPercent < 0 || SettingsPntr->scanPercent > 100 ||
+    SettingsPntr->duration <= 0)
+      return false;
+    for (i = 0; i < SettingsPntr->numberOfMaxReaders; i++)
+      if (SettingsPntr->maxReadersList[i] == 0)
+        return false; /* Threads need the locking turned on. */
+    MostReaders = 0;
+    for (i = 0; i < SettingsPntr->numberOfReaderCounts; i++)
+      if (SettingsPntr->readerCounts[i] > MostReaders)
+        MostReaders = SettingsPntr->readerCounts[i];
+    MostWriters = 0;
+    for (i = 0; i < SettingsPntr->numberOfWriterCounts; i++)
+      if (SettingsPntr->writerCounts[i] > MostWriters)
+        MostWriters = SettingsPntr->writerCounts[i];
+    if (MostReaders > MAX_THREADS || MostWriters > MAX_THREADS ||
+    MostReaders + MostWriters > MAX_THREADS)
+      return false;
+  }
+
+  RegularTreeMaxReaders = SettingsPntr->maxReaders;
+  return true;
+}
+
+
+
+/* Prints the settings shared by both modes, starting the JSON object. */
+
+static void PrintSettings (SettingsPointer SettingsPntr)
+{
+  printf ("{\"benchmark\": \"AVLDupBenchmark\", \"engine\": \"%s\", "
+    "\"keyType\": \"%s\", \"valueType\": \"%s\",\n",
+    SettingsPntr->enginePntr->name, TypeName (SettingsPntr->keyType),
+    TypeName (SettingsPntr->valueType));
+  printf ("  \"distribution\": \"%s\", \"zipfTheta\": %g, \"keySpace\": %llu, "
+    "\"valuesPerKey\": %llu, \"pairs\": %llu,\n",
+    (SettingsPntr->distribution == DISTRIBUTION_ZIPF) ? "zipf" :
+    (SettingsPntr->distribution == DISTRIBUTION_SEQUENTIAL) ? "sequential" :
+    "uniform", SettingsPntr->zipfTheta,
+    (unsigned long long) SettingsPntr->keySpace,
+    (unsigned long long) SettingsPntr->valuesPerKey,
+    (unsigned long long) SettingsPntr->pairs);
+  printf ("  \"scanLength\": %lu, \"stringLength\": %d, "
+    "\"stringLengthMax\": %d, \"seed\": %llu,\n",
+    (unsigned long) SettingsPntr->scanLength, SettingsPntr->stringLength,
+    SettingsPntr->stringLengthMax, (unsigned long long) SettingsPntr->seed);
+}
+
+
+
+/******************************************************************************
+ * The multithreaded mode.
+ */
+
+static volatile bool StopWorkers;
+
+
+/* Adds the counts from one histogram into another. */
+
+static void MergeHistogram (
+  AVLDupLatencyHistogramPointer DestinationPntr,
+  AVLDupLatencyHistogramPointer SourcePntr)
+{
+  int i;
+
+  for (i = 0; i < AVLDUP_LATENCY_BUCKETS; i++)
+    DestinationPntr->counts[i] += SourcePntr->counts[i];
+  DestinationPntr->totalCount += SourcePntr->totalCount;
+  DestinationPntr->totalTime += SourcePntr->totalTime;
+  if (SourcePntr->maximumTime > DestinationPntr->maximumTime)
+    DestinationPntr->maximumTime = SourcePntr->maximumTime;
+}
+
+
+
+/* The thread function for readers and writers.  Waits for the start signal
+then does operations until told to stop.  Readers do point lookups (all the
+values for a key) or scans (the next ScanLength pairs, 10 if it wasn't
+specified).  Writers do an even mix of additions and deletions, so the tree
+stays about the same size. */
+
+static int32 WorkerThread (void *Data)
+{
+  AVLDupThingRecord Key;
+  char             *KeyBuffer;
+  int64             OperationStart;
+  uint32            ScanLength;
+  SettingsPointer   SettingsPntr;
+  AVLDupThingRecord Value;
+  char             *ValueBuffer;
+  WorkerPointer     WorkerPntr;
+
+  WorkerPntr = (WorkerPointer) Data;
+  SettingsPntr = WorkerPntr->settingsPntr;
+  ScanLength = SettingsPntr->scanLength;
+  if (ScanLength == 0)
+    ScanLength = 10;
+  KeyBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+  ValueBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+
+  while (acquire_sem (WorkerPntr->startSemaphore) == B_INTERRUPTED)
+    ; /* Try again if a signal interrupted the wait. */
+
+  while (!StopWorkers)
+  {
+    MakeThing (SettingsPntr, SettingsPntr->keyType,
+      NextKeyNumber (&WorkerPntr->generator), KeyBuffer, &Key);
+
+    if (WorkerPntr->isWriter)
+    {
+      MakeThing (SettingsPntr, SettingsPntr->valueType,
+        NextRandom (&WorkerPntr->generator) % SettingsPntr->valuesPerKey,
+        ValueBuffer, &Value);
+      OperationStart = NanoTime ();
+      if (NextRandom (&WorkerPntr->generator) & 1)
+        SettingsPntr->enginePntr->addFunction (WorkerPntr->treePntr,
+          &Key, &Value);
+      else
+        SettingsPntr->enginePntr->deleteFunction (WorkerPntr->treePntr,
+          &Key, &Value);
+      AVLDupAddToLatencyHistogram (&WorkerPntr->writes,
+        NanoTime () - OperationStart);
+    }
+    else if ((int) (NextRandom (&WorkerPntr->generator) % 100) <
+    SettingsPntr->scanPercent)
+    {
+      OperationStart = NanoTime ();
+      WorkerPntr->itemsRead += DoRead (SettingsPntr, WorkerPntr->treePntr,
+        &Key, ScanLength);
+      AVLDupAddToLatencyHistogram (&WorkerPntr->scans,
+        NanoTime () - OperationStart);
+    }
+    else
+    {
+      OperationStart = NanoTime ();
+      WorkerPntr->itemsRead += DoRead (SettingsPntr, WorkerPntr->treePntr,
+        &Key, 0);
+      AVLDupAddToLatencyHistogram (&WorkerPntr->points,
+        NanoTime () - OperationStart);
+    }
+  }
+
+  return 0;
+}
+
+
+
+/* Runs one combination of reader and writer counts on a freshly loaded
+tree, and prints the results as a JSON object.  Returns false if something
+went wrong, like not being able to start the threads. */
+
+static bool RunThreadedCombination (
+  SettingsPointer SettingsPntr,
+  uint32          MaxReaders,
+  uint32          NumberOfReaders,
+  uint32          NumberOfWriters)
+{
+  AVLDupContentionSnapshotRecord Contention;
+  bool                           HaveContention;
+  uint32                         i;
+  PhaseResultsRecord             LoadResults;
+  KeyGeneratorRecord             LoadGenerator;
+  uint64                         Operations;
+  AVLDupLatencyHistogramRecord   Points;
+  bool                           ReturnCode = false;
+  AVLDupLatencyHistogramRecord   Scans;
+  double                         Seconds;
+  int64                          StartTime;
+  sem_id                         StartSemaphore = -1;
+  uint32                         ThreadsStarted = 0;
+  uint32                         TotalThreads;
+  void                          *TreePntr = NULL;
+  WorkerPointer                  Workers = NULL;
+  AVLDupLatencyHistogramRecord   Writes;
+
+  TotalThreads = NumberOfReaders + NumberOfWriters;
+  memset (&LoadResults, 0, sizeof (LoadResults));
+  memset (&Points, 0, sizeof (Points));
+  memset (&Scans, 0, sizeof (Scans));
+  memset (&Writes, 0, sizeof (Writes));
+
+  RegularTreeMaxReaders = MaxReaders;
+  TreePntr = SettingsPntr->enginePntr->allocFunction (
+    SettingsPntr->keyType, SettingsPntr->valueType);
+  if (TreePntr == NULL)
+    goto ErrorExit;
+  InitKeyGenerator (&LoadGenerator, SettingsPntr, 0);
+  RunLoadPhase (SettingsPntr, TreePntr, &LoadGenerator, &LoadResults);
+
+  /* Only the regular tree has a contention profiler, so the writer
+  starvation numbers are only available for it. */
+
+  HaveContention = (SettingsPntr->enginePntr == &Engines[0] &&
+    AVLDupEnableContentionProfiling ((AVLDupTreePointer) TreePntr, true,
+    SettingsPntr->starvationThreshold));
+
+  Workers = calloc (TotalThreads + 1, sizeof (WorkerRecord));
+  StartSemaphore = create_sem (0, "AVLDupBenchmark start");
+  if (Workers == NULL || StartSemaphore < 0)
+    goto ErrorExit;
+
+  StopWorkers = false;
+  for (i = 0; i < TotalThreads; i++)
+  {
+    Workers[i].settingsPntr = SettingsPntr;
+    Workers[i].treePntr = TreePntr;
+    Workers[i].isWriter = (i >= NumberOfReaders);
+    Workers[i].startSemaphore = StartSemaphore;
+    InitKeyGenerator (&Workers[i].generator, SettingsPntr, i + 1);
+    Workers[i].threadID = spawn_thread (WorkerThread,
+      Workers[i].isWriter ? "AVLDupBenchmark writer" :
+      "AVLDupBenchmark reader", B_NORMAL_PRIORITY, &Workers[i]);
+    if (Workers[i].threadID < 0)
+      break;
+    resume_thread (Workers[i].threadID);
+    ThreadsStarted++;
+  }
+
+  /* Clear out the lock waits from the loading, then let everybody go at
+  once.  If some threads didn't start, they still get released and then
+  immediately stopped, so that they all can be waited for. */
+
+  if (HaveContention)
+    AVLDupGetContentionSnapshot ((AVLDupTreePointer) TreePntr,
+      &Contention, true);
+  StartTime = NanoTime ();
+  release_sem_etc (StartSemaphore, ThreadsStarted, 0);
+  if (ThreadsStarted == TotalThreads)
+    snooze (SettingsPntr->duration);
+  StopWorkers = true;
+  for (i = 0; i < ThreadsStarted; i++)
+    wait_for_thread (Workers[i].threadID, NULL);
+  Seconds = (NanoTime () - StartTime) / 1e9;
+
+  if (ThreadsStarted != TotalThreads)
+  {
+    fprintf (stderr, "Unable to start %lu threads.\n",
+      (unsigned long) TotalThreads);
+    goto ErrorExit;
+  }
+
+  if (HaveContention)
+    AVLDupGetContentionSnapshot ((AVLDupTreePointer) TreePntr,
+      &Contention, false);
+
+  for (i = 0; i < TotalThreads; i++)
+  {
+    MergeHistogram (&Points, &Workers[i].points);
+    MergeHistogram (&Scans, &Workers[i].scans);
+    MergeHistogram (&Writes, &Workers[i].writes);
+  }
+  Operations = Points.totalCount + Scans.totalCount + Writes.totalCount;
+
+  printf ("    {\"maxReaders\": %lu, \"readers\": %lu, \"writers\": %lu, "
+    "\"seconds\": %.6f, \"operations\": %llu, \"opsPerSecond\": %.0f,\n",
+    (unsigned long) MaxReaders, (unsigned long) NumberOfReaders,
+    (unsigned long) NumberOfWriters, Seconds,
+    (unsigned long long) Operations, Operations / Seconds);
+  printf ("      \"readOpsPerSecond\": %.0f, \"writeOpsPerSecond\": %.0f,\n"
+    "      ", (Points.totalCount + Scans.totalCount) / Seconds,
+    Writes.totalCount / Seconds);
+  PrintHistogram ("point", &Points);
+  printf (",\n      ");
+  PrintHistogram ("scan", &Scans);
+  printf (",\n      ");
+  PrintHistogram ("write", &Writes);
+  printf (",\n      \"writerStarvation\": ");
+
+  /* The writers' total lock wait time, as a fraction of the time the
+  writer threads were running, shows how badly the readers are keeping them
+  out.  The maximum wait is the worst single case. */
+
+  if (HaveContention)
+    printf ("{\"acquisitions\": %llu, \"contended\": %llu, "
+      "\"totalWaitUs\": %lld, \"maxWaitUs\": %lld, \"waitFraction\": %.4f, "
+      "\"thresholdUs\": %lld, \"events\": %llu}",
+      (unsigned long long) Contention.writers.acquisitions,
+      (unsigned long long) Contention.writers.contendedAcquisitions,
+      (long long) Contention.writers.totalWaitTime,
+      (long long) Contention.writers.maximumWaitTime,
+      (NumberOfWriters == 0) ? 0.0 : Contention.writers.totalWaitTime /
+        (Seconds * 1e6 * NumberOfWriters),
+      (long long) Contention.starvationThreshold,
+      (unsigned long long) Contention.starvationEvents);
+  else
+    printf ("null");
+  printf ("}");
+
+  ReturnCode = true;
+
+ErrorExit:
+  if (StartSemaphore >= 0)
+    delete_sem (StartSemaphore);
+  free (Workers);
+  if (TreePntr != NULL)
+    SettingsPntr->enginePntr->freeFunction (TreePntr);
+  return ReturnCode;
+}
+
+
+
+/* Runs every combination of the MaxSimultaneousReaders, reader count and
+writer count lists. */
+
+static bool RunThreadedSweep (SettingsPointer SettingsPntr)
+{
+  bool FirstRun = true;
+  int  MaxReadersIndex;
+  int  ReadersIndex;
+  int  WritersIndex;
+
+  PrintSettings (SettingsPntr);
+  printf ("  \"scanPercent\": %d, \"durationMs\": %lld,\n  \"runs\": [\n",
+    SettingsPntr->scanPercent, (long long) (SettingsPntr->duration / 1000));
+
+  for (MaxReadersIndex = 0;
+  MaxReadersIndex < SettingsPntr->numberOfMaxReaders; MaxReadersIndex++)
+  {
+    for (ReadersIndex = 0;
+    ReadersIndex < SettingsPntr->numberOfReaderCounts; ReadersIndex++)
+    {
+      for (WritersIndex = 0;
+      WritersIndex < SettingsPntr->numberOfWriterCounts; WritersIndex++)
+      {
+        if (SettingsPntr->readerCounts[ReadersIndex] +
+        SettingsPntr->writerCounts[WritersIndex] == 0)
+          continue;
+        if (!FirstRun)
+          printf (",\n");
+        FirstRun = false;
+        fflush (stdout);
+        if (!RunThreadedCombination (SettingsPntr,
+        SettingsPntr->maxReadersList[MaxReadersIndex],
+        SettingsPntr->readerCounts[ReadersIndex],
+        SettingsPntr->writerCounts[WritersIndex]))
+          return false;
+      }
+    }
+  }
+
+  printf ("\n  ]}\n");
+  return true;
+}
+
+
+
+/******************************************************************************
+ * The replay mode.
+ */
+
+/* Does the calls recorded in a trace on a new tree and prints the latencies
+as a JSON object.  Pairs which were in the tree when recording started are
+added first, without timing them.  An iteration is stopped after the
+number of items it did when it was recorded, and if it finds a different
+number of items it counts as a mismatch, which usually means the trace
+didn't include the starting contents of the tree. */
+
+static bool RunReplay (SettingsPointer SettingsPntr)
+{
+  AVLDupLatencyHistogramRecord Adds;
+  AVLDupRecordedCallRecord     Call;
+  AVLDupLatencyHistogramRecord Deletes;
+  uint64                       ExistingPairs = 0;
+  uint64                       FinalCount;
+  bool                         FirstCall = true;
+  AVLDupLatencyHistogramRecord Iterations;
+  uint64                       Mismatches = 0;
+  int64                        OperationStart;
+  uint64                       Operations;
+  ReadStateRecord              ReadState;
+  AVLDupTraceReaderPointer     ReaderPntr;
+  bigtime_t                    ReplayStartTime = 0;
+  double                       Seconds;
+  int64                        StartTime;
+  AVLDupStatisticsRecord       Statistics;
+  bigtime_t                    TraceStartTime = 0;
+  void                        *TreePntr;
+  bigtime_t                    WaitTime;
+
+  ReaderPntr = AVLDupOpenTrace (SettingsPntr->replayPathName,
+    &SettingsPntr->keyType, &SettingsPntr->valueType);
+  if (ReaderPntr == NULL)
+  {
+    fprintf (stderr, "Unable to read trace file \"%s\".\n",
+      SettingsPntr->replayPathName);
+    return false;
+  }
+
+  TreePntr = SettingsPntr->enginePntr->allocFunction (
+    SettingsPntr->keyType, SettingsPntr->valueType);
+  if (TreePntr == NULL)
+  {
+    fprintf (stderr, "Unable to allocate the tree.\n");
+    AVLDupCloseTrace (ReaderPntr);
+    return false;
+  }
+
+  memset (&Adds, 0, sizeof (Adds));
+  memset (&Deletes, 0, sizeof (Deletes));
+  memset (&Iterations, 0, sizeof (Iterations));
+  StartTime = NanoTime ();
+
+  while (AVLDupReadTrace (ReaderPntr, &Call))
+  {
+    if (Call.existingPair)
+    {
+      SettingsPntr->enginePntr->addFunction (TreePntr,
+        &Call.key, &Call.value);
+      ExistingPairs++;
+      continue;
+    }
+
+    if (FirstCall)
+    {
+      /* The clock starts with the first real call, not the loading. */
+      StartTime = NanoTime ();
+      ReplayStartTime = system_time ();
+      TraceStartTime = Call.time;
+      FirstCall = false;
+    }
+    else if (SettingsPntr->originalTiming)
+    {
+      WaitTime = (Call.time - TraceStartTime) -
+        (system_time () - ReplayStartTime);
+      if (WaitTime > 0)
+        snooze (WaitTime);
+    }
+
+    switch (Call.operation)
+    {
+      case AVLDUP_RECORDED_ADD:
+        OperationStart = NanoTime ();
+        SettingsPntr->enginePntr->addFunction (TreePntr,
+          &Call.key, &Call.value);
+        AVLDupAddToLatencyHistogram (&Adds, NanoTime () - OperationStart);
+        break;
+
+      case AVLDUP_RECORDED_DELETE:
+        OperationStart = NanoTime ();
+        SettingsPntr->enginePntr->deleteFunction (TreePntr,
+          &Call.key, &Call.value);
+        AVLDupAddToLatencyHistogram (&Deletes, NanoTime () - OperationStart);
+        break;
+
+      case AVLDUP_RECORDED_ITERATE:
+        ReadState.itemsSeen = 0;
+        ReadState.itemsWanted = Call.itemsIterated;
+        OperationStart = NanoTime ();
+        SettingsPntr->enginePntr->iterateFunction (TreePntr,
+          Call.hasKey ? &Call.key : NULL,
+          Call.hasValue ? &Call.value : NULL,
+          Call.includeThingEqualToStart,
+          Call.hasEndKey ? &Call.endKey : NULL,
+          Call.hasEndValue ? &Call.endValue : NULL,
+          Call.includeThingEqualToEnd, ReadCallback, &ReadState);
+        AVLDupAddToLatencyHistogram (&Iterations,
+          NanoTime () - OperationStart);
+        if (ReadState.itemsSeen != Call.itemsIterated)
+          Mismatches++;
+        break;
+    }
+  }
+
+  Seconds = (NanoTime () - StartTime) / 1e9;
+  Operations = Adds.totalCount + Deletes.totalCount + Iterations.totalCount;
+  AVLDupCloseTrace (ReaderPntr);
+  FinalCount = CountPairs (SettingsPntr, TreePntr);
+
+  printf ("{\"benchmark\": \"AVLDupBenchmark\", \"engine\": \"%s\", "
+    "\"keyType\": \"%s\", \"valueType\": \"%s\",\n  \"trace\": ",
+    SettingsPntr->enginePntr->name, TypeName (SettingsPntr->keyType),
+    TypeName (SettingsPntr->valueType));
+  PrintJSONString (SettingsPntr->replayPathName);
+  printf (", \"timing\": \"%s\", \"existingPairs\": %llu,\n",
+    SettingsPntr->originalTiming ? "original" : "fast",
+    (unsigned long long) ExistingPairs);
+  printf ("  \"seconds\": %.6f, \"operations\": %llu, "
+    "\"opsPerSecond\": %.0f, \"iterationMismatches\": %llu,\n  ",
+    Seconds, (unsigned long long) Operations,
+    (Seconds > 0) ? Operations / Seconds : 0.0,
+    (unsigned long long) Mismatches);
+  PrintHistogram ("add", &Adds);
+  printf (",\n  ");
+  PrintHistogram ("delete", &Deletes);
+  printf (",\n  ");
+  PrintHistogram ("iterate", &Iterations);
+  printf (",\n  \"finalCount\": %llu, \"bytesPerEntry\": ",
+    (unsigned long long) FinalCount);
+
+  if (SettingsPntr->enginePntr == &Engines[0] && FinalCount > 0 &&
+  AVLDupGetStats ((AVLDupTreePointer) TreePntr, &Statistics, true))
+    printf ("%.1f", (double) (Statistics.nodeBytes +
+      Statistics.longStringBytes) / FinalCount);
+  else
+    printf ("null");
+  printf ("}\n");
+
+  SettingsPntr->enginePntr->freeFunction (TreePntr);
+  return true;
+}
+
+
+
+/******************************************************************************
+ * The memory footprint mode.
+ */
+
+/* The numbers a pair was made from, so that it can be deleted later. */
+
+typedef struct PairNumbersStruct
+{
+  uint64 keyNumber;
+  uint64 valueNumber;
+} PairNumbersRecord, *PairNumbersPointer;
+
+
+/* Finds out how much of the heap is in use and how much has been obtained
+from the operating system, including big blocks allocated separately.
+Returns FALSE if the C library can't tell us. */
+
+static bool MeasureHeap (int64 *InUsePntr, int64 *ReservedPntr)
+{
+#ifdef HEAP_MEASUREMENT
+  struct mallinfo2 Info;
+
+  Info = mallinfo2 ();
+  *InUsePntr = Info.uordblks + Info.hblkhd;
+  *ReservedPntr = Info.arena + Info.hblkhd;
+  return true;
+#else
+  *InUsePntr = *ReservedPntr = 0;
+  return false;
+#endif
+}
+
+
+
+/* Prints the memory used by the tree, as estimated by the tree and as
+measured by the growth of the heap since the base measurement.  The
+fragmentation is the fraction of the heap growth which isn't in use, so it
+includes memory freed by deletions which malloc hasn't handed out again. */
+
+static void PrintFootprint (
+  const char     *Name,
+  SettingsPointer SettingsPntr,
+  void           *TreePntr,
+  int64           BaseInUse,
+  int64           BaseReserved)
+{
+  uint64                 Count;
+  int64                  InUse;
+  int64                  Reserved;
+  AVLDupStatisticsRecord Statistics;
+
+  Count = CountPairs (SettingsPntr, TreePntr);
+  printf ("  \"%s\": {\"count\": %llu,\n    \"estimated\": ", Name,
+    (unsigned long long) Count);
+
+  /* Only the regular tree can say how much memory it uses. */
+
+  if (SettingsPntr->enginePntr == &Engines[0] &&
+  AVLDupGetStats ((AVLDupTreePointer) TreePntr, &Statistics, true))
+    printf ("{\"nodeBytes\": %llu, \"longStringBytes\": %llu, "
+      "\"longStrings\": %lu,\n      \"headerBytes\": %llu, "
+      "\"allocatorOverheadBytes\": %llu, \"totalBytes\": %llu, "
+      "\"bytesPerEntry\": %.1f}",
+      (unsigned long long) Statistics.nodeBytes,
+      (unsigned long long) Statistics.longStringBytes,
+      (unsigned long) Statistics.longStrings,
+      (unsigned long long) Statistics.headerBytes,
+      (unsigned long long) Statistics.allocatorOverheadBytes,
+      (unsigned long long) Statistics.totalBytes,
+      (Count > 0) ? (double) Statistics.totalBytes / Count : 0.0);
+  else
+    printf ("null");
+
+  printf (",\n    \"measured\": ");
+  if (MeasureHeap (&InUse, &Reserved))
+  {
+    InUse -= BaseInUse;
+    Reserved -= BaseReserved;
+    printf ("{\"heapInUseBytes\": %lld, \"heapReservedBytes\": %lld, "
+      "\"bytesPerEntry\": %.1f,\n      \"fragmentation\": %.3f}",
+      (long long) InUse, (long long) Reserved,
+      (Count > 0) ? (double) InUse / Count : 0.0,
+      (Reserved > InUse) ? (double) (Reserved - InUse) / Reserved : 0.0);
+  }
+  else
+    printf ("null");
+  printf ("}");
+}
+
+
+
+/* Loads the tree, reports its size, churns it and reports again.  The
+numbers for every pair added are kept in an array (allocated before the
+base heap measurement so it doesn't count) so that random pairs can be
+deleted during the churn.  Each round of churn deletes ChurnPercent of the
+pairs, then adds the same number of new ones in their place, so the tree
+ends up about the same size but with its nodes scattered over the heap. */
+
+static bool RunMemoryBenchmark (SettingsPointer SettingsPntr)
+{
+  int64              BaseInUse;
+  int64              BaseReserved;
+  uint64             ChurnCount;
+  KeyGeneratorRecord Generator;
+  uint64             i;
+  uint64            *Indices;
+  AVLDupThingRecord  Key;
+  char              *KeyBuffer;
+  PairNumbersPointer PairPntr;
+  PairNumbersPointer Pairs;
+  uint32             Round;
+  void              *TreePntr;
+  AVLDupThingRecord  Value;
+  char              *ValueBuffer;
+
+  if (SettingsPntr->pairs == 0)
+    return false;
+
+  ChurnCount = SettingsPntr->pairs * SettingsPntr->churnPercent / 100;
+  KeyBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+  ValueBuffer = alloca (SettingsPntr->stringLengthMax + 32);
+  Pairs = malloc (SettingsPntr->pairs * sizeof (PairNumbersRecord));
+  Indices = malloc ((ChurnCount + 1) * sizeof (uint64));
+  if (Pairs == NULL || Indices == NULL)
+  {
+    fprintf (stderr, "Not enough memory for %llu pairs.\n",
+      (unsigned long long) SettingsPntr->pairs);
+    free (Pairs);
+    free (Indices);
+    return false;
+  }
+
+  MeasureHeap (&BaseInUse, &BaseReserved);
+  TreePntr = SettingsPntr->enginePntr->allocFunction (
+    SettingsPntr->keyType, SettingsPntr->valueType);
+  if (TreePntr == NULL)
+  {
+    fprintf (stderr, "Unable to allocate the tree.\n");
+    free (Pairs);
+    free (Indices);
+    return false;
+  }
+
+  InitKeyGenerator (&Generator, SettingsPntr, 0);
+  for (i = 0; i < SettingsPntr->pairs; i++)
+  {
+    PairPntr = Pairs + i;
+    PairPntr->keyNumber = NextKeyNumber (&Generator);
+    PairPntr->valueNumber =
+      NextRandom (&Generator) % SettingsPntr->valuesPerKey;
+    MakeThing (SettingsPntr, SettingsPntr->keyType, PairPntr->keyNumber,
+      KeyBuffer, &Key);
+    MakeThing (SettingsPntr, SettingsPntr->valueType, PairPntr->valueNumber,
+      ValueBuffer, &Value);
+    SettingsPntr->enginePntr->addFunction (TreePntr, &Key, &Value);
+  }
+
+  PrintSettings (SettingsPntr);
+  printf ("  \"churnRounds\": %lu, \"churnPercent\": %d, "
+    "\"heapMeasurement\": %s,\n",
+    (unsigned long) SettingsPntr->churnRounds, SettingsPntr->churnPercent,
+#ifdef HEAP_MEASUREMENT
+    "true");
+#else
+    "false");
+#endif
+  PrintFootprint ("afterLoad", SettingsPntr, TreePntr,
+    BaseInUse, BaseReserved);
+
+  /* Delete a batch of random pairs first, then add their replacements, so
+  that the holes left by the deletions are there for the additions to
+  reuse or not.  A pair picked twice just fails to be deleted the second
+  time and its replacement is added twice, which the tree ignores. */
+
+  for (Round = 0; Round < SettingsPntr->churnRounds; Round++)
+  {
+    for (i = 0; i < ChurnCount; i++)
+    {
+      Indices[i] = NextRandom (&Generator) % SettingsPntr->pairs;
+      PairPntr = Pairs + Indices[i];
+      MakeThing (SettingsPntr, SettingsPntr->keyType, PairPntr->keyNumber,
+        KeyBuffer, &Key);
+      MakeThing (SettingsPntr, SettingsPntr->valueType,
+        PairPntr->valueNumber, ValueBuffer, &Value);
+      SettingsPntr->enginePntr->deleteFunction (TreePntr, &Key, &Value);
+      PairPntr->keyNumber = NextKeyNumber (&Generator);
+      PairPntr->valueNumber =
+        NextRandom (&Generator) % SettingsPntr->valuesPerKey;
+    }
+
+    for (i = 0; i < ChurnCount; i++)
+    {
+      PairPntr = Pairs + Indices[i];
+      MakeThing (SettingsPntr, SettingsPntr->keyType, PairPntr->keyNumber,
+        KeyBuffer, &Key);
+      MakeThing (SettingsPntr, SettingsPntr->valueType,
+        PairPntr->valueNumber, ValueBuffer, &Value);
+      SettingsPntr->enginePntr->addFunction (TreePntr, &Key, &Value);
+    }
+  }
+
+  printf (",\n");
+  PrintFootprint ("afterChurn", SettingsPntr, TreePntr,
+    BaseInUse, BaseReserved);
+  printf ("}\n");
+
+  SettingsPntr->enginePntr->freeFunction (TreePntr);
+  free (Pairs);
+  free (Indices);
+  return true;
+}
+
+
+
+int main (int argc, char **argv)
+{
+  uint64                 FinalCount;
+  KeyGeneratorRecord     Generator;
+  PhaseResultsRecord     LoadResults;
+  PhaseResultsRecord     MixedResults;
+  SettingsRecord         Settings;
+  AVLDupStatisticsRecord Statistics;
+  void                  *TreePntr;
+
+  if (!ParseArguments (argc, argv, &Settings))
+  {
+    PrintUsage (argv[0]);
+    return 2;
+  }
+
+  if (Settings.microOperations > 0)
+    return AVLDupRunMicroBenchmarks (Settings.microOperations,
+      Settings.stringLength, Settings.seed) ? 0 : 1;
+
+  if (Settings.memoryMode)
+    return RunMemoryBenchmark (&Settings) ? 0 : 1;
+
+  if (Settings.replayPathName != NULL)
+    return RunReplay (&Settings) ? 0 : 1;
+
+  if (Settings.threadedMode)
+    return RunThreadedSweep (&Settings) ? 0 : 1;
+
+  TreePntr = Settings.enginePntr->allocFunction (
+    Settings.keyType, Settings.valueType);
+  if (TreePntr == NULL)
+  {
+    fprintf (stderr, "Unable to allocate the tree.\n");
+    return 1;
+  }
+
+  memset (&LoadResults, 0, sizeof (LoadResults));
+  memset (&MixedResults, 0, sizeof (MixedResults));
+  InitKeyGenerator (&Generator, &Settings, 0);
+
+  RunLoadPhase (&Settings, TreePntr, &Generator, &LoadResults);
+  RunMixedPhase (&Settings, TreePntr, &Generator, &MixedResults);
+  FinalCount = CountPairs (&Settings, TreePntr);
+
+  PrintSettings (&Settings);
+  printf ("  \"operations\": %llu, \"readPercent\": %d, "
+    "\"deletePercent\": %d, \"maxReaders\": %lu,\n",
+    (unsigned long long) Settings.operations,
+    Settings.readPercent, Settings.deletePercent,
+    (unsigned long) Settings.maxReaders);
+  PrintPhase ("load", &LoadResults);
+  printf (",\n");
+  PrintPhase ("mixed", &MixedResults);
+  printf (",\n  \"finalCount\": %llu, \"bytesPerEntry\": ",
+    (unsigned long long) FinalCount);
+
+  /* Only the regular tree can say how much memory it uses. */
+
+  if (Settings.enginePntr == &Engines[0] && FinalCount > 0 &&
+  AVLDupGetStats ((AVLDupTreePointer) TreePntr, &Statistics, true))
+    printf ("%.1f", (double) (Statistics.nodeBytes +
+      Statistics.longStringBytes) / FinalCount);
+  else
+    printf ("null");
+  printf ("}\n");
+
+  Settings.enginePntr->freeFunction (TreePntr);
+  return 0;
+}
@@ -0,0 +1,20 @@
+/******************************************************************************
+ * AVLDupBenchmark.h
+ *
+ * Declarations shared between the source files of the AVLDupBenchmark
+ * program.  This program is released into the public domain.
+ */
+
+#ifndef _AVL_DUP_BENCHMARK_H
+#define _AVL_DUP_BENCHMARK_H 1
+
+#include <SupportDefs.h>
+
+/* From AVLDupMicroBenchmark.c, see there for details. */
+
+bool AVLDupRunMicroBenchmarks (
+  uint64 Operations,
+  int    StringLength,
+  uint64 Seed);
+
+#endif /* _AVL_DUP_BENCHMARK_H */
@@ -0,0 +1,710 @@
+/******************************************************************************
+ * AVLDupMicroBenchmark.c
+ *
+ * Microbenchmarks for the small operations which everything else in the
+ * tree is built from: the comparison functions for each data type, copying
+ * and freeing things (short strings are stored in place, long ones are
+ * separately allocated), converting text to things, and a single rebalance
+ * with AVLDupFixupSubtrees.  When the node layout or the comparison functions
+ * are changed, these show the effect on each piece, which can get lost in the
+ * averages of whole additions and iterations.
+ *
+ * Each microbenchmark works through an array of prepared inputs (4096 of
+ * them, so they stay in the cache) as many times as needed for the requested
+ * number of operations, and reports the time per operation in nanoseconds
+ * and in CPU cycles.  Cycles come from the time stamp counter on x86
+ * processors, which counts at a fixed rate on modern ones, so turn off
+ * frequency scaling for exact numbers.  On other processors only the
+ * nanoseconds are reported.  The comparisons are called through a function
+ * pointer, the same way the tree calls them.
+ *
+ * Run with "AVLDupBenchmark --micro N" for N operations per microbenchmark.
+ * This is part of the AVLDupBenchmark program and is released into the
+ * public domain.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+#include "AVLDupBenchmark.h"
+
+
+#define NUMBER_OF_INPUTS 4096 /* Must be a power of two. */
+#define INPUT_MASK (NUMBER_OF_INPUTS - 1)
+
+
+/* The kinds of input for the comparison benchmarks. */
+
+typedef enum CompareDistributionEnum {
+  COMPARE_RANDOM = 0, /* Unpredictable results. */
+  COMPARE_ASCENDING, /* A always less than B, easy to predict. */
+  COMPARE_EQUAL, /* Like comparing duplicate keys. */
+  COMPARE_DISTRIBUTIONS
+} CompareDistribution;
+
+static const char *CompareDistributionNames [COMPARE_DISTRIBUTIONS] =
+{
+  "random",
+  "ascending",
+  "equal"
+};
+
+
+/* The kinds of strings used for string comparisons, copying and
+conversions. */
+
+typedef enum StringKindEnum {
+  STRING_SHORT = 0, /* Up to 7 characters, stored in the thing itself. */
+  STRING_LONG, /* Separately allocated. */
+  STRING_LONG_PREFIX, /* Long, all the same except for the last few. */
+  STRING_KINDS
+} StringKind;
+
+static const char *StringKindNames [STRING_KINDS] =
+{
+  "short",
+  "long",
+  "longCommonPrefix"
+};
+
+
+/* Shared state for a run of the microbenchmarks. */
+
+typedef struct MicroStateStruct
+{
+  uint64 operations;
+  int    stringLength;
+  uint64 randomState;
+  bool   firstResult;
+  char  *stringsPntr; /* Room for 2 * NUMBER_OF_INPUTS strings. */
+} MicroStateRecord, *MicroStatePointer;
+
+
+/* Timing of one microbenchmark. */
+
+typedef struct MicroTimerStruct
+{
+  int64  nanoseconds;
+  uint64 cycles;
+} MicroTimerRecord, *MicroTimerPointer;
+
+
+/* Results get added into this so the compiler can't throw the work away. */
+
+static volatile int64 Sink;
+
+
+
+/******************************************************************************
+ * Utilities.
+ */
+
+static uint64 ReadCycleCounter (void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+  return __builtin_ia32_rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+
+
+static bool HaveCycleCounter (void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+
+static int64 NanoTime (void)
+{
+  struct timespec Now;
+
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return (int64) Now.tv_sec * 1000000000 + Now.tv_nsec;
+}
+
+
+
+static void StartTimer (MicroTimerPointer TimerPntr)
+{
+  TimerPntr->nanoseconds -= NanoTime ();
+  TimerPntr->cycles -= ReadCycleCounter ();
+}
+
+
+
+static void StopTimer (MicroTimerPointer TimerPntr)
+{
+  TimerPntr->cycles += ReadCycleCounter ();
+  TimerPntr->nanoseconds += NanoTime ();
+}
+
+
+
+static uint64 NextRandom (MicroStatePointer StatePntr)
+{
+  uint64 X;
+
+  X = StatePntr->randomState;
+  X ^= X >> 12;
+  X ^= X << 25;
+  X ^= X >> 27;
+  StatePntr->randomState = X;
+  return X * 2685821657736338717ULL;
+}
+
+
+
+/* Prints one result as an element of the JSON results array. */
+
+static void PrintResult (
+  MicroStatePointer StatePntr,
+  const char       *Name,
+  const char       *Distribution,
+  MicroTimerPointer TimerPntr,
+  uint64            Operations)
+{
+  printf ("%s\n    {\"name\": \"%s\", \"distribution\": \"%s\", "
+    "\"nsPerOp\": %.2f, \"cyclesPerOp\": ",
+    StatePntr->firstResult ? "" : ",", Name, Distribution,
+    (double) TimerPntr->nanoseconds / Operations);
+  if (HaveCycleCounter ())
+    printf ("%.1f}", (double) TimerPntr->cycles / Operations);
+  else
+    printf ("null}");
+  StatePntr->firstResult = false;
+}
+
+
+
+/* Fills in a string of the given kind in the buffer, which needs room for
+the string length plus a NUL.  Number makes the strings different. */
+
+static void MakeString (
+  MicroStatePointer StatePntr,
+  StringKind        Kind,
+  uint64            Number,
+  char             *BufferPntr)
+{
+  int  i;
+  int  Length;
+
+  switch (Kind)
+  {
+    case STRING_SHORT:
+      sprintf (BufferPntr, "%07llu", (unsigned long long) (Number % 10000000));
+      break;
+
+    case STRING_LONG:
+      Length = StatePntr->stringLength;
+      for (i = 0; i < Length; i++)
+        BufferPntr[i] = 'a' + (NextRandom (StatePntr) % 26);
+      BufferPntr[Length] = 0;
+      break;
+
+    default:
+      Length = StatePntr->stringLength;
+      memset (BufferPntr, 'p', Length);
+      sprintf (BufferPntr + (Length > 4 ? Length - 4 : 0), "%04llu",
+        (unsigned long long) (Number % 10000));
+      BufferPntr[Length] = 0;
+      break;
+  }
+}
+
+
+
+/* Makes a thing from a string, as a long string (pointing at the buffer) if
+it doesn't fit in a short string. */
+
+static void MakeStringThing (char *BufferPntr, AVLDupThingPointer ThingPntr)
+{
+  memset (ThingPntr, 0, sizeof (AVLDupThingRecord));
+  if (strlen (BufferPntr) < sizeof (ThingPntr->shortStringThing))
+    strcpy (ThingPntr->shortStringThing, BufferPntr);
+  else
+  {
+    ThingPntr->longStringThing.stringPntr = BufferPntr;
+    ThingPntr->longStringThing.isLongString = true;
+  }
+}
+
+
+
+/******************************************************************************
+ * The comparison functions.
+ */
+
+/* Fills in pairs of numeric things to compare, in the given distribution. */
+
+static void MakeNumberPairs (
+  MicroStatePointer   StatePntr,
+  type_code           ThingType,
+  CompareDistribution Distribution,
+  AVLDupThingPointer  AThings,
+  AVLDupThingPointer  BThings)
+{
+  int    i;
+  uint64 NumberA;
+  uint64 NumberB;
+
+  for (i = 0; i < NUMBER_OF_INPUTS; i++)
+  {
+    NumberA = NextRandom (StatePntr) % 1000000;
+    if (Distribution == COMPARE_RANDOM)
+      NumberB = NextRandom (StatePntr) % 1000000;
+    else if (Distribution == COMPARE_ASCENDING)
+      NumberB = NumberA + 1 + NextRandom (StatePntr) % 1000;
+    else
+      NumberB = NumberA;
+
+    memset (&AThings[i], 0, sizeof (AVLDupThingRecord));
+    memset (&BThings[i], 0, sizeof (AVLDupThingRecord));
+    switch (ThingType)
+    {
+      case B_INT32_TYPE:
+        AThings[i].int32Thing = (int32) NumberA - 500000;
+        BThings[i].int32Thing = (int32) NumberB - 500000;
+        break;
+
+      case B_INT64_TYPE:
+        AThings[i].int64Thing = (int64) NumberA << 20;
+        BThings[i].int64Thing = (int64) NumberB << 20;
+        break;
+
+      case B_FLOAT_TYPE:
+        AThings[i].floatThing = NumberA / 7.0f;
+        BThings[i].floatThing = NumberB / 7.0f;
+        break;
+
+      case B_DOUBLE_TYPE:
+        AThings[i].doubleThing = NumberA / 7.0;
+        BThings[i].doubleThing = NumberB / 7.0;
+        break;
+    }
+  }
+}
+
+
+
+/* Fills in pairs of string things to compare.  Ascending pairs just get
+sorted after being made randomly, equal ones have the same characters in
+different buffers, like comparing a search key with a key in the tree. */
+
+static void MakeStringPairs (
+  MicroStatePointer   StatePntr,
+  StringKind          Kind,
+  CompareDistribution Distribution,
+  AVLDupThingPointer  AThings,
+  AVLDupThingPointer  BThings)
+{
+  char  *BufferAPntr;
+  char  *BufferBPntr;
+  int    i;
+  size_t Stride;
+  char  *TempPntr;
+
+  Stride = StatePntr->stringLength + 1;
+  for (i = 0; i < NUMBER_OF_INPUTS; i++)
+  {
+    BufferAPntr = StatePntr->stringsPntr + 2 * i * Stride;
+    BufferBPntr = BufferAPntr + Stride;
+    MakeString (StatePntr, Kind, NextRandom (StatePntr), BufferAPntr);
+    if (Distribution == COMPARE_EQUAL)
+      strcpy (BufferBPntr, BufferAPntr);
+    else
+      MakeString (StatePntr, Kind, NextRandom (StatePntr), BufferBPntr);
+    if (Distribution == COMPARE_ASCENDING &&
+    strcmp (BufferAPntr, BufferBPntr) > 0)
+    {
+      TempPntr = BufferAPntr;
+      BufferAPntr = BufferBPntr;
+      BufferBPntr = TempPntr;
+    }
+    MakeStringThing (BufferAPntr, &AThings[i]);
+    MakeStringThing (BufferBPntr, &BThings[i]);
+  }
+}
+
+
+
+static void RunCompareBenchmarks (MicroStatePointer StatePntr)
+{
+  static const type_code NumberTypes [4] =
+    {B_INT32_TYPE, B_INT64_TYPE, B_FLOAT_TYPE, B_DOUBLE_TYPE};
+  static const char *NumberNames [4] =
+    {"CompareInt32", "CompareInt64", "CompareFloat", "CompareDouble"};
+
+  AVLDupThingRecord               AThings [NUMBER_OF_INPUTS];
+  AVLDupThingRecord               BThings [NUMBER_OF_INPUTS];
+  AVLDupComparisonFunctionPointer CompareFunction;
+  int                             Distribution;
+  uint64                          i;
+  int                             Kind;
+  char                            Name [64];
+  int64                           Total;
+  MicroTimerRecord                Timer;
+  int                             TypeIndex;
+
+  for (TypeIndex = 0; TypeIndex < 4; TypeIndex++)
+  {
+    CompareFunction =
+      AVLDupGetComparisonFunctionForType (NumberTypes[TypeIndex]);
+    for (Distribution = 0; Distribution < COMPARE_DISTRIBUTIONS;
+    Distribution++)
+    {
+      MakeNumberPairs (StatePntr, NumberTypes[TypeIndex],
+        (CompareDistribution) Distribution, AThings, BThings);
+      memset (&Timer, 0, sizeof (Timer));
+      Total = 0;
+      StartTimer (&Timer);
+      for (i = 0; i < StatePntr->operations; i++)
+        Total += CompareFunction (&AThings[i & INPUT_MASK],
+          &BThings[i & INPUT_MASK]);
+      StopTimer (&Timer);
+      Sink += Total;
+      PrintResult (StatePntr, NumberNames[TypeIndex],
+        CompareDistributionNames[Distribution], &Timer,
+        StatePntr->operations);
+    }
+  }
+
+  CompareFunction = AVLDupGetComparisonFunctionForType (B_STRING_TYPE);
+  for (Kind = 0; Kind < STRING_KINDS; Kind++)
+  {
+    for (Distribution = 0; Distribution < COMPARE_DISTRIBUTIONS;
+    Distribution++)
+    {
+      MakeStringPairs (StatePntr, (StringKind) Kind,
+        (CompareDistribution) Distribution, AThings, BThings);
+      memset (&Timer, 0, sizeof (Timer));
+      Total = 0;
+      StartTimer (&Timer);
+      for (i = 0; i < StatePntr->operations; i++)
+        Total += CompareFunction (&AThings[i & INPUT_MASK],
+          &BThings[i & INPUT_MASK]);
+      StopTimer (&Timer);
+      Sink += Total;
+      sprintf (Name, "%s/%s", StringKindNames[Kind],
+        CompareDistributionNames[Distribution]);
+      PrintResult (StatePntr, "CompareString", Name, &Timer,
+        StatePntr->operations);
+    }
+  }
+}
+
+
+
+/******************************************************************************
+ * Copying, freeing and converting things.
+ */
+
+/* Times AVLDupCopyThingArray and AVLDupFreeThingArray separately, one thing
+per call since that is how the tree uses them for keys and values.  The
+copies are freed after each pass through the inputs, the freeing is timed
+separately. */
+
+static void RunCopyBenchmarks (MicroStatePointer StatePntr)
+{
+  static AVLDupThingRecord Copies [NUMBER_OF_INPUTS];
+  static AVLDupThingRecord Sources [NUMBER_OF_INPUTS];
+
+  MicroTimerRecord CopyTimer;
+  int              Count;
+  uint64           Done;
+  MicroTimerRecord FreeTimer;
+  int              i;
+  int              Kind;
+  size_t           Stride;
+  type_code        ThingType;
+
+  Stride = StatePntr->stringLength + 1;
+
+  for (Kind = -1; Kind < STRING_LONG_PREFIX; Kind++)
+  {
+    /* Kind -1 is for int64 things, which are just copied. */
+
+    ThingType = (Kind < 0) ? B_INT64_TYPE : B_STRING_TYPE;
+    for (i = 0; i < NUMBER_OF_INPUTS; i++)
+    {
+      if (Kind < 0)
+      {
+        memset (&Sources[i], 0, sizeof (AVLDupThingRecord));
+        Sources[i].int64Thing = (int64) NextRandom (StatePntr);
+      }
+      else
+      {
+        MakeString (StatePntr, (StringKind) Kind, NextRandom (StatePntr),
+          StatePntr->stringsPntr + i * Stride);
+        MakeStringThing (StatePntr->stringsPntr + i * Stride, &Sources[i]);
+      }
+    }
+
+    memset (&CopyTimer, 0, sizeof (CopyTimer));
+    memset (&FreeTimer, 0, sizeof (FreeTimer));
+    for (Done = 0; Done < StatePntr->operations; Done += Count)
+    {
+      Count = NUMBER_OF_INPUTS;
+      if (StatePntr->operations - Done < (uint64) Count)
+        Count = (int) (StatePntr->operations - Done);
+
+      StartTimer (&CopyTimer);
+      for (i = 0; i < Count; i++)
+        if (!AVLDupCopyThingArray (&Copies[i], &Sources[i], ThingType, 1))
+          break;
+      StopTimer (&CopyTimer);
+      if (i < Count)
+      {
+        fprintf (stderr, "Out of memory while copying things.\n");
+        AVLDupFreeThingArray (Copies, ThingType, i);
+        return;
+      }
+
+      StartTimer (&FreeTimer);
+      for (i = 0; i < Count; i++)
+        AVLDupFreeThingArray (&Copies[i], ThingType, 1);
+      StopTimer (&FreeTimer);
+    }
+
+    PrintResult (StatePntr, "AVLDupCopyThingArray",
+      (Kind < 0) ? "int64" : StringKindNames[Kind], &CopyTimer,
+      StatePntr->operations);
+    PrintResult (StatePntr, "AVLDupFreeThingArray",
+      (Kind < 0) ? "int64" : StringKindNames[Kind], &FreeTimer,
+      StatePntr->operations);
+  }
+}
+
+
+
+/* Times AVLDupConvertStringToThing for each data type, with text like a
+user would type in a query. */
+
+static void RunConvertBenchmarks (MicroStatePointer StatePntr)
+{
+  static const type_code Types [6] = {B_INT32_TYPE, B_INT64_TYPE,
+    B_FLOAT_TYPE, B_DOUBLE_TYPE, B_STRING_TYPE, B_STRING_TYPE};
+  static const char *TypeNames [6] =
+    {"int32", "int64", "float", "double", "shortString", "longString"};
+
+  static AVLDupThingRecord Things [NUMBER_OF_INPUTS];
+
+  int               Count;
+  uint64            Done;
+  int               i;
+  size_t            Stride;
+  char             *TextPntr;
+  MicroTimerRecord  Timer;
+  int               TypeIndex;
+
+  Stride = StatePntr->stringLength + 32;
+
+  for (TypeIndex = 0; TypeIndex < 6; TypeIndex++)
+  {
+    for (i = 0; i < NUMBER_OF_INPUTS; i++)
+    {
+      TextPntr = StatePntr->stringsPntr + i * Stride;
+      switch (TypeIndex)
+      {
+        case 0:
+        case 1:
+          sprintf (TextPntr, "%lld",
+            (long long) (NextRandom (StatePntr) % 2000000000) - 1000000000);
+          break;
+
+        case 2:
+        case 3:
+          sprintf (TextPntr, "%.6g",
+            (NextRandom (StatePntr) % 1000000) / 1000.0);
+          break;
+
+        case 4:
+          MakeString (StatePntr, STRING_SHORT, NextRandom (StatePntr),
+            TextPntr);
+          break;
+
+        default:
+          MakeString (StatePntr, STRING_LONG, NextRandom (StatePntr),
+            TextPntr);
+          break;
+      }
+    }
+
+    /* Long strings get copied, so the things are freed (without timing
+    it) after each pass through the inputs. */
+
+    memset (&Timer, 0, sizeof (Timer));
+    for (Done = 0; Done < StatePntr->operations; Done += Count)
+    {
+      Count = NUMBER_OF_INPUTS;
+      if (StatePntr->operations - Done < (uint64) Count)
+        Count = (int) (StatePntr->operations - Done);
+
+      StartTimer (&Timer);
+      for (i = 0; i < Count; i++)
+        AVLDupConvertStringToThing (StatePntr->stringsPntr + i * Stride,
+          &Things[i], Types[TypeIndex]);
+      StopTimer (&Timer);
+
+      Sink += Things[0].int32Thing;
+      if (Types[TypeIndex] == B_STRING_TYPE)
+        AVLDupFreeThingArray (Things, B_STRING_TYPE, Count);
+    }
+    PrintResult (StatePntr, "AVLDupConvertStringToThing",
+      TypeNames[TypeIndex], &Timer, StatePntr->operations);
+  }
+}
+
+
+
+/******************************************************************************
+ * Rebalancing.
+ */
+
+/* Times single calls of AVLDupFixupSubtrees on little three node subtrees,
+which is the work done at each level on the way back up from an addition or
+deletion.  "none" only updates the height, "single" needs one rotation
+(the smaller child's smaller child was added) and "double" needs two (the
+smaller child's larger child was added).  The subtrees are put back between
+passes, which isn't timed. */
+
+typedef struct FixupGroupStruct
+{
+  AVLDupNodePointer rootPntr;
+  AVLDupNodeRecord  nodes [3];
+} FixupGroupRecord, *FixupGroupPointer;
+
+
+static void SetUpFixupGroup (FixupGroupPointer GroupPntr, int Case)
+{
+  AVLDupNodePointer A;
+  AVLDupNodePointer B;
+  AVLDupNodePointer C;
+
+  memset (GroupPntr->nodes, 0, sizeof (GroupPntr->nodes));
+  A = &GroupPntr->nodes[0];
+  B = &GroupPntr->nodes[1];
+  C = &GroupPntr->nodes[2];
+  GroupPntr->rootPntr = A;
+
+  if (Case == 0) /* Balanced, B < A < C. */
+  {
+    A->smallerChildPntr = B;
+    A->largerChildPntr = C;
+    A->height = 2;
+    B->height = 1;
+    C->height = 1;
+  }
+  else if (Case == 1) /* Left-left, C < B < A. */
+  {
+    A->smallerChildPntr = B;
+    B->smallerChildPntr = C;
+    A->height = 2; /* Not yet updated after the addition of C. */
+    B->height = 2;
+    C->height = 1;
+  }
+  else /* Left-right, B < C < A. */
+  {
+    A->smallerChildPntr = B;
+    B->largerChildPntr = C;
+    A->height = 2;
+    B->height = 2;
+    C->height = 1;
+  }
+}
+
+
+
+static void RunFixupBenchmarks (MicroStatePointer StatePntr)
+{
+  static const char *CaseNames [3] = {"none", "single", "double"};
+  static FixupGroupRecord Groups [NUMBER_OF_INPUTS];
+
+  NonRecursiveArgumentsRecord Arguments;
+  int                         Case;
+  int                         Count;
+  uint64                      Done;
+  int                         i;
+  MicroTimerRecord            Timer;
+
+  memset (&Arguments, 0, sizeof (Arguments));
+
+  for (Case = 0; Case < 3; Case++)
+  {
+    memset (&Timer, 0, sizeof (Timer));
+    for (Done = 0; Done < StatePntr->operations; Done += Count)
+    {
+      Count = NUMBER_OF_INPUTS;
+      if (StatePntr->operations - Done < (uint64) Count)
+        Count = (int) (StatePntr->operations - Done);
+
+      for (i = 0; i < Count; i++)
+        SetUpFixupGroup (&Groups[i], Case);
+
+      StartTimer (&Timer);
+      for (i = 0; i < Count; i++)
+        AVLDupFixupSubtrees (&Arguments, &Groups[i].rootPntr);
+      StopTimer (&Timer);
+
+      for (i = 0; i < Count; i++)
+        Sink += Groups[i].rootPntr->height;
+    }
+    PrintResult (StatePntr, "AVLDupFixupSubtrees", CaseNames[Case], &Timer,
+      StatePntr->operations);
+  }
+}
+
+
+
+/******************************************************************************
+ * Running them all.
+ */
+
+/* Runs all the microbenchmarks, Operations times each, and prints the
+results as JSON.  StringLength is the length of the long strings.  Returns
+FALSE if it runs out of memory. */
+
+bool AVLDupRunMicroBenchmarks (
+  uint64 Operations,
+  int    StringLength,
+  uint64 Seed)
+{
+  MicroStateRecord State;
+
+  memset (&State, 0, sizeof (State));
+  State.operations = (Operations > 0) ? Operations : 1;
+  State.stringLength = (StringLength > 7) ? StringLength : 8;
+  State.randomState = (Seed + 1) * 0x9E3779B97F4A7C15ULL;
+  State.firstResult = true;
+  State.stringsPntr = malloc (2 * NUMBER_OF_INPUTS *
+    (State.stringLength + 32));
+  if (State.stringsPntr == NULL)
+    return false;
+
+  printf ("{\"benchmark\": \"AVLDupMicroBenchmark\", \"operations\": %llu, "
+    "\"stringLength\": %d, \"seed\": %llu, \"cycleCounter\": %s,\n"
+    "  \"results\": [",
+    (unsigned long long) State.operations, State.stringLength,
+    (unsigned long long) Seed, HaveCycleCounter () ? "\"tsc\"" : "null");
+
+  RunCompareBenchmarks (&State);
+  RunCopyBenchmarks (&State);
+  RunConvertBenchmarks (&State);
+  RunFixupBenchmarks (&State);
+
+  printf ("\n  ]}\n");
+  free (State.stringsPntr);
+  return true;
+}
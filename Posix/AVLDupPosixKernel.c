@@ -0,0 +1,676 @@
+/******************************************************************************
+ * AVLDupPosixKernel.c
+ *
+ * The parts of the BeOS/Haiku kernel API that the AVLDupTree library uses,
+ * implemented with POSIX threads so that the library and the benchmark can
+ * be built and measured on Linux (see Makefile.linux).  On Haiku the real
+ * kernel functions are used and this file isn't compiled.
+ *
+ * Semaphores behave like the kernel ones where the library depends on it:
+ * they count, acquire_sem_etc can take several units at once (the tree's
+ * writer lock takes all of the reader units), and waiting threads are served
+ * in first come first served order, so a waiting writer isn't starved by a
+ * stream of readers arriving after it.  Deleting a semaphore wakes up its
+ * waiters with B_BAD_SEM_ID, and an old ID never matches a new semaphore, so
+ * code which uses the deletion to shut things down (like AVLDupFreeTree)
+ * works the same way.  The semaphores live in a fixed table of
+ * MAX_SEMAPHORES records which are never deallocated, each with its own
+ * mutex, so that threads using different semaphores don't get in each
+ * other's way.  The ID is the table index combined with a generation count.
+ *
+ * Threads are started suspended like with spawn_thread, and run when
+ * resume_thread or wait_for_thread is called.  Thread IDs come from a counter,
+ * and threads which weren't started by spawn_thread (like the main thread)
+ * get one the first time they call find_thread.  The POSIX threads are
+ * detached, since nobody waits for some of them (like the one started by
+ * AVLDupParallelFreeTree in the background).  A thread which exits before
+ * anybody waits for it leaves behind a small record with its return value,
+ * like the kernel does, so that a wait_for_thread done a little later still
+ * works.  Only the newest MAX_EXITED_THREADS of those are kept, older ones are
+ * freed, so threads which are never waited for don't use up memory.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define MAX_SEMAPHORES 4096 /* Must be a power of two. */
+#define SEMAPHORE_INDEX_BITS 12
+#define MAX_GENERATION (INT32_MAX >> SEMAPHORE_INDEX_BITS)
+#define THREAD_HASH_SIZE 256 /* Must be a power of two. */
+#define MAX_EXITED_THREADS 256
+
+
+/* A thread waiting for a semaphore.  The waiters are kept in a queue in the
+order they arrived, and only the one at the head can take units. */
+
+typedef struct SemaphoreWaiterStruct
+{
+  struct SemaphoreWaiterStruct *nextPntr;
+  int32                         count; /* Units wanted. */
+} SemaphoreWaiterRecord, *SemaphoreWaiterPointer;
+
+
+typedef struct SemaphoreStruct
+{
+  pthread_mutex_t        mutex;
+  pthread_cond_t         condition;
+  bool                   initialised; /* Mutex and condition are set up. */
+  sem_id                 id; /* Zero if this slot isn't in use. */
+  int32                  generation; /* Makes IDs of reused slots different. */
+  int32                  count;
+  SemaphoreWaiterPointer firstWaiterPntr;
+  SemaphoreWaiterPointer lastWaiterPntr;
+} SemaphoreRecord, *SemaphorePointer;
+
+
+typedef struct ThreadStruct
+{
+  struct ThreadStruct *nextPntr; /* Next in the same hash table bucket. */
+  struct ThreadStruct *nextExitedPntr; /* Next newer exited thread. */
+  thread_id            id;
+  pthread_t            pthread;
+  thread_func          functionPntr;
+  void                *data;
+  status_t             returnValue;
+  bool                 resumed;
+  bool                 exited;
+  bool                 waitedFor; /* Someone is in wait_for_thread for it. */
+  pthread_mutex_t      mutex;
+  pthread_cond_t       condition; /* Signalled when resumed. */
+  pthread_cond_t       exitCondition; /* Signalled when it exits. */
+} ThreadRecord, *ThreadPointer;
+
+
+static pthread_mutex_t  g_SemaphoreTableMutex = PTHREAD_MUTEX_INITIALIZER;
+static SemaphoreRecord  g_SemaphoreTable [MAX_SEMAPHORES];
+static int32            g_NextSemaphoreIndex;
+
+/* Threads which were spawned and haven't been waited for yet, hashed by ID,
+and the exited ones among them in the order they exited.  The list mutex
+protects all of these and the exited and waitedFor fields. */
+
+static pthread_mutex_t  g_ThreadListMutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadPointer    g_ThreadHashTable [THREAD_HASH_SIZE];
+static ThreadPointer    g_OldestExitedPntr;
+static ThreadPointer    g_NewestExitedPntr;
+static int32            g_ExitedThreadCount;
+static int32            g_LastThreadID;
+static __thread thread_id g_CurrentThreadID;
+
+
+
+/******************************************************************************
+ * Time.
+ */
+
+bigtime_t system_time (void)
+{
+  struct timespec Now;
+
+  clock_gettime (CLOCK_MONOTONIC, &Now);
+  return (bigtime_t) Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+}
+
+
+status_t snooze (bigtime_t Microseconds)
+{
+  struct timespec Remaining;
+
+  if (Microseconds <= 0)
+    return B_OK;
+
+  Remaining.tv_sec = Microseconds / 1000000;
+  Remaining.tv_nsec = (Microseconds % 1000000) * 1000;
+  while (nanosleep (&Remaining, &Remaining) != 0 && errno == EINTR)
+    ; /* Keep sleeping for the rest of the time. */
+
+  return B_OK;
+}
+
+
+status_t get_system_info (system_info *InfoPntr)
+{
+  long CPUCount;
+
+  if (InfoPntr == NULL)
+    return B_BAD_VALUE;
+
+  memset (InfoPntr, 0, sizeof (system_info));
+  CPUCount = sysconf (_SC_NPROCESSORS_ONLN);
+  InfoPntr->cpu_count = (CPUCount < 1) ? 1 : (int32) CPUCount;
+  return B_OK;
+}
+
+
+
+/******************************************************************************
+ * Semaphores.
+ */
+
+/* Finds the table slot for an ID and locks it.  Returns NULL if the ID
+doesn't belong to a current semaphore. */
+
+static SemaphorePointer LockSemaphore (sem_id SemaphoreID)
+{
+  SemaphorePointer SemPntr;
+
+  if (SemaphoreID <= 0)
+    return NULL;
+
+  SemPntr = g_SemaphoreTable + (SemaphoreID & (MAX_SEMAPHORES - 1));
+  if (!SemPntr->initialised)
+    return NULL;
+
+  pthread_mutex_lock (&SemPntr->mutex);
+  if (SemPntr->id != SemaphoreID)
+  {
+    pthread_mutex_unlock (&SemPntr->mutex);
+    return NULL;
+  }
+  return SemPntr;
+}
+
+
+sem_id create_sem (int32 Count, const char *Name)
+{
+  pthread_condattr_t ConditionAttributes;
+  int32              i;
+  int32              Index;
+  sem_id             NewID;
+  SemaphorePointer   SemPntr;
+
+  (void) Name;
+
+  if (Count < 0)
+    return B_BAD_VALUE;
+
+  pthread_mutex_lock (&g_SemaphoreTableMutex);
+
+  /* Look for a free slot, starting after the last one handed out so that
+  slots (and thus IDs) get reused as late as possible. */
+
+  SemPntr = NULL;
+  for (i = 0; i < MAX_SEMAPHORES; i++)
+  {
+    Index = (g_NextSemaphoreIndex + i) & (MAX_SEMAPHORES - 1);
+    if (Index != 0 && g_SemaphoreTable[Index].id == 0)
+    {
+      SemPntr = g_SemaphoreTable + Index;
+      g_NextSemaphoreIndex = Index + 1;
+      break;
+    }
+  }
+
+  if (SemPntr == NULL)
+  {
+    pthread_mutex_unlock (&g_SemaphoreTableMutex);
+    return B_NO_MORE_SEMS;
+  }
+
+  if (!SemPntr->initialised)
+  {
+    pthread_mutex_init (&SemPntr->mutex, NULL);
+    pthread_condattr_init (&ConditionAttributes);
+    pthread_condattr_setclock (&ConditionAttributes, CLOCK_MONOTONIC);
+    pthread_cond_init (&SemPntr->condition, &ConditionAttributes);
+    pthread_condattr_destroy (&ConditionAttributes);
+    SemPntr->initialised = true;
+  }
+
+  pthread_mutex_lock (&SemPntr->mutex);
+  if (++SemPntr->generation > MAX_GENERATION)
+    SemPntr->generation = 1;
+  NewID = (SemPntr->generation << SEMAPHORE_INDEX_BITS) | Index;
+  SemPntr->id = NewID;
+  SemPntr->count = Count;
+  SemPntr->firstWaiterPntr = NULL;
+  SemPntr->lastWaiterPntr = NULL;
+  pthread_mutex_unlock (&SemPntr->mutex);
+
+  pthread_mutex_unlock (&g_SemaphoreTableMutex);
+
+  return NewID;
+}
+
+
+status_t delete_sem (sem_id SemaphoreID)
+{
+  SemaphorePointer SemPntr;
+
+  pthread_mutex_lock (&g_SemaphoreTableMutex);
+
+  SemPntr = LockSemaphore (SemaphoreID);
+  if (SemPntr == NULL)
+  {
+    pthread_mutex_unlock (&g_SemaphoreTableMutex);
+    return B_BAD_SEM_ID;
+  }
+
+  /* The waiters notice that the ID has changed and leave the queue. */
+
+  SemPntr->id = 0;
+  pthread_cond_broadcast (&SemPntr->condition);
+  pthread_mutex_unlock (&SemPntr->mutex);
+
+  pthread_mutex_unlock (&g_SemaphoreTableMutex);
+
+  return B_OK;
+}
+
+
+/* Removes a waiter from the queue, wherever it is in it. */
+
+static void RemoveWaiter (
+  SemaphorePointer       SemPntr,
+  SemaphoreWaiterPointer WaiterPntr)
+{
+  SemaphoreWaiterPointer  PreviousPntr;
+  SemaphoreWaiterPointer *PreviousPntrPntr;
+
+  PreviousPntr = NULL;
+  PreviousPntrPntr = &SemPntr->firstWaiterPntr;
+  while (*PreviousPntrPntr != NULL && *PreviousPntrPntr != WaiterPntr)
+  {
+    PreviousPntr = *PreviousPntrPntr;
+    PreviousPntrPntr = &PreviousPntr->nextPntr;
+  }
+
+  if (*PreviousPntrPntr == NULL)
+    return; /* Not in the queue. */
+
+  *PreviousPntrPntr = WaiterPntr->nextPntr;
+  if (SemPntr->lastWaiterPntr == WaiterPntr)
+    SemPntr->lastWaiterPntr = PreviousPntr;
+}
+
+
+status_t acquire_sem_etc (
+  sem_id    SemaphoreID,
+  int32     Count,
+  uint32    Flags,
+  bigtime_t Timeout)
+{
+  struct timespec       Deadline;
+  bigtime_t             DeadlineTime;
+  status_t              ErrorCode;
+  SemaphorePointer      SemPntr;
+  SemaphoreWaiterRecord Waiter;
+
+  if (Count < 1)
+    return B_BAD_VALUE;
+
+  SemPntr = LockSemaphore (SemaphoreID);
+  if (SemPntr == NULL)
+    return B_BAD_SEM_ID;
+
+  /* The fast path, nobody waiting and enough units available. */
+
+  if (SemPntr->firstWaiterPntr == NULL && SemPntr->count >= Count)
+  {
+    SemPntr->count -= Count;
+    pthread_mutex_unlock (&SemPntr->mutex);
+    return B_OK;
+  }
+
+  /* Work out the deadline, if there is one.  A zero relative timeout means
+  don't wait at all. */
+
+  DeadlineTime = B_INFINITE_TIMEOUT;
+  if ((Flags & B_RELATIVE_TIMEOUT) && Timeout != B_INFINITE_TIMEOUT)
+  {
+    if (Timeout <= 0)
+    {
+      pthread_mutex_unlock (&SemPntr->mutex);
+      return B_WOULD_BLOCK;
+    }
+    DeadlineTime = system_time () + Timeout;
+  }
+  else if (Flags & B_ABSOLUTE_TIMEOUT)
+    DeadlineTime = Timeout;
+  Deadline.tv_sec = DeadlineTime / 1000000;
+  Deadline.tv_nsec = (DeadlineTime % 1000000) * 1000;
+
+  /* Join the end of the queue and wait until we're at the head of it and
+  there are enough units. */
+
+  Waiter.nextPntr = NULL;
+  Waiter.count = Count;
+  if (SemPntr->lastWaiterPntr == NULL)
+    SemPntr->firstWaiterPntr = &Waiter;
+  else
+    SemPntr->lastWaiterPntr->nextPntr = &Waiter;
+  SemPntr->lastWaiterPntr = &Waiter;
+
+  ErrorCode = B_OK;
+  while (true)
+  {
+    if (SemPntr->id != SemaphoreID)
+    {
+      ErrorCode = B_BAD_SEM_ID; /* Deleted while we were waiting. */
+      break;
+    }
+
+    if (SemPntr->firstWaiterPntr == &Waiter && SemPntr->count >= Count)
+      break;
+
+    if (DeadlineTime == B_INFINITE_TIMEOUT)
+      pthread_cond_wait (&SemPntr->condition, &SemPntr->mutex);
+    else if (pthread_cond_timedwait (&SemPntr->condition, &SemPntr->mutex,
+    &Deadline) == ETIMEDOUT)
+    {
+      if (SemPntr->id == SemaphoreID &&
+      SemPntr->firstWaiterPntr == &Waiter && SemPntr->count >= Count)
+        break;
+      ErrorCode = B_TIMED_OUT;
+      break;
+    }
+  }
+
+  if (ErrorCode == B_OK)
+    SemPntr->count -= Count;
+
+  /* Leave the queue.  The next waiter may now be able to go, or may have
+  been waiting behind us even though there were enough units for it. */
+
+  RemoveWaiter (SemPntr, &Waiter);
+  if (SemPntr->firstWaiterPntr != NULL)
+    pthread_cond_broadcast (&SemPntr->condition);
+
+  pthread_mutex_unlock (&SemPntr->mutex);
+
+  return ErrorCode;
+}
+
+
+status_t acquire_sem (sem_id SemaphoreID)
+{
+  return acquire_sem_etc (SemaphoreID, 1, 0, 0);
+}
+
+
+status_t release_sem_etc (sem_id SemaphoreID, int32 Count, uint32 Flags)
+{
+  SemaphorePointer SemPntr;
+
+  (void) Flags; /* Rescheduling is up to the POSIX scheduler. */
+
+  if (Count < 1)
+    return B_BAD_VALUE;
+
+  SemPntr = LockSemaphore (SemaphoreID);
+  if (SemPntr == NULL)
+    return B_BAD_SEM_ID;
+
+  SemPntr->count += Count;
+  if (SemPntr->firstWaiterPntr != NULL &&
+  SemPntr->count >= SemPntr->firstWaiterPntr->count)
+    pthread_cond_broadcast (&SemPntr->condition);
+
+  pthread_mutex_unlock (&SemPntr->mutex);
+
+  return B_OK;
+}
+
+
+status_t release_sem (sem_id SemaphoreID)
+{
+  return release_sem_etc (SemaphoreID, 1, 0);
+}
+
+
+
+/******************************************************************************
+ * Threads.
+ */
+
+static thread_id NewThreadID (void)
+{
+  thread_id NewID;
+
+  do
+  {
+    NewID = atomic_add (&g_LastThreadID, 1) + 1;
+  } while (NewID <= 0); /* Skip zero and negative numbers when it wraps. */
+
+  return NewID;
+}
+
+
+thread_id find_thread (const char *Name)
+{
+  if (Name != NULL)
+    return B_BAD_VALUE; /* Looking up other threads by name isn't done. */
+
+  if (g_CurrentThreadID == 0)
+    g_CurrentThreadID = NewThreadID ();
+
+  return g_CurrentThreadID;
+}
+
+
+/* Finds a spawned thread which hasn't been waited for yet.  The caller
+must hold the thread list mutex. */
+
+static ThreadPointer FindThreadRecord (thread_id ThreadID)
+{
+  ThreadPointer ThreadPntr;
+
+  for (ThreadPntr = g_ThreadHashTable[ThreadID & (THREAD_HASH_SIZE - 1)];
+  ThreadPntr != NULL && ThreadPntr->id != ThreadID;
+  ThreadPntr = ThreadPntr->nextPntr)
+    ;
+  return ThreadPntr;
+}
+
+
+/* Takes a thread out of the hash table, and out of the exited threads list
+if it is on it, then frees its record.  The caller must hold the thread list
+mutex. */
+
+static void FreeThreadRecord (ThreadPointer ThreadPntr)
+{
+  ThreadPointer *PreviousPntrPntr;
+  ThreadPointer  PreviousExitedPntr;
+
+  for (PreviousPntrPntr =
+  &g_ThreadHashTable[ThreadPntr->id & (THREAD_HASH_SIZE - 1)];
+  *PreviousPntrPntr != ThreadPntr;
+  PreviousPntrPntr = &(*PreviousPntrPntr)->nextPntr)
+    ;
+  *PreviousPntrPntr = ThreadPntr->nextPntr;
+
+  if (ThreadPntr->exited && !ThreadPntr->waitedFor)
+  {
+    if (g_OldestExitedPntr == ThreadPntr)
+    {
+      PreviousExitedPntr = NULL;
+      g_OldestExitedPntr = ThreadPntr->nextExitedPntr;
+    }
+    else
+    {
+      for (PreviousExitedPntr = g_OldestExitedPntr;
+      PreviousExitedPntr->nextExitedPntr != ThreadPntr;
+      PreviousExitedPntr = PreviousExitedPntr->nextExitedPntr)
+        ;
+      PreviousExitedPntr->nextExitedPntr = ThreadPntr->nextExitedPntr;
+    }
+    if (g_NewestExitedPntr == ThreadPntr)
+      g_NewestExitedPntr = PreviousExitedPntr;
+    g_ExitedThreadCount--;
+  }
+
+  pthread_cond_destroy (&ThreadPntr->exitCondition);
+  pthread_cond_destroy (&ThreadPntr->condition);
+  pthread_mutex_destroy (&ThreadPntr->mutex);
+  free (ThreadPntr);
+}
+
+
+/* The POSIX thread's start function, which waits to be resumed and then
+runs the user's function.  When that returns it either hands the return
+value to the thread waiting for it, or leaves it in the record for a later
+wait_for_thread, freeing the oldest such record if there are too many. */
+
+static void *ThreadStartFunction (void *Data)
+{
+  status_t      ReturnValue;
+  ThreadPointer ThreadPntr;
+
+  ThreadPntr = (ThreadPointer) Data;
+  g_CurrentThreadID = ThreadPntr->id;
+
+  pthread_mutex_lock (&ThreadPntr->mutex);
+  while (!ThreadPntr->resumed)
+    pthread_cond_wait (&ThreadPntr->condition, &ThreadPntr->mutex);
+  pthread_mutex_unlock (&ThreadPntr->mutex);
+
+  ReturnValue = ThreadPntr->functionPntr (ThreadPntr->data);
+
+  pthread_mutex_lock (&g_ThreadListMutex);
+  ThreadPntr->returnValue = ReturnValue;
+  ThreadPntr->exited = true;
+  if (ThreadPntr->waitedFor)
+    pthread_cond_signal (&ThreadPntr->exitCondition);
+  else
+  {
+    if (g_NewestExitedPntr == NULL)
+      g_OldestExitedPntr = ThreadPntr;
+    else
+      g_NewestExitedPntr->nextExitedPntr = ThreadPntr;
+    g_NewestExitedPntr = ThreadPntr;
+    g_ExitedThreadCount++;
+    if (g_ExitedThreadCount > MAX_EXITED_THREADS)
+      FreeThreadRecord (g_OldestExitedPntr);
+  }
+  pthread_mutex_unlock (&g_ThreadListMutex);
+
+  return NULL;
+}
+
+
+thread_id spawn_thread (
+  thread_func FunctionPntr,
+  const char *Name,
+  int32       Priority,
+  void       *Data)
+{
+  pthread_attr_t Attributes;
+  int            ErrorCode;
+  ThreadPointer  ThreadPntr;
+
+  (void) Name;
+  (void) Priority;
+
+  if (FunctionPntr == NULL)
+    return B_BAD_VALUE;
+
+  ThreadPntr = malloc (sizeof (ThreadRecord));
+  if (ThreadPntr == NULL)
+    return B_NO_MEMORY;
+
+  memset (ThreadPntr, 0, sizeof (ThreadRecord));
+  ThreadPntr->id = NewThreadID ();
+  ThreadPntr->functionPntr = FunctionPntr;
+  ThreadPntr->data = Data;
+  pthread_mutex_init (&ThreadPntr->mutex, NULL);
+  pthread_cond_init (&ThreadPntr->condition, NULL);
+  pthread_cond_init (&ThreadPntr->exitCondition, NULL);
+
+  /* Put it in the table first, it can't exit before it is resumed and that
+  needs it to be in the table. */
+
+  pthread_mutex_lock (&g_ThreadListMutex);
+  ThreadPntr->nextPntr =
+    g_ThreadHashTable[ThreadPntr->id & (THREAD_HASH_SIZE - 1)];
+  g_ThreadHashTable[ThreadPntr->id & (THREAD_HASH_SIZE - 1)] = ThreadPntr;
+  pthread_mutex_unlock (&g_ThreadListMutex);
+
+  pthread_attr_init (&Attributes);
+  pthread_attr_setdetachstate (&Attributes, PTHREAD_CREATE_DETACHED);
+  ErrorCode = pthread_create (&ThreadPntr->pthread, &Attributes,
+    ThreadStartFunction, ThreadPntr);
+  pthread_attr_destroy (&Attributes);
+
+  if (ErrorCode != 0)
+  {
+    pthread_mutex_lock (&g_ThreadListMutex);
+    FreeThreadRecord (ThreadPntr);
+    pthread_mutex_unlock (&g_ThreadListMutex);
+    return B_NO_MORE_THREADS;
+  }
+
+  return ThreadPntr->id;
+}
+
+
+/* Lets a suspended thread run.  The caller must hold the thread list
+mutex. */
+
+static void ResumeThreadRecord (ThreadPointer ThreadPntr)
+{
+  pthread_mutex_lock (&ThreadPntr->mutex);
+  ThreadPntr->resumed = true;
+  pthread_cond_signal (&ThreadPntr->condition);
+  pthread_mutex_unlock (&ThreadPntr->mutex);
+}
+
+
+status_t resume_thread (thread_id ThreadID)
+{
+  ThreadPointer ThreadPntr;
+
+  pthread_mutex_lock (&g_ThreadListMutex);
+  ThreadPntr = FindThreadRecord (ThreadID);
+  if (ThreadPntr != NULL && ThreadPntr->exited)
+    ThreadPntr = NULL;
+  if (ThreadPntr != NULL)
+    ResumeThreadRecord (ThreadPntr);
+  pthread_mutex_unlock (&g_ThreadListMutex);
+
+  return (ThreadPntr == NULL) ? B_BAD_THREAD_ID : B_OK;
+}
+
+
+/* Waits for a thread to exit and gets its return value.  Like the kernel
+version, it resumes the thread first if it is still suspended.  Only one
+thread can wait for a given thread. */
+
+status_t wait_for_thread (thread_id ThreadID, status_t *ReturnValuePntr)
+{
+  ThreadPointer ThreadPntr;
+
+  pthread_mutex_lock (&g_ThreadListMutex);
+  ThreadPntr = FindThreadRecord (ThreadID);
+  if (ThreadPntr == NULL || ThreadPntr->waitedFor)
+  {
+    pthread_mutex_unlock (&g_ThreadListMutex);
+    return B_BAD_THREAD_ID; /* Unknown, or someone else is waiting for it. */
+  }
+
+  if (!ThreadPntr->exited)
+  {
+    ThreadPntr->waitedFor = true;
+    ResumeThreadRecord (ThreadPntr);
+    while (!ThreadPntr->exited)
+      pthread_cond_wait (&ThreadPntr->exitCondition, &g_ThreadListMutex);
+  }
+
+  if (ReturnValuePntr != NULL)
+    *ReturnValuePntr = ThreadPntr->returnValue;
+  FreeThreadRecord (ThreadPntr);
+  pthread_mutex_unlock (&g_ThreadListMutex);
+
+  return B_OK;
+}
@@ -0,0 +1,28 @@
+/******************************************************************************
+ * ByteOrder.h
+ *
+ * The little endian conversion macros used for the AVLDupTree file formats,
+ * done with the <endian.h> functions from glibc and the other Linux C
+ * libraries.  See SupportDefs.h in this directory for what the Posix
+ * directory is for.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#ifndef _AVLDUP_POSIX_BYTE_ORDER_H
+#define _AVLDUP_POSIX_BYTE_ORDER_H
+
+#include <endian.h>
+
+#include "SupportDefs.h"
+
+#define B_HOST_TO_LENDIAN_INT32(Value) ((uint32) htole32 ((uint32) (Value)))
+#define B_HOST_TO_LENDIAN_INT64(Value) ((uint64) htole64 ((uint64) (Value)))
+#define B_LENDIAN_TO_HOST_INT32(Value) ((uint32) le32toh ((uint32) (Value)))
+#define B_LENDIAN_TO_HOST_INT64(Value) ((uint64) le64toh ((uint64) (Value)))
+
+#endif /* _AVLDUP_POSIX_BYTE_ORDER_H */
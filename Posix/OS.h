@@ -0,0 +1,72 @@
+/******************************************************************************
+ * OS.h
+ *
+ * The semaphore, thread and time functions of the BeOS/Haiku kernel API that
+ * the AVLDupTree library uses, implemented with POSIX threads in
+ * AVLDupPosixKernel.c.  See SupportDefs.h in this directory for what the
+ * Posix directory is for.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#ifndef _AVLDUP_POSIX_OS_H
+#define _AVLDUP_POSIX_OS_H
+
+#include "SupportDefs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int32 sem_id;
+typedef int32 thread_id;
+typedef status_t (*thread_func) (void *Data);
+
+#define B_OS_NAME_LENGTH      32
+#define B_INFINITE_TIMEOUT    ((bigtime_t) INT64_MAX)
+
+/* Flags for acquire_sem_etc and release_sem_etc. */
+
+#define B_CAN_INTERRUPT       0x01
+#define B_DO_NOT_RESCHEDULE   0x02
+#define B_RELATIVE_TIMEOUT    0x08
+#define B_ABSOLUTE_TIMEOUT    0x10
+
+/* Thread priorities.  They are accepted but ignored, since changing the
+priority of a POSIX thread usually needs special privileges. */
+
+#define B_LOW_PRIORITY        5
+#define B_NORMAL_PRIORITY     10
+
+typedef struct system_info
+{
+  int32 cpu_count;
+} system_info;
+
+sem_id create_sem (int32 Count, const char *Name);
+status_t delete_sem (sem_id SemaphoreID);
+status_t acquire_sem (sem_id SemaphoreID);
+status_t acquire_sem_etc (sem_id SemaphoreID, int32 Count, uint32 Flags,
+  bigtime_t Timeout);
+status_t release_sem (sem_id SemaphoreID);
+status_t release_sem_etc (sem_id SemaphoreID, int32 Count, uint32 Flags);
+
+thread_id spawn_thread (thread_func FunctionPntr, const char *Name,
+  int32 Priority, void *Data);
+status_t resume_thread (thread_id ThreadID);
+status_t wait_for_thread (thread_id ThreadID, status_t *ReturnValuePntr);
+thread_id find_thread (const char *Name);
+
+bigtime_t system_time (void);
+status_t snooze (bigtime_t Microseconds);
+status_t get_system_info (system_info *InfoPntr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVLDUP_POSIX_OS_H */
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * SupportDefs.h
+ *
+ * Part of the small POSIX version of the BeOS/Haiku kernel API which lets the
+ * AVLDupTree library and the AVLDupBenchmark program be built on Linux and
+ * other POSIX systems with Makefile.linux.  Only the parts the library uses
+ * are here.  The sized integer types, status codes and atomic functions have
+ * the same names, sizes and values as the Haiku ones, so that files written
+ * by AVLDupSaveTree and the write-ahead log are the same on both systems.
+ *
+ * The atomic functions are full barriers, like the Haiku ones, done with the
+ * GCC (and Clang) __atomic builtins.  They return the previous value, except
+ * for the get and set functions.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#ifndef _AVLDUP_POSIX_SUPPORT_DEFS_H
+#define _AVLDUP_POSIX_SUPPORT_DEFS_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+typedef int8_t    int8;
+typedef uint8_t   uint8;
+typedef int16_t   int16;
+typedef uint16_t  uint16;
+typedef int32_t   int32;
+typedef uint32_t  uint32;
+typedef int64_t   int64;
+typedef uint64_t  uint64;
+
+typedef int32     status_t;
+typedef int64     bigtime_t; /* Microseconds. */
+typedef uint32    type_code;
+
+
+/* Error codes, with the same values as in Haiku's Errors.h. */
+
+#define B_GENERAL_ERROR_BASE  INT_MIN
+#define B_OS_ERROR_BASE       (B_GENERAL_ERROR_BASE + 0x1000)
+
+#define B_OK                  ((status_t) 0)
+#define B_ERROR               ((status_t) -1)
+#define B_NO_MEMORY           (B_GENERAL_ERROR_BASE + 0)
+#define B_BAD_VALUE           (B_GENERAL_ERROR_BASE + 5)
+#define B_TIMED_OUT           (B_GENERAL_ERROR_BASE + 9)
+#define B_INTERRUPTED         (B_GENERAL_ERROR_BASE + 10)
+#define B_WOULD_BLOCK         (B_GENERAL_ERROR_BASE + 11)
+#define B_BAD_SEM_ID          (B_OS_ERROR_BASE + 0)
+#define B_NO_MORE_SEMS        (B_OS_ERROR_BASE + 1)
+#define B_BAD_THREAD_ID       (B_OS_ERROR_BASE + 0x100)
+#define B_NO_MORE_THREADS     (B_OS_ERROR_BASE + 0x101)
+
+
+static inline int32 atomic_add (int32 *ValuePntr, int32 Addend)
+{
+  return __atomic_fetch_add (ValuePntr, Addend, __ATOMIC_SEQ_CST);
+}
+
+static inline int64 atomic_add64 (int64 *ValuePntr, int64 Addend)
+{
+  return __atomic_fetch_add (ValuePntr, Addend, __ATOMIC_SEQ_CST);
+}
+
+static inline int32 atomic_and (int32 *ValuePntr, int32 Mask)
+{
+  return __atomic_fetch_and (ValuePntr, Mask, __ATOMIC_SEQ_CST);
+}
+
+static inline int32 atomic_or (int32 *ValuePntr, int32 Mask)
+{
+  return __atomic_fetch_or (ValuePntr, Mask, __ATOMIC_SEQ_CST);
+}
+
+static inline int32 atomic_get (int32 *ValuePntr)
+{
+  return __atomic_load_n (ValuePntr, __ATOMIC_SEQ_CST);
+}
+
+static inline int64 atomic_get64 (int64 *ValuePntr)
+{
+  return __atomic_load_n (ValuePntr, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_set (int32 *ValuePntr, int32 NewValue)
+{
+  __atomic_store_n (ValuePntr, NewValue, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_set64 (int64 *ValuePntr, int64 NewValue)
+{
+  __atomic_store_n (ValuePntr, NewValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32 atomic_get_and_set (int32 *ValuePntr, int32 NewValue)
+{
+  return __atomic_exchange_n (ValuePntr, NewValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int64 atomic_get_and_set64 (int64 *ValuePntr, int64 NewValue)
+{
+  return __atomic_exchange_n (ValuePntr, NewValue, __ATOMIC_SEQ_CST);
+}
+
+/* Sets the value to NewValue if it was TestAgainst, returns the old value. */
+
+static inline int32 atomic_test_and_set (
+  int32 *ValuePntr,
+  int32  NewValue,
+  int32  TestAgainst)
+{
+  __atomic_compare_exchange_n (ValuePntr, &TestAgainst, NewValue,
+    false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return TestAgainst;
+}
+
+static inline int64 atomic_test_and_set64 (
+  int64 *ValuePntr,
+  int64  NewValue,
+  int64  TestAgainst)
+{
+  __atomic_compare_exchange_n (ValuePntr, &TestAgainst, NewValue,
+    false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return TestAgainst;
+}
+
+#endif /* _AVLDUP_POSIX_SUPPORT_DEFS_H */
@@ -0,0 +1,28 @@
+/******************************************************************************
+ * TypeConstants.h
+ *
+ * The type codes the AVLDupTree library supports, with the same values as in
+ * Haiku's TypeConstants.h (the four character constants like 'CSTR' written
+ * out as numbers, to avoid multicharacter constant warnings).  See
+ * SupportDefs.h in this directory for what the Posix directory is for.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#ifndef _AVLDUP_POSIX_TYPE_CONSTANTS_H
+#define _AVLDUP_POSIX_TYPE_CONSTANTS_H
+
+enum
+{
+  B_DOUBLE_TYPE = 0x44424C45, /* 'DBLE' */
+  B_FLOAT_TYPE  = 0x464C4F54, /* 'FLOT' */
+  B_INT32_TYPE  = 0x4C4F4E47, /* 'LONG' */
+  B_INT64_TYPE  = 0x4C4C4E47, /* 'LLNG' */
+  B_STRING_TYPE = 0x43535452  /* 'CSTR' */
+};
+
+#endif /* _AVLDUP_POSIX_TYPE_CONSTANTS_H */
@@ -0,0 +1,469 @@
+/******************************************************************************
+ * AVLDupBatch.c
+ *
+ * Looking up lots of keys at once, for things like a database query with a
+ * long list of wanted keys or a join between two indices.  Doing a separate
+ * search for each key is slow for a big tree, since each step down the tree
+ * goes to a node which usually isn't in the CPU cache, and the CPU sits
+ * there waiting for it to arrive from memory before it can decide which way
+ * to go next.
+ *
+ * AVLDupLookupBatch speeds that up in three ways.  First the keys are sorted,
+ * so that keys which are near each other are looked up one after the other.
+ * Then each search starts from the deepest node on the previous search's path
+ * which is known to be above the new key, rather than from the root, sharing
+ * the top part of the path (which is already in the cache anyway).  Finally
+ * several searches are done at the same time, taking turns to do one step
+ * each.  Each step asks the CPU to start fetching the next node (a prefetch)
+ * and then goes on to the other searches, so by the time it comes back to
+ * that search the node has hopefully arrived.  That's the "asynchronous
+ * memory access chaining" technique from the database literature, done by
+ * hand since C doesn't have coroutines.
+ *
+ * The whole batch is done with the tree locked once for reading.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* How many searches are in progress at the same time.  There need to be
+enough of them to keep the CPU busy while waiting for memory, but with too
+many the nodes they have fetched start pushing each other out of the cache
+before they get used. */
+
+#define BATCH_LANES 8
+
+
+/* The deepest an AVL tree can be.  An AVL tree of height H has at least
+Fibonacci (H + 2) - 1 nodes, so a tree this deep wouldn't fit in memory. */
+
+#define BATCH_MAX_DEPTH 64
+
+
+/* Below this size the sort uses an insertion sort rather than merging. */
+
+#define INSERTION_SORT_LIMIT 16
+
+
+/* Asks the CPU to start loading the memory at the given address into the
+cache, without waiting for it.  Does nothing for compilers which can't. */
+
+#if defined (__GNUC__) && __GNUC__ >= 3
+#define PREFETCH(Address) __builtin_prefetch (Address)
+#else
+#define PREFETCH(Address)
+#endif
+
+
+/* Things shared by all the searches in a batch. */
+
+typedef struct BatchStruct
+{
+  AVLDupTreePointer           treePntr;
+  AVLDupThingPointer          keyArray;
+  AVLDupThingPointer          valueArray; /* NULL if counting all values. */
+  uint32                     *countArray;
+  uint32                     *sortedOrder; /* Key indices in sorted order. */
+  AVLDupOperationCountsRecord counts;
+} BatchRecord, *BatchPointer;
+
+
+/* One of the searches being done at the same time.  Each lane does its own
+slice of the sorted keys.  The path from the root to the node most recently
+looked at is kept along with the upper bound for each node on the path, which
+is the nearest node above it where the search went to the smaller side (or
+NULL if there isn't one).  All the pairs in a node's subtree are less than
+its upper bound. */
+
+typedef struct LaneStruct
+{
+  uint32            nextPosition; /* In sortedOrder, next key to look up. */
+  uint32            endPosition;
+  uint32            keyIndex; /* Key being looked up, or the last one. */
+  bool              busy;
+  AVLDupNodePointer currentNode; /* Next node to examine. */
+  AVLDupNodePointer currentBound; /* Upper bound for the currentNode. */
+  int               depth; /* Number of nodes in the path. */
+  AVLDupNodePointer pathNodes [BATCH_MAX_DEPTH];
+  AVLDupNodePointer pathBounds [BATCH_MAX_DEPTH];
+} LaneRecord, *LanePointer;
+
+
+
+/* Compares two of the user's keys (and values, if there are values) given
+their array indices, returning the usual negative, zero or positive. */
+
+static int CompareKeys (
+  BatchPointer BatchPntr,
+  uint32       IndexA,
+  uint32       IndexB)
+{
+  int Comparison;
+
+  Comparison = BatchPntr->treePntr->keyComparisonFunctionPntr (
+    BatchPntr->keyArray + IndexA, BatchPntr->keyArray + IndexB);
+  if (Comparison == 0 && BatchPntr->valueArray != NULL)
+    Comparison = BatchPntr->treePntr->valueComparisonFunctionPntr (
+      BatchPntr->valueArray + IndexA, BatchPntr->valueArray + IndexB);
+  return Comparison;
+}
+
+
+
+/* Compares one of the user's keys (and its value, if there are values) with
+a node, returning the usual negative, zero or positive for the user's key
+being less than, equal to or greater than the node. */
+
+static int CompareKeyWithNode (
+  BatchPointer      BatchPntr,
+  uint32            KeyIndex,
+  AVLDupNodePointer CurrentNode)
+{
+  int Comparison;
+
+  Comparison = BatchPntr->treePntr->keyComparisonFunctionPntr (
+    BatchPntr->keyArray + KeyIndex, &CurrentNode->key);
+  AVLDUP_STATISTIC (BatchPntr->counts.keyComparisons++);
+
+  if (Comparison == 0 && BatchPntr->valueArray != NULL)
+  {
+    Comparison = BatchPntr->treePntr->valueComparisonFunctionPntr (
+      BatchPntr->valueArray + KeyIndex, &CurrentNode->value);
+    AVLDUP_STATISTIC (BatchPntr->counts.valueComparisons++);
+  }
+  return Comparison;
+}
+
+
+
+/* A plain merge sort of the key indices, like the node sort used for bulk
+adding in AVLDupParallel.c.  ScratchArray is the same size as IndexArray. */
+
+static void SortKeyIndices (
+  BatchPointer BatchPntr,
+  uint32      *IndexArray,
+  uint32      *ScratchArray,
+  uint32       NumberOfIndices)
+{
+  uint32  HalfCount;
+  uint32  i;
+  uint32  j;
+  uint32 *LeftPntr;
+  uint32 *LeftEndPntr;
+  uint32 *OutputPntr;
+  uint32 *RightPntr;
+  uint32 *RightEndPntr;
+  uint32  TempIndex;
+
+  if (NumberOfIndices <= INSERTION_SORT_LIMIT)
+  {
+    for (i = 1; i < NumberOfIndices; i++)
+    {
+      TempIndex = IndexArray[i];
+      for (j = i; j > 0 &&
+      CompareKeys (BatchPntr, TempIndex, IndexArray[j-1]) < 0; j--)
+        IndexArray[j] = IndexArray[j-1];
+      IndexArray[j] = TempIndex;
+    }
+    return;
+  }
+
+  HalfCount = NumberOfIndices / 2;
+  SortKeyIndices (BatchPntr, IndexArray, ScratchArray, HalfCount);
+  SortKeyIndices (BatchPntr, IndexArray + HalfCount, ScratchArray + HalfCount,
+    NumberOfIndices - HalfCount);
+
+  if (CompareKeys (BatchPntr,
+  IndexArray[HalfCount-1], IndexArray[HalfCount]) <= 0)
+    return; /* Halves are already in order. */
+
+  LeftPntr = IndexArray;
+  LeftEndPntr = RightPntr = IndexArray + HalfCount;
+  RightEndPntr = IndexArray + NumberOfIndices;
+  OutputPntr = ScratchArray;
+  while (LeftPntr < LeftEndPntr && RightPntr < RightEndPntr)
+  {
+    if (CompareKeys (BatchPntr, *RightPntr, *LeftPntr) < 0)
+      *OutputPntr++ = *RightPntr++;
+    else
+      *OutputPntr++ = *LeftPntr++;
+  }
+  while (LeftPntr < LeftEndPntr)
+    *OutputPntr++ = *LeftPntr++;
+  while (RightPntr < RightEndPntr)
+    *OutputPntr++ = *RightPntr++;
+
+  memcpy (IndexArray, ScratchArray, NumberOfIndices * sizeof (uint32));
+}
+
+
+
+static uint32 CountSubtree (AVLDupNodePointer CurrentNode)
+{
+  if (CurrentNode == NULL)
+    return 0;
+  return 1 + CountSubtree (CurrentNode->smallerChildPntr) +
+    CountSubtree (CurrentNode->largerChildPntr);
+}
+
+
+
+/* Counts the values for a key, given the highest node in the tree with that
+key.  All the other nodes with the same key are in its subtree.  Going down
+the smaller side, each node with the key has only more of the same key on
+its larger side, so that whole subtree gets counted without comparisons,
+and similarly going down the larger side. */
+
+static uint32 CountValuesForKey (
+  BatchPointer      BatchPntr,
+  uint32            KeyIndex,
+  AVLDupNodePointer TopNode)
+{
+  uint32            Count;
+  AVLDupNodePointer CurrentNode;
+
+  Count = 1;
+
+  CurrentNode = TopNode->smallerChildPntr;
+  while (CurrentNode != NULL)
+  {
+    if (CompareKeyWithNode (BatchPntr, KeyIndex, CurrentNode) == 0)
+    {
+      Count += 1 + CountSubtree (CurrentNode->largerChildPntr);
+      CurrentNode = CurrentNode->smallerChildPntr;
+    }
+    else /* Node key is smaller than ours. */
+      CurrentNode = CurrentNode->largerChildPntr;
+  }
+
+  CurrentNode = TopNode->largerChildPntr;
+  while (CurrentNode != NULL)
+  {
+    if (CompareKeyWithNode (BatchPntr, KeyIndex, CurrentNode) == 0)
+    {
+      Count += 1 + CountSubtree (CurrentNode->smallerChildPntr);
+      CurrentNode = CurrentNode->largerChildPntr;
+    }
+    else /* Node key is larger than ours. */
+      CurrentNode = CurrentNode->smallerChildPntr;
+  }
+
+  return Count;
+}
+
+
+
+/* Gets the lane started on its next key, or marks it as not busy if it has
+done all its keys.  A key equal to the previous one just gets the same
+answer.  Otherwise the search restarts from the deepest node on the previous
+path whose upper bound is above the new key.  Since the keys are sorted,
+the new key is also above everything to the left of that node's subtree, so
+a search from the root would have gone through that node too. */
+
+static void StartNextLookup (
+  BatchPointer BatchPntr,
+  LanePointer  LanePntr)
+{
+  int    i;
+  uint32 KeyIndex;
+
+  while (LanePntr->nextPosition < LanePntr->endPosition)
+  {
+    KeyIndex = BatchPntr->sortedOrder[LanePntr->nextPosition++];
+
+    if (LanePntr->depth > 0 &&
+    CompareKeys (BatchPntr, KeyIndex, LanePntr->keyIndex) == 0)
+    {
+      BatchPntr->countArray[KeyIndex] =
+        BatchPntr->countArray[LanePntr->keyIndex];
+      continue;
+    }
+
+    LanePntr->keyIndex = KeyIndex;
+    LanePntr->busy = true;
+
+    if (LanePntr->depth == 0)
+    {
+      LanePntr->currentNode = BatchPntr->treePntr->rootPntr;
+      LanePntr->currentBound = NULL;
+    }
+    else
+    {
+      for (i = LanePntr->depth - 1; i > 0; i--)
+        if (LanePntr->pathBounds[i] == NULL || CompareKeyWithNode (BatchPntr,
+        KeyIndex, LanePntr->pathBounds[i]) < 0)
+          break;
+      LanePntr->currentNode = LanePntr->pathNodes[i];
+      LanePntr->currentBound = LanePntr->pathBounds[i];
+      LanePntr->depth = i;
+    }
+    PREFETCH (LanePntr->currentNode);
+    return;
+  }
+
+  LanePntr->busy = false;
+}
+
+
+
+/* Does one step of the lane's search, examining the current node (which
+was prefetched when the lane got to it) and moving on to a child, which
+gets prefetched in turn. */
+
+static void StepLane (
+  BatchPointer BatchPntr,
+  LanePointer  LanePntr)
+{
+  AVLDupNodePointer ChildNode;
+  int               Comparison;
+  AVLDupNodePointer CurrentNode;
+
+  CurrentNode = LanePntr->currentNode;
+  LanePntr->pathNodes[LanePntr->depth] = CurrentNode;
+  LanePntr->pathBounds[LanePntr->depth] = LanePntr->currentBound;
+  LanePntr->depth++;
+
+  Comparison = CompareKeyWithNode (BatchPntr, LanePntr->keyIndex,
+    CurrentNode);
+
+  if (Comparison == 0)
+  {
+    BatchPntr->countArray[LanePntr->keyIndex] =
+      (BatchPntr->valueArray != NULL) ? 1 :
+      CountValuesForKey (BatchPntr, LanePntr->keyIndex, CurrentNode);
+    StartNextLookup (BatchPntr, LanePntr);
+    return;
+  }
+
+  if (Comparison < 0)
+  {
+    ChildNode = CurrentNode->smallerChildPntr;
+    LanePntr->currentBound = CurrentNode;
+  }
+  else
+    ChildNode = CurrentNode->largerChildPntr;
+
+  if (ChildNode == NULL) /* Not in the tree. */
+  {
+    BatchPntr->countArray[LanePntr->keyIndex] = 0;
+    StartNextLookup (BatchPntr, LanePntr);
+    return;
+  }
+
+  PREFETCH (ChildNode);
+  LanePntr->currentNode = ChildNode;
+}
+
+
+
+/* Looks up all the keys in KeyArray at once, which is much faster than
+separate lookups for large batches (see the start of this file for how it
+works).  If ValueArray is NULL, the Nth entry of CountArray is set to the
+number of values the tree has for the Nth key.  Otherwise the Nth key goes
+with the Nth value, and the Nth entry of CountArray is set to 1 if that
+key/value pair is in the tree, 0 if it isn't.  The keys can be in any order
+and can have duplicates.  The tree is locked for reading while it is being
+searched, but the sorting is done before locking.  Returns FALSE if it ran
+out of memory or couldn't lock the tree, in which case CountArray is
+unchanged. */
+
+bool AVLDupLookupBatch (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyArray,
+  AVLDupThingPointer ValueArray,
+  uint32 NumberOfKeys,
+  uint32 *CountArray)
+{
+  bool                 Active;
+  BatchRecord          Batch;
+  status_t             ErrorCode;
+  AVLDupHeldLockRecord HeldLock;
+  uint32               i;
+  LaneRecord           Lanes [BATCH_LANES];
+  uint32               NumberOfLanes;
+  uint32              *ScratchArray;
+
+  if (TreePntr == NULL || KeyArray == NULL || CountArray == NULL)
+    return false;
+  if (NumberOfKeys == 0)
+    return true;
+
+  memset (&Batch, 0, sizeof (Batch));
+  Batch.treePntr = TreePntr;
+  Batch.keyArray = KeyArray;
+  Batch.valueArray = ValueArray;
+  Batch.countArray = CountArray;
+  Batch.sortedOrder = malloc (NumberOfKeys * sizeof (uint32));
+  ScratchArray = malloc (NumberOfKeys * sizeof (uint32));
+  if (Batch.sortedOrder == NULL || ScratchArray == NULL)
+    goto ErrorExit;
+
+  for (i = 0; i < NumberOfKeys; i++)
+    Batch.sortedOrder[i] = i;
+  SortKeyIndices (&Batch, Batch.sortedOrder, ScratchArray, NumberOfKeys);
+  free (ScratchArray);
+  ScratchArray = NULL;
+
+  /* Give each lane an equal slice of the sorted keys. */
+
+  NumberOfLanes = (NumberOfKeys < BATCH_LANES) ? NumberOfKeys : BATCH_LANES;
+  for (i = 0; i < NumberOfLanes; i++)
+  {
+    Lanes[i].nextPosition =
+      (uint32) ((uint64) NumberOfKeys * i / NumberOfLanes);
+    Lanes[i].endPosition =
+      (uint32) ((uint64) NumberOfKeys * (i + 1) / NumberOfLanes);
+    Lanes[i].depth = 0;
+  }
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    goto ErrorExit; /* Semaphore was deleted or a signal interrupted us. */
+
+  if (TreePntr->rootPntr == NULL)
+    memset (CountArray, 0, NumberOfKeys * sizeof (uint32));
+  else
+  {
+    for (i = 0; i < NumberOfLanes; i++)
+      StartNextLookup (&Batch, Lanes + i);
+
+    /* Round robin over the lanes, one step each, until all are done. */
+
+    do
+    {
+      Active = false;
+      for (i = 0; i < NumberOfLanes; i++)
+      {
+        if (Lanes[i].busy)
+        {
+          StepLane (&Batch, Lanes + i);
+          Active = true;
+        }
+      }
+    } while (Active);
+  }
+
+  AVLDupAddOperationCounts (TreePntr, &Batch.counts);
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "lookupBatch", NumberOfKeys);
+
+  free (Batch.sortedOrder);
+  return true;
+
+ErrorExit:
+  if (Batch.sortedOrder != NULL)
+    free (Batch.sortedOrder);
+  if (ScratchArray != NULL)
+    free (ScratchArray);
+  return false;
+}
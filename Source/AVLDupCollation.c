@@ -0,0 +1,537 @@
+/******************************************************************************
+ * AVLDupCollation.c
+ *
+ * Sorting string keys in a more human friendly order than plain strcmp.  A
+ * tree made with AVLDupAllocCollatedTree can sort its keys ignoring case
+ * (AVLDUP_COLLATION_IGNORE_CASE, so "readme" and "README" are the same key)
+ * or in dictionary order (AVLDUP_COLLATION_DICTIONARY, where case and
+ * accents only matter for breaking ties, so "Émile" sorts between "elephant"
+ * and "emu" rather than after "zebra" as it would with strcmp on UTF-8).
+ *
+ * Working out the collated order of two strings character by character is
+ * slow, and a comparison is done at every level of every descent through the
+ * tree.  So instead each key gets a sort key when it is added: a string of
+ * bytes made from the original, which strcmp puts in the right order.  It
+ * goes in the same memory block as the key's string, right after its NUL,
+ * with its offset stored in the filler bytes of the thing and the
+ * isLongString byte set to AVLDUP_COLLATED_STRING so that everything else
+ * still sees an ordinary long string.  Comparing two keys in the tree is
+ * then just a strcmp of their sort keys.
+ *
+ * Search keys passed in by the user don't have sort keys.  The main entry
+ * points (AVLDupAdd, AVLDupDelete and AVLDupIterate) make a collated copy of
+ * the search key first, and the comparison functions also cope with a thing
+ * without a sort key by working out its sort key bytes as they go, so the
+ * other searches still give the right answers, just a bit more slowly.
+ *
+ * The sort key is made of a weight for each character, which is the lower
+ * case version of the character when ignoring case, or the plain lower case
+ * letters without accents in dictionary order (with "ß" becoming "ss", "Æ"
+ * "ae" and so on).  Only the Latin-1 and Latin Extended-A letters are
+ * handled, other characters are weighted by their UTF-8 bytes, so they
+ * still sort in code point order.  In dictionary order the weights are
+ * followed by a byte smaller than any weight and then the original string,
+ * so that "Emu" and "emu" are different keys but sort next to each other.
+ * Since each character's weight only depends on that character, the weights
+ * for a prefix are also a prefix of the weights for any string starting with
+ * it, which AVLDupIteratePrefix relies on.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Separates the weights from the original string in dictionary order sort
+keys.  Smaller than any weight, so a string sorts before longer ones which
+start with the same letters. */
+
+#define LEVEL_SEPARATOR 1
+
+/* Longest sort key offset that fits in the three filler bytes of a thing. */
+
+#define MAX_SORT_KEY_OFFSET 0xFFFFFF
+
+
+/* The letters that dictionary order turns the Latin-1 and Latin Extended-A
+characters into.  Code points not listed (like the multiplication sign)
+aren't letters and are left alone. */
+
+typedef struct BaseLetterRangeStruct
+{
+  uint16      first;
+  uint16      last;
+  const char *baseLetters;
+} BaseLetterRangeRecord;
+
+static const BaseLetterRangeRecord BaseLetterRanges [] =
+{
+  {0x00C0, 0x00C5, "a"}, {0x00C6, 0x00C6, "ae"}, {0x00C7, 0x00C7, "c"},
+  {0x00C8, 0x00CB, "e"}, {0x00CC, 0x00CF, "i"}, {0x00D0, 0x00D0, "d"},
+  {0x00D1, 0x00D1, "n"}, {0x00D2, 0x00D6, "o"}, {0x00D8, 0x00D8, "o"},
+  {0x00D9, 0x00DC, "u"}, {0x00DD, 0x00DD, "y"}, {0x00DE, 0x00DE, "th"},
+  {0x00DF, 0x00DF, "ss"}, {0x00E0, 0x00E5, "a"}, {0x00E6, 0x00E6, "ae"},
+  {0x00E7, 0x00E7, "c"}, {0x00E8, 0x00EB, "e"}, {0x00EC, 0x00EF, "i"},
+  {0x00F0, 0x00F0, "d"}, {0x00F1, 0x00F1, "n"}, {0x00F2, 0x00F6, "o"},
+  {0x00F8, 0x00F8, "o"}, {0x00F9, 0x00FC, "u"}, {0x00FD, 0x00FD, "y"},
+  {0x00FE, 0x00FE, "th"}, {0x00FF, 0x00FF, "y"}, {0x0100, 0x0105, "a"},
+  {0x0106, 0x010D, "c"}, {0x010E, 0x0111, "d"}, {0x0112, 0x011B, "e"},
+  {0x011C, 0x0123, "g"}, {0x0124, 0x0127, "h"}, {0x0128, 0x0131, "i"},
+  {0x0132, 0x0133, "ij"}, {0x0134, 0x0135, "j"}, {0x0136, 0x0138, "k"},
+  {0x0139, 0x0142, "l"}, {0x0143, 0x014B, "n"}, {0x014C, 0x0151, "o"},
+  {0x0152, 0x0153, "oe"}, {0x0154, 0x0159, "r"}, {0x015A, 0x0161, "s"},
+  {0x0162, 0x0167, "t"}, {0x0168, 0x0173, "u"}, {0x0174, 0x0175, "w"},
+  {0x0176, 0x0178, "y"}, {0x0179, 0x017E, "z"}, {0x017F, 0x017F, "s"}
+};
+
+#define NUMBER_OF_BASE_LETTER_RANGES \
+  (sizeof (BaseLetterRanges) / sizeof (BaseLetterRanges[0]))
+
+
+/* The levels a sort key cursor goes through. */
+
+typedef enum SortKeyLevelEnum
+{
+  LEVEL_WEIGHTS = 0, /* Handing out the weights of the characters. */
+  LEVEL_ORIGINAL, /* Handing out the original string, dictionary order. */
+  LEVEL_FINISHED
+} SortKeyLevel;
+
+
+/* Hands out the bytes of a sort key one at a time, either ones already
+stored after a collated string or ones worked out from a plain string as it
+goes.  The pending bytes are the rest of the current character's weight, or
+the whole stored sort key. */
+
+typedef struct SortKeyCursorStruct
+{
+  AVLDupCollation collation;
+  SortKeyLevel    level;
+  bool            weightsOnly; /* Stop after the weights, for prefixes. */
+  const uint8    *originalPntr;
+  const uint8    *nextPntr; /* Next byte of the original to look at. */
+  const uint8    *pendingPntr;
+  uint8           pendingBuffer [4];
+} SortKeyCursorRecord, *SortKeyCursorPointer;
+
+
+
+/* Returns a pointer to the sort key stored after a collated string. */
+
+static const char *GetStoredSortKey (AVLDupThingPointer ThingPntr)
+{
+  uint32 Offset;
+
+  Offset = ThingPntr->longStringThing.filler1 |
+    ((uint32) ThingPntr->longStringThing.filler2 << 8) |
+    ((uint32) ThingPntr->longStringThing.filler3 << 16);
+  return ThingPntr->longStringThing.stringPntr + Offset;
+}
+
+
+
+/* Converts a Latin-1 or Latin Extended-A code point to lower case.  The
+upper and lower case letters in Latin Extended-A come in pairs, mostly with
+the capital first, but a few stretches are offset by one. */
+
+static uint32 LowerCaseLatin (uint32 CodePoint)
+{
+  if (CodePoint >= 0xC0 && CodePoint <= 0xDE && CodePoint != 0xD7)
+    return CodePoint + 0x20;
+  if (CodePoint == 0x130)
+    return 'i'; /* Capital I with a dot, the Turkish one. */
+  if (CodePoint == 0x178)
+    return 0xFF; /* Capital Y with diaeresis, its small form is in Latin-1. */
+  if ((CodePoint >= 0x100 && CodePoint <= 0x137) ||
+  (CodePoint >= 0x14A && CodePoint <= 0x177))
+    return CodePoint | 1;
+  if ((CodePoint >= 0x139 && CodePoint <= 0x148) ||
+  (CodePoint >= 0x179 && CodePoint <= 0x17E))
+    return (CodePoint & 1) ? CodePoint + 1 : CodePoint;
+  return CodePoint;
+}
+
+
+
+/* Works out the weight of the character at StringPntr, putting it in the
+NUL terminated WeightBuffer (which needs to hold 3 bytes and the NUL), and
+returns a pointer to the next character.  Bytes which aren't part of a
+Latin letter are their own weight, one byte at a time. */
+
+static const uint8 *WeighCharacter (
+  AVLDupCollation CollationMode,
+  const uint8    *StringPntr,
+  uint8          *WeightBuffer)
+{
+  uint32 CodePoint;
+  uint32 i;
+
+  if (StringPntr[0] >= 'A' && StringPntr[0] <= 'Z')
+  {
+    WeightBuffer[0] = StringPntr[0] + ('a' - 'A');
+    WeightBuffer[1] = 0;
+    return StringPntr + 1;
+  }
+
+  if (StringPntr[0] >= 0xC3 && StringPntr[0] <= 0xC5 &&
+  (StringPntr[1] & 0xC0) == 0x80)
+  {
+    CodePoint = ((StringPntr[0] & 0x1F) << 6) | (StringPntr[1] & 0x3F);
+    if (CollationMode == AVLDUP_COLLATION_DICTIONARY)
+    {
+      for (i = 0; i < NUMBER_OF_BASE_LETTER_RANGES; i++)
+      {
+        if (CodePoint >= BaseLetterRanges[i].first &&
+        CodePoint <= BaseLetterRanges[i].last)
+        {
+          strcpy ((char *) WeightBuffer, BaseLetterRanges[i].baseLetters);
+          return StringPntr + 2;
+        }
+      }
+    }
+    else /* Ignoring case. */
+    {
+      CodePoint = LowerCaseLatin (CodePoint);
+      if (CodePoint < 0x80)
+      {
+        WeightBuffer[0] = (uint8) CodePoint;
+        WeightBuffer[1] = 0;
+      }
+      else
+      {
+        WeightBuffer[0] = (uint8) (0xC0 | (CodePoint >> 6));
+        WeightBuffer[1] = (uint8) (0x80 | (CodePoint & 0x3F));
+        WeightBuffer[2] = 0;
+      }
+      return StringPntr + 2;
+    }
+  }
+
+  WeightBuffer[0] = StringPntr[0];
+  WeightBuffer[1] = 0;
+  return StringPntr + 1;
+}
+
+
+
+/* Sets up a cursor for going through the sort key of a thing.  If the thing
+already has a stored sort key, the cursor just hands out its bytes. */
+
+static void StartSortKeyCursor (
+  SortKeyCursorPointer CursorPntr,
+  AVLDupCollation      CollationMode,
+  AVLDupThingPointer   ThingPntr,
+  bool                 WeightsOnly)
+{
+  const char *StringPntr;
+
+  CursorPntr->collation = CollationMode;
+  CursorPntr->weightsOnly = WeightsOnly;
+  CursorPntr->pendingBuffer[0] = 0;
+  CursorPntr->pendingPntr = CursorPntr->pendingBuffer;
+
+  if (ThingPntr->longStringThing.isLongString == AVLDUP_COLLATED_STRING)
+  {
+    CursorPntr->pendingPntr = (const uint8 *) GetStoredSortKey (ThingPntr);
+    CursorPntr->level = LEVEL_FINISHED;
+    return;
+  }
+
+  StringPntr = AVLDupGetStringPntrFromThing (*ThingPntr);
+  if (StringPntr == NULL)
+    StringPntr = "";
+  CursorPntr->originalPntr = (const uint8 *) StringPntr;
+  CursorPntr->nextPntr = CursorPntr->originalPntr;
+  CursorPntr->level = LEVEL_WEIGHTS;
+}
+
+
+
+/* Returns the next byte of the sort key, or zero at the end. */
+
+static uint8 NextSortKeyByte (SortKeyCursorPointer CursorPntr)
+{
+  while (true)
+  {
+    if (*CursorPntr->pendingPntr != 0)
+      return *CursorPntr->pendingPntr++;
+
+    switch (CursorPntr->level)
+    {
+      case LEVEL_WEIGHTS:
+        if (*CursorPntr->nextPntr != 0)
+        {
+          CursorPntr->nextPntr = WeighCharacter (CursorPntr->collation,
+            CursorPntr->nextPntr, CursorPntr->pendingBuffer);
+          CursorPntr->pendingPntr = CursorPntr->pendingBuffer;
+          break;
+        }
+        if (CursorPntr->collation == AVLDUP_COLLATION_DICTIONARY &&
+        !CursorPntr->weightsOnly)
+        {
+          CursorPntr->level = LEVEL_ORIGINAL;
+          CursorPntr->nextPntr = CursorPntr->originalPntr;
+          return LEVEL_SEPARATOR;
+        }
+        CursorPntr->level = LEVEL_FINISHED;
+        return 0;
+
+      case LEVEL_ORIGINAL:
+        if (*CursorPntr->nextPntr != 0)
+          return *CursorPntr->nextPntr++;
+        CursorPntr->level = LEVEL_FINISHED;
+        return 0;
+
+      default:
+        return 0;
+    }
+  }
+}
+
+
+
+/* Compares two string things in collated order.  The usual case is two keys
+with stored sort keys, which is just a strcmp.  Otherwise the missing sort
+keys are worked out byte by byte while comparing. */
+
+static int CompareCollated (
+  AVLDupCollation    CollationMode,
+  AVLDupThingPointer A,
+  AVLDupThingPointer B)
+{
+  uint8               ByteA;
+  uint8               ByteB;
+  SortKeyCursorRecord CursorA;
+  SortKeyCursorRecord CursorB;
+
+  if (A->longStringThing.isLongString == AVLDUP_COLLATED_STRING &&
+  B->longStringThing.isLongString == AVLDUP_COLLATED_STRING)
+    return strcmp (GetStoredSortKey (A), GetStoredSortKey (B));
+
+  StartSortKeyCursor (&CursorA, CollationMode, A, false);
+  StartSortKeyCursor (&CursorB, CollationMode, B, false);
+  do
+  {
+    ByteA = NextSortKeyByte (&CursorA);
+    ByteB = NextSortKeyByte (&CursorB);
+    if (ByteA != ByteB)
+      return (ByteA < ByteB) ? -1 : 1;
+  } while (ByteA != 0);
+
+  return 0;
+}
+
+
+static int CompareIgnoringCase (AVLDupThingPointer A, AVLDupThingPointer B)
+{
+  return CompareCollated (AVLDUP_COLLATION_IGNORE_CASE, A, B);
+}
+
+
+static int CompareDictionary (AVLDupThingPointer A, AVLDupThingPointer B)
+{
+  return CompareCollated (AVLDUP_COLLATION_DICTIONARY, A, B);
+}
+
+
+
+/* Compares a prefix (A) with a key (B) in collated order, looking at only
+as many bytes of the key's sort key as the prefix's weights have.  Like the
+plain prefix comparison in AVLDupStringSearch.c, it returns zero for keys
+starting with the prefix.  Letters which only differ by case (or accents,
+in dictionary order) count as the same. */
+
+static int ComparePrefixCollated (
+  AVLDupCollation    CollationMode,
+  AVLDupThingPointer A,
+  AVLDupThingPointer B)
+{
+  uint8               ByteA;
+  uint8               ByteB;
+  SortKeyCursorRecord CursorA;
+  SortKeyCursorRecord CursorB;
+
+  StartSortKeyCursor (&CursorA, CollationMode, A, true /* weights only */);
+  StartSortKeyCursor (&CursorB, CollationMode, B, false);
+  while ((ByteA = NextSortKeyByte (&CursorA)) != 0)
+  {
+    ByteB = NextSortKeyByte (&CursorB);
+    if (ByteA != ByteB)
+      return (ByteA < ByteB) ? -1 : 1;
+  }
+
+  return 0;
+}
+
+
+static int ComparePrefixIgnoringCase (
+  AVLDupThingPointer A,
+  AVLDupThingPointer B)
+{
+  return ComparePrefixCollated (AVLDUP_COLLATION_IGNORE_CASE, A, B);
+}
+
+
+static int ComparePrefixDictionary (
+  AVLDupThingPointer A,
+  AVLDupThingPointer B)
+{
+  return ComparePrefixCollated (AVLDUP_COLLATION_DICTIONARY, A, B);
+}
+
+
+
+/* Returns the key comparison function for a collation, or NULL if it isn't
+one of the collated orders (AVLDUP_COLLATION_BINARY uses the plain string
+comparison). */
+
+AVLDupComparisonFunctionPointer AVLDupGetComparisonFunctionForCollation (
+  AVLDupCollation CollationMode)
+{
+  switch (CollationMode)
+  {
+    case AVLDUP_COLLATION_IGNORE_CASE:
+      return CompareIgnoringCase;
+
+    case AVLDUP_COLLATION_DICTIONARY:
+      return CompareDictionary;
+
+    default:
+      return NULL;
+  }
+}
+
+
+
+/* Returns the prefix comparison function for a collation, or NULL for
+AVLDUP_COLLATION_BINARY. */
+
+AVLDupComparisonFunctionPointer AVLDupGetCollatedPrefixComparison (
+  AVLDupCollation CollationMode)
+{
+  switch (CollationMode)
+  {
+    case AVLDUP_COLLATION_IGNORE_CASE:
+      return ComparePrefixIgnoringCase;
+
+    case AVLDUP_COLLATION_DICTIONARY:
+      return ComparePrefixDictionary;
+
+    default:
+      return NULL;
+  }
+}
+
+
+
+/* Makes a collated copy of a string thing, with its sort key stored after
+the string.  The result is always a long string, even for short ones, since
+the sort key needs somewhere to go, and can be freed with
+AVLDupFreeThingArray like any other string thing.  If the source already
+has a sort key, the whole block is just copied.  Returns FALSE if it ran out
+of memory or the string is too long for the offset to fit, leaving DestPntr
+zeroed. */
+
+bool AVLDupCollateThing (
+  AVLDupCollation    CollationMode,
+  AVLDupThingPointer SourcePntr,
+  AVLDupThingPointer DestPntr)
+{
+  SortKeyCursorRecord Cursor;
+  size_t              i;
+  char               *NewStringPntr;
+  size_t              Offset;
+  size_t              Size;
+  const char         *StringPntr;
+
+  memset (DestPntr, 0, sizeof (AVLDupThingRecord));
+
+  if (SourcePntr->longStringThing.isLongString == AVLDUP_COLLATED_STRING)
+  {
+    Size = AVLDupCollatedStringSize (SourcePntr);
+    NewStringPntr = malloc (Size);
+    if (NewStringPntr == NULL)
+      return false;
+    memcpy (NewStringPntr, SourcePntr->longStringThing.stringPntr, Size);
+    *DestPntr = *SourcePntr;
+    DestPntr->longStringThing.stringPntr = NewStringPntr;
+    return true;
+  }
+
+  StringPntr = AVLDupGetStringPntrFromThing (*SourcePntr);
+  if (StringPntr == NULL)
+    StringPntr = "";
+  Offset = strlen (StringPntr) + 1;
+  if (Offset > MAX_SORT_KEY_OFFSET)
+    return false;
+
+  /* Count the sort key bytes first, then fill them in. */
+
+  StartSortKeyCursor (&Cursor, CollationMode, SourcePntr, false);
+  for (Size = Offset + 1; NextSortKeyByte (&Cursor) != 0; Size++)
+    ;
+
+  NewStringPntr = malloc (Size);
+  if (NewStringPntr == NULL)
+    return false;
+  memcpy (NewStringPntr, StringPntr, Offset);
+
+  StartSortKeyCursor (&Cursor, CollationMode, SourcePntr, false);
+  for (i = Offset; (NewStringPntr[i] = NextSortKeyByte (&Cursor)) != 0; i++)
+    ;
+
+  DestPntr->longStringThing.stringPntr = NewStringPntr;
+  DestPntr->longStringThing.filler1 = (uint8) Offset;
+  DestPntr->longStringThing.filler2 = (uint8) (Offset >> 8);
+  DestPntr->longStringThing.filler3 = (uint8) (Offset >> 16);
+  DestPntr->longStringThing.isLongString = AVLDUP_COLLATED_STRING;
+  return true;
+}
+
+
+
+/* Returns the size of the memory block holding a collated string and its
+sort key. */
+
+size_t AVLDupCollatedStringSize (AVLDupThingPointer ThingPntr)
+{
+  const char *SortKeyPntr;
+
+  SortKeyPntr = GetStoredSortKey (ThingPntr);
+  return (SortKeyPntr - ThingPntr->longStringThing.stringPntr) +
+    strlen (SortKeyPntr) + 1;
+}
+
+
+
+/* Makes a collated copy of a search key for a tree which uses a collated
+order, so that the comparisons during the search are all between stored sort
+keys.  Returns CollatedKeyPntr if it made a copy, which the caller has to
+free with AVLDupFreeThingArray afterwards.  Returns KeyPntr itself if the
+tree doesn't need it, the key is NULL or it ran out of memory (the
+comparisons still work, they just work out the search key's sort key again
+each time). */
+
+AVLDupThingPointer AVLDupCollateSearchKey (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer CollatedKeyPntr)
+{
+  if (TreePntr->collation == AVLDUP_COLLATION_BINARY || KeyPntr == NULL ||
+  KeyPntr->longStringThing.isLongString == AVLDUP_COLLATED_STRING)
+    return KeyPntr;
+
+  if (!AVLDupCollateThing (TreePntr->collation, KeyPntr, CollatedKeyPntr))
+    return KeyPntr;
+  return CollatedKeyPntr;
+}
@@ -0,0 +1,1898 @@
+/******************************************************************************
+ * AVLDupConcurrentTree.c
+ *
+ * A variant of the AVLDupTree which lets many readers and many writers work
+ * on the same tree at the same time.  The ordinary AVLDupTree uses a single
+ * counting semaphore for the whole tree, so only one writer can be active and
+ * it has to wait for all the readers to leave first.  That's fine for an
+ * index which is mostly read, but a busy index with lots of additions and
+ * deletions ends up with all the threads lined up on the semaphore.
+ *
+ * This version uses the optimistic concurrency control algorithm from
+ * "A Practical Concurrent Binary Search Tree" by Nathan G. Bronson, Jared
+ * Casper, Hassan Chafi and Kunle Olukotun, in the proceedings of the 15th ACM
+ * SIGPLAN Symposium on Principles and Practice of Parallel Programming
+ * (PPoPP 2010), pages 257-268.  Each node has a version number and a small
+ * spin lock.  Readers don't lock anything, they traverse the tree hand over
+ * hand, reading a child pointer and then checking that the parent's version
+ * hasn't changed (which would mean the child was rotated away while we were
+ * looking at it), retrying from the parent if it did.  The version of a node
+ * only changes when the node is about to shrink (lose part of its subtree)
+ * due to a rotation, or when it gets unlinked from the tree.  Writers lock
+ * just the parent of the spot where they add a new leaf, or the parent and
+ * the node being unlinked, and the rebalancing rotations lock only the (at
+ * most four) nodes they rearrange, always in top down order so that there
+ * are no deadlocks.
+ *
+ * Balance is relaxed: rather than doing the fixups immediately on the way
+ * back up a recursive call chain like AVLDupFixupSubtrees does, the heights
+ * are repaired by walking up the parent pointers after the change, and a
+ * concurrent change may leave a temporarily unbalanced spot which the next
+ * fixup walk through that area repairs.  Deleting a node with two children
+ * just marks it as not present (it becomes a "routing" node which is still
+ * used for finding things).  Routing nodes are unlinked when they end up with
+ * fewer than two children, and rotations try to avoid creating such nodes.
+ *
+ * Since readers don't lock anything, an unlinked node may still be in use by
+ * a reader which was looking at it at the time.  So unlinked nodes are put
+ * on a retired list and deallocated later using epoch based reclamation (as
+ * described by Keir Fraser in "Practical lock-freedom", University of
+ * Cambridge Computer Laboratory technical report UCAM-CL-TR-579, 2004).
+ * There is a global epoch number, and each operation announces the epoch it
+ * started in by claiming one of a fixed number of announcement slots, each
+ * in its own cache line so that parallel operations don't fight over a
+ * shared counter.  A retired node is stamped with the epoch it was unlinked
+ * in and gets deallocated once every announced epoch is later than that,
+ * since any operation which started after the unlink can't find the node.
+ * An iteration keeps its slot while it walks from one node to the next and
+ * while your callback looks at the node, so it doesn't have to copy
+ * anything, but lets go of it every few hundred steps, so even a never
+ * ending stream of operations or a very long iteration doesn't stop the
+ * retired list from being cleaned up for long.
+ *
+ * The key/value pair (not just the key) is used as the search key, just like
+ * the regular AVLDupTree, so duplicate keys work the same way.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* The version word has a couple of flag bits and a counter in the rest of
+it.  The counter gets incremented each time the node finishes a change which
+shrinks its subtree, so an optimistic reader can tell that something happened
+while it wasn't looking by comparing the before and after version numbers. */
+
+#define VERSION_UNLINKED          1
+#define VERSION_SHRINKING         2
+#define VERSION_COUNT_INCREMENT   4
+
+
+/* Special values returned by NodeCondition, positive values are the height
+that the node should be set to. */
+
+#define CONDITION_UNLINK_REQUIRED     -1
+#define CONDITION_REBALANCE_REQUIRED  -2
+#define CONDITION_NOTHING_REQUIRED    -3
+
+
+/* Number of times a thread spins around waiting for a node lock or a node to
+finish changing, before it gives up the CPU to let other threads run.  The
+locks are only held for the duration of a rotation, so normally the wait is
+very short. */
+
+#define SPINS_BEFORE_SNOOZE 100
+
+
+/* The number of epoch announcement slots, which is the number of operations
+which can be in progress at the same time.  Each slot is padded out to
+CACHE_LINE_SIZE bytes so that threads announcing their epochs don't slow
+each other down by sharing a cache line.  When all the slots are taken, the
+65th and later operations spin in EnterOperation, going around the slots and
+snoozing for a microsecond after each lap until an operation finishes, so
+having many more than this many threads working on the same tree at once
+just has them waiting for each other. */
+
+#define NUMBER_OF_EPOCH_SLOTS 64
+#define CACHE_LINE_SIZE 64
+
+
+/* An iteration holds on to its slot while your callback runs, and a
+callback which adds or deletes something needs a second one.  So that those
+always find a free slot, at most half the slots are held by iterations this
+way; any more iterations let go of their slot for each callback, copying the
+key/value so that they know where to carry on from.  The ones holding on to
+their slot let go of it (and copy the key/value) after this many steps, so
+that the retired nodes can be deallocated. */
+
+#define MAX_ITERATIONS_HOLDING_SLOTS (NUMBER_OF_EPOCH_SLOTS / 2)
+#define ITERATION_STEPS_PER_EPOCH 256
+
+
+/* The number of nodes which have to be retired since the last attempt at
+reclaiming them before another attempt is made.  Reclaiming looks at all the
+announcement slots, so it isn't worth doing for every node. */
+
+#define RETIRED_NODES_BEFORE_RECLAIM 64
+
+
+/* A node in the concurrent tree.  Like the regular AVLDupTree node, with the
+addition of a parent pointer (for walking back up to do the height fixups),
+a version number for the optimistic readers, a lock, and a flag for marking
+the node as deleted without unlinking it.  The pointers and heights are
+changed by one thread while others are reading them, so they're volatile. */
+
+typedef struct AVLDupConcurrentNodeStruct
+  AVLDupConcurrentNodeRecord, *AVLDupConcurrentNodePointer;
+
+struct AVLDupConcurrentNodeStruct
+{
+  AVLDupThingRecord                    key;
+  AVLDupThingRecord                    value;
+  AVLDupConcurrentNodePointer volatile parentPntr;
+  AVLDupConcurrentNodePointer volatile smallerChildPntr;
+  AVLDupConcurrentNodePointer volatile largerChildPntr;
+  AVLDupConcurrentNodePointer          nextRetiredPntr;
+  int32                                retiredEpoch;
+  int32                                version;
+  int32 volatile                       height;
+  int32                                present; /* Zero for routing nodes. */
+  int32                                lockWord; /* Non-zero when locked. */
+};
+
+
+/* An epoch announcement slot.  The epoch is zero when the slot is free,
+otherwise it is the global epoch at the time the operation using the slot
+started. */
+
+typedef struct EpochSlotStruct
+{
+  int32 epoch;
+  char padding [CACHE_LINE_SIZE - sizeof (int32)];
+} EpochSlotRecord, *EpochSlotPointer;
+
+
+/* The header for the concurrent tree.  The root node is the larger child of
+rootHolder, a permanent dummy node which never gets rotated or unlinked, so
+that changing the root works the same way as changing any other child.  The
+fields which get changed by writers are kept away from the global epoch,
+which every operation reads. */
+
+struct AVLDupConcurrentTreeStruct
+{
+  char *indexName; /* Copy of the user's name for this index. */
+  type_code keyType;
+  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
+  type_code valueType;
+  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
+  int32 globalEpoch; /* Never zero, skips zero when it wraps around. */
+  char padding1 [CACHE_LINE_SIZE];
+  AVLDupConcurrentNodeRecord rootHolder;
+  int32 count; /* Counts key/value pairs which are present in the tree. */
+  int32 retiredListLock;
+  int32 retiredCount; /* Number of nodes in the retired list. */
+  int32 reclaimAtCount; /* Try reclaiming when retiredCount gets this big. */
+  int32 reclaimLock; /* Only one thread at a time reclaims nodes. */
+  int32 iterationsHoldingSlots; /* See MAX_ITERATIONS_HOLDING_SLOTS. */
+  AVLDupConcurrentNodePointer retiredListPntr; /* Unlinked, newest first. */
+  char padding2 [CACHE_LINE_SIZE];
+  EpochSlotRecord epochSlots [NUMBER_OF_EPOCH_SLOTS];
+};
+
+
+/* Per-operation arguments, passed to the recursive functions so that they
+don't need lots of parameters (see NonRecursiveArgumentsStruct in
+AVLDupTree.c for the same idea).  For iterations, the key/value is the
+current lower bound and hasLowerBound is FALSE when starting from the very
+beginning. */
+
+typedef struct ConcurrentArgumentsStruct
+{
+  AVLDupConcurrentTreePointer treePntr;
+  AVLDupThingRecord userKey;
+  AVLDupThingRecord userValue;
+  bool hasLowerBound;
+  bool userValueWasNULL;
+  bool includeThingEqualToStart;
+  AVLDupConcurrentNodePointer newNodePntr; /* Preallocated for additions. */
+  EpochSlotPointer epochSlotPntr; /* Slot announcing this operation's epoch. */
+} ConcurrentArgumentsRecord, *ConcurrentArgumentsPointer;
+
+
+/* Return codes for the recursive add and delete attempts.  CONC_RETRY means
+that something changed under us and the caller should try again from the
+parent node. */
+
+typedef enum ConcurrentReturnCodesEnum {
+  CONC_OUT_OF_MEMORY = -2,
+  CONC_RETRY = -1,
+  CONC_NOT_CHANGED = 0, /* Already in the tree, or not found for deletes. */
+  CONC_CHANGED = 1
+} ConcReturnCode;
+
+
+/* A unique address which the ceiling search returns to mean "retry". */
+
+static AVLDupConcurrentNodeRecord g_RetrySentinelNode;
+#define RETRY_NODE (&g_RetrySentinelNode)
+
+
+
+/* Lock functions.  A lock is just a word which is set to 1 with an atomic
+test and set operation.  They're only held briefly, so it spins a bit before
+it starts snoozing.  Used for the node locks and the retired list lock. */
+
+static void LockWord (int32 *LockWordPntr)
+{
+  int SpinCount = 0;
+
+  while (atomic_test_and_set (LockWordPntr, 1, 0) != 0)
+  {
+    if (++SpinCount >= SPINS_BEFORE_SNOOZE)
+    {
+      snooze (1);
+      SpinCount = 0;
+    }
+  }
+}
+
+
+static void UnlockWord (int32 *LockWordPntr)
+{
+  atomic_set (LockWordPntr, 0);
+}
+
+
+static void LockNode (AVLDupConcurrentNodePointer NodePntr)
+{
+  LockWord (&NodePntr->lockWord);
+}
+
+
+static void UnlockNode (AVLDupConcurrentNodePointer NodePntr)
+{
+  UnlockWord (&NodePntr->lockWord);
+}
+
+
+
+/* Wait until a node which is in the middle of a rotation (its subtree is
+shrinking) finishes changing.  The reader will then retry reading it. */
+
+static void WaitUntilNotChanging (AVLDupConcurrentNodePointer NodePntr)
+{
+  int   SpinCount = 0;
+  int32 Version;
+
+  Version = atomic_get (&NodePntr->version);
+  if ((Version & VERSION_SHRINKING) == 0)
+    return;
+
+  while (atomic_get (&NodePntr->version) == Version)
+  {
+    if (++SpinCount >= SPINS_BEFORE_SNOOZE)
+    {
+      snooze (1);
+      SpinCount = 0;
+    }
+  }
+}
+
+
+
+/* Utility functions for reading nodes.  A NULL node has a height of zero. */
+
+static int32 Height (AVLDupConcurrentNodePointer NodePntr)
+{
+  return (NodePntr == NULL) ? 0 : NodePntr->height;
+}
+
+
+static AVLDupConcurrentNodePointer GetChild (
+  AVLDupConcurrentNodePointer NodePntr,
+  int Direction)
+{
+  return (Direction < 0) ?
+    NodePntr->smallerChildPntr : NodePntr->largerChildPntr;
+}
+
+
+static void SetChild (
+  AVLDupConcurrentNodePointer NodePntr,
+  int Direction,
+  AVLDupConcurrentNodePointer ChildPntr)
+{
+  if (Direction < 0)
+    NodePntr->smallerChildPntr = ChildPntr;
+  else
+    NodePntr->largerChildPntr = ChildPntr;
+}
+
+
+static int32 BeginChange (int32 Version)
+{
+  return Version | VERSION_SHRINKING;
+}
+
+
+static int32 EndChange (int32 Version)
+{
+  return (int32) (((uint32) Version + VERSION_COUNT_INCREMENT) &
+    ~(uint32) VERSION_SHRINKING);
+}
+
+
+
+/* Deallocates a node and its key and value, but not its children. */
+
+static void FreeNode (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  AVLDupFreeThingArray (&NodePntr->key, TreePntr->keyType, 1);
+  AVLDupFreeThingArray (&NodePntr->value, TreePntr->valueType, 1);
+  memset (NodePntr, 0, sizeof (AVLDupConcurrentNodeRecord));
+  free (NodePntr);
+}
+
+
+
+/* Operation bookkeeping for deferred deallocation of unlinked nodes.  Every
+public function which looks at nodes calls EnterOperation first and
+LeaveOperation when it is done, and shouldn't hold on to any node pointers
+after leaving.  EnterOperation claims a free announcement slot, starting at
+one picked by the thread ID so that different threads usually get different
+slots, and stores the current global epoch in it.  Since the slot is claimed
+with the same atomic operation that announces the epoch, a slot costs just
+that one atomic operation on a cache line of its own, and another to free it
+in LeaveOperation.
+
+An epoch read just before the slot gets claimed may already be out of date
+by the time it is stored.  That's harmless: an older epoch just delays
+reclaiming a bit, and a node retired in between was unlinked before this
+operation started looking at the tree, so it won't be found anyway. */
+
+static bool EpochIsBefore (int32 EpochA, int32 EpochB)
+{
+  return (int32) ((uint32) EpochA - (uint32) EpochB) < 0; /* Wraparound OK. */
+}
+
+
+static void EnterOperation (
+  AVLDupConcurrentTreePointer TreePntr,
+  ConcurrentArgumentsPointer  ArgsPntr)
+{
+  int32            Epoch;
+  uint32           SlotIndex;
+  EpochSlotPointer SlotPntr;
+  int              SpinCount = 0;
+
+  SlotIndex = (uint32) find_thread (NULL) % NUMBER_OF_EPOCH_SLOTS;
+
+  while (true)
+  {
+    SlotPntr = TreePntr->epochSlots + SlotIndex;
+    if (atomic_get (&SlotPntr->epoch) == 0)
+    {
+      Epoch = atomic_get (&TreePntr->globalEpoch);
+      if (atomic_test_and_set (&SlotPntr->epoch, Epoch, 0) == 0)
+        break; /* Got the slot and announced our epoch. */
+    }
+
+    SlotIndex = (SlotIndex + 1) % NUMBER_OF_EPOCH_SLOTS;
+
+    /* After a full lap of busy slots, wait for someone to finish. */
+
+    if (++SpinCount >= NUMBER_OF_EPOCH_SLOTS)
+    {
+      snooze (1);
+      SpinCount = 0;
+    }
+  }
+
+  ArgsPntr->epochSlotPntr = SlotPntr;
+}
+
+
+
+/* Advances the global epoch and deallocates the retired nodes which were
+unlinked before the earliest epoch still announced by an operation in
+progress.  The retired list is sorted by epoch, newest first, since nodes are
+stamped and added to it while holding the list lock, so the nodes to
+deallocate are all at the tail end of it. */
+
+static void ReclaimRetiredNodes (AVLDupConcurrentTreePointer TreePntr)
+{
+  int32                       Epoch;
+  AVLDupConcurrentNodePointer FreeListPntr;
+  int                         i;
+  int32                       MinimumEpoch;
+  AVLDupConcurrentNodePointer NextPntr;
+  AVLDupConcurrentNodePointer *PreviousPntrPntr;
+  int32                       RemainingCount;
+
+  if (atomic_test_and_set (&TreePntr->reclaimLock, 1, 0) != 0)
+    return; /* Some other thread is already doing it. */
+
+  MinimumEpoch = atomic_add (&TreePntr->globalEpoch, 1) + 1;
+  if (MinimumEpoch == 0) /* Zero means a free slot, so skip over it. */
+    MinimumEpoch = atomic_add (&TreePntr->globalEpoch, 1) + 1;
+
+  for (i = 0; i < NUMBER_OF_EPOCH_SLOTS; i++)
+  {
+    Epoch = atomic_get (&TreePntr->epochSlots[i].epoch);
+    if (Epoch != 0 && EpochIsBefore (Epoch, MinimumEpoch))
+      MinimumEpoch = Epoch;
+  }
+
+  RemainingCount = 0;
+  LockWord (&TreePntr->retiredListLock);
+  PreviousPntrPntr = &TreePntr->retiredListPntr;
+  while (*PreviousPntrPntr != NULL &&
+  !EpochIsBefore ((*PreviousPntrPntr)->retiredEpoch, MinimumEpoch))
+  {
+    PreviousPntrPntr = &(*PreviousPntrPntr)->nextRetiredPntr;
+    RemainingCount++;
+  }
+  FreeListPntr = *PreviousPntrPntr;
+  *PreviousPntrPntr = NULL;
+  TreePntr->retiredCount = RemainingCount;
+  TreePntr->reclaimAtCount = RemainingCount + RETIRED_NODES_BEFORE_RECLAIM;
+  UnlockWord (&TreePntr->retiredListLock);
+
+  atomic_set (&TreePntr->reclaimLock, 0);
+
+  while (FreeListPntr != NULL)
+  {
+    NextPntr = FreeListPntr->nextRetiredPntr;
+    FreeNode (TreePntr, FreeListPntr);
+    FreeListPntr = NextPntr;
+  }
+}
+
+
+
+/* Frees up the operation's announcement slot, and if enough nodes have been
+retired since the last time, tries to deallocate them.  Reading the counts
+without the lock is fine, the worst that happens is an extra or a late
+reclaiming attempt. */
+
+static void LeaveOperation (
+  AVLDupConcurrentTreePointer TreePntr,
+  ConcurrentArgumentsPointer  ArgsPntr)
+{
+  atomic_set (&ArgsPntr->epochSlotPntr->epoch, 0);
+  ArgsPntr->epochSlotPntr = NULL;
+
+  if (TreePntr->retiredCount >= TreePntr->reclaimAtCount)
+    ReclaimRetiredNodes (TreePntr);
+}
+
+
+static void RetireNode (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  LockWord (&TreePntr->retiredListLock);
+  NodePntr->retiredEpoch = atomic_get (&TreePntr->globalEpoch);
+  NodePntr->nextRetiredPntr = TreePntr->retiredListPntr;
+  TreePntr->retiredListPntr = NodePntr;
+  TreePntr->retiredCount++;
+  UnlockWord (&TreePntr->retiredListLock);
+}
+
+
+
+/* Compares the key/value being searched for (the user's key, or the lower
+bound for iterations) with a node.  Returns <0 if the user's thing is smaller
+than the node's key/value, 0 if equal and >0 if larger.  For iterations, a
+NULL value for the lower bound counts as being smaller than all values, and
+an exclusive lower bound equal to the node counts as being larger. */
+
+static int CompareUserToNode (
+  ConcurrentArgumentsPointer  ArgsPntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  int                         ComparisonResult;
+  AVLDupConcurrentTreePointer TreePntr;
+
+  if (!ArgsPntr->hasLowerBound)
+    return -1;
+
+  TreePntr = ArgsPntr->treePntr;
+  ComparisonResult = TreePntr->keyComparisonFunctionPntr (
+    &ArgsPntr->userKey, &NodePntr->key);
+
+  if (ComparisonResult == 0) /* Equal keys, use the value to decide. */
+  {
+    if (ArgsPntr->userValueWasNULL)
+      return -1;
+    ComparisonResult = TreePntr->valueComparisonFunctionPntr (
+      &ArgsPntr->userValue, &NodePntr->value);
+    if (ComparisonResult == 0 && !ArgsPntr->includeThingEqualToStart)
+      return 1;
+  }
+
+  return ComparisonResult;
+}
+
+
+
+/* Figures out what needs to be done to a node after a change somewhere
+below it.  Returns the new height if just the height is wrong, or one of the
+CONDITION_ codes. */
+
+static int32 NodeCondition (AVLDupConcurrentNodePointer NodePntr)
+{
+  int32                       Balance;
+  int32                       HeightLeft;
+  int32                       HeightNew;
+  int32                       HeightRight;
+  AVLDupConcurrentNodePointer NodeLeft;
+  AVLDupConcurrentNodePointer NodeRight;
+
+  NodeLeft = NodePntr->smallerChildPntr;
+  NodeRight = NodePntr->largerChildPntr;
+
+  if ((NodeLeft == NULL || NodeRight == NULL) && !NodePntr->present)
+    return CONDITION_UNLINK_REQUIRED;
+
+  HeightLeft = Height (NodeLeft);
+  HeightRight = Height (NodeRight);
+  HeightNew = 1 + ((HeightLeft > HeightRight) ? HeightLeft : HeightRight);
+  Balance = HeightLeft - HeightRight;
+
+  if (Balance < -1 || Balance > 1)
+    return CONDITION_REBALANCE_REQUIRED;
+
+  return (NodePntr->height != HeightNew) ?
+    HeightNew : CONDITION_NOTHING_REQUIRED;
+}
+
+
+
+/* Updates the height of a locked node, if that's all it needs.  Returns the
+next node which needs fixing (the parent if the height changed, the node
+itself if it needs something more drastic, or NULL if nothing more needs to
+be done). */
+
+static AVLDupConcurrentNodePointer FixHeight_nl (
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  int32 Condition;
+
+  Condition = NodeCondition (NodePntr);
+
+  switch (Condition)
+  {
+    case CONDITION_REBALANCE_REQUIRED:
+    case CONDITION_UNLINK_REQUIRED:
+      return NodePntr;
+
+    case CONDITION_NOTHING_REQUIRED:
+      return NULL;
+  }
+
+  NodePntr->height = Condition;
+  return NodePntr->parentPntr;
+}
+
+
+
+/* Unlinks a routing node (or a node being deleted) which has at most one
+child, replacing it with its child.  Both the parent and the node must be
+locked.  Returns FALSE if the node can't be unlinked since it has two
+children or isn't a child of the parent any more. */
+
+static bool AttemptUnlink_nl (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  AVLDupConcurrentNodePointer ParentLeft;
+  AVLDupConcurrentNodePointer ParentRight;
+  AVLDupConcurrentNodePointer NodeLeft;
+  AVLDupConcurrentNodePointer NodeRight;
+  AVLDupConcurrentNodePointer SplicePntr;
+
+  ParentLeft = ParentPntr->smallerChildPntr;
+  ParentRight = ParentPntr->largerChildPntr;
+  if (ParentLeft != NodePntr && ParentRight != NodePntr)
+    return false; /* Node has been moved elsewhere, caller should retry. */
+
+  NodeLeft = NodePntr->smallerChildPntr;
+  NodeRight = NodePntr->largerChildPntr;
+  if (NodeLeft != NULL && NodeRight != NULL)
+    return false; /* Got a second child while we weren't looking. */
+
+  SplicePntr = (NodeLeft != NULL) ? NodeLeft : NodeRight;
+  if (ParentLeft == NodePntr)
+    ParentPntr->smallerChildPntr = SplicePntr;
+  else
+    ParentPntr->largerChildPntr = SplicePntr;
+  if (SplicePntr != NULL)
+    SplicePntr->parentPntr = ParentPntr;
+
+  atomic_set (&NodePntr->version, VERSION_UNLINKED);
+  atomic_set (&NodePntr->present, 0);
+  RetireNode (TreePntr, NodePntr);
+  return true;
+}
+
+
+
+/* The rotations.  These are the same as AVLDupRaiseLeftChild and
+AVLDupRaiseRightChild in AVLDupTree.c (see the ASCII pictures there), except
+that the node being pushed down is marked as shrinking during the change so
+that optimistic readers know to wait and retry, and the parent pointers and
+heights are updated from the heights that the caller already looked at.  All
+the nodes involved must be locked.  They return the next node needing fixing,
+like FixHeight_nl. */
+
+static AVLDupConcurrentNodePointer RotateRight_nl (
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupConcurrentNodePointer NodeLeft,
+  int32                       HeightRight,
+  int32                       HeightLeftLeft,
+  AVLDupConcurrentNodePointer NodeLeftRight,
+  int32                       HeightLeftRight)
+{
+  int32 BalanceLeft;
+  int32 BalanceNode;
+  int32 HeightNodeNew;
+  int32 NodeVersion;
+
+  NodeVersion = atomic_get (&NodePntr->version);
+  atomic_set (&NodePntr->version, BeginChange (NodeVersion));
+
+  NodePntr->smallerChildPntr = NodeLeftRight;
+  if (NodeLeftRight != NULL)
+    NodeLeftRight->parentPntr = NodePntr;
+
+  NodeLeft->largerChildPntr = NodePntr;
+  NodePntr->parentPntr = NodeLeft;
+
+  if (ParentPntr->smallerChildPntr == NodePntr)
+    ParentPntr->smallerChildPntr = NodeLeft;
+  else
+    ParentPntr->largerChildPntr = NodeLeft;
+  NodeLeft->parentPntr = ParentPntr;
+
+  HeightNodeNew = 1 + ((HeightLeftRight > HeightRight) ?
+    HeightLeftRight : HeightRight);
+  NodePntr->height = HeightNodeNew;
+  NodeLeft->height = 1 + ((HeightLeftLeft > HeightNodeNew) ?
+    HeightLeftLeft : HeightNodeNew);
+
+  atomic_set (&NodePntr->version, EndChange (NodeVersion));
+
+  /* See what needs fixing next, the pushed down node may still be out of
+  balance or be a routing node which can now be unlinked. */
+
+  BalanceNode = HeightLeftRight - HeightRight;
+  if (BalanceNode < -1 || BalanceNode > 1)
+    return NodePntr;
+
+  if ((NodeLeftRight == NULL || HeightRight == 0) && !NodePntr->present)
+    return NodePntr;
+
+  BalanceLeft = HeightLeftLeft - HeightNodeNew;
+  if (BalanceLeft < -1 || BalanceLeft > 1)
+    return NodeLeft;
+
+  if (HeightLeftLeft == 0 && !NodeLeft->present)
+    return NodeLeft;
+
+  return FixHeight_nl (ParentPntr);
+}
+
+
+static AVLDupConcurrentNodePointer RotateLeft_nl (
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  int32                       HeightLeft,
+  AVLDupConcurrentNodePointer NodeRight,
+  AVLDupConcurrentNodePointer NodeRightLeft,
+  int32                       HeightRightLeft,
+  int32                       HeightRightRight)
+{
+  int32 BalanceNode;
+  int32 BalanceRight;
+  int32 HeightNodeNew;
+  int32 NodeVersion;
+
+  NodeVersion = atomic_get (&NodePntr->version);
+  atomic_set (&NodePntr->version, BeginChange (NodeVersion));
+
+  NodePntr->largerChildPntr = NodeRightLeft;
+  if (NodeRightLeft != NULL)
+    NodeRightLeft->parentPntr = NodePntr;
+
+  NodeRight->smallerChildPntr = NodePntr;
+  NodePntr->parentPntr = NodeRight;
+
+  if (ParentPntr->smallerChildPntr == NodePntr)
+    ParentPntr->smallerChildPntr = NodeRight;
+  else
+    ParentPntr->largerChildPntr = NodeRight;
+  NodeRight->parentPntr = ParentPntr;
+
+  HeightNodeNew = 1 + ((HeightLeft > HeightRightLeft) ?
+    HeightLeft : HeightRightLeft);
+  NodePntr->height = HeightNodeNew;
+  NodeRight->height = 1 + ((HeightNodeNew > HeightRightRight) ?
+    HeightNodeNew : HeightRightRight);
+
+  atomic_set (&NodePntr->version, EndChange (NodeVersion));
+
+  BalanceNode = HeightRightLeft - HeightLeft;
+  if (BalanceNode < -1 || BalanceNode > 1)
+    return NodePntr;
+
+  if ((NodeRightLeft == NULL || HeightLeft == 0) && !NodePntr->present)
+    return NodePntr;
+
+  BalanceRight = HeightRightRight - HeightNodeNew;
+  if (BalanceRight < -1 || BalanceRight > 1)
+    return NodeRight;
+
+  if (HeightRightRight == 0 && !NodeRight->present)
+    return NodeRight;
+
+  return FixHeight_nl (ParentPntr);
+}
+
+
+
+/* Double rotations, raising the grandchild up two levels in one step.  Both
+the node and the child lose part of their subtrees so both are marked as
+shrinking. */
+
+static AVLDupConcurrentNodePointer RotateRightOverLeft_nl (
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupConcurrentNodePointer NodeLeft,
+  int32                       HeightRight,
+  int32                       HeightLeftLeft,
+  AVLDupConcurrentNodePointer NodeLeftRight,
+  int32                       HeightLeftRightLeft)
+{
+  int32                       BalanceLeftRight;
+  int32                       BalanceNode;
+  int32                       HeightLeftNew;
+  int32                       HeightLeftRightRight;
+  int32                       HeightNodeNew;
+  int32                       LeftVersion;
+  AVLDupConcurrentNodePointer NodeLeftRightLeft;
+  AVLDupConcurrentNodePointer NodeLeftRightRight;
+  int32                       NodeVersion;
+
+  NodeVersion = atomic_get (&NodePntr->version);
+  LeftVersion = atomic_get (&NodeLeft->version);
+
+  NodeLeftRightLeft = NodeLeftRight->smallerChildPntr;
+  NodeLeftRightRight = NodeLeftRight->largerChildPntr;
+  HeightLeftRightRight = Height (NodeLeftRightRight);
+
+  atomic_set (&NodePntr->version, BeginChange (NodeVersion));
+  atomic_set (&NodeLeft->version, BeginChange (LeftVersion));
+
+  NodePntr->smallerChildPntr = NodeLeftRightRight;
+  if (NodeLeftRightRight != NULL)
+    NodeLeftRightRight->parentPntr = NodePntr;
+
+  NodeLeft->largerChildPntr = NodeLeftRightLeft;
+  if (NodeLeftRightLeft != NULL)
+    NodeLeftRightLeft->parentPntr = NodeLeft;
+
+  NodeLeftRight->smallerChildPntr = NodeLeft;
+  NodeLeft->parentPntr = NodeLeftRight;
+  NodeLeftRight->largerChildPntr = NodePntr;
+  NodePntr->parentPntr = NodeLeftRight;
+
+  if (ParentPntr->smallerChildPntr == NodePntr)
+    ParentPntr->smallerChildPntr = NodeLeftRight;
+  else
+    ParentPntr->largerChildPntr = NodeLeftRight;
+  NodeLeftRight->parentPntr = ParentPntr;
+
+  HeightNodeNew = 1 + ((HeightLeftRightRight > HeightRight) ?
+    HeightLeftRightRight : HeightRight);
+  NodePntr->height = HeightNodeNew;
+  HeightLeftNew = 1 + ((HeightLeftLeft > HeightLeftRightLeft) ?
+    HeightLeftLeft : HeightLeftRightLeft);
+  NodeLeft->height = HeightLeftNew;
+  NodeLeftRight->height = 1 + ((HeightLeftNew > HeightNodeNew) ?
+    HeightLeftNew : HeightNodeNew);
+
+  atomic_set (&NodePntr->version, EndChange (NodeVersion));
+  atomic_set (&NodeLeft->version, EndChange (LeftVersion));
+
+  BalanceNode = HeightLeftRightRight - HeightRight;
+  if (BalanceNode < -1 || BalanceNode > 1)
+    return NodePntr;
+
+  if ((NodeLeftRightRight == NULL || HeightRight == 0) && !NodePntr->present)
+    return NodePntr;
+
+  BalanceLeftRight = HeightLeftNew - HeightNodeNew;
+  if (BalanceLeftRight < -1 || BalanceLeftRight > 1)
+    return NodeLeftRight;
+
+  return FixHeight_nl (ParentPntr);
+}
+
+
+static AVLDupConcurrentNodePointer RotateLeftOverRight_nl (
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  int32                       HeightLeft,
+  AVLDupConcurrentNodePointer NodeRight,
+  AVLDupConcurrentNodePointer NodeRightLeft,
+  int32                       HeightRightRight,
+  int32                       HeightRightLeftRight)
+{
+  int32                       BalanceNode;
+  int32                       BalanceRightLeft;
+  int32                       HeightNodeNew;
+  int32                       HeightRightLeftLeft;
+  int32                       HeightRightNew;
+  AVLDupConcurrentNodePointer NodeRightLeftLeft;
+  AVLDupConcurrentNodePointer NodeRightLeftRight;
+  int32                       NodeVersion;
+  int32                       RightVersion;
+
+  NodeVersion = atomic_get (&NodePntr->version);
+  RightVersion = atomic_get (&NodeRight->version);
+
+  NodeRightLeftLeft = NodeRightLeft->smallerChildPntr;
+  NodeRightLeftRight = NodeRightLeft->largerChildPntr;
+  HeightRightLeftLeft = Height (NodeRightLeftLeft);
+
+  atomic_set (&NodePntr->version, BeginChange (NodeVersion));
+  atomic_set (&NodeRight->version, BeginChange (RightVersion));
+
+  NodePntr->largerChildPntr = NodeRightLeftLeft;
+  if (NodeRightLeftLeft != NULL)
+    NodeRightLeftLeft->parentPntr = NodePntr;
+
+  NodeRight->smallerChildPntr = NodeRightLeftRight;
+  if (NodeRightLeftRight != NULL)
+    NodeRightLeftRight->parentPntr = NodeRight;
+
+  NodeRightLeft->largerChildPntr = NodeRight;
+  NodeRight->parentPntr = NodeRightLeft;
+  NodeRightLeft->smallerChildPntr = NodePntr;
+  NodePntr->parentPntr = NodeRightLeft;
+
+  if (ParentPntr->smallerChildPntr == NodePntr)
+    ParentPntr->smallerChildPntr = NodeRightLeft;
+  else
+    ParentPntr->largerChildPntr = NodeRightLeft;
+  NodeRightLeft->parentPntr = ParentPntr;
+
+  HeightNodeNew = 1 + ((HeightLeft > HeightRightLeftLeft) ?
+    HeightLeft : HeightRightLeftLeft);
+  NodePntr->height = HeightNodeNew;
+  HeightRightNew = 1 + ((HeightRightLeftRight > HeightRightRight) ?
+    HeightRightLeftRight : HeightRightRight);
+  NodeRight->height = HeightRightNew;
+  NodeRightLeft->height = 1 + ((HeightNodeNew > HeightRightNew) ?
+    HeightNodeNew : HeightRightNew);
+
+  atomic_set (&NodePntr->version, EndChange (NodeVersion));
+  atomic_set (&NodeRight->version, EndChange (RightVersion));
+
+  BalanceNode = HeightRightLeftLeft - HeightLeft;
+  if (BalanceNode < -1 || BalanceNode > 1)
+    return NodePntr;
+
+  if ((NodeRightLeftLeft == NULL || HeightLeft == 0) && !NodePntr->present)
+    return NodePntr;
+
+  BalanceRightLeft = HeightRightNew - HeightNodeNew;
+  if (BalanceRightLeft < -1 || BalanceRightLeft > 1)
+    return NodeRightLeft;
+
+  return FixHeight_nl (ParentPntr);
+}
+
+
+
+/* Rebalancing when the left side is too deep.  The parent and node are
+locked by the caller, this locks the left child (and maybe the left child's
+right child) and picks a single or double rotation, the same decision that
+AVLDupFixupSubtrees makes.  If the heights it sees don't justify a rotation
+any more, it returns the node so the caller can have another look. */
+
+static AVLDupConcurrentNodePointer RebalanceToLeft_nl (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupConcurrentNodePointer NodeRight,
+  int32                       HeightLeft);
+
+static AVLDupConcurrentNodePointer RebalanceToRight_nl (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupConcurrentNodePointer NodeLeft,
+  int32                       HeightRight)
+{
+  int32                       Balance;
+  int32                       HeightLeftLeft;
+  int32                       HeightLeftRight;
+  int32                       HeightLeftRightLeft;
+  AVLDupConcurrentNodePointer NodeLeftRight;
+  AVLDupConcurrentNodePointer ResultPntr;
+
+  LockNode (NodeLeft);
+
+  if (NodeLeft->height - HeightRight <= 1)
+  {
+    UnlockNode (NodeLeft);
+    return NodePntr; /* Changed in the meantime, have another look. */
+  }
+
+  NodeLeftRight = NodeLeft->largerChildPntr;
+  HeightLeftLeft = Height (NodeLeft->smallerChildPntr);
+  HeightLeftRight = Height (NodeLeftRight);
+
+  if (HeightLeftLeft >= HeightLeftRight)
+  {
+    ResultPntr = RotateRight_nl (ParentPntr, NodePntr, NodeLeft, HeightRight,
+      HeightLeftLeft, NodeLeftRight, HeightLeftRight);
+    UnlockNode (NodeLeft);
+    return ResultPntr;
+  }
+
+  /* The left child's right child is deeper, so a double rotation is needed
+  to avoid the AVL grandchild problem. */
+
+  LockNode (NodeLeftRight);
+
+  HeightLeftRight = NodeLeftRight->height;
+  if (HeightLeftLeft >= HeightLeftRight)
+  {
+    ResultPntr = RotateRight_nl (ParentPntr, NodePntr, NodeLeft, HeightRight,
+      HeightLeftLeft, NodeLeftRight, HeightLeftRight);
+    UnlockNode (NodeLeftRight);
+    UnlockNode (NodeLeft);
+    return ResultPntr;
+  }
+
+  HeightLeftRightLeft = Height (NodeLeftRight->smallerChildPntr);
+  Balance = HeightLeftLeft - HeightLeftRightLeft;
+  if (Balance >= -1 && Balance <= 1 &&
+  !((HeightLeftLeft == 0 || HeightLeftRightLeft == 0) && !NodeLeft->present))
+  {
+    ResultPntr = RotateRightOverLeft_nl (ParentPntr, NodePntr, NodeLeft,
+      HeightRight, HeightLeftLeft, NodeLeftRight, HeightLeftRightLeft);
+    UnlockNode (NodeLeftRight);
+    UnlockNode (NodeLeft);
+    return ResultPntr;
+  }
+
+  UnlockNode (NodeLeftRight);
+
+  /* The double rotation would leave the left child unbalanced, so just do
+  the first half of it (a left rotation of the left child) and let the
+  caller come back for the rest. */
+
+  ResultPntr = RebalanceToLeft_nl (TreePntr, NodePntr, NodeLeft,
+    NodeLeftRight, HeightLeftLeft);
+  UnlockNode (NodeLeft);
+  return ResultPntr;
+}
+
+
+static AVLDupConcurrentNodePointer RebalanceToLeft_nl (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupConcurrentNodePointer NodeRight,
+  int32                       HeightLeft)
+{
+  int32                       Balance;
+  int32                       HeightRightLeft;
+  int32                       HeightRightLeftRight;
+  int32                       HeightRightRight;
+  AVLDupConcurrentNodePointer NodeRightLeft;
+  AVLDupConcurrentNodePointer ResultPntr;
+
+  LockNode (NodeRight);
+
+  if (HeightLeft - NodeRight->height >= -1)
+  {
+    UnlockNode (NodeRight);
+    return NodePntr;
+  }
+
+  NodeRightLeft = NodeRight->smallerChildPntr;
+  HeightRightLeft = Height (NodeRightLeft);
+  HeightRightRight = Height (NodeRight->largerChildPntr);
+
+  if (HeightRightRight >= HeightRightLeft)
+  {
+    ResultPntr = RotateLeft_nl (ParentPntr, NodePntr, HeightLeft, NodeRight,
+      NodeRightLeft, HeightRightLeft, HeightRightRight);
+    UnlockNode (NodeRight);
+    return ResultPntr;
+  }
+
+  LockNode (NodeRightLeft);
+
+  HeightRightLeft = NodeRightLeft->height;
+  if (HeightRightRight >= HeightRightLeft)
+  {
+    ResultPntr = RotateLeft_nl (ParentPntr, NodePntr, HeightLeft, NodeRight,
+      NodeRightLeft, HeightRightLeft, HeightRightRight);
+    UnlockNode (NodeRightLeft);
+    UnlockNode (NodeRight);
+    return ResultPntr;
+  }
+
+  HeightRightLeftRight = Height (NodeRightLeft->largerChildPntr);
+  Balance = HeightRightRight - HeightRightLeftRight;
+  if (Balance >= -1 && Balance <= 1 &&
+  !((HeightRightRight == 0 || HeightRightLeftRight == 0) &&
+  !NodeRight->present))
+  {
+    ResultPntr = RotateLeftOverRight_nl (ParentPntr, NodePntr, HeightLeft,
+      NodeRight, NodeRightLeft, HeightRightRight, HeightRightLeftRight);
+    UnlockNode (NodeRightLeft);
+    UnlockNode (NodeRight);
+    return ResultPntr;
+  }
+
+  UnlockNode (NodeRightLeft);
+
+  ResultPntr = RebalanceToRight_nl (TreePntr, NodePntr, NodeRight,
+    NodeRightLeft, HeightRightRight);
+  UnlockNode (NodeRight);
+  return ResultPntr;
+}
+
+
+
+/* Does whatever a node needs, with the node and its parent locked.  Returns
+the next node to look at, or NULL if the fixups are finished. */
+
+static AVLDupConcurrentNodePointer Rebalance_nl (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  int32                       Balance;
+  int32                       HeightLeft;
+  int32                       HeightNew;
+  int32                       HeightRight;
+  AVLDupConcurrentNodePointer NodeLeft;
+  AVLDupConcurrentNodePointer NodeRight;
+
+  NodeLeft = NodePntr->smallerChildPntr;
+  NodeRight = NodePntr->largerChildPntr;
+
+  if ((NodeLeft == NULL || NodeRight == NULL) && !NodePntr->present)
+  {
+    if (AttemptUnlink_nl (TreePntr, ParentPntr, NodePntr))
+      return FixHeight_nl (ParentPntr);
+    return NodePntr;
+  }
+
+  HeightLeft = Height (NodeLeft);
+  HeightRight = Height (NodeRight);
+  HeightNew = 1 + ((HeightLeft > HeightRight) ? HeightLeft : HeightRight);
+  Balance = HeightLeft - HeightRight;
+
+  if (Balance > 1)
+    return RebalanceToRight_nl (TreePntr, ParentPntr, NodePntr, NodeLeft,
+      HeightRight);
+
+  if (Balance < -1)
+    return RebalanceToLeft_nl (TreePntr, ParentPntr, NodePntr, NodeRight,
+      HeightLeft);
+
+  if (HeightNew != NodePntr->height)
+  {
+    NodePntr->height = HeightNew;
+    return FixHeight_nl (ParentPntr);
+  }
+
+  return NULL;
+}
+
+
+
+/* Walks up the tree from a changed node, fixing heights, unlinking routing
+nodes and rebalancing as needed, until it gets to a node which doesn't need
+anything done or reaches the root holder.  Just updating a height only needs
+the node itself locked, rotations and unlinking also need the parent. */
+
+static void FixHeightAndRebalance (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  int32                       Condition;
+  AVLDupConcurrentNodePointer NextPntr;
+  AVLDupConcurrentNodePointer ParentPntr;
+
+  while (NodePntr != NULL && NodePntr->parentPntr != NULL)
+  {
+    Condition = NodeCondition (NodePntr);
+    if (Condition == CONDITION_NOTHING_REQUIRED ||
+    (atomic_get (&NodePntr->version) & VERSION_UNLINKED))
+      return;
+
+    if (Condition != CONDITION_UNLINK_REQUIRED &&
+    Condition != CONDITION_REBALANCE_REQUIRED)
+    {
+      LockNode (NodePntr);
+      NextPntr = FixHeight_nl (NodePntr);
+      UnlockNode (NodePntr);
+      NodePntr = NextPntr;
+    }
+    else
+    {
+      ParentPntr = NodePntr->parentPntr;
+      LockNode (ParentPntr);
+      if ((atomic_get (&ParentPntr->version) & VERSION_UNLINKED) == 0 &&
+      NodePntr->parentPntr == ParentPntr)
+      {
+        LockNode (NodePntr);
+        NextPntr = Rebalance_nl (TreePntr, ParentPntr, NodePntr);
+        UnlockNode (NodePntr);
+        NodePntr = NextPntr;
+      }
+      UnlockNode (ParentPntr);
+      /* Otherwise the parent changed, retry with the same node. */
+    }
+  }
+}
+
+
+
+/* Recursively descends the tree looking for the place to add the user's
+key/value, starting from the given Direction child of NodePntr, which had
+version NodeVersion when the caller looked at it.  If the key/value pair is
+already there as a routing node (deleted but not unlinked), it is just marked
+as present again. */
+
+static ConcReturnCode AttemptAdd (
+  ConcurrentArgumentsPointer  ArgsPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  int                         Direction,
+  int32                       NodeVersion)
+{
+  AVLDupConcurrentNodePointer ChildPntr;
+  int32                       ChildVersion;
+  int                         ComparisonResult;
+  AVLDupConcurrentNodePointer NewNode;
+  ConcReturnCode              ReturnCode;
+  AVLDupConcurrentTreePointer TreePntr;
+
+  TreePntr = ArgsPntr->treePntr;
+
+  while (true)
+  {
+    ChildPntr = GetChild (NodePntr, Direction);
+    if (atomic_get (&NodePntr->version) != NodeVersion)
+      return CONC_RETRY;
+
+    if (ChildPntr == NULL)
+    {
+      /* Found the spot for a new leaf.  Allocate the node outside the lock,
+      keep it around in case we have to retry. */
+
+      if (ArgsPntr->newNodePntr == NULL)
+      {
+        NewNode = malloc (sizeof (AVLDupConcurrentNodeRecord));
+        if (NewNode == NULL)
+          return CONC_OUT_OF_MEMORY;
+        memset (NewNode, 0, sizeof (AVLDupConcurrentNodeRecord));
+        if (!AVLDupCopyThingArray (&NewNode->key, &ArgsPntr->userKey,
+        TreePntr->keyType, 1))
+        {
+          free (NewNode);
+          return CONC_OUT_OF_MEMORY;
+        }
+        if (!AVLDupCopyThingArray (&NewNode->value, &ArgsPntr->userValue,
+        TreePntr->valueType, 1))
+        {
+          AVLDupFreeThingArray (&NewNode->key, TreePntr->keyType, 1);
+          free (NewNode);
+          return CONC_OUT_OF_MEMORY;
+        }
+        NewNode->height = 1;
+        NewNode->present = 1;
+        ArgsPntr->newNodePntr = NewNode;
+      }
+
+      LockNode (NodePntr);
+
+      if (atomic_get (&NodePntr->version) != NodeVersion)
+      {
+        UnlockNode (NodePntr);
+        return CONC_RETRY;
+      }
+
+      if (GetChild (NodePntr, Direction) != NULL)
+      {
+        UnlockNode (NodePntr);
+        continue; /* Someone else added a node here, look again. */
+      }
+
+      NewNode = ArgsPntr->newNodePntr;
+      ArgsPntr->newNodePntr = NULL;
+      NewNode->parentPntr = NodePntr;
+      atomic_set (&NewNode->version, 0); /* Memory barrier before linking. */
+      SetChild (NodePntr, Direction, NewNode);
+
+      UnlockNode (NodePntr);
+
+      FixHeightAndRebalance (TreePntr, NodePntr);
+      return CONC_CHANGED;
+    }
+
+    ComparisonResult = CompareUserToNode (ArgsPntr, ChildPntr);
+
+    if (ComparisonResult == 0)
+    {
+      /* Found it.  If it's a routing node, bring it back to life. */
+
+      LockNode (ChildPntr);
+      if (atomic_get (&ChildPntr->version) & VERSION_UNLINKED)
+        ReturnCode = CONC_RETRY;
+      else if (ChildPntr->present)
+        ReturnCode = CONC_NOT_CHANGED;
+      else
+      {
+        atomic_set (&ChildPntr->present, 1);
+        ReturnCode = CONC_CHANGED;
+      }
+      UnlockNode (ChildPntr);
+
+      if (ReturnCode != CONC_RETRY)
+        return ReturnCode;
+      continue;
+    }
+
+    ChildVersion = atomic_get (&ChildPntr->version);
+    if (ChildVersion & VERSION_SHRINKING)
+      WaitUntilNotChanging (ChildPntr);
+    else if ((ChildVersion & VERSION_UNLINKED) == 0 &&
+    ChildPntr == GetChild (NodePntr, Direction))
+    {
+      if (atomic_get (&NodePntr->version) != NodeVersion)
+        return CONC_RETRY;
+
+      ReturnCode =
+        AttemptAdd (ArgsPntr, ChildPntr, ComparisonResult, ChildVersion);
+      if (ReturnCode != CONC_RETRY)
+        return ReturnCode;
+    }
+    /* Otherwise the child changed under us, have another look. */
+  }
+}
+
+
+
+/* Removes a node which matched the user's key/value.  Nodes with zero or one
+child are unlinked, nodes with two children become routing nodes. */
+
+static ConcReturnCode AttemptRemoveNode (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer ParentPntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  if (!atomic_get (&NodePntr->present))
+    return CONC_NOT_CHANGED;
+
+  if (NodePntr->smallerChildPntr == NULL || NodePntr->largerChildPntr == NULL)
+  {
+    LockNode (ParentPntr);
+    if ((atomic_get (&ParentPntr->version) & VERSION_UNLINKED) ||
+    NodePntr->parentPntr != ParentPntr)
+    {
+      UnlockNode (ParentPntr);
+      return CONC_RETRY;
+    }
+
+    LockNode (NodePntr);
+    if (!NodePntr->present)
+    {
+      UnlockNode (NodePntr);
+      UnlockNode (ParentPntr);
+      return CONC_NOT_CHANGED;
+    }
+    if (!AttemptUnlink_nl (TreePntr, ParentPntr, NodePntr))
+    {
+      UnlockNode (NodePntr);
+      UnlockNode (ParentPntr);
+      return CONC_RETRY;
+    }
+    UnlockNode (NodePntr);
+    UnlockNode (ParentPntr);
+
+    FixHeightAndRebalance (TreePntr, ParentPntr);
+    return CONC_CHANGED;
+  }
+
+  LockNode (NodePntr);
+  if ((atomic_get (&NodePntr->version) & VERSION_UNLINKED) ||
+  NodePntr->smallerChildPntr == NULL || NodePntr->largerChildPntr == NULL)
+  {
+    UnlockNode (NodePntr);
+    return CONC_RETRY; /* Can unlink it now, so do that instead. */
+  }
+  atomic_set (&NodePntr->present, 0);
+  UnlockNode (NodePntr);
+  return CONC_CHANGED;
+}
+
+
+
+/* Recursively descends the tree looking for the user's key/value to delete,
+in the same way as AttemptAdd. */
+
+static ConcReturnCode AttemptDelete (
+  ConcurrentArgumentsPointer  ArgsPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  int                         Direction,
+  int32                       NodeVersion)
+{
+  AVLDupConcurrentNodePointer ChildPntr;
+  int32                       ChildVersion;
+  int                         ComparisonResult;
+  ConcReturnCode              ReturnCode;
+
+  while (true)
+  {
+    ChildPntr = GetChild (NodePntr, Direction);
+    if (atomic_get (&NodePntr->version) != NodeVersion)
+      return CONC_RETRY;
+
+    if (ChildPntr == NULL)
+      return CONC_NOT_CHANGED; /* Not in the tree. */
+
+    ComparisonResult = CompareUserToNode (ArgsPntr, ChildPntr);
+
+    if (ComparisonResult == 0)
+    {
+      ReturnCode =
+        AttemptRemoveNode (ArgsPntr->treePntr, NodePntr, ChildPntr);
+      if (ReturnCode != CONC_RETRY)
+        return ReturnCode;
+      continue;
+    }
+
+    ChildVersion = atomic_get (&ChildPntr->version);
+    if (ChildVersion & VERSION_SHRINKING)
+      WaitUntilNotChanging (ChildPntr);
+    else if ((ChildVersion & VERSION_UNLINKED) == 0 &&
+    ChildPntr == GetChild (NodePntr, Direction))
+    {
+      if (atomic_get (&NodePntr->version) != NodeVersion)
+        return CONC_RETRY;
+
+      ReturnCode =
+        AttemptDelete (ArgsPntr, ChildPntr, ComparisonResult, ChildVersion);
+      if (ReturnCode != CONC_RETRY)
+        return ReturnCode;
+    }
+  }
+}
+
+
+
+/* Finds the smallest node (present or routing) which is greater than the
+lower bound in the arguments (or equal to it, if equal things are included).
+Returns NULL if there isn't one, or RETRY_NODE if the caller should retry
+since something changed. */
+
+static AVLDupConcurrentNodePointer AttemptFindCeiling (
+  ConcurrentArgumentsPointer  ArgsPntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  int                         Direction,
+  int32                       NodeVersion)
+{
+  AVLDupConcurrentNodePointer ChildPntr;
+  int32                       ChildVersion;
+  int                         ComparisonResult;
+  AVLDupConcurrentNodePointer ResultPntr;
+
+  while (true)
+  {
+    ChildPntr = GetChild (NodePntr, Direction);
+    if (atomic_get (&NodePntr->version) != NodeVersion)
+      return RETRY_NODE;
+
+    if (ChildPntr == NULL)
+      return NULL;
+
+    ComparisonResult = CompareUserToNode (ArgsPntr, ChildPntr);
+    if (ComparisonResult == 0)
+      return ChildPntr;
+
+    ChildVersion = atomic_get (&ChildPntr->version);
+    if (ChildVersion & VERSION_SHRINKING)
+      WaitUntilNotChanging (ChildPntr);
+    else if ((ChildVersion & VERSION_UNLINKED) == 0 &&
+    ChildPntr == GetChild (NodePntr, Direction))
+    {
+      if (atomic_get (&NodePntr->version) != NodeVersion)
+        return RETRY_NODE;
+
+      ResultPntr = AttemptFindCeiling (ArgsPntr, ChildPntr, ComparisonResult,
+        ChildVersion);
+      if (ResultPntr != RETRY_NODE)
+      {
+        /* If the bound is smaller than the child and there was nothing
+        in the child's left subtree, then the child is the ceiling. */
+
+        if (ResultPntr == NULL && ComparisonResult < 0)
+          return ChildPntr;
+        return ResultPntr;
+      }
+    }
+  }
+}
+
+
+
+/* Create a new empty concurrent tree.  Returns NULL if out of memory or any
+of the key/value data types are unsupported.  There isn't a maximum number of
+readers like AVLDupAllocTree has, since readers don't take turns. */
+
+AVLDupConcurrentTreePointer AVLDupConcurrentAllocTree (
+  type_code   KeyType,
+  type_code   ValueType,
+  const char *IndexName)
+{
+  AVLDupConcurrentTreePointer NewTree;
+
+  NewTree = malloc (sizeof (AVLDupConcurrentTreeRecord));
+  if (NewTree == NULL) goto ErrorExit;
+
+  memset (NewTree, 0, sizeof (AVLDupConcurrentTreeRecord));
+  NewTree->rootHolder.present = 1; /* So it never looks unlinkable. */
+  NewTree->globalEpoch = 1;
+  NewTree->reclaimAtCount = RETIRED_NODES_BEFORE_RECLAIM;
+
+  if (IndexName != NULL)
+  {
+    NewTree->indexName = malloc (strlen (IndexName) + 1);
+    if (NewTree->indexName == NULL) goto ErrorExit;
+    strcpy (NewTree->indexName, IndexName);
+  }
+
+  NewTree->keyType = KeyType;
+  NewTree->keyComparisonFunctionPntr =
+    AVLDupGetComparisonFunctionForType (KeyType);
+  if (NewTree->keyComparisonFunctionPntr == NULL) goto ErrorExit;
+
+  NewTree->valueType = ValueType;
+  NewTree->valueComparisonFunctionPntr =
+    AVLDupGetComparisonFunctionForType (ValueType);
+  if (NewTree->valueComparisonFunctionPntr == NULL) goto ErrorExit;
+
+  return NewTree;
+
+
+ErrorExit: /* Deallocate partial allocations and return NULL. */
+  AVLDupConcurrentFreeTree (NewTree);
+  return NULL;
+}
+
+
+
+/* Internal function for deallocating a subtree and all its nodes. */
+
+static void RecursiveDeallocateNodes (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  if (NodePntr == NULL)
+    return;
+
+  RecursiveDeallocateNodes (TreePntr, NodePntr->smallerChildPntr);
+  RecursiveDeallocateNodes (TreePntr, NodePntr->largerChildPntr);
+  FreeNode (TreePntr, NodePntr);
+}
+
+
+
+/* Deallocate a concurrent tree and everything in it.  Unlike AVLDupFreeTree,
+it can't wait for other threads to finish, so make sure nobody else is
+using the tree before calling it.  Safe to pass in NULL. */
+
+void AVLDupConcurrentFreeTree (AVLDupConcurrentTreePointer TreePntr)
+{
+  AVLDupConcurrentNodePointer NextPntr;
+
+  if (TreePntr == NULL)
+    return;
+
+  RecursiveDeallocateNodes (TreePntr, TreePntr->rootHolder.largerChildPntr);
+
+  while (TreePntr->retiredListPntr != NULL)
+  {
+    NextPntr = TreePntr->retiredListPntr->nextRetiredPntr;
+    FreeNode (TreePntr, TreePntr->retiredListPntr);
+    TreePntr->retiredListPntr = NextPntr;
+  }
+
+  if (TreePntr->indexName != NULL)
+    free (TreePntr->indexName);
+
+  memset (TreePntr, 0, sizeof (AVLDupConcurrentTreeRecord));
+  free (TreePntr);
+}
+
+
+
+/* Returns the number of key/value pairs in the tree.  With other threads
+busy changing the tree, it's only a snapshot of the count. */
+
+unsigned int AVLDupConcurrentGetTreeCount (
+  AVLDupConcurrentTreePointer TreePntr)
+{
+  if (TreePntr != NULL)
+    return (unsigned int) atomic_get (&TreePntr->count);
+
+  return 0;
+}
+
+
+
+/* Adds a key/value pair to the concurrent tree.  Same as AVLDupAdd, returns
+TRUE if successful or if it was already there, FALSE if out of memory. */
+
+bool AVLDupConcurrentAdd (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer          Key,
+  AVLDupThingPointer          Value)
+{
+  ConcurrentArgumentsRecord Arguments;
+  ConcReturnCode            ReturnCode;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  memset (&Arguments, 0, sizeof (Arguments));
+  Arguments.treePntr = TreePntr;
+  Arguments.userKey = *Key;
+  Arguments.userValue = *Value;
+  Arguments.hasLowerBound = true;
+  Arguments.includeThingEqualToStart = true;
+
+  EnterOperation (TreePntr, &Arguments);
+
+  do
+  {
+    ReturnCode = AttemptAdd (&Arguments, &TreePntr->rootHolder, 1,
+      atomic_get (&TreePntr->rootHolder.version));
+  } while (ReturnCode == CONC_RETRY);
+
+  if (ReturnCode == CONC_CHANGED)
+    atomic_add (&TreePntr->count, 1);
+
+  LeaveOperation (TreePntr, &Arguments);
+
+  /* Someone else added the same key/value while we were allocating. */
+
+  if (Arguments.newNodePntr != NULL)
+    FreeNode (TreePntr, Arguments.newNodePntr);
+
+  return (ReturnCode != CONC_OUT_OF_MEMORY);
+}
+
+
+
+/* Deletes the given key/value pair.  Returns TRUE if it deleted it, FALSE if
+it wasn't in the tree. */
+
+bool AVLDupConcurrentDelete (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer          Key,
+  AVLDupThingPointer          Value)
+{
+  ConcurrentArgumentsRecord Arguments;
+  ConcReturnCode            ReturnCode;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  memset (&Arguments, 0, sizeof (Arguments));
+  Arguments.treePntr = TreePntr;
+  Arguments.userKey = *Key;
+  Arguments.userValue = *Value;
+  Arguments.hasLowerBound = true;
+  Arguments.includeThingEqualToStart = true;
+
+  EnterOperation (TreePntr, &Arguments);
+
+  do
+  {
+    ReturnCode = AttemptDelete (&Arguments, &TreePntr->rootHolder, 1,
+      atomic_get (&TreePntr->rootHolder.version));
+  } while (ReturnCode == CONC_RETRY);
+
+  if (ReturnCode == CONC_CHANGED)
+    atomic_add (&TreePntr->count, -1);
+
+  LeaveOperation (TreePntr, &Arguments);
+
+  return (ReturnCode == CONC_CHANGED);
+}
+
+
+
+/* The ceiling search from the top of the tree, retrying until nothing
+changes under it. */
+
+static AVLDupConcurrentNodePointer FindCeiling (
+  ConcurrentArgumentsPointer ArgsPntr)
+{
+  AVLDupConcurrentNodePointer NodePntr;
+  AVLDupConcurrentTreePointer TreePntr;
+
+  TreePntr = ArgsPntr->treePntr;
+  do
+  {
+    NodePntr = AttemptFindCeiling (ArgsPntr, &TreePntr->rootHolder, 1,
+      atomic_get (&TreePntr->rootHolder.version));
+  } while (NodePntr == RETRY_NODE);
+
+  return NodePntr;
+}
+
+
+
+/* Finds the node (present or routing) after the given one, which must not
+be deallocated during the search, so the caller has to be in the middle of
+an operation.  The node becomes the exclusive lower bound.  Usually the next
+node is the smallest one in the node's larger subtree, which is found
+without going back to the top.  If the node has no larger subtree, or it
+got unlinked or rotated, the search starts again from the root. */
+
+static AVLDupConcurrentNodePointer FindNextNode (
+  ConcurrentArgumentsPointer  ArgsPntr,
+  AVLDupConcurrentNodePointer NodePntr)
+{
+  int32                       NodeVersion;
+  AVLDupConcurrentNodePointer ResultPntr;
+
+  ArgsPntr->hasLowerBound = true;
+  ArgsPntr->userKey = NodePntr->key;
+  ArgsPntr->userValue = NodePntr->value;
+  ArgsPntr->userValueWasNULL = false;
+  ArgsPntr->includeThingEqualToStart = false;
+
+  NodeVersion = atomic_get (&NodePntr->version);
+  if ((NodeVersion & (VERSION_UNLINKED | VERSION_SHRINKING)) == 0)
+  {
+    ResultPntr = AttemptFindCeiling (ArgsPntr, NodePntr, 1, NodeVersion);
+    if (ResultPntr != NULL && ResultPntr != RETRY_NODE)
+      return ResultPntr;
+  }
+
+  return FindCeiling (ArgsPntr);
+}
+
+
+
+/* Returns TRUE if the node is past the end of the iteration's range.  Same
+logic as in AVLDupRecursiveRangeIterate. */
+
+static bool NodeIsPastEnd (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupThingPointer          EndKeyPntr,
+  AVLDupThingPointer          EndValuePntr,
+  bool                        IncludeThingEqualToEnd)
+{
+  int ComparisonUpper;
+
+  if (EndKeyPntr == NULL)
+    return false;
+
+  ComparisonUpper = TreePntr->keyComparisonFunctionPntr (
+    EndKeyPntr, &NodePntr->key);
+  if (ComparisonUpper == 0)
+  {
+    if (EndValuePntr == NULL)
+      ComparisonUpper = 1;
+    else
+      ComparisonUpper = TreePntr->valueComparisonFunctionPntr (
+        EndValuePntr, &NodePntr->value);
+  }
+
+  return (ComparisonUpper < 0 ||
+    (ComparisonUpper == 0 && !IncludeThingEqualToEnd));
+}
+
+
+
+/* Copies a node's key and value, for an iteration which is about to let go
+of its slot and needs to know where to carry on from afterwards.  Returns
+FALSE if out of memory, with nothing left allocated. */
+
+static bool CopyNodeKeyValue (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupConcurrentNodePointer NodePntr,
+  AVLDupThingPointer          KeyPntr,
+  AVLDupThingPointer          ValuePntr)
+{
+  if (!AVLDupCopyThingArray (KeyPntr, &NodePntr->key, TreePntr->keyType, 1))
+    return false;
+
+  if (!AVLDupCopyThingArray (ValuePntr, &NodePntr->value,
+  TreePntr->valueType, 1))
+  {
+    AVLDupFreeThingArray (KeyPntr, TreePntr->keyType, 1);
+    return false;
+  }
+
+  return true;
+}
+
+
+
+/* Iterates over a range of key/value pairs, with the same arguments and
+range semantics as AVLDupIterate.  Rather than a single recursive traversal,
+it walks from each node to the next one, checking that nothing changed under
+it on the way, so other threads can add and delete things while the
+iteration is in progress.  You'll see everything that was in the range for
+the whole time of the iteration, things added or deleted during the
+iteration may or may not be seen.  Your callback can call
+AVLDupConcurrentAdd and AVLDupConcurrentDelete (unlike with AVLDupIterate).
+
+The iteration holds an epoch slot while your callback runs, so that the
+callback can be given the node's own key/value rather than a copy, and
+nothing unlinked in the meantime gets deallocated until the iteration lets
+go of the slot, which it does every ITERATION_STEPS_PER_EPOCH steps.  So a
+callback which takes a long time holds up the deallocation for everyone.
+See MAX_ITERATIONS_HOLDING_SLOTS for what happens when lots of iterations
+are running at once.  Returns FALSE if your callback asked to stop or if it
+ran out of memory copying a string. */
+
+bool AVLDupConcurrentIterate (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  ConcurrentArgumentsRecord   Arguments;
+  AVLDupThingRecord           CopiedKey;
+  AVLDupThingRecord           CopiedValue;
+  bool                        HoldingSlot;
+  AVLDupConcurrentNodePointer NodePntr;
+  uint32                      StepsInEpoch;
+  bool                        Successful;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  memset (&Arguments, 0, sizeof (Arguments));
+  Arguments.treePntr = TreePntr;
+
+  if (StartKeyPntr != NULL)
+  {
+    Arguments.hasLowerBound = true;
+    Arguments.userKey = *StartKeyPntr;
+    if (StartValuePntr == NULL)
+      Arguments.userValueWasNULL = true;
+    else
+      Arguments.userValue = *StartValuePntr;
+    Arguments.includeThingEqualToStart = IncludeThingEqualToStart;
+  }
+
+  HoldingSlot = (atomic_add (&TreePntr->iterationsHoldingSlots, 1) <
+    MAX_ITERATIONS_HOLDING_SLOTS);
+  if (!HoldingSlot)
+    atomic_add (&TreePntr->iterationsHoldingSlots, -1);
+
+  Successful = true;
+  StepsInEpoch = 0;
+
+  EnterOperation (TreePntr, &Arguments);
+  NodePntr = FindCeiling (&Arguments);
+
+  while (NodePntr != NULL && !NodeIsPastEnd (TreePntr, NodePntr,
+  EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd))
+  {
+    /* Routing nodes just get stepped over. */
+
+    if (atomic_get (&NodePntr->present) == 0)
+    {
+      NodePntr = FindNextNode (&Arguments, NodePntr);
+      continue;
+    }
+
+    if (!HoldingSlot)
+    {
+      /* Let go of the slot while the callback runs, giving it a copy of
+      the key/value, which is also where the next step carries on from. */
+
+      if (!CopyNodeKeyValue (TreePntr, NodePntr, &CopiedKey, &CopiedValue))
+      {
+        Successful = false; /* Out of memory. */
+        break;
+      }
+      LeaveOperation (TreePntr, &Arguments);
+
+      Successful =
+        CallbackFunctionPntr (&CopiedKey, &CopiedValue, ExtraUserData);
+
+      if (Successful)
+      {
+        EnterOperation (TreePntr, &Arguments);
+        Arguments.hasLowerBound = true;
+        Arguments.userKey = CopiedKey;
+        Arguments.userValue = CopiedValue;
+        Arguments.userValueWasNULL = false;
+        Arguments.includeThingEqualToStart = false;
+        NodePntr = FindCeiling (&Arguments);
+      }
+
+      AVLDupFreeThingArray (&CopiedKey, TreePntr->keyType, 1);
+      AVLDupFreeThingArray (&CopiedValue, TreePntr->valueType, 1);
+      if (!Successful)
+        return false; /* The user requested an early abort. */
+      continue;
+    }
+
+    if (++StepsInEpoch >= ITERATION_STEPS_PER_EPOCH &&
+    CopyNodeKeyValue (TreePntr, NodePntr, &CopiedKey, &CopiedValue))
+    {
+      /* Time to let the retired nodes go.  Find this node again (or the
+      one after it, if it was deleted meanwhile) in a new epoch.  If the
+      copy ran out of memory this just gets tried again next time. */
+
+      LeaveOperation (TreePntr, &Arguments);
+      EnterOperation (TreePntr, &Arguments);
+      Arguments.hasLowerBound = true;
+      Arguments.userKey = CopiedKey;
+      Arguments.userValue = CopiedValue;
+      Arguments.userValueWasNULL = false;
+      Arguments.includeThingEqualToStart = true;
+      NodePntr = FindCeiling (&Arguments);
+      AVLDupFreeThingArray (&CopiedKey, TreePntr->keyType, 1);
+      AVLDupFreeThingArray (&CopiedValue, TreePntr->valueType, 1);
+      StepsInEpoch = 0;
+      continue;
+    }
+
+    if (!CallbackFunctionPntr (&NodePntr->key, &NodePntr->value,
+    ExtraUserData))
+    {
+      Successful = false; /* The user requested an early abort. */
+      break;
+    }
+
+    NodePntr = FindNextNode (&Arguments, NodePntr);
+  }
+
+  LeaveOperation (TreePntr, &Arguments);
+  if (HoldingSlot)
+    atomic_add (&TreePntr->iterationsHoldingSlots, -1);
+
+  return Successful;
+}
@@ -0,0 +1,516 @@
+/******************************************************************************
+ * AVLDupContention.c
+ *
+ * An optional profiler for the tree's access semaphore, so that you can find
+ * out how much the readers and writers get in each other's way.  It's meant
+ * for sizing MaxSimultaneousReaders and deciding whether an index should be
+ * split into several trees, based on measurements rather than guesses.
+ *
+ * Readers and writers are counted separately.  Each time the lock is
+ * wanted, it is first tried without waiting.  If that works then it just
+ * counts as an uncontended acquisition, otherwise the time spent waiting for
+ * the lock is measured and added to the totals.  A writer which waits longer
+ * than the starvation threshold also counts as a writer starvation event,
+ * which is usually a sign of long running iterations blocking the writers.
+ * The time each operation holds the lock is measured too, and the longest
+ * ones are remembered along with the kind of operation and how many items it
+ * touched (for iterations, the number of callbacks, which is counted even
+ * when the statistics are compiled out).
+ *
+ * Only the main operations go through the profiled lock functions in this
+ * file: adding, deleting, the various iterations, batched lookups and bulk
+ * adds.  Some rarely used operations (saving, log checkpoints) still lock
+ * the tree directly.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Writers waiting longer than this (in microseconds) count as starved, unless
+the user asks for some other threshold. */
+
+#define DEFAULT_STARVATION_THRESHOLD 100000
+
+
+/* Lock wait counts while they are being recorded into.  int64 so that they
+can be updated with the atomic functions. */
+
+typedef struct LiveWaitStruct
+{
+  int64 acquisitions;
+  int64 contendedAcquisitions;
+  int64 totalWaitTime;
+  int64 maximumWaitTime;
+} LiveWaitRecord, *LiveWaitPointer;
+
+
+/* The contention information for a tree.  Like the latency histograms, it
+stays around until the tree is freed once it has been turned on.  The list
+of longest holders is kept sorted, longest first, and is protected by its
+own semaphore.  shortestListedTime lets most operations skip that semaphore
+when they obviously won't make it into a full list. */
+
+struct AVLDupContentionStruct
+{
+  int32                  enabled;
+  int64                  resetTime;
+  bigtime_t              starvationThreshold;
+  LiveWaitRecord         readers;
+  LiveWaitRecord         writers;
+  int64                  starvationEvents;
+  sem_id                 holdersSemaphoreID;
+  int64                  shortestListedTime;
+  uint32                 numberOfHolders;
+  AVLDupLockHolderRecord longestHolders [AVLDUP_CONTENTION_HOLDERS];
+};
+
+
+
+static void RaiseMaximum (int64 *MaximumPntr, int64 NewValue)
+{
+  int64 OldMaximum;
+
+  OldMaximum = atomic_get64 (MaximumPntr);
+  while (NewValue > OldMaximum)
+    OldMaximum = atomic_test_and_set64 (MaximumPntr, NewValue, OldMaximum);
+}
+
+
+
+/* Adds a lock holding time to the list of longest holders, if it is long
+enough to be in it. */
+
+static void RecordHolder (
+  AVLDupContentionPointer ContentionPntr,
+  AVLDupHeldLockPointer   HeldPntr,
+  bigtime_t               HeldTime,
+  const char             *OperationName,
+  uint32                  RangeSize)
+{
+  int                    i;
+  AVLDupLockHolderRecord NewHolder;
+
+  if (ContentionPntr->numberOfHolders >= AVLDUP_CONTENTION_HOLDERS &&
+  HeldTime <= atomic_get64 (&ContentionPntr->shortestListedTime))
+    return; /* Not a contender, don't bother locking the list. */
+
+  if (acquire_sem (ContentionPntr->holdersSemaphoreID) != B_OK)
+    return;
+
+  /* Find where it goes in the list, shifting shorter ones down a place and
+  dropping the shortest one if the list is full. */
+
+  i = ContentionPntr->numberOfHolders;
+  if (i < AVLDUP_CONTENTION_HOLDERS)
+    ContentionPntr->numberOfHolders++;
+  else if (HeldTime > ContentionPntr->longestHolders[i - 1].heldTime)
+    i--;
+  else
+    goto Done; /* Another thread got in a longer one in the meantime. */
+
+  while (i > 0 && ContentionPntr->longestHolders[i - 1].heldTime < HeldTime)
+  {
+    ContentionPntr->longestHolders[i] = ContentionPntr->longestHolders[i - 1];
+    i--;
+  }
+
+  NewHolder.operationName = OperationName;
+  NewHolder.isWriter = HeldPntr->isWriter;
+  NewHolder.lockedTime = HeldPntr->lockedTime;
+  NewHolder.heldTime = HeldTime;
+  NewHolder.rangeSize = RangeSize;
+  NewHolder.threadID = find_thread (NULL);
+  ContentionPntr->longestHolders[i] = NewHolder;
+
+  if (ContentionPntr->numberOfHolders >= AVLDUP_CONTENTION_HOLDERS)
+    atomic_set64 (&ContentionPntr->shortestListedTime,
+      ContentionPntr->longestHolders[AVLDUP_CONTENTION_HOLDERS - 1].heldTime);
+
+Done:
+  release_sem (ContentionPntr->holdersSemaphoreID);
+}
+
+
+
+/* Locks the tree for reading or writing, the same way as the other functions
+do it directly, but also recording how long it had to wait if contention
+profiling is turned on.  HeldPntr is filled in with what AVLDupReleaseAccess
+needs to know.  Returns B_OK if it got the lock (or the tree doesn't have
+one), or the error from acquire_sem_etc. */
+
+status_t AVLDupAcquireAccess (
+  AVLDupTreePointer     TreePntr,
+  bool                  IsWriter,
+  AVLDupHeldLockPointer HeldPntr)
+{
+  AVLDupContentionPointer ContentionPntr;
+  status_t                ErrorCode;
+  bigtime_t               StartTime;
+  int32                   Units;
+  bigtime_t               WaitTime;
+  LiveWaitPointer         WaitPntr;
+
+  HeldPntr->contentionPntr = NULL;
+  HeldPntr->isWriter = IsWriter;
+
+  if (TreePntr->accessSemaphoreID < 0)
+    return B_OK;
+
+  Units = IsWriter ? TreePntr->maxSimultaneousReaders : 1;
+  AVLDUP_TRACE2 (lock__acquire, TreePntr, IsWriter ? 1 : 0);
+
+  ContentionPntr = TreePntr->contentionPntr;
+  if (ContentionPntr == NULL || !ContentionPntr->enabled)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID, Units, 0, 0);
+    if (ErrorCode == B_OK)
+      AVLDUP_TRACE2 (lock__acquired, TreePntr, IsWriter ? 1 : 0);
+    return ErrorCode;
+  }
+
+  /* Try to get it without waiting first, so that uncontended acquisitions
+  just cost an extra counter update. */
+
+  WaitPntr = IsWriter ? &ContentionPntr->writers : &ContentionPntr->readers;
+
+  ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID, Units,
+    B_RELATIVE_TIMEOUT, 0);
+
+  if (ErrorCode == B_WOULD_BLOCK || ErrorCode == B_TIMED_OUT)
+  {
+    StartTime = system_time ();
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID, Units, 0, 0);
+    if (ErrorCode != B_OK)
+      return ErrorCode;
+    WaitTime = system_time () - StartTime;
+
+    atomic_add64 (&WaitPntr->contendedAcquisitions, 1);
+    atomic_add64 (&WaitPntr->totalWaitTime, WaitTime);
+    RaiseMaximum (&WaitPntr->maximumWaitTime, WaitTime);
+    if (IsWriter && WaitTime >= ContentionPntr->starvationThreshold)
+      atomic_add64 (&ContentionPntr->starvationEvents, 1);
+  }
+  else if (ErrorCode != B_OK)
+    return ErrorCode; /* Semaphore was deleted or a signal interrupted us. */
+
+  atomic_add64 (&WaitPntr->acquisitions, 1);
+  AVLDUP_TRACE2 (lock__acquired, TreePntr, IsWriter ? 1 : 0);
+
+  HeldPntr->contentionPntr = ContentionPntr;
+  HeldPntr->lockedTime = system_time ();
+  return B_OK;
+}
+
+
+
+/* Unlocks the tree after AVLDupAcquireAccess.  OperationName (a string
+constant, since only the pointer is kept) and RangeSize describe what was
+done while holding the lock, for the list of longest holders. */
+
+void AVLDupReleaseAccess (
+  AVLDupTreePointer     TreePntr,
+  AVLDupHeldLockPointer HeldPntr,
+  const char           *OperationName,
+  uint32                RangeSize)
+{
+  bigtime_t HeldTime;
+
+  if (TreePntr->accessSemaphoreID < 0)
+    return;
+
+  AVLDUP_TRACE2 (lock__release, TreePntr, HeldPntr->isWriter ? 1 : 0);
+  release_sem_etc (TreePntr->accessSemaphoreID,
+    HeldPntr->isWriter ? TreePntr->maxSimultaneousReaders : 1,
+    B_DO_NOT_RESCHEDULE);
+
+  if (HeldPntr->contentionPntr != NULL)
+  {
+    HeldTime = system_time () - HeldPntr->lockedTime;
+    RecordHolder (HeldPntr->contentionPntr, HeldPntr, HeldTime,
+      OperationName, RangeSize);
+  }
+}
+
+
+
+/* Deallocates the contention record, used when the tree is freed. */
+
+void AVLDupFreeContention (AVLDupContentionPointer ContentionPntr)
+{
+  if (ContentionPntr == NULL)
+    return;
+
+  if (ContentionPntr->holdersSemaphoreID >= 0)
+    delete_sem (ContentionPntr->holdersSemaphoreID);
+  free (ContentionPntr);
+}
+
+
+
+/* Turns contention profiling on or off for a tree.  StarvationThreshold is
+how long (in microseconds) a writer has to wait before it counts as a
+starvation event, use zero for the default of a tenth of a second.  Turning
+it on again later continues with the existing counts, but with the new
+threshold.  Returns FALSE if it ran out of memory or couldn't lock the tree,
+or if the tree has no lock (MaxSimultaneousReaders was zero) so there's
+nothing to profile. */
+
+bool AVLDupEnableContentionProfiling (
+  AVLDupTreePointer TreePntr,
+  bool Enable,
+  bigtime_t StarvationThreshold)
+{
+  status_t                ErrorCode;
+  AVLDupContentionPointer NewContentionPntr;
+
+  if (TreePntr == NULL || TreePntr->accessSemaphoreID < 0)
+    return false;
+
+  if (StarvationThreshold <= 0)
+    StarvationThreshold = DEFAULT_STARVATION_THRESHOLD;
+
+  if (TreePntr->contentionPntr == NULL)
+  {
+    if (!Enable)
+      return true; /* Never turned on, nothing to do. */
+
+    NewContentionPntr = calloc (1, sizeof (AVLDupContentionRecord));
+    if (NewContentionPntr == NULL)
+      return false;
+    NewContentionPntr->resetTime = system_time ();
+    NewContentionPntr->holdersSemaphoreID =
+      create_sem (1, "AVLDupTree Lock Holders");
+    if (NewContentionPntr->holdersSemaphoreID < 0)
+    {
+      free (NewContentionPntr);
+      return false;
+    }
+
+    /* Install it while holding the writer lock, so that no operations are
+    in progress when the pointer changes. */
+
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+    {
+      AVLDupFreeContention (NewContentionPntr);
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+    }
+
+    if (TreePntr->contentionPntr == NULL)
+      TreePntr->contentionPntr = NewContentionPntr;
+    else /* Some other thread beat us to it. */
+      AVLDupFreeContention (NewContentionPntr);
+
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+
+  TreePntr->contentionPntr->starvationThreshold = StarvationThreshold;
+  atomic_set (&TreePntr->contentionPntr->enabled, Enable ? 1 : 0);
+  return true;
+}
+
+
+
+static void CopyWaits (
+  LiveWaitPointer           LivePntr,
+  AVLDupLockWaitStatsPointer CopyPntr,
+  bool                      Reset)
+{
+  if (Reset)
+  {
+    CopyPntr->acquisitions = atomic_get_and_set64 (&LivePntr->acquisitions, 0);
+    CopyPntr->contendedAcquisitions =
+      atomic_get_and_set64 (&LivePntr->contendedAcquisitions, 0);
+    CopyPntr->totalWaitTime =
+      atomic_get_and_set64 (&LivePntr->totalWaitTime, 0);
+    CopyPntr->maximumWaitTime =
+      atomic_get_and_set64 (&LivePntr->maximumWaitTime, 0);
+  }
+  else
+  {
+    CopyPntr->acquisitions = atomic_get64 (&LivePntr->acquisitions);
+    CopyPntr->contendedAcquisitions =
+      atomic_get64 (&LivePntr->contendedAcquisitions);
+    CopyPntr->totalWaitTime = atomic_get64 (&LivePntr->totalWaitTime);
+    CopyPntr->maximumWaitTime = atomic_get64 (&LivePntr->maximumWaitTime);
+  }
+}
+
+
+
+/* Copies the tree's contention measurements into the user provided snapshot
+record, and optionally starts them over.  Doesn't need to lock the tree.
+Returns FALSE if contention profiling was never turned on for the tree. */
+
+bool AVLDupGetContentionSnapshot (
+  AVLDupTreePointer TreePntr,
+  AVLDupContentionSnapshotPointer SnapshotPntr,
+  bool ResetAfterwards)
+{
+  AVLDupContentionPointer ContentionPntr;
+
+  if (TreePntr == NULL || SnapshotPntr == NULL)
+    return false;
+
+  ContentionPntr = TreePntr->contentionPntr;
+  if (ContentionPntr == NULL)
+    return false;
+
+  memset (SnapshotPntr, 0, sizeof (AVLDupContentionSnapshotRecord));
+
+  SnapshotPntr->endTime = system_time ();
+  if (ResetAfterwards)
+    SnapshotPntr->startTime = atomic_get_and_set64 (&ContentionPntr->resetTime,
+      SnapshotPntr->endTime);
+  else
+    SnapshotPntr->startTime = atomic_get64 (&ContentionPntr->resetTime);
+
+  CopyWaits (&ContentionPntr->readers, &SnapshotPntr->readers,
+    ResetAfterwards);
+  CopyWaits (&ContentionPntr->writers, &SnapshotPntr->writers,
+    ResetAfterwards);
+  SnapshotPntr->starvationThreshold = ContentionPntr->starvationThreshold;
+  SnapshotPntr->starvationEvents = ResetAfterwards ?
+    atomic_get_and_set64 (&ContentionPntr->starvationEvents, 0) :
+    atomic_get64 (&ContentionPntr->starvationEvents);
+
+  if (acquire_sem (ContentionPntr->holdersSemaphoreID) == B_OK)
+  {
+    SnapshotPntr->numberOfHolders = ContentionPntr->numberOfHolders;
+    memcpy (SnapshotPntr->longestHolders, ContentionPntr->longestHolders,
+      ContentionPntr->numberOfHolders * sizeof (AVLDupLockHolderRecord));
+    if (ResetAfterwards)
+    {
+      ContentionPntr->numberOfHolders = 0;
+      atomic_set64 (&ContentionPntr->shortestListedTime, 0);
+    }
+    release_sem (ContentionPntr->holdersSemaphoreID);
+  }
+
+  return true;
+}
+
+
+
+static void PrintJSONWaits (
+  const char *Name,
+  AVLDupLockWaitStatsPointer WaitsPntr,
+  FILE *OutputFile)
+{
+  fprintf (OutputFile, "\"%s\": {\"acquisitions\": %llu, \"contended\": %llu, "
+    "\"totalWait\": %lld, \"maxWait\": %lld}", Name,
+    (unsigned long long) WaitsPntr->acquisitions,
+    (unsigned long long) WaitsPntr->contendedAcquisitions,
+    (long long) WaitsPntr->totalWaitTime,
+    (long long) WaitsPntr->maximumWaitTime);
+}
+
+
+
+static void PrintTextWaits (
+  const char *Name,
+  AVLDupLockWaitStatsPointer WaitsPntr,
+  FILE *OutputFile)
+{
+  fprintf (OutputFile, "%-8s %12llu %12llu %14lld %12.1f %12lld\n", Name,
+    (unsigned long long) WaitsPntr->acquisitions,
+    (unsigned long long) WaitsPntr->contendedAcquisitions,
+    (long long) WaitsPntr->totalWaitTime,
+    (WaitsPntr->contendedAcquisitions == 0) ? 0.0 :
+      (double) WaitsPntr->totalWaitTime / WaitsPntr->contendedAcquisitions,
+    (long long) WaitsPntr->maximumWaitTime);
+}
+
+
+
+/* Prints out a contention snapshot, as a table or as a JSON object.  The
+IndexName (from AVLDupGetTreeName, can be NULL) labels the output so that
+the reports from several trees can be told apart.  Times are in
+microseconds.  Returns FALSE if there was an error writing. */
+
+bool AVLDupPrintContentionSnapshot (
+  AVLDupContentionSnapshotPointer SnapshotPntr,
+  const char *IndexName,
+  bool AsJSON,
+  FILE *OutputFile)
+{
+  AVLDupLockHolderPointer HolderPntr;
+  uint32                  i;
+  double                  Seconds;
+
+  if (SnapshotPntr == NULL || OutputFile == NULL)
+    return false;
+
+  Seconds = (SnapshotPntr->endTime - SnapshotPntr->startTime) / 1000000.0;
+
+  if (AsJSON)
+  {
+    fprintf (OutputFile, "{\"index\": ");
+    if (IndexName == NULL)
+      fprintf (OutputFile, "null");
+    else
+      AVLDupPrintJSONString (IndexName, OutputFile);
+    fprintf (OutputFile, ", \"seconds\": %.3f,\n  ", Seconds);
+    PrintJSONWaits ("readers", &SnapshotPntr->readers, OutputFile);
+    fprintf (OutputFile, ",\n  ");
+    PrintJSONWaits ("writers", &SnapshotPntr->writers, OutputFile);
+    fprintf (OutputFile, ",\n  \"starvationThreshold\": %lld, "
+      "\"starvationEvents\": %llu,\n  \"longestHolders\": [",
+      (long long) SnapshotPntr->starvationThreshold,
+      (unsigned long long) SnapshotPntr->starvationEvents);
+
+    for (i = 0; i < SnapshotPntr->numberOfHolders; i++)
+    {
+      HolderPntr = SnapshotPntr->longestHolders + i;
+      fprintf (OutputFile, "%s\n    {\"operation\": \"%s\", \"writer\": %s, "
+        "\"held\": %lld, \"rangeSize\": %lu, \"thread\": %ld}",
+        (i == 0) ? "" : ",", HolderPntr->operationName,
+        HolderPntr->isWriter ? "true" : "false",
+        (long long) HolderPntr->heldTime,
+        (unsigned long) HolderPntr->rangeSize,
+        (long) HolderPntr->threadID);
+    }
+
+    fprintf (OutputFile, "]}\n");
+  }
+  else
+  {
+    fprintf (OutputFile, "Lock contention for %s over %.3f seconds, "
+      "in microseconds:\n",
+      (IndexName == NULL) ? "unnamed tree" : IndexName, Seconds);
+    fprintf (OutputFile, "%-8s %12s %12s %14s %12s %12s\n", "Lock",
+      "Acquired", "Contended", "Total wait", "Mean wait", "Max wait");
+    PrintTextWaits ("readers", &SnapshotPntr->readers, OutputFile);
+    PrintTextWaits ("writers", &SnapshotPntr->writers, OutputFile);
+    fprintf (OutputFile, "Writer starvation events (waits of %lld or more): "
+      "%llu\n", (long long) SnapshotPntr->starvationThreshold,
+      (unsigned long long) SnapshotPntr->starvationEvents);
+
+    if (SnapshotPntr->numberOfHolders > 0)
+      fprintf (OutputFile, "Longest lock holders:\n");
+    for (i = 0; i < SnapshotPntr->numberOfHolders; i++)
+    {
+      HolderPntr = SnapshotPntr->longestHolders + i;
+      fprintf (OutputFile, "  %10lld %-20s %-6s %10lu items, thread %ld\n",
+        (long long) HolderPntr->heldTime, HolderPntr->operationName,
+        HolderPntr->isWriter ? "writer" : "reader",
+        (unsigned long) HolderPntr->rangeSize, (long) HolderPntr->threadID);
+    }
+  }
+
+  return !ferror (OutputFile);
+}
@@ -0,0 +1,893 @@
+/******************************************************************************
+ * AVLDupFile.c
+ *
+ * Saving an AVLDupTree to a file and loading it back again, so that an index
+ * doesn't have to be rebuilt from scratch one AVLDupAdd at a time every time
+ * the program starts up.
+ *
+ * The file format is described in AVLDupTreePrivate.h.  Briefly, there is a
+ * header with the key and value types and the number of entries, the index
+ * name, a section with all the long strings, and then the key/value entries
+ * in sorted order, 16 bytes each.  Everything is little endian so that files
+ * can be moved between machines.  Since the entries are already sorted,
+ * loading doesn't need to do any searching or rebalancing - the nodes are
+ * read one at a time and assembled directly into a balanced tree, in time
+ * proportional to the number of entries.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <ByteOrder.h>
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Number of entries read or written with each call to the stdio library. */
+
+#define ENTRY_BUFFER_SIZE 512
+
+
+/* Rounds a file position up to the next multiple of 8. */
+
+#define ALIGN_TO_8(x) (((x) + 7) & ~(uint64) 7)
+
+
+/* State kept while saving a tree. */
+
+typedef struct SaveStateStruct
+{
+  AVLDupTreePointer     treePntr;
+  FILE                 *filePntr;
+  uint64                stringsSize; /* Strings written or counted so far. */
+  AVLDupFileEntryRecord entryBuffer [ENTRY_BUFFER_SIZE];
+  uint32                entriesInBuffer;
+  bool                  failed;
+} SaveStateRecord, *SaveStatePointer;
+
+
+/* State kept while loading a tree. */
+
+typedef struct LoadStateStruct
+{
+  AVLDupTreePointer     treePntr;
+  FILE                 *filePntr;
+  char                 *stringsPntr; /* The whole string section. */
+  uint64                stringsSize;
+  uint32                entriesLeftInFile;
+  AVLDupFileEntryRecord entryBuffer [ENTRY_BUFFER_SIZE];
+  uint32                entriesInBuffer;
+  uint32                nextEntryInBuffer;
+  AVLDupFileEntryPointer allEntriesPntr; /* For Eytzinger order files. */
+  uint32                nextEytzingerIndex;
+  uint32                count;
+  AVLDupNodePointer     previousNode; /* For checking the sort order. */
+  bool                  failed;
+} LoadStateRecord, *LoadStatePointer;
+
+
+
+/* Returns the length of the string in a string thing. */
+
+static size_t StringThingLength (AVLDupThingPointer ThingPntr)
+{
+  return strlen (AVLDupGetStringPntrFromThing (*ThingPntr));
+}
+
+
+
+/* Converts a thing from the tree into the file format.  Long strings get the
+given offset into the string section, the caller takes care of writing the
+string itself there. */
+
+static void EncodeFileThing (
+  AVLDupThingPointer ThingPntr,
+  type_code ThingType,
+  uint64 StringOffset,
+  AVLDupFileThingPointer FileThingPntr)
+{
+  uint32      Bits32;
+  uint64      Bits64;
+  const char *StringPntr;
+
+  FileThingPntr->int64Thing = 0;
+
+  switch (ThingType)
+  {
+    case B_INT32_TYPE:
+      FileThingPntr->int32Thing =
+        B_HOST_TO_LENDIAN_INT32 (ThingPntr->int32Thing);
+      break;
+
+    case B_FLOAT_TYPE:
+      memcpy (&Bits32, &ThingPntr->floatThing, sizeof (Bits32));
+      FileThingPntr->int32Thing = B_HOST_TO_LENDIAN_INT32 (Bits32);
+      break;
+
+    case B_INT64_TYPE:
+      FileThingPntr->int64Thing =
+        B_HOST_TO_LENDIAN_INT64 (ThingPntr->int64Thing);
+      break;
+
+    case B_DOUBLE_TYPE:
+      memcpy (&Bits64, &ThingPntr->doubleThing, sizeof (Bits64));
+      FileThingPntr->int64Thing = B_HOST_TO_LENDIAN_INT64 (Bits64);
+      break;
+
+    case B_STRING_TYPE:
+      StringPntr = AVLDupGetStringPntrFromThing (*ThingPntr);
+      if (strlen (StringPntr) < sizeof (FileThingPntr->shortStringThing))
+        strcpy (FileThingPntr->shortStringThing, StringPntr);
+      else
+      {
+        FileThingPntr->longStringThing.stringOffset =
+          B_HOST_TO_LENDIAN_INT32 ((uint32) StringOffset);
+        FileThingPntr->longStringThing.isLongString = 1;
+      }
+      break;
+  }
+}
+
+
+
+/* Converts a thing from the file format into a thing which can be passed to
+the tree functions.  Long strings are not copied, the resulting thing points
+into the string section, so you'll need to use AVLDupCopyThingArray if you
+want to keep it around for longer than the string section.  Returns FALSE if
+the thing is damaged (string offset outside the string section). */
+
+bool AVLDupDecodeFileThing (
+  const AVLDupFileThingRecord *FileThingPntr,
+  type_code ThingType,
+  const char *StringsPntr,
+  uint64 StringsSize,
+  AVLDupThingPointer ThingPntr)
+{
+  uint32 Bits32;
+  uint64 Bits64;
+  uint32 StringOffset;
+
+  memset (ThingPntr, 0, sizeof (AVLDupThingRecord));
+
+  switch (ThingType)
+  {
+    case B_INT32_TYPE:
+      ThingPntr->int32Thing =
+        B_LENDIAN_TO_HOST_INT32 (FileThingPntr->int32Thing);
+      return true;
+
+    case B_FLOAT_TYPE:
+      Bits32 = B_LENDIAN_TO_HOST_INT32 (FileThingPntr->int32Thing);
+      memcpy (&ThingPntr->floatThing, &Bits32, sizeof (Bits32));
+      return true;
+
+    case B_INT64_TYPE:
+      ThingPntr->int64Thing =
+        B_LENDIAN_TO_HOST_INT64 (FileThingPntr->int64Thing);
+      return true;
+
+    case B_DOUBLE_TYPE:
+      Bits64 = B_LENDIAN_TO_HOST_INT64 (FileThingPntr->int64Thing);
+      memcpy (&ThingPntr->doubleThing, &Bits64, sizeof (Bits64));
+      return true;
+
+    case B_STRING_TYPE:
+      if (FileThingPntr->longStringThing.isLongString)
+      {
+        StringOffset =
+          B_LENDIAN_TO_HOST_INT32 (FileThingPntr->longStringThing.stringOffset);
+        if (StringOffset >= StringsSize)
+          return false;
+        ThingPntr->longStringThing.stringPntr =
+          (char *) StringsPntr + StringOffset;
+        ThingPntr->longStringThing.isLongString = true;
+      }
+      else
+        memcpy (ThingPntr->shortStringThing, FileThingPntr->shortStringThing,
+          sizeof (FileThingPntr->shortStringThing));
+      return true;
+  }
+
+  return false;
+}
+
+
+
+/* Converts a header read from a file to the host byte order, and checks that
+it looks like one of our files with sections that make sense.  Returns FALSE
+if it isn't.  The offsets and sizes come from a file which could be damaged
+or made up, so each is checked against what is left of the file before it
+is used, rather than adding them together first, since a huge value could
+make the sum wrap around to something which looks fine. */
+
+bool AVLDupDecodeFileHeader (
+  const AVLDupFileHeaderRecord *FileHeaderPntr,
+  AVLDupFileHeaderPointer HeaderPntr)
+{
+  uint64 EntriesSize;
+
+  HeaderPntr->magic = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->magic);
+  HeaderPntr->version = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->version);
+  HeaderPntr->flags = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->flags);
+  HeaderPntr->keyType = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->keyType);
+  HeaderPntr->valueType = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->valueType);
+  HeaderPntr->count = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->count);
+  HeaderPntr->nameLength = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->nameLength);
+  HeaderPntr->collation = B_LENDIAN_TO_HOST_INT32 (FileHeaderPntr->collation);
+  HeaderPntr->stringsOffset =
+    B_LENDIAN_TO_HOST_INT64 (FileHeaderPntr->stringsOffset);
+  HeaderPntr->stringsSize =
+    B_LENDIAN_TO_HOST_INT64 (FileHeaderPntr->stringsSize);
+  HeaderPntr->entriesOffset =
+    B_LENDIAN_TO_HOST_INT64 (FileHeaderPntr->entriesOffset);
+  HeaderPntr->fileSize = B_LENDIAN_TO_HOST_INT64 (FileHeaderPntr->fileSize);
+
+  if (HeaderPntr->magic != AVLDUP_FILE_MAGIC ||
+  HeaderPntr->version != AVLDUP_FILE_VERSION ||
+  (HeaderPntr->flags & ~AVLDUP_FILE_FLAG_EYTZINGER_ORDER) != 0)
+    return false;
+
+  /* The name comes right after the header, then the strings, then the
+  entries, which go all the way to the end of the file. */
+
+  if (HeaderPntr->stringsOffset < sizeof (AVLDupFileHeaderRecord) +
+  (uint64) HeaderPntr->nameLength + 1 ||
+  HeaderPntr->stringsOffset > HeaderPntr->fileSize ||
+  HeaderPntr->stringsSize > HeaderPntr->fileSize - HeaderPntr->stringsOffset)
+    return false;
+
+  if (HeaderPntr->entriesOffset < HeaderPntr->stringsOffset ||
+  HeaderPntr->entriesOffset - HeaderPntr->stringsOffset <
+  HeaderPntr->stringsSize ||
+  HeaderPntr->entriesOffset > HeaderPntr->fileSize)
+    return false;
+
+  EntriesSize = HeaderPntr->fileSize - HeaderPntr->entriesOffset;
+  if (HeaderPntr->count > EntriesSize / sizeof (AVLDupFileEntryRecord) ||
+  EntriesSize != HeaderPntr->count * sizeof (AVLDupFileEntryRecord))
+    return false;
+
+  return true;
+}
+
+
+
+/* Writes out some bytes, remembering if it failed. */
+
+static void WriteBytes (
+  SaveStatePointer StatePntr,
+  const void *BufferPntr,
+  size_t NumberOfBytes)
+{
+  if (StatePntr->failed || NumberOfBytes == 0)
+    return;
+
+  if (fwrite (BufferPntr, NumberOfBytes, 1, StatePntr->filePntr) != 1)
+    StatePntr->failed = true;
+}
+
+
+
+/* Writes zero bytes until the file position is a multiple of 8. */
+
+static void WritePadding (
+  SaveStatePointer StatePntr,
+  uint64 CurrentPosition)
+{
+  static const char Zeroes [8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+  WriteBytes (StatePntr, Zeroes,
+    ALIGN_TO_8 (CurrentPosition) - CurrentPosition);
+}
+
+
+
+/* Does the part of the save job selected by WhatToDo for one node: 0 to add
+up the size of the string section, 1 to write out the string section, 2 to
+write out the entries (which have to be in the same order as the strings, so
+that the string offsets match). */
+
+static void SaveOneNode (
+  SaveStatePointer StatePntr,
+  AVLDupNodePointer CurrentNode,
+  int WhatToDo)
+{
+  AVLDupFileEntryPointer EntryPntr;
+  size_t                 Length;
+  AVLDupTreePointer      TreePntr;
+
+  TreePntr = StatePntr->treePntr;
+
+  if (WhatToDo == 2)
+  {
+    EntryPntr = StatePntr->entryBuffer + StatePntr->entriesInBuffer;
+    EncodeFileThing (&CurrentNode->key, TreePntr->keyType,
+      StatePntr->stringsSize, &EntryPntr->key);
+    if (TreePntr->keyType == B_STRING_TYPE &&
+    EntryPntr->key.longStringThing.isLongString)
+      StatePntr->stringsSize += StringThingLength (&CurrentNode->key) + 1;
+    EncodeFileThing (&CurrentNode->value, TreePntr->valueType,
+      StatePntr->stringsSize, &EntryPntr->value);
+    if (TreePntr->valueType == B_STRING_TYPE &&
+    EntryPntr->value.longStringThing.isLongString)
+      StatePntr->stringsSize += StringThingLength (&CurrentNode->value) + 1;
+
+    if (++StatePntr->entriesInBuffer >= ENTRY_BUFFER_SIZE)
+    {
+      WriteBytes (StatePntr, StatePntr->entryBuffer,
+        StatePntr->entriesInBuffer * sizeof (AVLDupFileEntryRecord));
+      StatePntr->entriesInBuffer = 0;
+    }
+  }
+  else /* Doing strings. */
+  {
+    if (TreePntr->keyType == B_STRING_TYPE)
+    {
+      Length = StringThingLength (&CurrentNode->key);
+      if (Length >= sizeof (AVLDupFileThingRecord))
+      {
+        if (WhatToDo == 1)
+          WriteBytes (StatePntr,
+            AVLDupGetStringPntrFromThing (CurrentNode->key), Length + 1);
+        StatePntr->stringsSize += Length + 1;
+      }
+    }
+    if (TreePntr->valueType == B_STRING_TYPE)
+    {
+      Length = StringThingLength (&CurrentNode->value);
+      if (Length >= sizeof (AVLDupFileThingRecord))
+      {
+        if (WhatToDo == 1)
+          WriteBytes (StatePntr,
+            AVLDupGetStringPntrFromThing (CurrentNode->value), Length + 1);
+        StatePntr->stringsSize += Length + 1;
+      }
+    }
+  }
+}
+
+
+
+/* Goes through the tree in order, doing SaveOneNode for each node. */
+
+static void RecursivelySaveNodes (
+  SaveStatePointer StatePntr,
+  AVLDupNodePointer CurrentNode,
+  int WhatToDo)
+{
+  while (CurrentNode != NULL && !StatePntr->failed)
+  {
+    RecursivelySaveNodes (StatePntr, CurrentNode->smallerChildPntr, WhatToDo);
+    SaveOneNode (StatePntr, CurrentNode, WhatToDo);
+    CurrentNode = CurrentNode->largerChildPntr;
+  }
+}
+
+
+
+/* Goes through the nodes in Eytzinger order (see AVLDupFirstEytzingerIndex),
+doing SaveOneNode for each one. */
+
+static void SaveNodesInEytzingerOrder (
+  SaveStatePointer StatePntr,
+  AVLDupNodePointer *EytzingerNodeArray,
+  int WhatToDo)
+{
+  uint32 i;
+
+  for (i = 0; i < StatePntr->treePntr->count && !StatePntr->failed; i++)
+    SaveOneNode (StatePntr, EytzingerNodeArray[i], WhatToDo);
+}
+
+
+
+/* In an Eytzinger layout (named after Michael Eytzinger, who used it for
+genealogy in the 1500s, and also used for heaps), a balanced binary tree is
+stored in an array breadth first: the root is at index 1 and the children of
+the entry at index K are at 2K and 2K+1.  Searching only needs index
+arithmetic, and the first few levels of the tree, which every search goes
+through, are packed together at the start of the array where they stay in the
+cache.  These functions give the 1-based index of the smallest entry and the
+next larger entry after a given index (zero after the last one), for going
+through a layout of Count entries in sorted order. */
+
+uint32 AVLDupFirstEytzingerIndex (uint32 Count)
+{
+  uint64 Index;
+
+  if (Count == 0)
+    return 0;
+
+  for (Index = 1; Index * 2 <= Count; Index *= 2)
+    ; /* Keep going to the left. */
+
+  return (uint32) Index;
+}
+
+
+uint32 AVLDupNextEytzingerIndex (
+  uint32 Index,
+  uint32 Count)
+{
+  uint64 NextIndex;
+
+  if ((uint64) Index * 2 + 1 <= Count)
+  {
+    /* Smallest entry in the right subtree. */
+
+    NextIndex = (uint64) Index * 2 + 1;
+    while (NextIndex * 2 <= Count)
+      NextIndex *= 2;
+    return (uint32) NextIndex;
+  }
+
+  /* Go up until we come from a left child, that parent is next.  Coming out
+  of the rightmost entry ends up at zero. */
+
+  while (Index & 1)
+    Index >>= 1;
+  return Index >> 1;
+}
+
+
+
+/* Does the work for AVLDupSaveTree and AVLDupSaveTreeForMapping.  If
+LockTree is FALSE the caller already has the tree locked.  If SyncToDisk is
+TRUE the file is forced to disk before it replaces the old one. */
+
+static bool SaveTreeWithFlags (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName,
+  uint32 Flags,
+  bool LockTree,
+  bool SyncToDisk)
+{
+  status_t               ErrorCode;
+  AVLDupNodePointer     *EytzingerNodeArray;
+  uint32                 i;
+  uint32                 Index;
+  AVLDupFileHeaderRecord Header;
+  size_t                 NameLength;
+  const char            *NamePntr;
+  AVLDupNodePointer     *SortedNodeArray;
+  SaveStatePointer       StatePntr;
+  bool                   Successful;
+  bool                   TempFileCreated;
+  char                  *TempPathName;
+
+  if (TreePntr == NULL || FilePathName == NULL)
+    return false;
+
+  Successful = false;
+  EytzingerNodeArray = NULL;
+  TempFileCreated = false;
+  TempPathName = NULL;
+
+  TempPathName = malloc (strlen (FilePathName) + 5);
+  StatePntr = malloc (sizeof (SaveStateRecord));
+  if (TempPathName == NULL || StatePntr == NULL)
+    goto ExitWithoutLock;
+  strcpy (TempPathName, FilePathName);
+  strcat (TempPathName, ".tmp");
+
+  memset (StatePntr, 0, sizeof (SaveStateRecord));
+  StatePntr->treePntr = TreePntr;
+  StatePntr->filePntr = fopen (TempPathName, "wb");
+  if (StatePntr->filePntr == NULL)
+    goto ExitWithoutLock;
+  TempFileCreated = true;
+
+  if (LockTree && TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      1 /* we are a reader, grab just 1 unit */, 0, 0);
+    if (ErrorCode < 0)
+      goto ExitWithoutLock; /* Semaphore was deleted or a signal interrupted. */
+  }
+
+  /* For the Eytzinger layout, work out which node goes where.  The nodes
+  are put into the array in sorted order first, then moved to their places. */
+
+  if (Flags & AVLDUP_FILE_FLAG_EYTZINGER_ORDER)
+  {
+    SortedNodeArray = malloc (TreePntr->count * sizeof (AVLDupNodePointer));
+    EytzingerNodeArray = malloc (TreePntr->count * sizeof (AVLDupNodePointer));
+    if (SortedNodeArray == NULL || EytzingerNodeArray == NULL)
+      StatePntr->failed = true;
+    else
+    {
+      AVLDupFlattenSubtree (TreePntr->rootPntr, SortedNodeArray);
+      Index = AVLDupFirstEytzingerIndex (TreePntr->count);
+      for (i = 0; i < TreePntr->count; i++)
+      {
+        EytzingerNodeArray[Index - 1] = SortedNodeArray[i];
+        Index = AVLDupNextEytzingerIndex (Index, TreePntr->count);
+      }
+    }
+    if (SortedNodeArray != NULL)
+      free (SortedNodeArray);
+  }
+
+  /* Find out how big the string section is, so that the header can be
+  written first. */
+
+  RecursivelySaveNodes (StatePntr, TreePntr->rootPntr, 0);
+  if (StatePntr->stringsSize > 0xFFFFFFFFUL)
+    StatePntr->failed = true; /* Offsets won't fit in 32 bits. */
+
+  NamePntr = (TreePntr->indexName == NULL) ? "" : TreePntr->indexName;
+  NameLength = strlen (NamePntr);
+
+  memset (&Header, 0, sizeof (Header));
+  Header.magic = B_HOST_TO_LENDIAN_INT32 (AVLDUP_FILE_MAGIC);
+  Header.version = B_HOST_TO_LENDIAN_INT32 (AVLDUP_FILE_VERSION);
+  Header.flags = B_HOST_TO_LENDIAN_INT32 (Flags);
+  Header.keyType = B_HOST_TO_LENDIAN_INT32 (TreePntr->keyType);
+  Header.valueType = B_HOST_TO_LENDIAN_INT32 (TreePntr->valueType);
+  Header.count = B_HOST_TO_LENDIAN_INT32 (TreePntr->count);
+  Header.nameLength = B_HOST_TO_LENDIAN_INT32 (NameLength);
+  Header.collation = B_HOST_TO_LENDIAN_INT32 (TreePntr->collation);
+  Header.stringsOffset = B_HOST_TO_LENDIAN_INT64 (
+    ALIGN_TO_8 (sizeof (Header) + NameLength + 1));
+  Header.stringsSize = B_HOST_TO_LENDIAN_INT64 (StatePntr->stringsSize);
+  Header.entriesOffset = B_HOST_TO_LENDIAN_INT64 (
+    ALIGN_TO_8 (sizeof (Header) + NameLength + 1) +
+    ALIGN_TO_8 (StatePntr->stringsSize));
+  Header.fileSize = B_HOST_TO_LENDIAN_INT64 (
+    ALIGN_TO_8 (sizeof (Header) + NameLength + 1) +
+    ALIGN_TO_8 (StatePntr->stringsSize) +
+    (uint64) TreePntr->count * sizeof (AVLDupFileEntryRecord));
+
+  WriteBytes (StatePntr, &Header, sizeof (Header));
+  WriteBytes (StatePntr, NamePntr, NameLength + 1);
+  WritePadding (StatePntr, sizeof (Header) + NameLength + 1);
+
+  /* Write the strings, then the entries referring to them. */
+
+  StatePntr->stringsSize = 0;
+  if (EytzingerNodeArray != NULL)
+    SaveNodesInEytzingerOrder (StatePntr, EytzingerNodeArray, 1);
+  else
+    RecursivelySaveNodes (StatePntr, TreePntr->rootPntr, 1);
+  WritePadding (StatePntr, StatePntr->stringsSize);
+
+  StatePntr->stringsSize = 0;
+  if (EytzingerNodeArray != NULL)
+    SaveNodesInEytzingerOrder (StatePntr, EytzingerNodeArray, 2);
+  else
+    RecursivelySaveNodes (StatePntr, TreePntr->rootPntr, 2);
+  WriteBytes (StatePntr, StatePntr->entryBuffer,
+    StatePntr->entriesInBuffer * sizeof (AVLDupFileEntryRecord));
+
+  if (LockTree && TreePntr->accessSemaphoreID >= 0)
+    release_sem_etc (TreePntr->accessSemaphoreID, 1, B_DO_NOT_RESCHEDULE);
+
+  if (SyncToDisk && (fflush (StatePntr->filePntr) != 0 ||
+  fsync (fileno (StatePntr->filePntr)) != 0))
+    StatePntr->failed = true;
+
+  if (fclose (StatePntr->filePntr) != 0)
+    StatePntr->failed = true;
+  StatePntr->filePntr = NULL;
+
+  if (!StatePntr->failed && rename (TempPathName, FilePathName) == 0)
+    Successful = true;
+
+ExitWithoutLock:
+  if (StatePntr != NULL)
+  {
+    if (StatePntr->filePntr != NULL)
+      fclose (StatePntr->filePntr);
+    free (StatePntr);
+  }
+  if (TempPathName != NULL)
+  {
+    /* Only remove the temporary file if we made it, not someone else's file
+    with the same name which we failed to open. */
+
+    if (TempFileCreated && !Successful)
+      remove (TempPathName);
+    free (TempPathName);
+  }
+  if (EytzingerNodeArray != NULL)
+    free (EytzingerNodeArray);
+
+  return Successful;
+}
+
+
+
+/* Saves the tree to the given file, replacing it if it already exists.  The
+tree is locked for reading while it is being saved, so other readers can
+carry on.  The data is first written to a temporary file (the name with
+".tmp" added) which is then renamed, so a crash part way through leaves the
+old file alone.  Returns TRUE if successful, FALSE if the file couldn't be
+written (disk full etc), or the tree has more than 4GB of long strings. */
+
+bool AVLDupSaveTree (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName)
+{
+  return SaveTreeWithFlags (TreePntr, FilePathName, 0, true, false);
+}
+
+
+
+/* Like AVLDupSaveTree, but the entries are written in Eytzinger order (see
+AVLDupFirstEytzingerIndex) rather than sorted order, which makes searches in
+the file faster when it is opened with AVLDupOpenMappedTree.  The file can
+still be loaded with AVLDupLoadTree, though that needs memory for all the
+entries at once while loading.  Needs some extra memory (two pointers per
+entry) while saving. */
+
+bool AVLDupSaveTreeForMapping (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName)
+{
+  return SaveTreeWithFlags (TreePntr, FilePathName,
+    AVLDUP_FILE_FLAG_EYTZINGER_ORDER, true, false);
+}
+
+
+
+/* Internal version of AVLDupSaveTree for AVLDupCheckpointTree, which already
+has the tree locked for writing.  The file is forced to disk before it is
+renamed, since the caller is about to throw away the log of the changes. */
+
+bool AVLDupSaveTreeWithoutLocking (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName)
+{
+  return SaveTreeWithFlags (TreePntr, FilePathName, 0, false, true);
+}
+
+
+
+/* Reads the next entry from the file and makes a node out of it, checking
+that it comes after the previous one.  Returns NULL and marks the load as
+failed if something goes wrong. */
+
+static AVLDupNodePointer LoadNextNode (LoadStatePointer StatePntr)
+{
+  AVLDupFileEntryPointer EntryPntr;
+  AVLDupThingRecord      Key;
+  AVLDupNodePointer      NewNode;
+  AVLDupTreePointer      TreePntr;
+  AVLDupThingRecord      Value;
+
+  TreePntr = StatePntr->treePntr;
+
+  if (StatePntr->allEntriesPntr != NULL)
+  {
+    /* The entries are all in memory, pick them out in sorted order. */
+
+    if (StatePntr->nextEytzingerIndex == 0)
+      goto ErrorExit;
+    EntryPntr = StatePntr->allEntriesPntr + StatePntr->nextEytzingerIndex - 1;
+    StatePntr->nextEytzingerIndex = AVLDupNextEytzingerIndex (
+      StatePntr->nextEytzingerIndex, StatePntr->count);
+    goto GotEntry;
+  }
+
+  if (StatePntr->nextEntryInBuffer >= StatePntr->entriesInBuffer)
+  {
+    StatePntr->entriesInBuffer = StatePntr->entriesLeftInFile;
+    if (StatePntr->entriesInBuffer > ENTRY_BUFFER_SIZE)
+      StatePntr->entriesInBuffer = ENTRY_BUFFER_SIZE;
+    StatePntr->nextEntryInBuffer = 0;
+
+    if (StatePntr->entriesInBuffer == 0 ||
+    fread (StatePntr->entryBuffer, sizeof (AVLDupFileEntryRecord),
+    StatePntr->entriesInBuffer, StatePntr->filePntr) !=
+    StatePntr->entriesInBuffer)
+      goto ErrorExit;
+    StatePntr->entriesLeftInFile -= StatePntr->entriesInBuffer;
+  }
+
+  EntryPntr = StatePntr->entryBuffer + StatePntr->nextEntryInBuffer++;
+
+GotEntry:
+  if (!AVLDupDecodeFileThing (&EntryPntr->key, TreePntr->keyType,
+  StatePntr->stringsPntr, StatePntr->stringsSize, &Key) ||
+  !AVLDupDecodeFileThing (&EntryPntr->value, TreePntr->valueType,
+  StatePntr->stringsPntr, StatePntr->stringsSize, &Value))
+    goto ErrorExit;
+
+  NewNode = AVLDupAllocateNode (TreePntr, &Key, &Value);
+  if (NewNode == NULL)
+    goto ErrorExit;
+
+  /* A file which isn't sorted would make a broken tree, reject it. */
+
+  if (StatePntr->previousNode != NULL &&
+  AVLDupCompareNodes (TreePntr, StatePntr->previousNode, NewNode) >= 0)
+  {
+    AVLDupDeallocateNode (TreePntr, NewNode);
+    goto ErrorExit;
+  }
+
+  StatePntr->previousNode = NewNode;
+  return NewNode;
+
+ErrorExit:
+  StatePntr->failed = true;
+  return NULL;
+}
+
+
+
+/* Builds a balanced subtree out of the next NumberOfNodes entries in the
+file.  The shape is the same as the one made by AVLDupBuildBalancedSubtree,
+but the nodes are used as soon as they are read, so the whole file never
+needs to be in memory at once.  Returns NULL if the load failed, having freed
+the partial subtree. */
+
+static AVLDupNodePointer RecursivelyLoadSubtree (
+  LoadStatePointer StatePntr,
+  uint32           NumberOfNodes)
+{
+  unsigned int      LeftHeight;
+  uint32            MiddleIndex;
+  AVLDupNodePointer MiddleNode;
+  unsigned int      RightHeight;
+  AVLDupNodePointer SmallerSubtree;
+  AVLDupNodePointer LargerSubtree;
+
+  if (NumberOfNodes == 0 || StatePntr->failed)
+    return NULL;
+
+  MiddleIndex = NumberOfNodes / 2;
+
+  SmallerSubtree = RecursivelyLoadSubtree (StatePntr, MiddleIndex);
+  MiddleNode = (StatePntr->failed) ? NULL : LoadNextNode (StatePntr);
+  LargerSubtree = RecursivelyLoadSubtree (StatePntr,
+    NumberOfNodes - MiddleIndex - 1);
+
+  if (StatePntr->failed)
+  {
+    AVLDupRecursiveDeallocateNodes (StatePntr->treePntr, SmallerSubtree);
+    if (MiddleNode != NULL)
+      AVLDupDeallocateNode (StatePntr->treePntr, MiddleNode);
+    AVLDupRecursiveDeallocateNodes (StatePntr->treePntr, LargerSubtree);
+    return NULL;
+  }
+
+  MiddleNode->smallerChildPntr = SmallerSubtree;
+  MiddleNode->largerChildPntr = LargerSubtree;
+
+  LeftHeight = (SmallerSubtree == NULL) ? 0 : SmallerSubtree->height;
+  RightHeight = (LargerSubtree == NULL) ? 0 : LargerSubtree->height;
+  MiddleNode->height = 1 + ((LeftHeight > RightHeight) ?
+    LeftHeight : RightHeight);
+
+  return MiddleNode;
+}
+
+
+
+/* Creates a new tree from a file written by AVLDupSaveTree.  The key and
+value types and the index name come from the file.  MaxSimultaneousReaders
+is the same as for AVLDupAllocTree.  The entries are read sequentially and
+assembled straight into a balanced tree, so it takes time proportional to the
+number of entries, with no searching or rebalancing.  Returns the new tree,
+or NULL if the file couldn't be read, isn't an index file, is damaged or
+there isn't enough memory. */
+
+AVLDupTreePointer AVLDupLoadTree (
+  const char *FilePathName,
+  uint32 MaxSimultaneousReaders)
+{
+  AVLDupFileHeaderRecord FileHeader;
+  AVLDupFileHeaderRecord Header;
+  char                  *NamePntr;
+  AVLDupTreePointer      NewTree;
+  LoadStatePointer       StatePntr;
+
+  if (FilePathName == NULL)
+    return NULL;
+
+  NewTree = NULL;
+  NamePntr = NULL;
+  StatePntr = malloc (sizeof (LoadStateRecord));
+  if (StatePntr == NULL)
+    return NULL;
+  memset (StatePntr, 0, sizeof (LoadStateRecord));
+
+  StatePntr->filePntr = fopen (FilePathName, "rb");
+  if (StatePntr->filePntr == NULL)
+    goto ErrorExit;
+
+  if (fread (&FileHeader, sizeof (FileHeader), 1, StatePntr->filePntr) != 1 ||
+  !AVLDupDecodeFileHeader (&FileHeader, &Header))
+    goto ErrorExit;
+
+  /* Read the name and make the empty tree. */
+
+  NamePntr = malloc (Header.nameLength + 1);
+  if (NamePntr == NULL ||
+  fread (NamePntr, Header.nameLength + 1, 1, StatePntr->filePntr) != 1)
+    goto ErrorExit;
+  NamePntr[Header.nameLength] = 0;
+
+  NewTree = AVLDupAllocCollatedTree (Header.keyType, Header.valueType,
+    (NamePntr[0] == 0) ? NULL : NamePntr, MaxSimultaneousReaders,
+    (AVLDupCollation) Header.collation);
+  if (NewTree == NULL)
+    goto ErrorExit;
+
+  /* Read in the whole string section, the strings get copied into the
+  nodes as they are made. */
+
+  StatePntr->treePntr = NewTree;
+  StatePntr->stringsSize = Header.stringsSize;
+  if (Header.stringsSize > 0)
+  {
+    if (Header.stringsSize != (size_t) Header.stringsSize)
+      goto ErrorExit; /* Too big for this machine's memory. */
+    StatePntr->stringsPntr = malloc (Header.stringsSize + 1);
+    if (StatePntr->stringsPntr == NULL ||
+    fseek (StatePntr->filePntr, Header.stringsOffset, SEEK_SET) != 0 ||
+    fread (StatePntr->stringsPntr, Header.stringsSize, 1,
+    StatePntr->filePntr) != 1)
+      goto ErrorExit;
+    StatePntr->stringsPntr[Header.stringsSize] = 0; /* In case of damage. */
+  }
+
+  /* Read the entries and build the tree out of them. */
+
+  if (fseek (StatePntr->filePntr, Header.entriesOffset, SEEK_SET) != 0)
+    goto ErrorExit;
+  StatePntr->entriesLeftInFile = Header.count;
+  StatePntr->count = Header.count;
+
+  if ((Header.flags & AVLDUP_FILE_FLAG_EYTZINGER_ORDER) && Header.count > 0)
+  {
+    /* Not stored in sorted order, need to read them all in first. */
+
+    StatePntr->allEntriesPntr =
+      malloc (Header.count * sizeof (AVLDupFileEntryRecord));
+    if (StatePntr->allEntriesPntr == NULL ||
+    fread (StatePntr->allEntriesPntr, sizeof (AVLDupFileEntryRecord),
+    Header.count, StatePntr->filePntr) != Header.count)
+      goto ErrorExit;
+    StatePntr->nextEytzingerIndex = AVLDupFirstEytzingerIndex (Header.count);
+  }
+
+  NewTree->rootPntr = RecursivelyLoadSubtree (StatePntr, Header.count);
+  if (StatePntr->failed)
+    goto ErrorExit;
+  NewTree->count = Header.count;
+
+  fclose (StatePntr->filePntr);
+  if (StatePntr->stringsPntr != NULL)
+    free (StatePntr->stringsPntr);
+  if (StatePntr->allEntriesPntr != NULL)
+    free (StatePntr->allEntriesPntr);
+  free (StatePntr);
+  free (NamePntr);
+  return NewTree;
+
+
+ErrorExit: /* Deallocate partial allocations and return NULL. */
+  if (StatePntr->filePntr != NULL)
+    fclose (StatePntr->filePntr);
+  if (StatePntr->stringsPntr != NULL)
+    free (StatePntr->stringsPntr);
+  if (StatePntr->allEntriesPntr != NULL)
+    free (StatePntr->allEntriesPntr);
+  free (StatePntr);
+  if (NamePntr != NULL)
+    free (NamePntr);
+  AVLDupFreeTree (NewTree);
+  return NULL;
+}
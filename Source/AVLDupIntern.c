@@ -0,0 +1,520 @@
+/******************************************************************************
+ * AVLDupIntern.c
+ *
+ * Optional sharing of long strings between the entries of a tree.  Every
+ * node normally has its own copy of its key and value, so a key with 50000
+ * values is stored 50000 times, as is a long value that turns up under lots
+ * of keys.  After AVLDupEnableInterning, the tree keeps a hash table of its
+ * long strings instead, each with a reference count, and a node which needs
+ * a string that is already there just points at the existing copy.  Short
+ * strings (7 bytes or less) live inside the thing anyway, so they aren't
+ * affected.
+ *
+ * An interned string has a small header in front of it, with the hash chain
+ * link, the reference count and a pointer to its table, and the thing has
+ * AVLDUP_INTERNED_STRING in its isLongString byte, so everything else still
+ * sees an ordinary long string.  AVLDupFreeThingArray notices the marker and
+ * drops a reference instead of freeing the string, which is why the table
+ * pointer is in the header: the string can be released without knowing which
+ * tree it came from.
+ *
+ * Since equal interned strings are the same memory, the string comparison
+ * function returns "equal" right away when both things point at the same
+ * string.  To get the most out of that, AVLDupAdd, AVLDupDelete and
+ * AVLDupIterate swap the user's search key and value for the interned copy if
+ * there is one, so that walking down through a long run of duplicate keys
+ * doesn't compare the whole key string at every level.
+ *
+ * The table is normally only changed by writers holding the tree's lock, but
+ * AVLDupParallelAddArray and AVLDupParallelFreeTree make and free nodes from
+ * several threads at once, so the table has a benaphore of its own as well.
+ * Looking up a search key doesn't need it: both of those run while nobody
+ * else can get at the tree, so holding the tree's lock is enough.
+ * Keys in a collated tree already have their own special format (see
+ * AVLDupCollation.c) and aren't interned, only the values are.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Number of hash buckets in a new table, a power of two.  The table doubles
+in size whenever there are more strings than buckets. */
+
+#define INITIAL_BUCKETS 256
+
+
+/* A shared string and its header.  The string is allocated along with the
+header, the array size is just a placeholder. */
+
+typedef struct InternedStringStruct
+{
+  struct InternedStringStruct *nextPntr; /* Next in the same hash bucket. */
+  AVLDupInternTablePointer     tablePntr;
+  uint32                       hashValue;
+  uint32                       referenceCount;
+  char                         string [1];
+} InternedStringRecord, *InternedStringPointer;
+
+
+struct AVLDupInternTableStruct
+{
+  InternedStringPointer *bucketsArray;
+  uint32                 numberOfBuckets;
+  uint32                 numberOfStrings;
+  uint64                 stringBytes; /* Allocated for strings and headers. */
+  int32                  lockCount; /* Benaphore count, threads wanting in. */
+  sem_id                 lockSemaphoreID;
+  bool                   orphaned; /* The tree is gone, free when empty. */
+};
+
+
+/* Gets the header of an interned string from the string pointer. */
+
+#define GetInternedString(StringPntr) ((InternedStringPointer) \
+  ((StringPntr) - offsetof (InternedStringRecord, string)))
+
+
+
+/* The lock is a benaphore: the semaphore only gets used when several threads
+want the table at the same moment, otherwise it's just an atomic add. */
+
+static void LockTable (AVLDupInternTablePointer TablePntr)
+{
+  if (atomic_add (&TablePntr->lockCount, 1) > 0)
+    acquire_sem (TablePntr->lockSemaphoreID);
+}
+
+
+
+static void UnlockTable (AVLDupInternTablePointer TablePntr)
+{
+  if (atomic_add (&TablePntr->lockCount, -1) > 1)
+    release_sem (TablePntr->lockSemaphoreID);
+}
+
+
+
+/* The FNV-1a hash of a string, also returns its length. */
+
+static uint32 HashString (
+  const char *StringPntr,
+  size_t *LengthPntr)
+{
+  uint32               HashValue;
+  const unsigned char *BytePntr;
+
+  HashValue = 2166136261U;
+  for (BytePntr = (const unsigned char *) StringPntr; *BytePntr != 0;
+  BytePntr++)
+    HashValue = (HashValue ^ *BytePntr) * 16777619U;
+
+  *LengthPntr = (const char *) BytePntr - StringPntr;
+  return HashValue;
+}
+
+
+
+/* Looks for a string in the table, which needs to be locked.  Returns NULL
+if it isn't there. */
+
+static InternedStringPointer FindString (
+  AVLDupInternTablePointer TablePntr,
+  const char *StringPntr,
+  uint32 HashValue)
+{
+  InternedStringPointer InternedPntr;
+
+  for (InternedPntr =
+  TablePntr->bucketsArray[HashValue & (TablePntr->numberOfBuckets - 1)];
+  InternedPntr != NULL;
+  InternedPntr = InternedPntr->nextPntr)
+  {
+    if (InternedPntr->hashValue == HashValue &&
+    strcmp (InternedPntr->string, StringPntr) == 0)
+      return InternedPntr;
+  }
+
+  return NULL;
+}
+
+
+
+/* Doubles the number of hash buckets.  If there isn't enough memory the
+table stays the way it is, the chains just get a bit longer. */
+
+static void GrowTable (AVLDupInternTablePointer TablePntr)
+{
+  uint32                 i;
+  InternedStringPointer  InternedPntr;
+  InternedStringPointer *NewBucketsArray;
+  uint32                 NewNumberOfBuckets;
+  InternedStringPointer  NextPntr;
+
+  NewNumberOfBuckets = TablePntr->numberOfBuckets * 2;
+  NewBucketsArray =
+    calloc (NewNumberOfBuckets, sizeof (InternedStringPointer));
+  if (NewBucketsArray == NULL)
+    return;
+
+  for (i = 0; i < TablePntr->numberOfBuckets; i++)
+  {
+    for (InternedPntr = TablePntr->bucketsArray[i]; InternedPntr != NULL;
+    InternedPntr = NextPntr)
+    {
+      NextPntr = InternedPntr->nextPntr;
+      InternedPntr->nextPntr = NewBucketsArray[
+        InternedPntr->hashValue & (NewNumberOfBuckets - 1)];
+      NewBucketsArray[InternedPntr->hashValue & (NewNumberOfBuckets - 1)] =
+        InternedPntr;
+    }
+  }
+
+  free (TablePntr->bucketsArray);
+  TablePntr->bucketsArray = NewBucketsArray;
+  TablePntr->numberOfBuckets = NewNumberOfBuckets;
+}
+
+
+
+static void DeallocateTable (AVLDupInternTablePointer TablePntr)
+{
+  if (TablePntr->lockSemaphoreID >= 0)
+    delete_sem (TablePntr->lockSemaphoreID);
+  if (TablePntr->bucketsArray != NULL)
+    free (TablePntr->bucketsArray);
+  free (TablePntr);
+}
+
+
+
+/* Makes a new empty table.  Returns NULL if out of memory. */
+
+AVLDupInternTablePointer AVLDupAllocInternTable (void)
+{
+  AVLDupInternTablePointer TablePntr;
+
+  TablePntr = calloc (1, sizeof (AVLDupInternTableRecord));
+  if (TablePntr == NULL)
+    return NULL;
+
+  TablePntr->lockSemaphoreID = create_sem (0, "AVLDup Intern");
+  TablePntr->numberOfBuckets = INITIAL_BUCKETS;
+  TablePntr->bucketsArray =
+    calloc (INITIAL_BUCKETS, sizeof (InternedStringPointer));
+  if (TablePntr->lockSemaphoreID < 0 || TablePntr->bucketsArray == NULL)
+  {
+    DeallocateTable (TablePntr);
+    return NULL;
+  }
+
+  return TablePntr;
+}
+
+
+
+/* Called when the tree is deallocated.  All its nodes are gone by then, so
+normally the table is empty and gets freed right away.  If some interned
+strings are still around the table stays until the last one is released. */
+
+void AVLDupFreeInternTable (AVLDupInternTablePointer TablePntr)
+{
+  bool IsEmpty;
+
+  if (TablePntr == NULL)
+    return;
+
+  LockTable (TablePntr);
+  TablePntr->orphaned = true;
+  IsEmpty = (TablePntr->numberOfStrings == 0);
+  UnlockTable (TablePntr);
+
+  if (IsEmpty)
+    DeallocateTable (TablePntr);
+}
+
+
+
+/* Copies a string thing like AVLDupCopyThingArray does, except that a long
+string becomes a reference to the table's copy of it, which is added if it
+isn't there yet.  Returns FALSE if out of memory, leaving the destination
+zeroed. */
+
+bool AVLDupInternThing (
+  AVLDupInternTablePointer TablePntr,
+  AVLDupThingPointer SourcePntr,
+  AVLDupThingPointer DestPntr)
+{
+  uint32                HashValue;
+  InternedStringPointer InternedPntr;
+  size_t                Length;
+  const char           *StringPntr;
+
+  StringPntr = AVLDupGetStringPntrFromThing (*SourcePntr);
+  if (SourcePntr->longStringThing.isLongString == AVLDUP_INTERNED_STRING &&
+  GetInternedString (StringPntr)->tablePntr == TablePntr)
+  {
+    /* Already one of ours, no need to look for it. */
+
+    InternedPntr = GetInternedString (StringPntr);
+    LockTable (TablePntr);
+    InternedPntr->referenceCount++;
+    UnlockTable (TablePntr);
+    *DestPntr = *SourcePntr;
+    return true;
+  }
+
+  memset (DestPntr, 0, sizeof (AVLDupThingRecord));
+  if (StringPntr == NULL)
+    return true; /* Becomes an empty short string. */
+
+  HashValue = HashString (StringPntr, &Length);
+  if (Length <= 7)
+    return AVLDupCopyThingArray (DestPntr, SourcePntr, B_STRING_TYPE, 1);
+
+  LockTable (TablePntr);
+
+  InternedPntr = FindString (TablePntr, StringPntr, HashValue);
+  if (InternedPntr != NULL)
+    InternedPntr->referenceCount++;
+  else
+  {
+    InternedPntr =
+      malloc (offsetof (InternedStringRecord, string) + Length + 1);
+    if (InternedPntr == NULL)
+    {
+      UnlockTable (TablePntr);
+      return false;
+    }
+    InternedPntr->tablePntr = TablePntr;
+    InternedPntr->hashValue = HashValue;
+    InternedPntr->referenceCount = 1;
+    memcpy (InternedPntr->string, StringPntr, Length + 1);
+
+    InternedPntr->nextPntr =
+      TablePntr->bucketsArray[HashValue & (TablePntr->numberOfBuckets - 1)];
+    TablePntr->bucketsArray[HashValue & (TablePntr->numberOfBuckets - 1)] =
+      InternedPntr;
+    TablePntr->numberOfStrings++;
+    TablePntr->stringBytes +=
+      offsetof (InternedStringRecord, string) + Length + 1;
+    if (TablePntr->numberOfStrings > TablePntr->numberOfBuckets)
+      GrowTable (TablePntr);
+  }
+
+  UnlockTable (TablePntr);
+
+  DestPntr->longStringThing.stringPntr = InternedPntr->string;
+  DestPntr->longStringThing.isLongString = AVLDUP_INTERNED_STRING;
+  return true;
+}
+
+
+
+/* For search keys and values.  If the table has a copy of the thing's
+string, sets up InternedThingPntr to point at it and returns that, otherwise
+returns ThingPntr, since the string isn't in the tree anyway.  This happens
+on every add, delete and iteration, so it doesn't take the table's lock or a
+reference to the string: the caller has to hold the tree's lock (reading is
+enough), which keeps out everything that changes the table.  The search thing
+is only good for as long as the tree doesn't change, and mustn't be freed
+with AVLDupFreeThingArray since it doesn't own a reference. */
+
+AVLDupThingPointer AVLDupInternSearchThing (
+  AVLDupInternTablePointer TablePntr,
+  AVLDupThingPointer ThingPntr,
+  AVLDupThingPointer InternedThingPntr)
+{
+  uint32                HashValue;
+  InternedStringPointer InternedPntr;
+  size_t                Length;
+
+  if (TablePntr == NULL || ThingPntr == NULL ||
+  ThingPntr->longStringThing.isLongString != true ||
+  ThingPntr->longStringThing.stringPntr == NULL)
+    return ThingPntr;
+
+  HashValue = HashString (ThingPntr->longStringThing.stringPntr, &Length);
+  InternedPntr =
+    FindString (TablePntr, ThingPntr->longStringThing.stringPntr, HashValue);
+  if (InternedPntr == NULL)
+    return ThingPntr;
+
+  memset (InternedThingPntr, 0, sizeof (AVLDupThingRecord));
+  InternedThingPntr->longStringThing.stringPntr = InternedPntr->string;
+  InternedThingPntr->longStringThing.isLongString = AVLDUP_INTERNED_STRING;
+  return InternedThingPntr;
+}
+
+
+
+/* Drops a reference to an interned string, called by AVLDupFreeThingArray.
+The string is freed when nobody uses it any more. */
+
+void AVLDupReleaseInternedString (char *StringPntr)
+{
+  bool                     FreeTable;
+  InternedStringPointer    InternedPntr;
+  InternedStringPointer   *PreviousPntrPntr;
+  AVLDupInternTablePointer TablePntr;
+
+  InternedPntr = GetInternedString (StringPntr);
+  TablePntr = InternedPntr->tablePntr;
+
+  LockTable (TablePntr);
+
+  if (--InternedPntr->referenceCount > 0)
+  {
+    UnlockTable (TablePntr);
+    return;
+  }
+
+  for (PreviousPntrPntr = TablePntr->bucketsArray +
+  (InternedPntr->hashValue & (TablePntr->numberOfBuckets - 1));
+  *PreviousPntrPntr != InternedPntr;
+  PreviousPntrPntr = &(*PreviousPntrPntr)->nextPntr)
+    ; /* Find the link pointing at it. */
+  *PreviousPntrPntr = InternedPntr->nextPntr;
+
+  TablePntr->numberOfStrings--;
+  TablePntr->stringBytes -=
+    offsetof (InternedStringRecord, string) + strlen (StringPntr) + 1;
+  FreeTable = (TablePntr->orphaned && TablePntr->numberOfStrings == 0);
+
+  UnlockTable (TablePntr);
+
+  free (InternedPntr);
+  if (FreeTable)
+    DeallocateTable (TablePntr);
+}
+
+
+
+/* Gets the memory used by the table for AVLDupGetStats: the number of
+strings, the bytes allocated for them (headers included) and the size of the
+bucket array. */
+
+void AVLDupGetInternTableSizes (
+  AVLDupInternTablePointer TablePntr,
+  uint32 *NumberOfStringsPntr,
+  uint64 *StringBytesPntr,
+  uint64 *TableBytesPntr)
+{
+  LockTable (TablePntr);
+  *NumberOfStringsPntr = TablePntr->numberOfStrings;
+  *StringBytesPntr = TablePntr->stringBytes;
+  *TableBytesPntr = sizeof (AVLDupInternTableRecord) +
+    TablePntr->numberOfBuckets * sizeof (InternedStringPointer);
+  UnlockTable (TablePntr);
+}
+
+
+
+/* Turns each long string in a subtree into an interned one.  Returns FALSE
+if out of memory, with the rest of the subtree left alone. */
+
+static bool InternSubtree (
+  AVLDupTreePointer TreePntr,
+  AVLDupNodePointer CurrentNode)
+{
+  AVLDupThingRecord InternedThing;
+
+  while (CurrentNode != NULL)
+  {
+    if (TreePntr->internKeys &&
+    CurrentNode->key.longStringThing.isLongString == true)
+    {
+      if (!AVLDupInternThing (TreePntr->internTablePntr, &CurrentNode->key,
+      &InternedThing))
+        return false;
+      AVLDupFreeThingArray (&CurrentNode->key, TreePntr->keyType, 1);
+      CurrentNode->key = InternedThing;
+    }
+
+    if (TreePntr->internValues &&
+    CurrentNode->value.longStringThing.isLongString == true)
+    {
+      if (!AVLDupInternThing (TreePntr->internTablePntr, &CurrentNode->value,
+      &InternedThing))
+        return false;
+      AVLDupFreeThingArray (&CurrentNode->value, TreePntr->valueType, 1);
+      CurrentNode->value = InternedThing;
+    }
+
+    if (!InternSubtree (TreePntr, CurrentNode->smallerChildPntr))
+      return false;
+    CurrentNode = CurrentNode->largerChildPntr;
+  }
+
+  return true;
+}
+
+
+
+/* Turns string interning on or off for a tree.  When turned on, the long
+string keys and values already in the tree are converted too, so that they
+share memory with each other and with what gets added later.  Turning it off
+just stops new strings from being interned, the ones which already are stay
+shared.  Returns FALSE if the tree has no string keys or values (or only
+collated keys), the tree couldn't be locked or it ran out of memory, in which
+case some of the strings may have been converted already, which does no
+harm. */
+
+bool AVLDupEnableInterning (
+  AVLDupTreePointer TreePntr,
+  bool Enable)
+{
+  status_t             ErrorCode;
+  AVLDupHeldLockRecord HeldLock;
+  bool                 InternKeys;
+  bool                 InternValues;
+  bool                 Successful;
+
+  if (TreePntr == NULL)
+    return false;
+
+  InternKeys = (TreePntr->keyType == B_STRING_TYPE &&
+    TreePntr->collation == AVLDUP_COLLATION_BINARY);
+  InternValues = (TreePntr->valueType == B_STRING_TYPE);
+  if (Enable && !InternKeys && !InternValues)
+    return false;
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  Successful = true;
+  if (!Enable)
+  {
+    TreePntr->internKeys = false;
+    TreePntr->internValues = false;
+  }
+  else
+  {
+    if (TreePntr->internTablePntr == NULL)
+      TreePntr->internTablePntr = AVLDupAllocInternTable ();
+    if (TreePntr->internTablePntr == NULL)
+      Successful = false;
+    else
+    {
+      TreePntr->internKeys = InternKeys;
+      TreePntr->internValues = InternValues;
+      Successful = InternSubtree (TreePntr, TreePntr->rootPntr);
+    }
+  }
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "intern", 0);
+  return Successful;
+}
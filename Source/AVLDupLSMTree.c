@@ -0,0 +1,1571 @@
+/******************************************************************************
+ * AVLDupLSMTree.c
+ *
+ * A variant of the AVLDupTree for indices which get a lot more additions than
+ * lookups, organised like a log-structured merge tree.  With a big ordinary
+ * tree, every addition walks down a long chain of nodes scattered all over
+ * memory and then rebalances on the way back up, so once the tree no longer
+ * fits in the processor cache each addition costs a couple of dozen cache
+ * misses.
+ *
+ * Here additions go into a small ordinary AVLDupTree (the memtable) which
+ * stays in the cache.  When the memtable holds a certain number of pairs it is
+ * frozen: its contents are copied in sorted order into a sorted run, which is
+ * just arrays of keys and values, and the memtable starts over empty.  Runs
+ * never change once made.  A background thread merges neighbouring runs
+ * together (an older run with the next newer one, whenever the older one is
+ * less than twice the size of the newer one), so there are only a logarithmic
+ * number of runs and each pair gets copied a logarithmic number of times,
+ * always in long sequential passes which the memory system handles well.
+ *
+ * Since runs can't be changed, deleting a pair which is in a run adds a
+ * tombstone to the memtable instead (the memtable has a second tree for
+ * those).  Newer runs take precedence over older ones, so a tombstone hides
+ * the pair in the older runs, and the two are dropped when they meet during a
+ * merge into the oldest run.
+ *
+ * Iteration looks at the memtable trees and all the runs at once, finding the
+ * start of the range in each one and then repeatedly taking the smallest pair
+ * from any of them, skipping pairs which are hidden by a tombstone or a
+ * duplicate in a newer place.  The order and range semantics are the same as
+ * for AVLDupIterate.  A single semaphore protects the whole thing, just like
+ * the regular tree, except that the background merges only hold it for the
+ * moment it takes to swap in the merged run.
+ *
+ * String keys in the runs are front coded: each one is stored as the number
+ * of leading bytes it shares with the key before it, followed by the rest of
+ * the string.  Sorted file names and paths mostly differ only near the end, so
+ * a path index takes a fraction of the memory it would with a separately
+ * allocated string (plus a 16 byte thing) per key.  Every sixteenth key is a
+ * restart point which is stored whole, so searches do a binary search on the
+ * restart points and then decode at most one block of keys in order.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* The number of pairs (including tombstones) in the memtable which triggers a
+freeze, if the user doesn't specify it. */
+
+#define DEFAULT_MEMTABLE_SIZE 65536
+
+/* The most runs there can be.  With the merge policy there are normally at
+most about log2 (total pairs / memtable size) of them; if the merging falls
+behind and the limit is hit, the memtable just grows until the runs are
+merged. */
+
+#define MAX_RUNS 48
+
+/* Front coded keys have a restart point, a key which doesn't share a prefix
+with the one before it, this often.  Smaller makes searches decode fewer keys,
+larger saves a bit more memory. */
+
+#define RESTART_INTERVAL 16
+
+/* The index of a run cursor which hasn't decoded a key yet. */
+
+#define NO_DECODED_KEY ((uint32) -1)
+
+
+/* A sorted run, with the keys and values in separate arrays so that searches
+(which mostly look at keys) touch fewer cache lines.  The long strings in the
+things are owned by the run.  String keys are front coded instead, with
+keyArray set to NULL.  Each coded key is the shared prefix length (7 bits per
+byte, low bits first, the top bit set on all but the last byte), then the rest
+of the key and its NUL.  Since a restart point's shared length is the single
+byte zero, its whole key is the C string right after that byte. */
+
+typedef struct SortedRunStruct
+{
+  AVLDupThingPointer keyArray;
+  AVLDupThingPointer valueArray;
+  uint8             *tombstoneArray; /* Non-zero for deleted pairs. */
+  uint32             count;
+  uint8             *codedKeysPntr; /* Front coded string keys. */
+  size_t             codedKeysSize;
+  size_t            *restartArray; /* Offset of every RESTART_INTERVAL'th. */
+  uint32             longestKeyLength; /* Not counting the NUL. */
+} SortedRunRecord, *SortedRunPointer;
+
+
+struct AVLDupLSMTreeStruct
+{
+  type_code keyType;
+  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
+  type_code valueType;
+  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
+  AVLDupTreePointer addTreePntr; /* Memtable of pairs added, unlocked. */
+  AVLDupTreePointer deleteTreePntr; /* Memtable of tombstones, unlocked. */
+  uint32 memtableSize;
+  SortedRunPointer runsArray [MAX_RUNS]; /* Oldest run first. */
+  uint32 numberOfRuns;
+  char *keyBufferPntr; /* Big enough to decode any run key, for writers. */
+  uint32 keyBufferSize;
+  sem_id accessSemaphoreID; /* Negative if no semaphore is being used. */
+  uint32 maxSimultaneousReaders;
+  sem_id mergeSemaphoreID; /* Held by whoever is merging runs. */
+  sem_id mergeRequestSemaphoreID; /* Released to wake up the merge thread. */
+  thread_id mergeThreadID; /* Negative if merging is done by the writers. */
+  volatile bool quitting;
+};
+
+
+/* A run which has entries that get thrown away in a merge, for deallocating
+their strings once the merged run has replaced it. */
+
+typedef struct DroppedEntryStruct
+{
+  SortedRunPointer runPntr;
+  uint32           index;
+} DroppedEntryRecord, *DroppedEntryPointer;
+
+
+/* Reads the keys of a run.  For front coded keys it holds the most recently
+decoded one, so that reading the keys in order only decodes each once.  The
+key it returns stays valid until it is asked for a different one.  For other
+runs it just points into the key array. */
+
+typedef struct RunCursorStruct
+{
+  SortedRunPointer  runPntr;
+  uint32            index; /* Entry in keyThing, or NO_DECODED_KEY. */
+  const uint8      *nextPntr; /* The coded key after that one. */
+  AVLDupThingRecord keyThing; /* A long string thing for the buffer. */
+} RunCursorRecord, *RunCursorPointer;
+
+
+/* Front codes the keys of a new run as they are added in order.  The
+previous key is kept in a buffer of its own, since the caller's copy of it
+may be gone by the time the next key is added. */
+
+typedef struct KeyEncoderStruct
+{
+  SortedRunPointer runPntr;
+  size_t           capacity; /* Bytes allocated for the coded keys. */
+  char            *previousKeyPntr;
+  size_t           previousLength;
+} KeyEncoderRecord, *KeyEncoderPointer;
+
+
+/* Run searches use a function which says whether an entry comes before the
+place being looked for. */
+
+typedef bool (* EntryIsBeforeFunctionPointer) (
+  void *SearchDataPntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer ValuePntr);
+
+
+/* The pair being looked for by FindPairInRun. */
+
+typedef struct PairSearchStruct
+{
+  AVLDupLSMTreePointer treePntr;
+  AVLDupThingPointer   keyPntr;
+  AVLDupThingPointer   valuePntr;
+} PairSearchRecord, *PairSearchPointer;
+
+
+/* One of the sorted sequences being combined by the iterator, with the
+position of the next entry and the end of the range in it. */
+
+typedef struct MergeSourceStruct
+{
+  SortedRunPointer runPntr;
+  uint32           position;
+  uint32           endPosition;
+  RunCursorRecord  cursor;
+} MergeSourceRecord, *MergeSourcePointer;
+
+
+
+static bool LockTree (
+  AVLDupLSMTreePointer TreePntr,
+  bool ForWriting)
+{
+  if (TreePntr->accessSemaphoreID < 0)
+    return true;
+
+  return (acquire_sem_etc (TreePntr->accessSemaphoreID,
+    ForWriting ? TreePntr->maxSimultaneousReaders : 1, 0, 0) >= 0);
+}
+
+
+
+static void UnlockTree (
+  AVLDupLSMTreePointer TreePntr,
+  bool ForWriting)
+{
+  if (TreePntr->accessSemaphoreID < 0)
+    return;
+
+  release_sem_etc (TreePntr->accessSemaphoreID,
+    ForWriting ? TreePntr->maxSimultaneousReaders : 1, B_DO_NOT_RESCHEDULE);
+}
+
+
+
+/* Compares two key/value pairs the same way the tree orders them, returning
+>0 for A > B, <0 for A < B and 0 if they are equal. */
+
+static int ComparePairs (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer KeyA,
+  AVLDupThingPointer ValueA,
+  AVLDupThingPointer KeyB,
+  AVLDupThingPointer ValueB)
+{
+  int ComparisonResult;
+
+  ComparisonResult = TreePntr->keyComparisonFunctionPntr (KeyA, KeyB);
+  if (ComparisonResult != 0)
+    return ComparisonResult;
+
+  return TreePntr->valueComparisonFunctionPntr (ValueA, ValueB);
+}
+
+
+
+/* Allocates a run with room for Count entries.  If CodedKeys is TRUE the keys
+will be front coded, using a KeyEncoderRecord, instead of in the key array. */
+
+static SortedRunPointer AllocateRun (
+  uint32 Count,
+  bool CodedKeys)
+{
+  SortedRunPointer RunPntr;
+
+  RunPntr = malloc (sizeof (SortedRunRecord));
+  if (RunPntr == NULL)
+    return NULL;
+
+  memset (RunPntr, 0, sizeof (SortedRunRecord));
+  if (CodedKeys)
+    RunPntr->restartArray =
+      malloc (sizeof (size_t) * (Count / RESTART_INTERVAL + 1));
+  else
+    RunPntr->keyArray = malloc (sizeof (AVLDupThingRecord) * (Count + 1));
+  RunPntr->valueArray = malloc (sizeof (AVLDupThingRecord) * (Count + 1));
+  RunPntr->tombstoneArray = malloc (Count + 1);
+  if ((RunPntr->keyArray == NULL && RunPntr->restartArray == NULL) ||
+  RunPntr->valueArray == NULL || RunPntr->tombstoneArray == NULL)
+  {
+    if (RunPntr->keyArray != NULL)
+      free (RunPntr->keyArray);
+    if (RunPntr->restartArray != NULL)
+      free (RunPntr->restartArray);
+    if (RunPntr->valueArray != NULL)
+      free (RunPntr->valueArray);
+    if (RunPntr->tombstoneArray != NULL)
+      free (RunPntr->tombstoneArray);
+    free (RunPntr);
+    return NULL;
+  }
+
+  return RunPntr;
+}
+
+
+
+/* Deallocates a run.  If FreeStrings is FALSE the strings in it have been
+handed over to some other run, so only the arrays are deallocated.  Front
+coded keys always belong to their run. */
+
+static void DeallocateRun (
+  AVLDupLSMTreePointer TreePntr,
+  SortedRunPointer RunPntr,
+  bool FreeStrings)
+{
+  if (FreeStrings)
+  {
+    if (RunPntr->keyArray != NULL)
+      AVLDupFreeThingArray (RunPntr->keyArray, TreePntr->keyType,
+        RunPntr->count);
+    AVLDupFreeThingArray (RunPntr->valueArray, TreePntr->valueType,
+      RunPntr->count);
+  }
+
+  if (RunPntr->keyArray != NULL)
+    free (RunPntr->keyArray);
+  if (RunPntr->codedKeysPntr != NULL)
+    free (RunPntr->codedKeysPntr);
+  if (RunPntr->restartArray != NULL)
+    free (RunPntr->restartArray);
+  free (RunPntr->valueArray);
+  free (RunPntr->tombstoneArray);
+  free (RunPntr);
+}
+
+
+
+/* Gets ready to front code the keys of a new run.  LongestKeyLength has to
+be at least the length of the longest key that will be added.  Returns FALSE
+if out of memory, FinishEncodingKeys still needs to be called then. */
+
+static bool StartEncodingKeys (
+  KeyEncoderPointer EncoderPntr,
+  SortedRunPointer RunPntr,
+  uint32 LongestKeyLength)
+{
+  EncoderPntr->runPntr = RunPntr;
+  EncoderPntr->capacity = 4096;
+  EncoderPntr->previousKeyPntr = malloc (LongestKeyLength + 1);
+  EncoderPntr->previousLength = 0;
+
+  RunPntr->codedKeysPntr = malloc (EncoderPntr->capacity);
+  RunPntr->codedKeysSize = 0;
+  RunPntr->longestKeyLength = LongestKeyLength;
+
+  return (EncoderPntr->previousKeyPntr != NULL &&
+    RunPntr->codedKeysPntr != NULL);
+}
+
+
+
+/* Appends the key of entry number Index (they have to be added in order,
+starting with zero) to the run's coded keys.  Returns FALSE if out of
+memory. */
+
+static bool EncodeKey (
+  KeyEncoderPointer EncoderPntr,
+  uint32 Index,
+  const char *KeyString)
+{
+  size_t           NewCapacity;
+  uint8           *NewCodedKeysPntr;
+  size_t           Remaining;
+  SortedRunPointer RunPntr;
+  size_t           SharedLength;
+  size_t           SuffixLength;
+  uint8           *WritePntr;
+
+  RunPntr = EncoderPntr->runPntr;
+
+  SharedLength = 0;
+  if (Index % RESTART_INTERVAL == 0)
+    RunPntr->restartArray[Index / RESTART_INTERVAL] = RunPntr->codedKeysSize;
+  else
+  {
+    while (SharedLength < EncoderPntr->previousLength &&
+    KeyString[SharedLength] == EncoderPntr->previousKeyPntr[SharedLength])
+      SharedLength++;
+  }
+  SuffixLength = strlen (KeyString + SharedLength);
+
+  /* Make room for the shared length (no more than 5 bytes for a 32 bit
+  length), the suffix and its NUL. */
+
+  if (RunPntr->codedKeysSize + SuffixLength + 6 > EncoderPntr->capacity)
+  {
+    NewCapacity = EncoderPntr->capacity * 2 + SuffixLength + 6;
+    NewCodedKeysPntr = realloc (RunPntr->codedKeysPntr, NewCapacity);
+    if (NewCodedKeysPntr == NULL)
+      return false;
+    RunPntr->codedKeysPntr = NewCodedKeysPntr;
+    EncoderPntr->capacity = NewCapacity;
+  }
+
+  WritePntr = RunPntr->codedKeysPntr + RunPntr->codedKeysSize;
+  for (Remaining = SharedLength; Remaining >= 0x80; Remaining >>= 7)
+    *WritePntr++ = (uint8) (Remaining | 0x80);
+  *WritePntr++ = (uint8) Remaining;
+  memcpy (WritePntr, KeyString + SharedLength, SuffixLength + 1);
+  WritePntr += SuffixLength + 1;
+  RunPntr->codedKeysSize = WritePntr - RunPntr->codedKeysPntr;
+
+  memcpy (EncoderPntr->previousKeyPntr + SharedLength,
+    KeyString + SharedLength, SuffixLength + 1);
+  EncoderPntr->previousLength = SharedLength + SuffixLength;
+
+  return true;
+}
+
+
+
+/* Deallocates the encoder's buffer and gives back the unused part of the
+coded keys. */
+
+static void FinishEncodingKeys (KeyEncoderPointer EncoderPntr)
+{
+  uint8           *NewCodedKeysPntr;
+  SortedRunPointer RunPntr;
+
+  RunPntr = EncoderPntr->runPntr;
+  if (EncoderPntr->previousKeyPntr != NULL)
+    free (EncoderPntr->previousKeyPntr);
+  EncoderPntr->previousKeyPntr = NULL;
+
+  if (RunPntr->codedKeysPntr != NULL && RunPntr->codedKeysSize > 0)
+  {
+    NewCodedKeysPntr = realloc (RunPntr->codedKeysPntr,
+      RunPntr->codedKeysSize);
+    if (NewCodedKeysPntr != NULL)
+      RunPntr->codedKeysPntr = NewCodedKeysPntr;
+  }
+}
+
+
+
+/* Sets up a cursor for reading the keys of a run.  KeyBufferPntr is where
+front coded keys get decoded, it needs room for the run's longest key and a
+NUL, and can be NULL for runs without coded keys. */
+
+static void StartRunCursor (
+  RunCursorPointer CursorPntr,
+  SortedRunPointer RunPntr,
+  char *KeyBufferPntr)
+{
+  CursorPntr->runPntr = RunPntr;
+  CursorPntr->index = NO_DECODED_KEY;
+  CursorPntr->nextPntr = NULL;
+  memset (&CursorPntr->keyThing, 0, sizeof (AVLDupThingRecord));
+  CursorPntr->keyThing.longStringThing.stringPntr = KeyBufferPntr;
+  CursorPntr->keyThing.longStringThing.isLongString = 1;
+}
+
+
+
+/* Decodes the coded key at the cursor's next pointer into its buffer, which
+already holds the key before it, and moves the next pointer past it. */
+
+static void DecodeNextKey (RunCursorPointer CursorPntr)
+{
+  const uint8 *ReadPntr;
+  size_t       SharedLength;
+  int          Shift;
+  size_t       SuffixLength;
+
+  ReadPntr = CursorPntr->nextPntr;
+  SharedLength = 0;
+  Shift = 0;
+  do
+  {
+    SharedLength |= (size_t) (*ReadPntr & 0x7F) << Shift;
+    Shift += 7;
+  } while (*ReadPntr++ & 0x80);
+
+  SuffixLength = strlen ((const char *) ReadPntr);
+  memcpy (CursorPntr->keyThing.longStringThing.stringPntr + SharedLength,
+    ReadPntr, SuffixLength + 1);
+
+  CursorPntr->nextPntr = ReadPntr + SuffixLength + 1;
+}
+
+
+
+/* Returns the key of entry number Index in the cursor's run.  Decodes
+forward from the key it has if that is in reach, otherwise from the restart
+point at or before the entry. */
+
+static AVLDupThingPointer GetRunKey (
+  RunCursorPointer CursorPntr,
+  uint32 Index)
+{
+  SortedRunPointer RunPntr;
+
+  RunPntr = CursorPntr->runPntr;
+  if (RunPntr->keyArray != NULL)
+    return RunPntr->keyArray + Index;
+
+  if (CursorPntr->index == NO_DECODED_KEY || CursorPntr->index > Index ||
+  Index - CursorPntr->index > RESTART_INTERVAL)
+  {
+    CursorPntr->index = Index - Index % RESTART_INTERVAL;
+    CursorPntr->nextPntr = RunPntr->codedKeysPntr +
+      RunPntr->restartArray[Index / RESTART_INTERVAL];
+    DecodeNextKey (CursorPntr);
+  }
+
+  while (CursorPntr->index < Index)
+  {
+    DecodeNextKey (CursorPntr);
+    CursorPntr->index++;
+  }
+
+  return &CursorPntr->keyThing;
+}
+
+
+
+/* Finds the first entry at or after StartIndex for which the IsBefore
+function returns FALSE, or the end of the run if there isn't one.  The entries
+for which it returns TRUE must all come first.  For front coded keys the
+binary search is done on the restart points, which can be compared without
+decoding, then the one block which can hold the answer is decoded in order. */
+
+static uint32 SearchRun (
+  RunCursorPointer CursorPntr,
+  uint32 StartIndex,
+  EntryIsBeforeFunctionPointer IsBeforeFunctionPntr,
+  void *SearchDataPntr)
+{
+  uint32            HighIndex;
+  uint32            Index;
+  uint32            LowIndex;
+  uint32            MiddleIndex;
+  AVLDupThingRecord RestartKey;
+  SortedRunPointer  RunPntr;
+
+  RunPntr = CursorPntr->runPntr;
+
+  if (RunPntr->keyArray != NULL)
+  {
+    LowIndex = StartIndex;
+    HighIndex = RunPntr->count;
+    while (LowIndex < HighIndex)
+    {
+      MiddleIndex = LowIndex + (HighIndex - LowIndex) / 2;
+      if (IsBeforeFunctionPntr (SearchDataPntr,
+      RunPntr->keyArray + MiddleIndex, RunPntr->valueArray + MiddleIndex))
+        LowIndex = MiddleIndex + 1;
+      else
+        HighIndex = MiddleIndex;
+    }
+    return LowIndex;
+  }
+
+  /* Find the first restart point after the one for StartIndex which isn't
+  before the place.  The low and high indices count blocks here. */
+
+  memset (&RestartKey, 0, sizeof (RestartKey));
+  RestartKey.longStringThing.isLongString = 1;
+
+  LowIndex = StartIndex / RESTART_INTERVAL + 1;
+  HighIndex = (RunPntr->count + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+  while (LowIndex < HighIndex)
+  {
+    MiddleIndex = LowIndex + (HighIndex - LowIndex) / 2;
+    RestartKey.longStringThing.stringPntr = (char *) RunPntr->codedKeysPntr +
+      RunPntr->restartArray[MiddleIndex] + 1;
+    if (IsBeforeFunctionPntr (SearchDataPntr, &RestartKey,
+    RunPntr->valueArray + MiddleIndex * RESTART_INTERVAL))
+      LowIndex = MiddleIndex + 1;
+    else
+      HighIndex = MiddleIndex;
+  }
+
+  /* The answer is in the block before that restart point, or is the restart
+  point itself. */
+
+  HighIndex = LowIndex * RESTART_INTERVAL;
+  if (HighIndex > RunPntr->count)
+    HighIndex = RunPntr->count;
+  Index = (LowIndex - 1) * RESTART_INTERVAL;
+  if (Index < StartIndex)
+    Index = StartIndex;
+
+  for (; Index < HighIndex; Index++)
+  {
+    if (!IsBeforeFunctionPntr (SearchDataPntr, GetRunKey (CursorPntr, Index),
+    RunPntr->valueArray + Index))
+      return Index;
+  }
+
+  return HighIndex;
+}
+
+
+
+/* Search function for FindPairInRun, the search data is the pair. */
+
+static bool PairIsBefore (
+  void *SearchDataPntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer ValuePntr)
+{
+  PairSearchPointer SearchPntr;
+
+  SearchPntr = (PairSearchPointer) SearchDataPntr;
+  return (ComparePairs (SearchPntr->treePntr, KeyPntr, ValuePntr,
+    SearchPntr->keyPntr, SearchPntr->valuePntr) < 0);
+}
+
+
+
+/* Binary search for a key/value pair in a run.  Returns TRUE and sets the
+index if it is there. */
+
+static bool FindPairInRun (
+  AVLDupLSMTreePointer TreePntr,
+  RunCursorPointer CursorPntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value,
+  uint32 *IndexPntr)
+{
+  uint32           Index;
+  SortedRunPointer RunPntr;
+  PairSearchRecord Search;
+
+  RunPntr = CursorPntr->runPntr;
+  Search.treePntr = TreePntr;
+  Search.keyPntr = Key;
+  Search.valuePntr = Value;
+  Index = SearchRun (CursorPntr, 0, PairIsBefore, &Search);
+
+  if (Index >= RunPntr->count || ComparePairs (TreePntr,
+  GetRunKey (CursorPntr, Index), RunPntr->valueArray + Index,
+  Key, Value) != 0)
+    return false;
+
+  *IndexPntr = Index;
+  return true;
+}
+
+
+
+/* Returns TRUE if the newest run containing the pair has it as a live pair,
+rather than a tombstone.  The tree needs to be locked for writing, since the
+tree's key buffer is used for decoding. */
+
+static bool PairIsLiveInRuns (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  RunCursorRecord Cursor;
+  uint32          Index;
+  int             RunIndex;
+
+  for (RunIndex = (int) TreePntr->numberOfRuns - 1; RunIndex >= 0; RunIndex--)
+  {
+    StartRunCursor (&Cursor, TreePntr->runsArray[RunIndex],
+      TreePntr->keyBufferPntr);
+    if (FindPairInRun (TreePntr, &Cursor, Key, Value, &Index))
+      return !TreePntr->runsArray[RunIndex]->tombstoneArray[Index];
+  }
+
+  return false;
+}
+
+
+
+/* Moves the contents of the memtable into a new sorted run, leaving the
+memtable empty.  The strings are moved over rather than copied, except for
+string keys which get front coded.  The caller holds the writer lock.  If it
+runs out of memory the memtable is left alone, and the freeze will be tried
+again after the next change. */
+
+static void FreezeMemtable (AVLDupLSMTreePointer TreePntr)
+{
+  AVLDupTreePointer  AddTreePntr;
+  AVLDupNodePointer *AddNodeArray;
+  bool               CodedKeys;
+  AVLDupTreePointer  DeleteTreePntr;
+  AVLDupNodePointer *DeleteNodeArray;
+  KeyEncoderRecord   Encoder;
+  uint32             i;
+  uint32             j;
+  uint32             k;
+  uint32             KeyLength;
+  uint32             LongestKeyLength;
+  char              *NewKeyBufferPntr;
+  AVLDupNodePointer  NodePntr;
+  AVLDupNodePointer *OrderedNodeArray;
+  SortedRunPointer   RunPntr;
+
+  AddTreePntr = TreePntr->addTreePntr;
+  DeleteTreePntr = TreePntr->deleteTreePntr;
+  if (AddTreePntr->count + DeleteTreePntr->count == 0 ||
+  TreePntr->numberOfRuns >= MAX_RUNS)
+    return;
+
+  CodedKeys = (TreePntr->keyType == B_STRING_TYPE);
+  Encoder.previousKeyPntr = NULL;
+  RunPntr = AllocateRun (AddTreePntr->count + DeleteTreePntr->count,
+    CodedKeys);
+  AddNodeArray = malloc (sizeof (AVLDupNodePointer) * (AddTreePntr->count + 1));
+  DeleteNodeArray =
+    malloc (sizeof (AVLDupNodePointer) * (DeleteTreePntr->count + 1));
+  OrderedNodeArray = malloc (sizeof (AVLDupNodePointer) *
+    (AddTreePntr->count + DeleteTreePntr->count));
+  if (RunPntr == NULL || AddNodeArray == NULL || DeleteNodeArray == NULL ||
+  OrderedNodeArray == NULL)
+    goto ErrorExit;
+
+  AVLDupFlattenSubtree (AddTreePntr->rootPntr, AddNodeArray);
+  AVLDupFlattenSubtree (DeleteTreePntr->rootPntr, DeleteNodeArray);
+
+  /* Merge the two trees, which never have a pair in common. */
+
+  LongestKeyLength = 0;
+  for (i = 0, j = 0, k = 0;
+  i < AddTreePntr->count || j < DeleteTreePntr->count;
+  k++)
+  {
+    if (j >= DeleteTreePntr->count || (i < AddTreePntr->count &&
+    AVLDupCompareNodes (AddTreePntr, AddNodeArray[i], DeleteNodeArray[j]) < 0))
+    {
+      NodePntr = AddNodeArray[i++];
+      RunPntr->tombstoneArray[k] = 0;
+    }
+    else
+    {
+      NodePntr = DeleteNodeArray[j++];
+      RunPntr->tombstoneArray[k] = 1;
+    }
+    OrderedNodeArray[k] = NodePntr;
+
+    if (CodedKeys)
+    {
+      KeyLength = strlen (AVLDupGetStringPntrFromThing (NodePntr->key));
+      if (KeyLength > LongestKeyLength)
+        LongestKeyLength = KeyLength;
+    }
+  }
+
+  /* Encode the keys before anything gets taken apart, in case it runs out
+  of memory.  The writers' key buffer also needs to be able to hold the
+  longest key of the new run. */
+
+  if (CodedKeys)
+  {
+    if (!StartEncodingKeys (&Encoder, RunPntr, LongestKeyLength))
+      goto ErrorExit;
+    for (k = 0; k < AddTreePntr->count + DeleteTreePntr->count; k++)
+      if (!EncodeKey (&Encoder, k,
+      AVLDupGetStringPntrFromThing (OrderedNodeArray[k]->key)))
+        goto ErrorExit;
+    FinishEncodingKeys (&Encoder);
+
+    if (LongestKeyLength + 1 > TreePntr->keyBufferSize)
+    {
+      NewKeyBufferPntr = malloc (LongestKeyLength + 1);
+      if (NewKeyBufferPntr == NULL)
+        goto ErrorExit;
+      if (TreePntr->keyBufferPntr != NULL)
+        free (TreePntr->keyBufferPntr);
+      TreePntr->keyBufferPntr = NewKeyBufferPntr;
+      TreePntr->keyBufferSize = LongestKeyLength + 1;
+    }
+  }
+
+  for (k = 0; k < AddTreePntr->count + DeleteTreePntr->count; k++)
+  {
+    NodePntr = OrderedNodeArray[k];
+    if (CodedKeys)
+      AVLDupFreeThingArray (&NodePntr->key, TreePntr->keyType, 1);
+    else
+      RunPntr->keyArray[k] = NodePntr->key;
+    RunPntr->valueArray[k] = NodePntr->value;
+    free (NodePntr); /* The value strings now belong to the run. */
+  }
+  RunPntr->count = k;
+
+  AddTreePntr->rootPntr = NULL;
+  AddTreePntr->count = 0;
+  DeleteTreePntr->rootPntr = NULL;
+  DeleteTreePntr->count = 0;
+
+  TreePntr->runsArray[TreePntr->numberOfRuns++] = RunPntr;
+  RunPntr = NULL;
+
+ErrorExit:
+  if (CodedKeys && Encoder.previousKeyPntr != NULL)
+    FinishEncodingKeys (&Encoder);
+  if (RunPntr != NULL)
+    DeallocateRun (TreePntr, RunPntr, false);
+  if (AddNodeArray != NULL)
+    free (AddNodeArray);
+  if (DeleteNodeArray != NULL)
+    free (DeleteNodeArray);
+  if (OrderedNodeArray != NULL)
+    free (OrderedNodeArray);
+}
+
+
+
+/* Merges two neighbouring runs into a new one.  Where both have the same
+pair, the entry from the newer run wins.  If DropTombstones is TRUE (the
+older run is the oldest one, so there is nothing under it for tombstones to
+hide) tombstones are left out.  The entries which are left out are listed in
+the dropped array, which needs room for all the entries of both runs, so that
+their strings can be deallocated once the new run is in place.  Front coded
+keys are decoded and coded again for the new run.  Returns the new run or NULL
+if out of memory.  The old runs aren't changed. */
+
+static SortedRunPointer MergeTwoRuns (
+  AVLDupLSMTreePointer TreePntr,
+  SortedRunPointer NewerRunPntr,
+  SortedRunPointer OlderRunPntr,
+  bool DropTombstones,
+  DroppedEntryPointer DroppedArray,
+  uint32 *NumberDroppedPntr)
+{
+  bool               CodedKeys;
+  int                ComparisonResult;
+  KeyEncoderRecord   Encoder;
+  RunCursorPointer   FromCursorPntr;
+  SortedRunPointer   FromRunPntr;
+  uint32             FromIndex;
+  uint32             i;
+  uint32             j;
+  uint32             k;
+  char              *KeyBufferPntr;
+  AVLDupThingPointer KeyPntr;
+  uint32             LongestKeyLength;
+  RunCursorRecord    NewerCursor;
+  uint32             NumberDropped;
+  RunCursorRecord    OlderCursor;
+  SortedRunPointer   RunPntr;
+
+  CodedKeys = (NewerRunPntr->keyArray == NULL);
+  KeyBufferPntr = NULL;
+  Encoder.previousKeyPntr = NULL;
+  RunPntr = AllocateRun (NewerRunPntr->count + OlderRunPntr->count,
+    CodedKeys);
+  if (RunPntr == NULL)
+    return NULL;
+
+  if (CodedKeys)
+  {
+    LongestKeyLength = NewerRunPntr->longestKeyLength;
+    if (OlderRunPntr->longestKeyLength > LongestKeyLength)
+      LongestKeyLength = OlderRunPntr->longestKeyLength;
+    KeyBufferPntr = malloc (2 * (LongestKeyLength + 1));
+    if (KeyBufferPntr == NULL ||
+    !StartEncodingKeys (&Encoder, RunPntr, LongestKeyLength))
+      goto ErrorExit;
+  }
+  StartRunCursor (&NewerCursor, NewerRunPntr, KeyBufferPntr);
+  StartRunCursor (&OlderCursor, OlderRunPntr,
+    CodedKeys ? KeyBufferPntr + LongestKeyLength + 1 : NULL);
+
+  i = j = k = 0;
+  NumberDropped = 0;
+  while (i < NewerRunPntr->count || j < OlderRunPntr->count)
+  {
+    if (i >= NewerRunPntr->count)
+      ComparisonResult = 1;
+    else if (j >= OlderRunPntr->count)
+      ComparisonResult = -1;
+    else
+      ComparisonResult = ComparePairs (TreePntr,
+        GetRunKey (&NewerCursor, i), NewerRunPntr->valueArray + i,
+        GetRunKey (&OlderCursor, j), OlderRunPntr->valueArray + j);
+
+    if (ComparisonResult == 0)
+    {
+      /* The older entry is hidden by the newer one. */
+
+      DroppedArray[NumberDropped].runPntr = OlderRunPntr;
+      DroppedArray[NumberDropped++].index = j++;
+      ComparisonResult = -1;
+    }
+
+    if (ComparisonResult < 0)
+    {
+      FromRunPntr = NewerRunPntr;
+      FromCursorPntr = &NewerCursor;
+      FromIndex = i++;
+    }
+    else
+    {
+      FromRunPntr = OlderRunPntr;
+      FromCursorPntr = &OlderCursor;
+      FromIndex = j++;
+    }
+
+    if (DropTombstones && FromRunPntr->tombstoneArray[FromIndex])
+    {
+      DroppedArray[NumberDropped].runPntr = FromRunPntr;
+      DroppedArray[NumberDropped++].index = FromIndex;
+      continue;
+    }
+
+    KeyPntr = GetRunKey (FromCursorPntr, FromIndex);
+    if (!CodedKeys)
+      RunPntr->keyArray[k] = *KeyPntr;
+    else if (!EncodeKey (&Encoder, k, AVLDupGetStringPntrFromThing (*KeyPntr)))
+      goto ErrorExit;
+    RunPntr->valueArray[k] = FromRunPntr->valueArray[FromIndex];
+    RunPntr->tombstoneArray[k] = FromRunPntr->tombstoneArray[FromIndex];
+    k++;
+  }
+
+  RunPntr->count = k;
+  if (CodedKeys)
+  {
+    FinishEncodingKeys (&Encoder);
+    free (KeyBufferPntr);
+  }
+  *NumberDroppedPntr = NumberDropped;
+  return RunPntr;
+
+ErrorExit:
+  if (Encoder.previousKeyPntr != NULL)
+    FinishEncodingKeys (&Encoder);
+  if (KeyBufferPntr != NULL)
+    free (KeyBufferPntr);
+  DeallocateRun (TreePntr, RunPntr, false);
+  return NULL;
+}
+
+
+
+/* Merges runs until none of them need it.  Only one thread merges at a time,
+the merge semaphore makes any others wait their turn.  The runs are only read
+while merging (they never change), and only the merging thread removes runs,
+so the tree just needs to be locked for reading while picking a pair of runs
+and for writing while swapping in the result. */
+
+static void MergeRunsWhileNeeded (AVLDupLSMTreePointer TreePntr)
+{
+  DroppedEntryPointer DroppedArray;
+  DroppedEntryPointer DroppedPntr;
+  bool                HasStrings;
+  int                 i;
+  uint32              MergedIndex;
+  SortedRunPointer    MergedRunPntr;
+  SortedRunPointer    NewerRunPntr;
+  uint32              NumberDropped;
+  SortedRunPointer    OlderRunPntr;
+
+  if (acquire_sem (TreePntr->mergeSemaphoreID) < B_OK)
+    return;
+
+  HasStrings = (TreePntr->keyType == B_STRING_TYPE ||
+    TreePntr->valueType == B_STRING_TYPE);
+
+  while (!TreePntr->quitting)
+  {
+    if (!LockTree (TreePntr, false))
+      break;
+
+    /* Look for the newest pair of neighbouring runs where the older one is
+    less than twice the size of the newer one. */
+
+    OlderRunPntr = NULL;
+    for (i = (int) TreePntr->numberOfRuns - 2; i >= 0; i--)
+    {
+      if (TreePntr->runsArray[i]->count <=
+      2 * TreePntr->runsArray[i + 1]->count)
+      {
+        OlderRunPntr = TreePntr->runsArray[i];
+        NewerRunPntr = TreePntr->runsArray[i + 1];
+        MergedIndex = i;
+        break;
+      }
+    }
+
+    UnlockTree (TreePntr, false);
+
+    if (OlderRunPntr == NULL)
+      break;
+
+    DroppedArray = malloc (sizeof (DroppedEntryRecord) *
+      (NewerRunPntr->count + OlderRunPntr->count + 1));
+    if (DroppedArray == NULL)
+      break;
+
+    MergedRunPntr = MergeTwoRuns (TreePntr, NewerRunPntr, OlderRunPntr,
+      MergedIndex == 0, DroppedArray, &NumberDropped);
+    if (MergedRunPntr == NULL)
+    {
+      free (DroppedArray);
+      break;
+    }
+
+    if (!LockTree (TreePntr, true))
+    {
+      DeallocateRun (TreePntr, MergedRunPntr, false);
+      free (DroppedArray);
+      break;
+    }
+
+    /* New runs may have been added at the end since we looked, but the two
+    being merged are still in the same place. */
+
+    TreePntr->runsArray[MergedIndex] = MergedRunPntr;
+    memmove (TreePntr->runsArray + MergedIndex + 1,
+      TreePntr->runsArray + MergedIndex + 2,
+      (TreePntr->numberOfRuns - MergedIndex - 2) * sizeof (SortedRunPointer));
+    TreePntr->numberOfRuns--;
+
+    UnlockTree (TreePntr, true);
+
+    for (DroppedPntr = DroppedArray;
+    HasStrings && DroppedPntr < DroppedArray + NumberDropped;
+    DroppedPntr++)
+    {
+      if (DroppedPntr->runPntr->keyArray != NULL)
+        AVLDupFreeThingArray (
+          DroppedPntr->runPntr->keyArray + DroppedPntr->index,
+          TreePntr->keyType, 1);
+      AVLDupFreeThingArray (
+        DroppedPntr->runPntr->valueArray + DroppedPntr->index,
+        TreePntr->valueType, 1);
+    }
+    free (DroppedArray);
+    DeallocateRun (TreePntr, NewerRunPntr, false);
+    DeallocateRun (TreePntr, OlderRunPntr, false);
+  }
+
+  release_sem (TreePntr->mergeSemaphoreID);
+}
+
+
+
+/* The background merging thread.  It sleeps until a writer freezes the
+memtable, then does any merges that are needed. */
+
+static int32 MergeThreadEntry (void *DataPntr)
+{
+  AVLDupLSMTreePointer TreePntr;
+
+  TreePntr = (AVLDupLSMTreePointer) DataPntr;
+
+  while (acquire_sem (TreePntr->mergeRequestSemaphoreID) == B_OK &&
+  !TreePntr->quitting)
+    MergeRunsWhileNeeded (TreePntr);
+
+  return 0;
+}
+
+
+
+/* Called by writers after making a change, while holding the writer lock.
+Freezes the memtable if it is full.  Returns TRUE if the runs may need
+merging. */
+
+static bool FreezeMemtableIfFull (AVLDupLSMTreePointer TreePntr)
+{
+  uint32 NumberOfRunsBefore;
+
+  if (TreePntr->addTreePntr->count + TreePntr->deleteTreePntr->count <
+  TreePntr->memtableSize)
+    return false;
+
+  NumberOfRunsBefore = TreePntr->numberOfRuns;
+  FreezeMemtable (TreePntr);
+
+  return (TreePntr->numberOfRuns != NumberOfRunsBefore ||
+    TreePntr->numberOfRuns >= MAX_RUNS);
+}
+
+
+
+/* Called by writers after releasing the writer lock if the runs need
+merging.  Wakes up the merging thread, or does the merging if there isn't
+one.  If the merging has fallen so far behind that the runs are full up,
+the writer pitches in too.  RunsFull is checked by the caller while it still
+has the writer lock, since the merging thread changes the number of runs. */
+
+static void RequestMerge (AVLDupLSMTreePointer TreePntr, bool RunsFull)
+{
+  if (TreePntr->mergeThreadID >= 0)
+  {
+    release_sem (TreePntr->mergeRequestSemaphoreID);
+    if (!RunsFull)
+      return;
+  }
+
+  MergeRunsWhileNeeded (TreePntr);
+}
+
+
+
+/* Creates a new empty LSM tree.  The types, name and MaxSimultaneousReaders
+are the same as for AVLDupAllocTree.  MemtableSize is the number of changed
+pairs kept in the in-memory AVL tree before it gets turned into a sorted run,
+zero for the default of 65536.  It should be small enough that the memtable
+stays in the processor cache (the nodes are 32 bytes plus strings).  If
+multitasking protection is turned on, a background thread does the merging,
+otherwise it is done by AVLDupLSMAdd and AVLDupLSMDelete.  Returns NULL if
+out of memory or the types are unsupported. */
+
+AVLDupLSMTreePointer AVLDupLSMAllocTree (
+  type_code   KeyType,
+  type_code   ValueType,
+  const char *IndexName,
+  uint32      MaxSimultaneousReaders,
+  uint32      MemtableSize)
+{
+  AVLDupLSMTreePointer NewTree;
+
+  NewTree = malloc (sizeof (AVLDupLSMTreeRecord));
+  if (NewTree == NULL) goto ErrorExit;
+
+  /* Set up some initial values so that cleanup of
+  further errors won't cause a crash. */
+
+  memset (NewTree, 0, sizeof (AVLDupLSMTreeRecord));
+  NewTree->accessSemaphoreID = -1;
+  NewTree->mergeSemaphoreID = -1;
+  NewTree->mergeRequestSemaphoreID = -1;
+  NewTree->mergeThreadID = -1;
+  NewTree->maxSimultaneousReaders = MaxSimultaneousReaders;
+  NewTree->memtableSize =
+    (MemtableSize == 0) ? DEFAULT_MEMTABLE_SIZE : MemtableSize;
+
+  /* The memtable trees don't need their own semaphores, they are protected
+  by ours.  They also provide the comparison functions. */
+
+  NewTree->addTreePntr = AVLDupAllocTree (KeyType, ValueType, IndexName, 0);
+  NewTree->deleteTreePntr = AVLDupAllocTree (KeyType, ValueType, NULL, 0);
+  if (NewTree->addTreePntr == NULL || NewTree->deleteTreePntr == NULL)
+    goto ErrorExit;
+
+  NewTree->keyType = KeyType;
+  NewTree->keyComparisonFunctionPntr =
+    NewTree->addTreePntr->keyComparisonFunctionPntr;
+  NewTree->valueType = ValueType;
+  NewTree->valueComparisonFunctionPntr =
+    NewTree->addTreePntr->valueComparisonFunctionPntr;
+
+  NewTree->mergeSemaphoreID = create_sem (1, "AVLDupLSM Merge");
+  if (NewTree->mergeSemaphoreID < 0) goto ErrorExit;
+
+  if (MaxSimultaneousReaders > 0)
+  {
+    NewTree->accessSemaphoreID = create_sem (MaxSimultaneousReaders,
+      "AVLDupLSM Access");
+    if (NewTree->accessSemaphoreID < 0) goto ErrorExit;
+
+    NewTree->mergeRequestSemaphoreID = create_sem (0, "AVLDupLSM Request");
+    if (NewTree->mergeRequestSemaphoreID < 0) goto ErrorExit;
+
+    NewTree->mergeThreadID = spawn_thread (MergeThreadEntry,
+      "AVLDupLSM Merger", B_NORMAL_PRIORITY, NewTree);
+    if (NewTree->mergeThreadID < 0) goto ErrorExit;
+    resume_thread (NewTree->mergeThreadID);
+  }
+
+  return NewTree;
+
+
+ErrorExit: /* Deallocate partial allocations and return NULL. */
+  AVLDupLSMFreeTree (NewTree);
+  return NULL;
+}
+
+
+
+/* Deallocates the tree.  Stops the merging thread, waits for other users of
+the tree to leave, then frees everything. */
+
+void AVLDupLSMFreeTree (AVLDupLSMTreePointer TreePntr)
+{
+  status_t ThreadResult;
+  uint32   i;
+
+  if (TreePntr == NULL)
+    return;
+
+  TreePntr->quitting = true;
+  if (TreePntr->mergeThreadID >= 0)
+  {
+    release_sem (TreePntr->mergeRequestSemaphoreID);
+    wait_for_thread (TreePntr->mergeThreadID, &ThreadResult);
+  }
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    /* Wait for all readers and writers to leave, then delete the semaphore
+    so that any threads still waiting get an error and go away. */
+
+    acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are writer, grab all */, 0, 0);
+    delete_sem (TreePntr->accessSemaphoreID);
+  }
+
+  if (TreePntr->mergeSemaphoreID >= 0)
+    delete_sem (TreePntr->mergeSemaphoreID);
+  if (TreePntr->mergeRequestSemaphoreID >= 0)
+    delete_sem (TreePntr->mergeRequestSemaphoreID);
+
+  for (i = 0; i < TreePntr->numberOfRuns; i++)
+    DeallocateRun (TreePntr, TreePntr->runsArray[i], true);
+  if (TreePntr->keyBufferPntr != NULL)
+    free (TreePntr->keyBufferPntr);
+
+  AVLDupFreeTree (TreePntr->addTreePntr);
+  AVLDupFreeTree (TreePntr->deleteTreePntr);
+
+  memset (TreePntr, 0, sizeof (AVLDupLSMTreeRecord));
+  free (TreePntr);
+}
+
+
+
+/* Adds a key/value pair.  Same as AVLDupAdd, except that it doesn't notice
+if the pair was already there (that would need a search of all the runs),
+it just gets added to the memtable again and the duplicates are weeded out
+later.  Returns FALSE if out of memory or the tree is being deallocated. */
+
+bool AVLDupLSMAdd (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer   Key,
+  AVLDupThingPointer   Value)
+{
+  bool          MergeNeeded;
+  RANReturnCode ReturnCode;
+  bool          RunsFull;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  if (!LockTree (TreePntr, true))
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  /* A newer addition cancels an earlier deletion. */
+
+  AVLDupDeleteWithoutLocking (TreePntr->deleteTreePntr, Key, Value);
+  ReturnCode = AVLDupAddWithoutLocking (TreePntr->addTreePntr, Key, Value);
+  MergeNeeded = FreezeMemtableIfFull (TreePntr);
+  RunsFull = (TreePntr->numberOfRuns >= MAX_RUNS);
+
+  UnlockTree (TreePntr, true);
+
+  if (MergeNeeded)
+    RequestMerge (TreePntr, RunsFull);
+
+  return (ReturnCode != RAN_OUT_OF_MEMORY);
+}
+
+
+
+/* Deletes a key/value pair.  If it is in one of the runs, a tombstone is
+added to the memtable to hide it.  Returns TRUE if the pair was there and got
+deleted, FALSE if it wasn't there or something went wrong. */
+
+bool AVLDupLSMDelete (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer   Key,
+  AVLDupThingPointer   Value)
+{
+  bool          MergeNeeded;
+  bool          RemovedFromMemtable;
+  RANReturnCode ReturnCode;
+  bool          RunsFull;
+  bool          Successful;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  if (!LockTree (TreePntr, true))
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  RemovedFromMemtable =
+    AVLDupDeleteWithoutLocking (TreePntr->addTreePntr, Key, Value);
+
+  /* Add a tombstone if a run has it, unless there already is one. */
+
+  ReturnCode = RAN_ALREADY_IN_TREE;
+  if (PairIsLiveInRuns (TreePntr, Key, Value))
+    ReturnCode =
+      AVLDupAddWithoutLocking (TreePntr->deleteTreePntr, Key, Value);
+
+  Successful = (ReturnCode != RAN_OUT_OF_MEMORY &&
+    (RemovedFromMemtable || ReturnCode == RAN_ADDED_A_NODE));
+  MergeNeeded = FreezeMemtableIfFull (TreePntr);
+  RunsFull = (TreePntr->numberOfRuns >= MAX_RUNS);
+
+  UnlockTree (TreePntr, true);
+
+  if (MergeNeeded)
+    RequestMerge (TreePntr, RunsFull);
+
+  return Successful;
+}
+
+
+
+/* Copies the memtable pairs in the iteration range into a temporary run,
+in sorted order.  The strings aren't copied, so the temporary run must not
+outlive the lock. */
+
+static void CollectMemtableRange (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer CurrentNode,
+  bool TestLowerBound,
+  bool TestUpperBound,
+  SortedRunPointer RunPntr)
+{
+  int ComparisonLower;
+  int ComparisonUpper;
+
+  while (CurrentNode != NULL)
+  {
+    AVLDupCompareNodeWithBounds (ArgsPntr, CurrentNode,
+      TestLowerBound, TestUpperBound, &ComparisonLower, &ComparisonUpper);
+
+    if (ComparisonLower > 0 ||
+    (ComparisonLower == 0 && !ArgsPntr->includeThingEqualToStart))
+    {
+      CurrentNode = CurrentNode->largerChildPntr; /* Below the range. */
+      continue;
+    }
+    if (ComparisonUpper < 0 ||
+    (ComparisonUpper == 0 && !ArgsPntr->includeThingEqualToEnd))
+    {
+      CurrentNode = CurrentNode->smallerChildPntr; /* Above the range. */
+      continue;
+    }
+
+    /* In the range.  The smaller side still needs the lower bound test
+    and the larger side the upper bound test. */
+
+    CollectMemtableRange (ArgsPntr, CurrentNode->smallerChildPntr,
+      TestLowerBound, false, RunPntr);
+    RunPntr->keyArray[RunPntr->count] = CurrentNode->key;
+    RunPntr->valueArray[RunPntr->count] = CurrentNode->value;
+    RunPntr->count++;
+    CurrentNode = CurrentNode->largerChildPntr;
+    TestLowerBound = false;
+  }
+}
+
+
+
+/* Search function for finding the start of the iteration range in a run, the
+search data is the iteration arguments. */
+
+static bool PairIsBelowRange (
+  void *SearchDataPntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer ValuePntr)
+{
+  NonRecursiveArgumentsPointer ArgsPntr;
+  int                          ComparisonLower;
+  int                          ComparisonUpper;
+  AVLDupNodeRecord             TempNode;
+
+  ArgsPntr = (NonRecursiveArgumentsPointer) SearchDataPntr;
+  TempNode.key = *KeyPntr;
+  TempNode.value = *ValuePntr;
+  AVLDupCompareNodeWithBounds (ArgsPntr, &TempNode, true, false,
+    &ComparisonLower, &ComparisonUpper);
+
+  return (ComparisonLower > 0 ||
+    (ComparisonLower == 0 && !ArgsPntr->includeThingEqualToStart));
+}
+
+
+
+/* Search function for finding the end of the iteration range in a run. */
+
+static bool PairIsNotPastRange (
+  void *SearchDataPntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer ValuePntr)
+{
+  NonRecursiveArgumentsPointer ArgsPntr;
+  int                          ComparisonLower;
+  int                          ComparisonUpper;
+  AVLDupNodeRecord             TempNode;
+
+  ArgsPntr = (NonRecursiveArgumentsPointer) SearchDataPntr;
+  TempNode.key = *KeyPntr;
+  TempNode.value = *ValuePntr;
+  AVLDupCompareNodeWithBounds (ArgsPntr, &TempNode, false, true,
+    &ComparisonLower, &ComparisonUpper);
+
+  return (ComparisonUpper > 0 ||
+    (ComparisonUpper == 0 && ArgsPntr->includeThingEqualToEnd));
+}
+
+
+
+/* Finds the part of a run which is within the iteration range.  The source's
+cursor has to be set up already. */
+
+static void FindRangeInRun (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  bool TestLowerBound,
+  bool TestUpperBound,
+  MergeSourcePointer SourcePntr)
+{
+  SortedRunPointer RunPntr;
+
+  RunPntr = SourcePntr->cursor.runPntr;
+  SourcePntr->runPntr = RunPntr;
+
+  /* First entry not below the range. */
+
+  SourcePntr->position = 0;
+  if (TestLowerBound)
+    SourcePntr->position =
+      SearchRun (&SourcePntr->cursor, 0, PairIsBelowRange, ArgsPntr);
+
+  /* First entry past the range. */
+
+  SourcePntr->endPosition = RunPntr->count;
+  if (TestUpperBound)
+    SourcePntr->endPosition = SearchRun (&SourcePntr->cursor,
+      SourcePntr->position, PairIsNotPastRange, ArgsPntr);
+}
+
+
+
+/* Iterates through the pairs in the given range, in ascending order, calling
+the callback for each one.  The arguments and the results are the same as for
+AVLDupIterate.  The tree is locked for reading during the iteration, so the
+callback mustn't change the tree. */
+
+bool AVLDupLSMIterate (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  MergeSourcePointer          BestSourcePntr;
+  AVLDupThingPointer          BestKeyPntr;
+  AVLDupThingPointer          BestValuePntr;
+  int                         i;
+  char                       *KeyBufferPntr;
+  char                       *KeyBuffersPntr;
+  size_t                      KeyBuffersSize;
+  AVLDupThingPointer          KeyPntr;
+  SortedRunPointer            MemtableAddsPntr;
+  SortedRunPointer            MemtableDeletesPntr;
+  int                         NumberOfSources;
+  MergeSourcePointer          SourcePntr;
+  MergeSourceRecord           SourcesArray [MAX_RUNS + 2];
+  bool                        Successful;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  AVLDupSetUpIterationArguments (TreePntr->addTreePntr, &Arguments,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+
+  if (!LockTree (TreePntr, false))
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  /* Make the list of sources, newest first, so that when several have the
+  same pair the first one found is the one that counts.  The two memtable
+  trees never have a pair in common, so their order doesn't matter. */
+
+  Successful = false;
+  MemtableAddsPntr = AllocateRun (TreePntr->addTreePntr->count, false);
+  MemtableDeletesPntr = AllocateRun (TreePntr->deleteTreePntr->count, false);
+
+  /* Each run with front coded keys needs its own buffer for decoding them,
+  so that the best key found so far stays put while the others are looked
+  at.  The writers' buffer can't be used since there may be other readers. */
+
+  KeyBuffersSize = 0;
+  for (i = 0; i < (int) TreePntr->numberOfRuns; i++)
+    if (TreePntr->runsArray[i]->keyArray == NULL)
+      KeyBuffersSize += TreePntr->runsArray[i]->longestKeyLength + 1;
+  KeyBuffersPntr = malloc (KeyBuffersSize + 1);
+
+  if (MemtableAddsPntr == NULL || MemtableDeletesPntr == NULL ||
+  KeyBuffersPntr == NULL)
+    goto ExitWithLock;
+
+  CollectMemtableRange (&Arguments, TreePntr->addTreePntr->rootPntr,
+    StartKeyPntr != NULL, EndKeyPntr != NULL, MemtableAddsPntr);
+  memset (MemtableAddsPntr->tombstoneArray, 0, MemtableAddsPntr->count);
+  CollectMemtableRange (&Arguments, TreePntr->deleteTreePntr->rootPntr,
+    StartKeyPntr != NULL, EndKeyPntr != NULL, MemtableDeletesPntr);
+  memset (MemtableDeletesPntr->tombstoneArray, 1, MemtableDeletesPntr->count);
+
+  NumberOfSources = 0;
+  SourcesArray[NumberOfSources].runPntr = MemtableAddsPntr;
+  SourcesArray[NumberOfSources].position = 0;
+  SourcesArray[NumberOfSources].endPosition = MemtableAddsPntr->count;
+  StartRunCursor (&SourcesArray[NumberOfSources++].cursor, MemtableAddsPntr,
+    NULL);
+  SourcesArray[NumberOfSources].runPntr = MemtableDeletesPntr;
+  SourcesArray[NumberOfSources].position = 0;
+  SourcesArray[NumberOfSources].endPosition = MemtableDeletesPntr->count;
+  StartRunCursor (&SourcesArray[NumberOfSources++].cursor, MemtableDeletesPntr,
+    NULL);
+
+  KeyBufferPntr = KeyBuffersPntr;
+  for (i = (int) TreePntr->numberOfRuns - 1; i >= 0; i--)
+  {
+    SourcePntr = &SourcesArray[NumberOfSources++];
+    StartRunCursor (&SourcePntr->cursor, TreePntr->runsArray[i],
+      KeyBufferPntr);
+    if (TreePntr->runsArray[i]->keyArray == NULL)
+      KeyBufferPntr += TreePntr->runsArray[i]->longestKeyLength + 1;
+    FindRangeInRun (&Arguments, StartKeyPntr != NULL, EndKeyPntr != NULL,
+      SourcePntr);
+  }
+
+  /* Repeatedly take the smallest pair.  There are only a few sources, so
+  looking at each of them is quicker than keeping a priority queue. */
+
+  Successful = true;
+  while (true)
+  {
+    BestSourcePntr = NULL;
+    for (SourcePntr = SourcesArray;
+    SourcePntr < SourcesArray + NumberOfSources;
+    SourcePntr++)
+    {
+      if (SourcePntr->position >= SourcePntr->endPosition)
+        continue;
+      KeyPntr = GetRunKey (&SourcePntr->cursor, SourcePntr->position);
+      if (BestSourcePntr == NULL || ComparePairs (TreePntr, KeyPntr,
+      SourcePntr->runPntr->valueArray + SourcePntr->position,
+      BestKeyPntr, BestValuePntr) < 0)
+      {
+        BestSourcePntr = SourcePntr;
+        BestKeyPntr = KeyPntr;
+        BestValuePntr = SourcePntr->runPntr->valueArray + SourcePntr->position;
+      }
+    }
+    if (BestSourcePntr == NULL)
+      break; /* All done. */
+
+    /* Skip over the same pair in the older sources. */
+
+    for (SourcePntr = BestSourcePntr + 1;
+    SourcePntr < SourcesArray + NumberOfSources;
+    SourcePntr++)
+    {
+      if (SourcePntr->position < SourcePntr->endPosition &&
+      ComparePairs (TreePntr,
+      GetRunKey (&SourcePntr->cursor, SourcePntr->position),
+      SourcePntr->runPntr->valueArray + SourcePntr->position,
+      BestKeyPntr, BestValuePntr) == 0)
+        SourcePntr->position++;
+    }
+
+    if (!BestSourcePntr->runPntr->tombstoneArray[BestSourcePntr->position] &&
+    !CallbackFunctionPntr (BestKeyPntr, BestValuePntr, ExtraUserData))
+    {
+      Successful = false; /* The user requested an early abort. */
+      break;
+    }
+
+    BestSourcePntr->position++;
+  }
+
+ExitWithLock:
+  UnlockTree (TreePntr, false);
+
+  /* The temporary runs borrowed the memtable's strings, don't free those. */
+
+  if (MemtableAddsPntr != NULL)
+    DeallocateRun (TreePntr, MemtableAddsPntr, false);
+  if (MemtableDeletesPntr != NULL)
+    DeallocateRun (TreePntr, MemtableDeletesPntr, false);
+  if (KeyBuffersPntr != NULL)
+    free (KeyBuffersPntr);
+
+  return Successful;
+}
@@ -0,0 +1,523 @@
+/******************************************************************************
+ * AVLDupLatency.c
+ *
+ * Optional latency histograms for AVLDupAdd, AVLDupDelete and AVLDupIterate,
+ * so that you can see where the slow operations come from.  Each operation
+ * records two times: how long it waited to get the tree's access semaphore,
+ * and how long it then held the lock doing the actual work.  If writers
+ * have a long tail of lock waits while the work times are all short, then
+ * they're stuck behind long running readers (iterations).
+ *
+ * The histograms are in the same style as HDR histograms: the bucket for a
+ * time is found from its power of two magnitude, and each power of two range
+ * is split into 4 equal sub-buckets.  Times from 0 to 3 microseconds get a
+ * bucket each, and the rest are recorded to within 25% of their value, up to
+ * about 12 days.  Recording a time just does a few atomic adds, so several
+ * readers can record at the same time without any locking.
+ *
+ * Timing is off until you call AVLDupEnableLatencyHistograms, and costs just
+ * a test of a pointer per operation when it is off.  Use
+ * AVLDupGetLatencySnapshot to copy the histograms (and optionally start them
+ * over), and AVLDupPrintLatencySnapshot to print a copy out as a table or as
+ * JSON.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Number of linear sub-buckets in each power of two range, and its log. */
+
+#define SUB_BUCKETS 4
+#define SUB_BUCKET_BITS 2
+
+
+/* The histogram while it is being recorded into.  The counts are int32 and
+int64 so that they can be updated with the atomic functions, and are copied
+into an AVLDupLatencyHistogramRecord for the user. */
+
+typedef struct LiveHistogramStruct
+{
+  int32 counts [AVLDUP_LATENCY_BUCKETS];
+  int64 totalCount;
+  int64 totalTime;
+  int64 maximumTime;
+} LiveHistogramRecord, *LiveHistogramPointer;
+
+
+/* The latency information for a tree.  Once allocated it stays around until
+the tree is freed, since operations look at it without holding the lock;
+turning timing off just clears the enabled flag. */
+
+struct AVLDupLatencyStruct
+{
+  int32               enabled;
+  int64               resetTime;
+  LiveHistogramRecord lockWait [AVLDUP_LATENCY_OPERATIONS];
+  LiveHistogramRecord work [AVLDUP_LATENCY_OPERATIONS];
+};
+
+
+static const char *OperationNames [AVLDUP_LATENCY_OPERATIONS] =
+{
+  "add",
+  "delete",
+  "iterate"
+};
+
+
+
+/* Returns the bucket to count a time in. */
+
+static int BucketForTime (bigtime_t Time)
+{
+  int Bucket;
+  int Magnitude;
+
+  if (Time < SUB_BUCKETS)
+    return (Time < 0) ? 0 : (int) Time;
+
+  /* Find the power of two, the position of the highest one bit. */
+
+  Magnitude = SUB_BUCKET_BITS;
+  while ((Time >> (Magnitude + 1)) != 0)
+    Magnitude++;
+
+  Bucket = (Magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+    (int) ((Time >> (Magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+
+  if (Bucket >= AVLDUP_LATENCY_BUCKETS)
+    Bucket = AVLDUP_LATENCY_BUCKETS - 1;
+  return Bucket;
+}
+
+
+
+/* Returns the smallest time which goes into the given bucket. */
+
+static bigtime_t LowestTimeInBucket (int Bucket)
+{
+  int Magnitude;
+
+  if (Bucket < SUB_BUCKETS)
+    return Bucket;
+
+  Magnitude = Bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  return (bigtime_t) (SUB_BUCKETS + Bucket % SUB_BUCKETS) <<
+    (Magnitude - SUB_BUCKET_BITS);
+}
+
+
+
+static void RecordTime (LiveHistogramPointer HistogramPntr, bigtime_t Time)
+{
+  int64 OldMaximum;
+
+  if (Time < 0)
+    Time = 0; /* In case the clock goes backwards. */
+
+  atomic_add (&HistogramPntr->counts[BucketForTime (Time)], 1);
+  atomic_add64 (&HistogramPntr->totalCount, 1);
+  atomic_add64 (&HistogramPntr->totalTime, Time);
+
+  /* Raise the maximum, unless some other thread has already raised it past
+  our time. */
+
+  OldMaximum = atomic_get64 (&HistogramPntr->maximumTime);
+  while (Time > OldMaximum)
+  {
+    OldMaximum = atomic_test_and_set64 (&HistogramPntr->maximumTime,
+      Time, OldMaximum);
+  }
+}
+
+
+
+/* Copies a live histogram into the user's format, optionally zeroing it.
+Each field is individually atomic, so a snapshot taken while operations are
+being recorded may have a count or two missing from the totals. */
+
+static void CopyHistogram (
+  LiveHistogramPointer          LivePntr,
+  AVLDupLatencyHistogramPointer CopyPntr,
+  bool                          Reset)
+{
+  int i;
+
+  for (i = 0; i < AVLDUP_LATENCY_BUCKETS; i++)
+    CopyPntr->counts[i] = Reset ?
+      atomic_get_and_set (&LivePntr->counts[i], 0) :
+      atomic_get (&LivePntr->counts[i]);
+
+  if (Reset)
+  {
+    CopyPntr->totalCount = atomic_get_and_set64 (&LivePntr->totalCount, 0);
+    CopyPntr->totalTime = atomic_get_and_set64 (&LivePntr->totalTime, 0);
+    CopyPntr->maximumTime = atomic_get_and_set64 (&LivePntr->maximumTime, 0);
+  }
+  else
+  {
+    CopyPntr->totalCount = atomic_get64 (&LivePntr->totalCount);
+    CopyPntr->totalTime = atomic_get64 (&LivePntr->totalTime);
+    CopyPntr->maximumTime = atomic_get64 (&LivePntr->maximumTime);
+  }
+}
+
+
+
+/* Called by an operation before it tries to lock the tree.  Returns NULL if
+timing is turned off for the tree, otherwise sets *StartTimePntr to the
+current time and returns the latency record to pass to
+AVLDupLatencyRecordTimes once the operation is done. */
+
+AVLDupLatencyPointer AVLDupLatencyStart (
+  AVLDupTreePointer TreePntr,
+  bigtime_t *StartTimePntr)
+{
+  AVLDupLatencyPointer LatencyPntr;
+
+  LatencyPntr = TreePntr->latencyPntr;
+  if (LatencyPntr == NULL || !LatencyPntr->enabled)
+    return NULL;
+
+  *StartTimePntr = system_time ();
+  return LatencyPntr;
+}
+
+
+
+/* Records the times for an operation, called just after it has unlocked the
+tree.  LockedTime is when it got the lock. */
+
+void AVLDupLatencyRecordTimes (
+  AVLDupLatencyPointer LatencyPntr,
+  AVLDupLatencyOperation Operation,
+  bigtime_t StartTime,
+  bigtime_t LockedTime)
+{
+  bigtime_t EndTime;
+
+  EndTime = system_time ();
+  RecordTime (&LatencyPntr->lockWait[Operation], LockedTime - StartTime);
+  RecordTime (&LatencyPntr->work[Operation], EndTime - LockedTime);
+}
+
+
+
+/* Turns the latency histograms on or off for a tree.  The first time they
+are turned on the histograms are allocated (and stay around until the tree
+is freed), turning them on again later continues with the existing counts.
+Returns FALSE if it ran out of memory or couldn't lock the tree. */
+
+bool AVLDupEnableLatencyHistograms (
+  AVLDupTreePointer TreePntr,
+  bool Enable)
+{
+  status_t             ErrorCode;
+  AVLDupLatencyPointer NewLatencyPntr;
+
+  if (TreePntr == NULL)
+    return false;
+
+  if (TreePntr->latencyPntr == NULL)
+  {
+    if (!Enable)
+      return true; /* Never turned on, nothing to do. */
+
+    NewLatencyPntr = calloc (1, sizeof (AVLDupLatencyRecord));
+    if (NewLatencyPntr == NULL)
+      return false;
+    NewLatencyPntr->resetTime = system_time ();
+
+    /* Install it while holding the writer lock, so that no operations are
+    in progress when the pointer changes. */
+
+    if (TreePntr->accessSemaphoreID >= 0)
+    {
+      ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+        TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+      if (ErrorCode < 0)
+      {
+        free (NewLatencyPntr);
+        return false; /* Semaphore was deleted or a signal interrupted us. */
+      }
+    }
+
+    if (TreePntr->latencyPntr == NULL)
+      TreePntr->latencyPntr = NewLatencyPntr;
+    else /* Some other thread beat us to it. */
+      free (NewLatencyPntr);
+
+    if (TreePntr->accessSemaphoreID >= 0)
+      release_sem_etc (TreePntr->accessSemaphoreID,
+        TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+
+  atomic_set (&TreePntr->latencyPntr->enabled, Enable ? 1 : 0);
+  return true;
+}
+
+
+
+/* Copies the tree's latency histograms into the user provided snapshot
+record.  If ResetAfterwards is TRUE then the histograms are started over, so
+that the next snapshot only covers the time after this one.  Doesn't need to
+lock the tree.  Returns FALSE if latency histograms were never turned on for
+the tree. */
+
+bool AVLDupGetLatencySnapshot (
+  AVLDupTreePointer TreePntr,
+  AVLDupLatencySnapshotPointer SnapshotPntr,
+  bool ResetAfterwards)
+{
+  AVLDupLatencyPointer LatencyPntr;
+  int                  Operation;
+
+  if (TreePntr == NULL || SnapshotPntr == NULL)
+    return false;
+
+  LatencyPntr = TreePntr->latencyPntr;
+  if (LatencyPntr == NULL)
+    return false;
+
+  SnapshotPntr->endTime = system_time ();
+  if (ResetAfterwards)
+    SnapshotPntr->startTime =
+      atomic_get_and_set64 (&LatencyPntr->resetTime, SnapshotPntr->endTime);
+  else
+    SnapshotPntr->startTime = atomic_get64 (&LatencyPntr->resetTime);
+
+  for (Operation = 0; Operation < AVLDUP_LATENCY_OPERATIONS; Operation++)
+  {
+    CopyHistogram (&LatencyPntr->lockWait[Operation],
+      &SnapshotPntr->lockWait[Operation], ResetAfterwards);
+    CopyHistogram (&LatencyPntr->work[Operation],
+      &SnapshotPntr->work[Operation], ResetAfterwards);
+  }
+
+  return true;
+}
+
+
+
+/* Adds a time to a histogram record of your own, for programs (like the
+benchmarks) which want to measure things the same way.  The time can be in
+any unit, the buckets don't care.  Not thread safe, use one histogram per
+thread and add them up afterwards. */
+
+void AVLDupAddToLatencyHistogram (
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  bigtime_t Time)
+{
+  if (HistogramPntr == NULL)
+    return;
+
+  if (Time < 0)
+    Time = 0;
+
+  HistogramPntr->counts[BucketForTime (Time)]++;
+  HistogramPntr->totalCount++;
+  HistogramPntr->totalTime += Time;
+  if (Time > HistogramPntr->maximumTime)
+    HistogramPntr->maximumTime = Time;
+}
+
+
+
+/* Returns the time which the given percentage (0 to 100) of the recorded
+times are at or below.  Since the counts are in buckets, the answer is the
+largest time in the bucket holding that percentile (but never more than the
+largest time actually recorded).  Returns zero for an empty histogram. */
+
+bigtime_t AVLDupLatencyPercentile (
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  double Percentile)
+{
+  int       Bucket;
+  uint64    RunningCount;
+  uint64    TargetCount;
+  bigtime_t Time;
+
+  if (HistogramPntr == NULL || HistogramPntr->totalCount == 0)
+    return 0;
+
+  if (Percentile <= 0.0)
+    TargetCount = 1;
+  else if (Percentile >= 100.0)
+    return HistogramPntr->maximumTime;
+  else
+  {
+    TargetCount =
+      (uint64) (HistogramPntr->totalCount * Percentile / 100.0 + 0.999999);
+    if (TargetCount < 1)
+      TargetCount = 1;
+  }
+
+  RunningCount = 0;
+  for (Bucket = 0; Bucket < AVLDUP_LATENCY_BUCKETS - 1; Bucket++)
+  {
+    RunningCount += HistogramPntr->counts[Bucket];
+    if (RunningCount >= TargetCount)
+    {
+      Time = LowestTimeInBucket (Bucket + 1) - 1;
+      return (Time < HistogramPntr->maximumTime) ?
+        Time : HistogramPntr->maximumTime;
+    }
+  }
+
+  return HistogramPntr->maximumTime;
+}
+
+
+
+/* Prints a JSON string, with quotes, escaping characters as needed.  Also
+used by the other report printing functions in the library. */
+
+void AVLDupPrintJSONString (const char *StringPntr, FILE *OutputFile)
+{
+  unsigned char Letter;
+
+  fputc ('"', OutputFile);
+  while ((Letter = (unsigned char) *StringPntr++) != 0)
+  {
+    if (Letter == '"' || Letter == '\\')
+      fprintf (OutputFile, "\\%c", Letter);
+    else if (Letter < 32)
+      fprintf (OutputFile, "\\u%04x", Letter);
+    else
+      fputc (Letter, OutputFile);
+  }
+  fputc ('"', OutputFile);
+}
+
+
+
+static void PrintJSONHistogram (
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  FILE *OutputFile)
+{
+  int  Bucket;
+  bool First;
+
+  fprintf (OutputFile, "{\"count\": %llu, \"mean\": %.1f, \"p50\": %lld, "
+    "\"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld, "
+    "\"buckets\": [",
+    (unsigned long long) HistogramPntr->totalCount,
+    (HistogramPntr->totalCount == 0) ? 0.0 :
+      (double) HistogramPntr->totalTime / HistogramPntr->totalCount,
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 50.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 90.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.9),
+    (long long) HistogramPntr->maximumTime);
+
+  /* Just the non-empty buckets, as [lowest time, count] pairs. */
+
+  First = true;
+  for (Bucket = 0; Bucket < AVLDUP_LATENCY_BUCKETS; Bucket++)
+  {
+    if (HistogramPntr->counts[Bucket] == 0)
+      continue;
+    fprintf (OutputFile, "%s[%lld, %lu]", First ? "" : ", ",
+      (long long) LowestTimeInBucket (Bucket),
+      (unsigned long) HistogramPntr->counts[Bucket]);
+    First = false;
+  }
+
+  fprintf (OutputFile, "]}");
+}
+
+
+
+static void PrintTextHistogram (
+  const char *OperationName,
+  const char *PhaseName,
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  FILE *OutputFile)
+{
+  fprintf (OutputFile,
+    "%-8s %-10s %10llu %10.1f %8lld %8lld %8lld %8lld %10lld\n",
+    OperationName, PhaseName,
+    (unsigned long long) HistogramPntr->totalCount,
+    (HistogramPntr->totalCount == 0) ? 0.0 :
+      (double) HistogramPntr->totalTime / HistogramPntr->totalCount,
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 50.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 90.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.0),
+    (long long) AVLDupLatencyPercentile (HistogramPntr, 99.9),
+    (long long) HistogramPntr->maximumTime);
+}
+
+
+
+/* Prints out a snapshot, either as a table for people to read or as a JSON
+object for feeding to other programs.  The JSON object has the index name,
+the number of seconds covered, and then an object for each operation with
+"lockWait" and "work" histograms, each giving the count, mean, percentiles,
+maximum and the non-empty buckets.  All times are in microseconds.
+IndexName can be NULL.  Returns FALSE if there was an error writing. */
+
+bool AVLDupPrintLatencySnapshot (
+  AVLDupLatencySnapshotPointer SnapshotPntr,
+  const char *IndexName,
+  bool AsJSON,
+  FILE *OutputFile)
+{
+  double Seconds;
+  int    Operation;
+
+  if (SnapshotPntr == NULL || OutputFile == NULL)
+    return false;
+
+  Seconds = (SnapshotPntr->endTime - SnapshotPntr->startTime) / 1000000.0;
+
+  if (AsJSON)
+  {
+    fprintf (OutputFile, "{\"index\": ");
+    if (IndexName == NULL)
+      fprintf (OutputFile, "null");
+    else
+      AVLDupPrintJSONString (IndexName, OutputFile);
+    fprintf (OutputFile, ", \"seconds\": %.3f", Seconds);
+
+    for (Operation = 0; Operation < AVLDUP_LATENCY_OPERATIONS; Operation++)
+    {
+      fprintf (OutputFile, ",\n  \"%s\": {\"lockWait\": ",
+        OperationNames[Operation]);
+      PrintJSONHistogram (&SnapshotPntr->lockWait[Operation], OutputFile);
+      fprintf (OutputFile, ",\n    \"work\": ");
+      PrintJSONHistogram (&SnapshotPntr->work[Operation], OutputFile);
+      fprintf (OutputFile, "}");
+    }
+
+    fprintf (OutputFile, "}\n");
+  }
+  else
+  {
+    fprintf (OutputFile, "Latency of %s over %.3f seconds, in microseconds:\n",
+      (IndexName == NULL) ? "unnamed tree" : IndexName, Seconds);
+    fprintf (OutputFile, "%-8s %-10s %10s %10s %8s %8s %8s %8s %10s\n",
+      "Op", "Phase", "Count", "Mean", "p50", "p90", "p99", "p99.9", "Max");
+
+    for (Operation = 0; Operation < AVLDUP_LATENCY_OPERATIONS; Operation++)
+    {
+      PrintTextHistogram (OperationNames[Operation], "lock wait",
+        &SnapshotPntr->lockWait[Operation], OutputFile);
+      PrintTextHistogram (OperationNames[Operation], "work",
+        &SnapshotPntr->work[Operation], OutputFile);
+    }
+  }
+
+  return !ferror (OutputFile);
+}
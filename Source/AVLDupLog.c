@@ -0,0 +1,817 @@
+/******************************************************************************
+ * AVLDupLog.c
+ *
+ * An optional write-ahead log for an AVLDupTree.  Once a log is attached
+ * with AVLDupAttachLog, every key/value pair added or deleted is appended to
+ * the log file as a small binary record, and AVLDupAdd / AVLDupDelete don't
+ * return until their record is safely on disk.  After a crash, attaching the
+ * same log file to a freshly loaded tree replays the changes, so an index
+ * can be kept up to date with one sequential write per batch of changes
+ * rather than saving the whole tree every so often.  AVLDupCheckpointTree
+ * saves the tree with AVLDupSaveTree and then empties the log, which keeps
+ * the recovery time down.
+ *
+ * Forcing data to disk (fsync) is slow, typically a few milliseconds, so the
+ * log uses group commit.  Records are appended to a memory buffer while the
+ * tree's writer lock is held, then the writer releases the tree lock and
+ * waits for the log flush semaphore.  Whoever gets the flush semaphore writes
+ * out everything that has accumulated in the buffer so far (its own record
+ * plus those of all the other writers that queued up while the previous
+ * flush was going on) with a single write and a single fsync.  When the
+ * waiting writers get their turn, they find that their records are already
+ * on disk and return immediately.  So with many writers, the number of
+ * fsyncs per second stays about the same while the number of changes per
+ * fsync goes up.
+ *
+ * The log file starts with a 16 byte header (magic number, version, key and
+ * value types), then has a sequence of records.  Each record is the length
+ * of the payload (4 bytes), the payload and a CRC-32 of the payload (4
+ * bytes).  The payload is an operation code byte followed by the key and the
+ * value.  Numbers are stored in 4 or 8 bytes as appropriate, strings as a
+ * length (7 bits per byte, high bit set on all but the last byte) followed by
+ * the characters without the NUL.  Everything is little endian.  A record
+ * which is cut short or has a bad checksum is assumed to be the tail end of
+ * a write which was interrupted by a crash; it and everything after it is
+ * thrown away when the log is replayed.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <ByteOrder.h>
+#include <OS.h>
+#include <TypeConstants.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+#define AVLDUP_LOG_MAGIC 0x4C4C5641 /* "AVLL" when read as bytes. */
+#define AVLDUP_LOG_VERSION 1
+
+/* Operation codes stored in the first byte of a record's payload. */
+
+#define LOG_OP_ADD 1
+#define LOG_OP_DELETE 2
+
+/* Record payloads bigger than this are assumed to be garbage. */
+
+#define MAX_PAYLOAD_SIZE 0x40000000UL
+
+/* Starting size of the append buffer.  It grows as needed. */
+
+#define INITIAL_BUFFER_SIZE 4096
+
+
+typedef struct AVLDupLogHeaderStruct
+{
+  uint32 magic;
+  uint32 version;
+  uint32 keyType;
+  uint32 valueType;
+} AVLDupLogHeaderRecord, *AVLDupLogHeaderPointer;
+
+
+/* The log attached to a tree.  The append buffer fields are protected by the
+buffer semaphore, since records get appended (by a thread holding the tree's
+writer lock) while another thread may be writing out the previous batch.
+The spare buffer and the file are only touched by the thread holding the
+flush semaphore.  Positions count bytes of records ever appended to the log
+and keep going up even when a checkpoint empties the file, so a writer can
+remember the position of its record and later check whether it has been
+flushed. */
+
+struct AVLDupLogStruct
+{
+  int            fileDescriptor;
+  type_code      keyType;
+  type_code      valueType;
+  sem_id         bufferSemaphoreID;
+  sem_id         flushSemaphoreID;
+  char          *bufferPntr; /* Records not written to the file yet. */
+  size_t         bufferSize;
+  size_t         bufferUsed;
+  char          *spareBufferPntr; /* Swapped with bufferPntr when flushing. */
+  size_t         spareBufferSize;
+  int64          appendedPosition; /* End of the last record appended. */
+  int64          durablePosition; /* End of the last record known on disk. */
+  volatile bool  failed; /* Set when writing fails, cleared by checkpoint. */
+};
+
+
+/* Table for the usual CRC-32 (the one used by zip and ethernet), filled in
+the first time a log is attached.  Several threads filling it in at the same
+time is harmless since they all store the same values. */
+
+static uint32 CRCTable [256];
+static bool CRCTableReady = false;
+
+
+
+static void MakeCRCTable (void)
+{
+  uint32 CRC;
+  int    i;
+  int    j;
+
+  for (i = 0; i < 256; i++)
+  {
+    CRC = i;
+    for (j = 0; j < 8; j++)
+      CRC = (CRC & 1) ? (0xEDB88320UL ^ (CRC >> 1)) : (CRC >> 1);
+    CRCTable[i] = CRC;
+  }
+  CRCTableReady = true;
+}
+
+
+
+static uint32 ComputeCRC (const uint8 *DataPntr, size_t DataSize)
+{
+  uint32 CRC;
+
+  CRC = 0xFFFFFFFFUL;
+  while (DataSize-- > 0)
+    CRC = CRCTable[(CRC ^ *DataPntr++) & 0xFF] ^ (CRC >> 8);
+  return CRC ^ 0xFFFFFFFFUL;
+}
+
+
+
+/* Returns the number of bytes needed to store the given thing in a log
+record.  Also used for the operation traces in AVLDupRecorder.c. */
+
+size_t AVLDupEncodedThingSize (
+  AVLDupThingConstPointer ThingPntr,
+  type_code Type)
+{
+  size_t StringLength;
+  size_t Size;
+
+  switch (Type)
+  {
+    case B_INT32_TYPE:
+    case B_FLOAT_TYPE:
+      return 4;
+
+    case B_INT64_TYPE:
+    case B_DOUBLE_TYPE:
+      return 8;
+  }
+
+  /* A string, its length followed by the characters. */
+
+  StringLength = strlen (AVLDupGetStringPntrFromThing (*ThingPntr));
+  Size = StringLength + 1;
+  while (StringLength >= 0x80)
+  {
+    StringLength >>= 7;
+    Size++;
+  }
+  return Size;
+}
+
+
+
+/* Stores the thing at the given place in a log record, returns the place
+just after it. */
+
+uint8 *AVLDupEncodeThing (
+  uint8 *DestPntr,
+  AVLDupThingConstPointer ThingPntr,
+  type_code Type)
+{
+  uint32      Number32;
+  uint64      Number64;
+  const char *StringPntr;
+  size_t      StringLength;
+
+  switch (Type)
+  {
+    case B_INT32_TYPE:
+    case B_FLOAT_TYPE:
+      Number32 = B_HOST_TO_LENDIAN_INT32 (ThingPntr->int32Thing);
+      memcpy (DestPntr, &Number32, 4);
+      return DestPntr + 4;
+
+    case B_INT64_TYPE:
+    case B_DOUBLE_TYPE:
+      Number64 = B_HOST_TO_LENDIAN_INT64 (ThingPntr->int64Thing);
+      memcpy (DestPntr, &Number64, 8);
+      return DestPntr + 8;
+  }
+
+  StringPntr = AVLDupGetStringPntrFromThing (*ThingPntr);
+  StringLength = strlen (StringPntr);
+  Number64 = StringLength;
+  while (Number64 >= 0x80)
+  {
+    *DestPntr++ = (uint8) (Number64 | 0x80);
+    Number64 >>= 7;
+  }
+  *DestPntr++ = (uint8) Number64;
+  memcpy (DestPntr, StringPntr, StringLength);
+  return DestPntr + StringLength;
+}
+
+
+
+/* Decodes a thing from a log record payload, returns the place just after it
+or NULL if the payload is too short.  Strings are copied to the string
+buffer, which must have room for the whole payload plus a NUL, and the thing
+is made into a long string pointing at the copy (AVLDupCopyThingArray turns
+it into a short string if it is short enough).  Also used for reading
+operation traces. */
+
+const uint8 *AVLDupDecodeThing (
+  const uint8 *SourcePntr,
+  const uint8 *EndPntr,
+  type_code Type,
+  char **StringBufferPntrPntr,
+  AVLDupThingPointer ThingPntr)
+{
+  uint32 Number32;
+  uint64 Number64;
+  int    Shift;
+
+  memset (ThingPntr, 0, sizeof (AVLDupThingRecord));
+
+  switch (Type)
+  {
+    case B_INT32_TYPE:
+    case B_FLOAT_TYPE:
+      if (EndPntr - SourcePntr < 4)
+        return NULL;
+      memcpy (&Number32, SourcePntr, 4);
+      ThingPntr->int32Thing = B_LENDIAN_TO_HOST_INT32 (Number32);
+      return SourcePntr + 4;
+
+    case B_INT64_TYPE:
+    case B_DOUBLE_TYPE:
+      if (EndPntr - SourcePntr < 8)
+        return NULL;
+      memcpy (&Number64, SourcePntr, 8);
+      ThingPntr->int64Thing = B_LENDIAN_TO_HOST_INT64 (Number64);
+      return SourcePntr + 8;
+  }
+
+  Number64 = 0;
+  Shift = 0;
+  do
+  {
+    if (SourcePntr >= EndPntr || Shift > 28)
+      return NULL;
+    Number64 |= (uint64) (*SourcePntr & 0x7F) << Shift;
+    Shift += 7;
+  } while (*SourcePntr++ & 0x80);
+
+  if (Number64 > (uint64) (EndPntr - SourcePntr))
+    return NULL;
+
+  memcpy (*StringBufferPntrPntr, SourcePntr, Number64);
+  (*StringBufferPntrPntr)[Number64] = 0;
+  ThingPntr->longStringThing.stringPntr = *StringBufferPntrPntr;
+  ThingPntr->longStringThing.isLongString = 1;
+  *StringBufferPntrPntr += Number64 + 1;
+  return SourcePntr + Number64;
+}
+
+
+
+/* Appends a record for an added or deleted key/value pair to the log's
+memory buffer.  Called by AVLDupAddWithoutLocking and
+AVLDupDeleteWithoutLocking after they have changed the tree, so the tree's
+writer lock is held.  The record isn't on disk until somebody calls
+AVLDupLogWaitUntilDurable.  If there isn't enough memory for the record, the
+log is marked as failed and every wait will return FALSE until the next
+checkpoint. */
+
+void AVLDupLogChange (
+  AVLDupLogPointer   LogPntr,
+  bool               IsAddition,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  uint32  CRC;
+  uint8  *DestPntr;
+  size_t  NewSize;
+  char   *NewBufferPntr;
+  uint32  PayloadSize;
+  uint8  *PayloadPntr;
+  size_t  RecordSize;
+
+  PayloadSize = 1 + AVLDupEncodedThingSize (Key, LogPntr->keyType) +
+    AVLDupEncodedThingSize (Value, LogPntr->valueType);
+  RecordSize = 4 + PayloadSize + 4;
+
+  if (acquire_sem (LogPntr->bufferSemaphoreID) < B_OK)
+  {
+    LogPntr->failed = true;
+    return;
+  }
+
+  if (LogPntr->bufferUsed + RecordSize > LogPntr->bufferSize)
+  {
+    NewSize = LogPntr->bufferSize * 2;
+    while (NewSize < LogPntr->bufferUsed + RecordSize)
+      NewSize *= 2;
+    NewBufferPntr = realloc (LogPntr->bufferPntr, NewSize);
+    if (NewBufferPntr == NULL)
+    {
+      LogPntr->failed = true;
+      goto ErrorExit;
+    }
+    LogPntr->bufferPntr = NewBufferPntr;
+    LogPntr->bufferSize = NewSize;
+  }
+
+  DestPntr = (uint8 *) LogPntr->bufferPntr + LogPntr->bufferUsed;
+  PayloadSize = B_HOST_TO_LENDIAN_INT32 (PayloadSize);
+  memcpy (DestPntr, &PayloadSize, 4);
+  DestPntr += 4;
+  PayloadPntr = DestPntr;
+  *DestPntr++ = IsAddition ? LOG_OP_ADD : LOG_OP_DELETE;
+  DestPntr = AVLDupEncodeThing (DestPntr, Key, LogPntr->keyType);
+  DestPntr = AVLDupEncodeThing (DestPntr, Value, LogPntr->valueType);
+  CRC = B_HOST_TO_LENDIAN_INT32 (
+    ComputeCRC (PayloadPntr, DestPntr - PayloadPntr));
+  memcpy (DestPntr, &CRC, 4);
+
+  LogPntr->bufferUsed += RecordSize;
+  LogPntr->appendedPosition += RecordSize;
+
+ErrorExit:
+  release_sem (LogPntr->bufferSemaphoreID);
+}
+
+
+
+/* Returns the position just after the last record appended.  Call it while
+holding the tree's writer lock, right after the change, then pass the result
+to AVLDupLogWaitUntilDurable after releasing the lock. */
+
+int64 AVLDupLogGetAppendedPosition (AVLDupLogPointer LogPntr)
+{
+  return LogPntr->appendedPosition;
+}
+
+
+
+/* Writes out everything in the append buffer with a single write and
+forces it to disk.  The caller must hold the flush semaphore. */
+
+static void FlushBuffer (AVLDupLogPointer LogPntr)
+{
+  char    *DataPntr;
+  size_t   DataSize;
+  int64    EndPosition;
+  ssize_t  AmountWritten;
+  char    *TempPntr;
+  size_t   TempSize;
+
+  if (acquire_sem (LogPntr->bufferSemaphoreID) < B_OK)
+  {
+    LogPntr->failed = true;
+    return;
+  }
+
+  /* Swap in the empty spare buffer so that writers can keep on appending
+  while this batch is being written. */
+
+  DataPntr = LogPntr->bufferPntr;
+  DataSize = LogPntr->bufferUsed;
+  EndPosition = LogPntr->appendedPosition;
+  TempPntr = LogPntr->spareBufferPntr;
+  TempSize = LogPntr->spareBufferSize;
+  LogPntr->spareBufferPntr = DataPntr;
+  LogPntr->spareBufferSize = LogPntr->bufferSize;
+  LogPntr->bufferPntr = TempPntr;
+  LogPntr->bufferSize = TempSize;
+  LogPntr->bufferUsed = 0;
+
+  release_sem (LogPntr->bufferSemaphoreID);
+
+  while (DataSize > 0 && !LogPntr->failed)
+  {
+    AmountWritten = write (LogPntr->fileDescriptor, DataPntr, DataSize);
+    if (AmountWritten < 0)
+    {
+      if (errno != EINTR)
+        LogPntr->failed = true;
+    }
+    else
+    {
+      DataPntr += AmountWritten;
+      DataSize -= AmountWritten;
+    }
+  }
+
+  if (!LogPntr->failed && fsync (LogPntr->fileDescriptor) != 0)
+    LogPntr->failed = true;
+
+  if (!LogPntr->failed)
+    LogPntr->durablePosition = EndPosition;
+}
+
+
+
+/* Waits until the log is on disk up to the given position (from
+AVLDupLogGetAppendedPosition), doing the writing if nobody else is.  Call
+it without holding the tree lock, so that other writers can append their
+records while the disk is busy and get them written in the next batch.
+Returns TRUE if the records are on disk, FALSE if the log has failed. */
+
+bool AVLDupLogWaitUntilDurable (
+  AVLDupLogPointer LogPntr,
+  int64 Position)
+{
+  bool Successful;
+
+  if (acquire_sem (LogPntr->flushSemaphoreID) < B_OK)
+    return false;
+
+  if (LogPntr->durablePosition < Position && !LogPntr->failed)
+    FlushBuffer (LogPntr);
+
+  Successful = (!LogPntr->failed && LogPntr->durablePosition >= Position);
+
+  release_sem (LogPntr->flushSemaphoreID);
+
+  return Successful;
+}
+
+
+
+/* Writes out anything still buffered and deallocates the log.  The caller
+must hold the tree's writer lock (or otherwise know that nobody else is using
+the tree) and must have already unhooked the log from the tree.  Returns TRUE
+if everything made it to disk. */
+
+bool AVLDupLogClose (AVLDupLogPointer LogPntr)
+{
+  bool Successful;
+
+  if (LogPntr == NULL)
+    return true;
+
+  Successful = AVLDupLogWaitUntilDurable (LogPntr,
+    LogPntr->appendedPosition);
+
+  if (LogPntr->fileDescriptor >= 0)
+  {
+    if (close (LogPntr->fileDescriptor) != 0)
+      Successful = false;
+  }
+  if (LogPntr->bufferSemaphoreID >= 0)
+    delete_sem (LogPntr->bufferSemaphoreID);
+  if (LogPntr->flushSemaphoreID >= 0)
+    delete_sem (LogPntr->flushSemaphoreID);
+  if (LogPntr->bufferPntr != NULL)
+    free (LogPntr->bufferPntr);
+  if (LogPntr->spareBufferPntr != NULL)
+    free (LogPntr->spareBufferPntr);
+  free (LogPntr);
+
+  return Successful;
+}
+
+
+
+/* Reads the records in an existing log file and applies them to the tree,
+which is locked for writing by the caller.  Returns the size of the valid
+part of the file (header plus all complete records), or -1 if the file is
+not a log for this kind of tree or there wasn't enough memory. */
+
+static int64 ReplayLogFile (
+  AVLDupTreePointer TreePntr,
+  FILE *FilePntr)
+{
+  char                 *BufferPntr;
+  size_t                BufferSize;
+  uint32                CRC;
+  const uint8          *EndPntr;
+  AVLDupLogHeaderRecord Header;
+  AVLDupThingRecord     Key;
+  char                 *NewBufferPntr;
+  uint8                 Operation;
+  uint32                PayloadSize;
+  int64                 Position;
+  const uint8          *SourcePntr;
+  char                 *StringBufferPntr;
+  AVLDupThingRecord     Value;
+
+  if (fread (&Header, sizeof (Header), 1, FilePntr) != 1 ||
+  B_LENDIAN_TO_HOST_INT32 (Header.magic) != AVLDUP_LOG_MAGIC ||
+  B_LENDIAN_TO_HOST_INT32 (Header.version) != AVLDUP_LOG_VERSION ||
+  B_LENDIAN_TO_HOST_INT32 (Header.keyType) != TreePntr->keyType ||
+  B_LENDIAN_TO_HOST_INT32 (Header.valueType) != TreePntr->valueType)
+    return -1;
+
+  Position = sizeof (Header);
+  BufferPntr = NULL;
+  BufferSize = 0;
+
+  while (true)
+  {
+    if (fread (&PayloadSize, 4, 1, FilePntr) != 1)
+      break; /* End of the log, or a record cut short by a crash. */
+    PayloadSize = B_LENDIAN_TO_HOST_INT32 (PayloadSize);
+    if (PayloadSize < 1 || PayloadSize > MAX_PAYLOAD_SIZE)
+      break;
+
+    /* The buffer holds the payload, the CRC and then the decoded strings,
+    which need at most the payload size plus two NULs. */
+
+    if (BufferSize < 2 * (size_t) PayloadSize + 6)
+    {
+      NewBufferPntr = realloc (BufferPntr, 2 * (size_t) PayloadSize + 6);
+      if (NewBufferPntr == NULL)
+        goto ErrorExit;
+      BufferPntr = NewBufferPntr;
+      BufferSize = 2 * (size_t) PayloadSize + 6;
+    }
+
+    if (fread (BufferPntr, PayloadSize + 4, 1, FilePntr) != 1)
+      break;
+    memcpy (&CRC, BufferPntr + PayloadSize, 4);
+    if (B_LENDIAN_TO_HOST_INT32 (CRC) !=
+    ComputeCRC ((uint8 *) BufferPntr, PayloadSize))
+      break;
+
+    /* The record is intact, anything wrong with it from here on means the
+    file isn't what we think it is. */
+
+    SourcePntr = (uint8 *) BufferPntr;
+    EndPntr = SourcePntr + PayloadSize;
+    StringBufferPntr = BufferPntr + PayloadSize + 4;
+    Operation = *SourcePntr++;
+    SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr, TreePntr->keyType,
+      &StringBufferPntr, &Key);
+    if (SourcePntr != NULL)
+      SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr, TreePntr->valueType,
+        &StringBufferPntr, &Value);
+    if (SourcePntr != EndPntr)
+      goto ErrorExit;
+
+    if (Operation == LOG_OP_ADD)
+    {
+      if (AVLDupAddWithoutLocking (TreePntr, &Key, &Value) ==
+      RAN_OUT_OF_MEMORY)
+        goto ErrorExit;
+    }
+    else if (Operation == LOG_OP_DELETE)
+      AVLDupDeleteWithoutLocking (TreePntr, &Key, &Value);
+    else
+      goto ErrorExit;
+
+    Position += 4 + PayloadSize + 4;
+  }
+
+  if (BufferPntr != NULL)
+    free (BufferPntr);
+  return Position;
+
+ErrorExit:
+  if (BufferPntr != NULL)
+    free (BufferPntr);
+  return -1;
+}
+
+
+
+/* Attaches a write-ahead log file to the tree.  If the file exists, the
+changes recorded in it are first applied to the tree (which would normally
+have just been loaded from the last checkpoint with AVLDupLoadTree, or be
+empty if there wasn't one), and any partial record left at the end by a
+crash is cut off.  Otherwise a new empty log is created.  From then on all
+additions and deletions are logged, and AVLDupAdd, AVLDupDelete and friends
+wait for their changes to reach the disk before returning.  Returns TRUE if
+successful, FALSE if the file couldn't be read or written, it is a log for
+different key or value types, the tree already has a log, or there isn't
+enough memory (in which case some of the log may have been applied). */
+
+bool AVLDupAttachLog (
+  AVLDupTreePointer TreePntr,
+  const char *LogPathName)
+{
+  status_t              ErrorCode;
+  FILE                 *FilePntr;
+  AVLDupLogHeaderRecord Header;
+  AVLDupLogPointer      LogPntr;
+  int64                 ValidSize;
+
+  if (TreePntr == NULL || LogPathName == NULL)
+    return false;
+
+  if (!CRCTableReady)
+    MakeCRCTable ();
+
+  LogPntr = malloc (sizeof (AVLDupLogRecord));
+  if (LogPntr == NULL)
+    return false;
+  memset (LogPntr, 0, sizeof (AVLDupLogRecord));
+  LogPntr->fileDescriptor = -1;
+  LogPntr->keyType = TreePntr->keyType;
+  LogPntr->valueType = TreePntr->valueType;
+  LogPntr->bufferSemaphoreID = create_sem (1, "AVLDupLog Buffer");
+  LogPntr->flushSemaphoreID = create_sem (1, "AVLDupLog Flush");
+  LogPntr->bufferPntr = malloc (INITIAL_BUFFER_SIZE);
+  LogPntr->spareBufferPntr = malloc (INITIAL_BUFFER_SIZE);
+  if (LogPntr->bufferSemaphoreID < 0 || LogPntr->flushSemaphoreID < 0 ||
+  LogPntr->bufferPntr == NULL || LogPntr->spareBufferPntr == NULL)
+  {
+    AVLDupLogClose (LogPntr);
+    return false;
+  }
+  LogPntr->bufferSize = INITIAL_BUFFER_SIZE;
+  LogPntr->spareBufferSize = INITIAL_BUFFER_SIZE;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+    {
+      AVLDupLogClose (LogPntr);
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+    }
+  }
+
+  if (TreePntr->logPntr != NULL)
+    goto ErrorExit;
+
+  FilePntr = fopen (LogPathName, "rb");
+  if (FilePntr != NULL)
+  {
+    ValidSize = ReplayLogFile (TreePntr, FilePntr);
+    fclose (FilePntr);
+    if (ValidSize < 0)
+      goto ErrorExit;
+
+    LogPntr->fileDescriptor = open (LogPathName, O_WRONLY);
+    if (LogPntr->fileDescriptor < 0 ||
+    ftruncate (LogPntr->fileDescriptor, ValidSize) != 0 ||
+    lseek (LogPntr->fileDescriptor, ValidSize, SEEK_SET) != ValidSize)
+      goto ErrorExit;
+  }
+  else if (errno == ENOENT)
+  {
+    Header.magic = B_HOST_TO_LENDIAN_INT32 (AVLDUP_LOG_MAGIC);
+    Header.version = B_HOST_TO_LENDIAN_INT32 (AVLDUP_LOG_VERSION);
+    Header.keyType = B_HOST_TO_LENDIAN_INT32 (TreePntr->keyType);
+    Header.valueType = B_HOST_TO_LENDIAN_INT32 (TreePntr->valueType);
+
+    LogPntr->fileDescriptor =
+      open (LogPathName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (LogPntr->fileDescriptor < 0 ||
+    write (LogPntr->fileDescriptor, &Header, sizeof (Header)) !=
+    sizeof (Header) ||
+    fsync (LogPntr->fileDescriptor) != 0)
+      goto ErrorExit;
+  }
+  else
+    goto ErrorExit;
+
+  TreePntr->logPntr = LogPntr;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+  return true;
+
+ErrorExit:
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+  AVLDupLogClose (LogPntr);
+  return false;
+}
+
+
+
+/* Writes out any buffered log records, closes the log file and stops logging
+changes to the tree.  The log file is left as is, so it can be replayed
+later.  Don't call it while other threads are still adding or deleting.
+Returns TRUE if all the records made it to disk. */
+
+bool AVLDupDetachLog (AVLDupTreePointer TreePntr)
+{
+  status_t         ErrorCode;
+  AVLDupLogPointer LogPntr;
+
+  if (TreePntr == NULL)
+    return false;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+  }
+
+  LogPntr = TreePntr->logPntr;
+  TreePntr->logPntr = NULL;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+
+  return AVLDupLogClose (LogPntr);
+}
+
+
+
+/* Saves the tree to the given file (same as AVLDupSaveTree, except that the
+file is forced to disk) and then empties the attached log, since all the
+changes in it are now in the saved file.  The tree is locked for writing
+the whole time so that no changes slip in between the two.  If the save
+fails the log is left alone.  A successful checkpoint also clears an earlier
+log failure, since the tree on disk is up to date again.  To recover after a
+crash, load the file with AVLDupLoadTree and then call AVLDupAttachLog.
+Replaying a log on top of a checkpoint that already contains some of its
+changes is harmless, so a crash between saving and emptying the log doesn't
+lose or duplicate anything.  Returns TRUE if successful. */
+
+bool AVLDupCheckpointTree (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName)
+{
+  status_t              ErrorCode;
+  AVLDupLogHeaderRecord Header;
+  AVLDupLogPointer      LogPntr;
+  bool                  Successful;
+
+  if (TreePntr == NULL || FilePathName == NULL)
+    return false;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+  }
+
+  Successful = AVLDupSaveTreeWithoutLocking (TreePntr, FilePathName);
+
+  LogPntr = TreePntr->logPntr;
+  if (Successful && LogPntr != NULL)
+  {
+    /* Wait for any flush in progress to finish, then throw away the
+    buffered records and the file contents.  Writers still waiting for
+    their records will find them marked as being on disk, which is true
+    since they are in the checkpoint. */
+
+    if (acquire_sem (LogPntr->flushSemaphoreID) < B_OK)
+      Successful = false;
+    else
+    {
+      acquire_sem (LogPntr->bufferSemaphoreID);
+      LogPntr->bufferUsed = 0;
+      release_sem (LogPntr->bufferSemaphoreID);
+
+      Header.magic = B_HOST_TO_LENDIAN_INT32 (AVLDUP_LOG_MAGIC);
+      Header.version = B_HOST_TO_LENDIAN_INT32 (AVLDUP_LOG_VERSION);
+      Header.keyType = B_HOST_TO_LENDIAN_INT32 (TreePntr->keyType);
+      Header.valueType = B_HOST_TO_LENDIAN_INT32 (TreePntr->valueType);
+
+      LogPntr->failed = false;
+      if (ftruncate (LogPntr->fileDescriptor, 0) != 0 ||
+      lseek (LogPntr->fileDescriptor, 0, SEEK_SET) != 0 ||
+      write (LogPntr->fileDescriptor, &Header, sizeof (Header)) !=
+      sizeof (Header) ||
+      fsync (LogPntr->fileDescriptor) != 0)
+      {
+        LogPntr->failed = true;
+        Successful = false;
+      }
+      LogPntr->durablePosition = LogPntr->appendedPosition;
+
+      release_sem (LogPntr->flushSemaphoreID);
+    }
+  }
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+
+  return Successful;
+}
@@ -0,0 +1,413 @@
+/******************************************************************************
+ * AVLDupMappedTree.c
+ *
+ * A read-only index which works directly on a file saved by AVLDupSaveTree
+ * or AVLDupSaveTreeForMapping, without loading it into memory.  The file is
+ * memory mapped, so opening it takes the same small amount of time no matter
+ * how big it is, only the pages actually used by searches get read from disk,
+ * and the operating system's file cache is shared by all the programs that
+ * have the same index open.  Good for big archival indices which are searched
+ * now and then but never changed.
+ *
+ * Files saved by AVLDupSaveTreeForMapping have their entries in Eytzinger
+ * order (an implicit binary tree stored breadth first, see
+ * AVLDupFirstEytzingerIndex in AVLDupFile.c), which is the quickest to
+ * search since the top levels of the tree are all together in a few pages.
+ * Ordinary sorted files from AVLDupSaveTree work too, using a binary search.
+ *
+ * Since nothing ever changes, there is no locking, and any number of threads
+ * can iterate over a mapped tree at the same time.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* The header for a mapped tree.  All the pointers point into the mapped
+file. */
+
+struct AVLDupMappedTreeStruct
+{
+  void *mappedAddress;
+  size_t mappedSize;
+  const char *indexName;
+  const char *stringsPntr;
+  uint64 stringsSize;
+  const AVLDupFileEntryRecord *entriesPntr;
+  uint32 count;
+  bool eytzingerOrder;
+  type_code keyType;
+  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
+  type_code valueType;
+  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
+};
+
+
+
+/* Opens an index file for read-only use, by memory mapping it.  Returns NULL
+if the file can't be opened or mapped, or isn't a valid index file.  Use
+AVLDupCloseMappedTree when done.  Changing or replacing the file while it is
+mapped has undefined results (AVLDupSaveTree replaces the file with a new
+one, so that's safe, the old contents stay around until closed). */
+
+AVLDupMappedTreePointer AVLDupOpenMappedTree (const char *FilePathName)
+{
+  int                     FileDescriptor;
+  struct stat             FileStat;
+  AVLDupFileHeaderRecord  Header;
+  AVLDupMappedTreePointer NewTree;
+
+  if (FilePathName == NULL)
+    return NULL;
+
+  NewTree = malloc (sizeof (AVLDupMappedTreeRecord));
+  if (NewTree == NULL)
+    return NULL;
+  memset (NewTree, 0, sizeof (AVLDupMappedTreeRecord));
+  NewTree->mappedAddress = MAP_FAILED;
+
+  FileDescriptor = open (FilePathName, O_RDONLY);
+  if (FileDescriptor < 0)
+    goto ErrorExit;
+
+  if (fstat (FileDescriptor, &FileStat) != 0 ||
+  FileStat.st_size < (off_t) sizeof (AVLDupFileHeaderRecord) ||
+  (uint64) FileStat.st_size != (size_t) FileStat.st_size)
+  {
+    close (FileDescriptor);
+    goto ErrorExit;
+  }
+
+  NewTree->mappedSize = FileStat.st_size;
+  NewTree->mappedAddress = mmap (NULL, NewTree->mappedSize, PROT_READ,
+    MAP_SHARED, FileDescriptor, 0);
+  close (FileDescriptor); /* The mapping keeps the file open. */
+  if (NewTree->mappedAddress == MAP_FAILED)
+    goto ErrorExit;
+
+  /* Check that the header makes sense and fits the actual file. */
+
+  if (!AVLDupDecodeFileHeader (
+  (AVLDupFileHeaderPointer) NewTree->mappedAddress, &Header) ||
+  Header.fileSize > NewTree->mappedSize)
+    goto ErrorExit;
+
+  /* The file doesn't have the sort keys of a collated tree, and working them
+  out for every comparison would be too slow, so those have to be loaded. */
+
+  if (Header.collation != AVLDUP_COLLATION_BINARY)
+    goto ErrorExit;
+
+  NewTree->keyType = Header.keyType;
+  NewTree->keyComparisonFunctionPntr =
+    AVLDupGetComparisonFunctionForType (Header.keyType);
+  NewTree->valueType = Header.valueType;
+  NewTree->valueComparisonFunctionPntr =
+    AVLDupGetComparisonFunctionForType (Header.valueType);
+  if (NewTree->keyComparisonFunctionPntr == NULL ||
+  NewTree->valueComparisonFunctionPntr == NULL)
+    goto ErrorExit;
+
+  NewTree->indexName = (const char *) NewTree->mappedAddress +
+    sizeof (AVLDupFileHeaderRecord);
+  if (NewTree->indexName[Header.nameLength] != 0)
+    goto ErrorExit;
+  if (Header.nameLength == 0)
+    NewTree->indexName = NULL;
+
+  /* A missing NUL at the end of the string section would let a damaged file
+  send string comparisons off the end of the mapping. */
+
+  NewTree->stringsPntr =
+    (const char *) NewTree->mappedAddress + Header.stringsOffset;
+  NewTree->stringsSize = Header.stringsSize;
+  if (NewTree->stringsSize > 0 &&
+  NewTree->stringsPntr[NewTree->stringsSize - 1] != 0)
+    goto ErrorExit;
+
+  NewTree->entriesPntr = (const AVLDupFileEntryRecord *)
+    ((const char *) NewTree->mappedAddress + Header.entriesOffset);
+  NewTree->count = Header.count;
+  NewTree->eytzingerOrder =
+    ((Header.flags & AVLDUP_FILE_FLAG_EYTZINGER_ORDER) != 0);
+
+  return NewTree;
+
+
+ErrorExit: /* Deallocate partial allocations and return NULL. */
+  AVLDupCloseMappedTree (NewTree);
+  return NULL;
+}
+
+
+
+/* Unmaps the file and deallocates the mapped tree.  Safe to pass in NULL.
+Make sure no other threads are still iterating over it. */
+
+void AVLDupCloseMappedTree (AVLDupMappedTreePointer TreePntr)
+{
+  if (TreePntr == NULL)
+    return;
+
+  if (TreePntr->mappedAddress != MAP_FAILED)
+    munmap (TreePntr->mappedAddress, TreePntr->mappedSize);
+
+  memset (TreePntr, 0, sizeof (AVLDupMappedTreeRecord));
+  free (TreePntr);
+}
+
+
+
+/* Returns the number of key/value pairs in the mapped tree. */
+
+unsigned int AVLDupMappedGetTreeCount (AVLDupMappedTreePointer TreePntr)
+{
+  if (TreePntr != NULL)
+    return TreePntr->count;
+
+  return 0;
+}
+
+
+
+/* Returns the name of the mapped tree, or NULL if it isn't named. */
+
+const char *AVLDupMappedGetTreeName (AVLDupMappedTreePointer TreePntr)
+{
+  if (TreePntr != NULL)
+    return TreePntr->indexName;
+
+  return NULL;
+}
+
+
+
+/* Decodes the entry at the given position in the file (0 is the first one)
+into a temporary node, so that the usual range comparison code can be used on
+it.  Returns FALSE if the entry is damaged. */
+
+static bool DecodeEntryIntoNode (
+  AVLDupMappedTreePointer TreePntr,
+  uint32 EntryIndex,
+  AVLDupNodePointer NodePntr)
+{
+  const AVLDupFileEntryRecord *EntryPntr;
+
+  EntryPntr = TreePntr->entriesPntr + EntryIndex;
+
+  return AVLDupDecodeFileThing (&EntryPntr->key, TreePntr->keyType,
+    TreePntr->stringsPntr, TreePntr->stringsSize, &NodePntr->key) &&
+    AVLDupDecodeFileThing (&EntryPntr->value, TreePntr->valueType,
+    TreePntr->stringsPntr, TreePntr->stringsSize, &NodePntr->value);
+}
+
+
+
+/* Returns TRUE if the entry at the given position is at or above the start of
+the range, FALSE if it is below it.  Damaged entries count as being above,
+the caller notices the damage when it decodes the entry again. */
+
+static bool EntryIsAboveLowerBound (
+  AVLDupMappedTreePointer TreePntr,
+  NonRecursiveArgumentsPointer ArgsPntr,
+  uint32 EntryIndex)
+{
+  int              ComparisonLower;
+  int              ComparisonUpper;
+  AVLDupNodeRecord TempNode;
+
+  if (!DecodeEntryIntoNode (TreePntr, EntryIndex, &TempNode))
+    return true;
+
+  AVLDupCompareNodeWithBounds (ArgsPntr, &TempNode, true, false,
+    &ComparisonLower, &ComparisonUpper);
+
+  return (ComparisonLower < 0 ||
+    (ComparisonLower == 0 && ArgsPntr->includeThingEqualToStart));
+}
+
+
+
+/* Finds the first entry in the range, setting *PositionPntr to its position
+in the file (0 for the first entry in the file).  Returns FALSE if nothing is
+in the range.  For Eytzinger order it goes down the implicit tree, moving left
+when the entry is in the range and right when it is below.  The answer is the
+last entry where it went left, found by undoing the trailing right moves plus
+one left move.  The entries four levels further down are prefetched, since
+they're all next to each other in the file. */
+
+static bool FindFirstInRange (
+  AVLDupMappedTreePointer TreePntr,
+  NonRecursiveArgumentsPointer ArgsPntr,
+  bool TestLowerBound,
+  uint32 *PositionPntr)
+{
+  uint64 HighIndex;
+  uint64 Index;
+  uint64 LowIndex;
+  uint64 MiddleIndex;
+
+  if (TreePntr->count == 0)
+    return false;
+
+  if (TreePntr->eytzingerOrder)
+  {
+    if (!TestLowerBound)
+      Index = AVLDupFirstEytzingerIndex (TreePntr->count);
+    else
+    {
+      Index = 1;
+      while (Index <= TreePntr->count)
+      {
+#if defined (__GNUC__) && __GNUC__ >= 3
+        if (Index * 16 <= TreePntr->count)
+          __builtin_prefetch (TreePntr->entriesPntr + Index * 16 - 1);
+#endif
+        if (EntryIsAboveLowerBound (TreePntr, ArgsPntr, (uint32) Index - 1))
+          Index = Index * 2;
+        else
+          Index = Index * 2 + 1;
+      }
+      while (Index & 1)
+        Index >>= 1;
+      Index >>= 1;
+    }
+
+    if (Index == 0)
+      return false;
+    *PositionPntr = (uint32) Index - 1;
+    return true;
+  }
+
+  /* Plain sorted order, use a binary search. */
+
+  LowIndex = 0;
+  HighIndex = TreePntr->count;
+  if (TestLowerBound)
+  {
+    while (LowIndex < HighIndex)
+    {
+      MiddleIndex = (LowIndex + HighIndex) / 2;
+      if (EntryIsAboveLowerBound (TreePntr, ArgsPntr, (uint32) MiddleIndex))
+        HighIndex = MiddleIndex;
+      else
+        LowIndex = MiddleIndex + 1;
+    }
+  }
+
+  if (LowIndex >= TreePntr->count)
+    return false;
+  *PositionPntr = (uint32) LowIndex;
+  return true;
+}
+
+
+
+/* Moves *PositionPntr on to the entry with the next larger key/value.
+Returns FALSE if there are no more. */
+
+static bool FindNextEntry (
+  AVLDupMappedTreePointer TreePntr,
+  uint32 *PositionPntr)
+{
+  uint32 Index;
+
+  if (TreePntr->eytzingerOrder)
+  {
+    Index = AVLDupNextEytzingerIndex (*PositionPntr + 1, TreePntr->count);
+    if (Index == 0)
+      return false;
+    *PositionPntr = Index - 1;
+    return true;
+  }
+
+  if (*PositionPntr + 1 >= TreePntr->count)
+    return false;
+  (*PositionPntr)++;
+  return true;
+}
+
+
+
+/* Iterates over a range of the mapped tree, calling your callback function
+for each key/value pair in the range, in ascending order.  The arguments are
+exactly the same as for AVLDupIterate, with the same handling of duplicate
+keys (NULL start or end values meaning all values for that key) and inclusive
+or exclusive bounds.  The key and value things passed to your callback point
+into the mapped file, so copy them with AVLDupCopyThingArray if you want to
+keep them after the tree is closed.  Returns TRUE if it got to the end of the
+range, FALSE if your callback stopped it or the file turned out to be
+damaged. */
+
+bool AVLDupMappedIterate (
+  AVLDupMappedTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  int                         ComparisonLower;
+  int                         ComparisonUpper;
+  bool                        MoreEntries;
+  uint32                      Position;
+  AVLDupNodeRecord            TempNode;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  memset (&Arguments, 0, sizeof (Arguments));
+  Arguments.keyType = TreePntr->keyType;
+  Arguments.keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
+  Arguments.valueType = TreePntr->valueType;
+  Arguments.valueComparisonFunctionPntr= TreePntr->valueComparisonFunctionPntr;
+  AVLDupSetUpIterationArguments (NULL, &Arguments,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+
+  /* Find the start, then go forwards through the entries in sorted order
+  until one is past the end of the range. */
+
+  MoreEntries = FindFirstInRange (TreePntr, &Arguments,
+    StartKeyPntr != NULL, &Position);
+
+  while (MoreEntries)
+  {
+    if (!DecodeEntryIntoNode (TreePntr, Position, &TempNode))
+      return false; /* Damaged file. */
+
+    AVLDupCompareNodeWithBounds (&Arguments, &TempNode, false,
+      EndKeyPntr != NULL, &ComparisonLower, &ComparisonUpper);
+
+    if (ComparisonUpper < 0 ||
+    (ComparisonUpper == 0 && !IncludeThingEqualToEnd))
+      break; /* Past the end of the range. */
+
+    if (!CallbackFunctionPntr (&TempNode.key, &TempNode.value, ExtraUserData))
+      return false; /* The user requested an early abort of the iteration. */
+
+    MoreEntries = FindNextEntry (TreePntr, &Position);
+  }
+
+  return true;
+}
@@ -0,0 +1,1407 @@
+/******************************************************************************
+ * AVLDupParallel.c
+ *
+ * Operations on an AVLDupTree which split the work up between several
+ * threads, so that big jobs (like iterating over an index with tens of
+ * millions of entries) can use all the CPUs in the machine rather than just
+ * one.
+ *
+ * The work is divided up by cutting the tree into subtrees a few levels down
+ * from the root.  Since the tree is balanced, the subtrees at a given depth
+ * are all about the same size.  There are several times as many pieces as
+ * there are threads, and each thread grabs the next unclaimed piece when it
+ * finishes one, so a thread which gets an easy piece (or a slow callback)
+ * doesn't hold up the others for long.
+ *
+ * Bulk adding (AVLDupParallelAddArray) and freeing (AVLDupParallelFreeTree)
+ * also use several threads, see the comments before those functions.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* How many pieces of work to make for each thread.  More pieces give better
+load balancing but cost more overhead for tiny trees. */
+
+#define PIECES_PER_THREAD 8
+
+
+/* Accumulators are spaced apart by at least this much, so that threads
+updating their own accumulators don't fight over the same cache line. */
+
+#define CACHE_LINE_SIZE 64
+
+
+/* Used for starting up a worker thread, since spawn_thread only lets us pass
+in one pointer. */
+
+typedef struct WorkerStartupStruct
+{
+  AVLDupWorkerFunctionPointer workerFunction;
+  void *workerData;
+} WorkerStartupRecord, *WorkerStartupPointer;
+
+
+/* A piece of work for a parallel iteration, either a whole subtree (which may
+need its nodes checked against the lower and upper bounds) or just a single
+node which is known to be in the range. */
+
+typedef struct IterationPieceStruct
+{
+  AVLDupNodePointer nodePntr;
+  bool              singleNode;
+  bool              testLowerBound;
+  bool              testUpperBound;
+} IterationPieceRecord, *IterationPiecePointer;
+
+
+/* Data shared by all the threads in a parallel iteration. */
+
+typedef struct ParallelIterationStruct
+{
+  NonRecursiveArgumentsRecord arguments; /* Bounds, common to all threads. */
+  IterationPiecePointer piecesArray;
+  uint32 numberOfPieces;
+  uint32 allocatedPieces;
+  uint32 splitDepth; /* Tree levels above this get cut into pieces. */
+  int32 nextPieceIndex; /* Next piece to be claimed by a thread. */
+  int32 aborted; /* Non-zero if the user's callback stopped the iteration. */
+  int32 callbacksDone; /* Total for all threads. */
+  AVLDupParallelCallbackFunctionPointer userCallback;
+  void *userExtraData;
+} ParallelIterationRecord, *ParallelIterationPointer;
+
+
+/* Data for each thread in a parallel iteration. */
+
+typedef struct IterationWorkerStruct
+{
+  ParallelIterationPointer sharedPntr;
+  void *accumulatorPntr;
+} IterationWorkerRecord, *IterationWorkerPointer;
+
+
+
+/* Returns the number of threads to use when the user asks for the default
+(zero), which is the number of CPUs. */
+
+uint32 AVLDupGetDefaultThreadCount (void)
+{
+  system_info SystemInfo;
+
+  if (get_system_info (&SystemInfo) != B_OK || SystemInfo.cpu_count < 1)
+    return 1;
+
+  return SystemInfo.cpu_count;
+}
+
+
+
+/* The function which a spawned worker thread runs. */
+
+static int32 WorkerThreadEntry (void *DataPntr)
+{
+  WorkerStartupPointer StartupPntr;
+
+  StartupPntr = (WorkerStartupPointer) DataPntr;
+  StartupPntr->workerFunction (StartupPntr->workerData);
+  return 0;
+}
+
+
+
+/* Runs the worker function once for each element in an array of worker data
+(which has elements WorkerDataSize bytes long), using a separate thread for
+each one.  The calling thread does the first one itself.  Waits for all of
+them to finish before returning.  If threads can't be created, the calling
+thread does the remaining work itself, so the job always gets done, just
+slower. */
+
+void AVLDupRunWorkers (
+  AVLDupWorkerFunctionPointer WorkerFunction,
+  void *WorkerDataArray,
+  size_t WorkerDataSize,
+  uint32 NumberOfWorkers)
+{
+  uint32               i;
+  WorkerStartupPointer StartupArray;
+  thread_id           *ThreadIDArray;
+
+  if (NumberOfWorkers == 0)
+    return;
+
+  StartupArray = malloc (NumberOfWorkers * sizeof (WorkerStartupRecord));
+  ThreadIDArray = malloc (NumberOfWorkers * sizeof (thread_id));
+
+  if (StartupArray == NULL || ThreadIDArray == NULL)
+  {
+    /* Out of memory, do it all in this thread. */
+
+    for (i = 0; i < NumberOfWorkers; i++)
+      WorkerFunction ((char *) WorkerDataArray + i * WorkerDataSize);
+  }
+  else
+  {
+    for (i = 1; i < NumberOfWorkers; i++)
+    {
+      StartupArray[i].workerFunction = WorkerFunction;
+      StartupArray[i].workerData =
+        (char *) WorkerDataArray + i * WorkerDataSize;
+      ThreadIDArray[i] = spawn_thread (WorkerThreadEntry, "AVLDup Worker",
+        B_NORMAL_PRIORITY, StartupArray + i);
+      if (ThreadIDArray[i] >= 0)
+        resume_thread (ThreadIDArray[i]);
+    }
+
+    WorkerFunction (WorkerDataArray);
+
+    for (i = 1; i < NumberOfWorkers; i++)
+    {
+      if (ThreadIDArray[i] >= 0)
+        wait_for_thread (ThreadIDArray[i], NULL);
+      else /* Couldn't start a thread for this one. */
+        WorkerFunction ((char *) WorkerDataArray + i * WorkerDataSize);
+    }
+  }
+
+  if (StartupArray != NULL)
+    free (StartupArray);
+  if (ThreadIDArray != NULL)
+    free (ThreadIDArray);
+}
+
+
+
+/* Picks a split depth which gives enough pieces (two to the power of the
+depth) for all the threads, but no deeper than the tree. */
+
+static uint32 ChooseSplitDepth (
+  uint32       NumberOfThreads,
+  unsigned int TreeHeight)
+{
+  uint32 SplitDepth;
+
+  SplitDepth = 0;
+  while ((1UL << SplitDepth) < NumberOfThreads * PIECES_PER_THREAD &&
+  SplitDepth < 20)
+    SplitDepth++;
+  if (TreeHeight > 0 && SplitDepth >= TreeHeight)
+    SplitDepth = TreeHeight - 1;
+
+  return SplitDepth;
+}
+
+
+
+/* Adds a piece of work to the list.  The list was preallocated with enough
+room for all the pieces at the split depth, so it doesn't need to grow. */
+
+static void AddIterationPiece (
+  ParallelIterationPointer SharedPntr,
+  AVLDupNodePointer        NodePntr,
+  bool                     SingleNode,
+  bool                     TestLowerBound,
+  bool                     TestUpperBound)
+{
+  IterationPiecePointer PiecePntr;
+
+  if (SharedPntr->numberOfPieces >= SharedPntr->allocatedPieces)
+    return; /* Shouldn't happen. */
+
+  PiecePntr = SharedPntr->piecesArray + SharedPntr->numberOfPieces++;
+  PiecePntr->nodePntr = NodePntr;
+  PiecePntr->singleNode = SingleNode;
+  PiecePntr->testLowerBound = TestLowerBound;
+  PiecePntr->testUpperBound = TestUpperBound;
+}
+
+
+
+/* Cuts the part of the tree in the range into pieces.  Works like
+AVLDupRecursiveRangeIterate, except that rather than calling the callback it
+makes a piece for each node in the range above the split depth, and for each
+subtree at the split depth which has something in the range. */
+
+static void RecursivelyCollectPieces (
+  ParallelIterationPointer SharedPntr,
+  AVLDupNodePointer        CurrentNode,
+  bool                     TestLowerBound,
+  bool                     TestUpperBound,
+  uint32                   Depth)
+{
+  int ComparisonLower;
+  int ComparisonUpper;
+
+  if (CurrentNode == NULL)
+    return;
+
+  if (Depth >= SharedPntr->splitDepth)
+  {
+    AddIterationPiece (SharedPntr, CurrentNode, false,
+      TestLowerBound, TestUpperBound);
+    return;
+  }
+
+  AVLDupCompareNodeWithBounds (&SharedPntr->arguments, CurrentNode,
+    TestLowerBound, TestUpperBound, &ComparisonLower, &ComparisonUpper);
+
+  if (ComparisonLower < 0)
+    RecursivelyCollectPieces (SharedPntr, CurrentNode->smallerChildPntr,
+      TestLowerBound, (ComparisonUpper >= 0) ? false : TestUpperBound,
+      Depth + 1);
+
+  if ((ComparisonLower < 0 ||
+  (ComparisonLower == 0 && SharedPntr->arguments.includeThingEqualToStart)) &&
+  (ComparisonUpper > 0 ||
+  (ComparisonUpper == 0 && SharedPntr->arguments.includeThingEqualToEnd)))
+    AddIterationPiece (SharedPntr, CurrentNode, true, false, false);
+
+  if (ComparisonUpper > 0)
+    RecursivelyCollectPieces (SharedPntr, CurrentNode->largerChildPntr,
+      (ComparisonLower <= 0) ? false : TestLowerBound, TestUpperBound,
+      Depth + 1);
+}
+
+
+
+/* The callback used by AVLDupRecursiveRangeIterate in the worker threads.
+It passes the thread's accumulator to the user's callback, and stops early if
+some other thread's callback has asked to stop. */
+
+static bool ParallelIterationCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  ParallelIterationPointer SharedPntr;
+  IterationWorkerPointer   WorkerPntr;
+
+  WorkerPntr = (IterationWorkerPointer) ExtraData;
+  SharedPntr = WorkerPntr->sharedPntr;
+
+  if (SharedPntr->aborted)
+    return false;
+
+  if (!SharedPntr->userCallback (KeyPntr, ValuePntr,
+  WorkerPntr->accumulatorPntr, SharedPntr->userExtraData))
+  {
+    atomic_or (&SharedPntr->aborted, 1);
+    return false;
+  }
+
+  return true;
+}
+
+
+
+/* Each worker thread keeps on grabbing the next piece of work until there are
+none left. */
+
+static void IterationWorkerFunction (void *WorkerData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  int32                       PieceIndex;
+  IterationPiecePointer       PiecePntr;
+  ParallelIterationPointer    SharedPntr;
+  IterationWorkerPointer      WorkerPntr;
+
+  WorkerPntr = (IterationWorkerPointer) WorkerData;
+  SharedPntr = WorkerPntr->sharedPntr;
+
+  /* Our own copy of the arguments, pointing the callback at our data, and
+  with our own operation counts for AVLDupGetStats. */
+
+  Arguments = SharedPntr->arguments;
+  Arguments.iterationCallback = ParallelIterationCallback;
+  Arguments.extraUserData = WorkerPntr;
+  memset (&Arguments.counts, 0, sizeof (Arguments.counts));
+  Arguments.itemsDelivered = 0;
+
+  while (!SharedPntr->aborted)
+  {
+    PieceIndex = atomic_add (&SharedPntr->nextPieceIndex, 1);
+    if (PieceIndex >= (int32) SharedPntr->numberOfPieces)
+      break;
+
+    PiecePntr = SharedPntr->piecesArray + PieceIndex;
+
+    if (PiecePntr->singleNode)
+    {
+      AVLDUP_STATISTIC (Arguments.counts.callbacks++);
+      Arguments.itemsDelivered++;
+      ParallelIterationCallback (&PiecePntr->nodePntr->key,
+        &PiecePntr->nodePntr->value, WorkerPntr);
+    }
+    else
+      AVLDupRecursiveRangeIterate (&Arguments, PiecePntr->nodePntr,
+        PiecePntr->testLowerBound, PiecePntr->testUpperBound);
+  }
+
+  AVLDupAddOperationCounts (Arguments.treePntr, &Arguments.counts);
+  atomic_add (&SharedPntr->callbacksDone, (int32) Arguments.itemsDelivered);
+}
+
+
+
+/* Like AVLDupIterate, but the work is spread out over several threads.  The
+range arguments are the same as for AVLDupIterate.  Your callback function
+gets called from several threads at the same time, and the key/value pairs
+are NOT delivered in ascending order (each thread goes through its own parts
+of the tree in order, but the parts are done in any order).  The usual
+restriction applies: the callback can't modify the tree.
+
+NumberOfThreads is the number of threads to use, including the calling
+thread.  Zero means one per CPU.
+
+To help with things like adding up totals, each thread can have its own
+accumulator, a block of memory AccumulatorSize bytes long (which can be zero
+if you don't need it), initially all zeroes.  Your callback gets passed the
+accumulator of the thread it is running in, so it can update it without
+needing any locking.  When the iteration is finished, your ReduceFunction (if
+not NULL) gets called once for each accumulator, one at a time in the
+calling thread, so that you can combine them into a final result.  It gets
+called even if the iteration was stopped early.
+
+If your callback function returns FALSE, the iteration is stopped as soon as
+the other threads notice, and this function returns FALSE.  It also returns
+FALSE if it runs out of memory for the accumulators or can't get the reader
+lock.  Returns TRUE if it finished the whole iteration. */
+
+bool AVLDupParallelIterate (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupParallelCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData,
+  uint32 NumberOfThreads,
+  size_t AccumulatorSize,
+  AVLDupParallelReduceFunctionPointer ReduceFunctionPntr)
+{
+  char                   *AccumulatorsPntr;
+  size_t                  AccumulatorSpacing;
+  AVLDupThingPointer      EndSearchKeyPntr;
+  status_t                ErrorCode;
+  AVLDupHeldLockRecord    HeldLock;
+  uint32                  i;
+  AVLDupThingRecord       PreparedEndKey;
+  AVLDupThingRecord       PreparedStartKey;
+  ParallelIterationRecord Shared;
+  AVLDupThingPointer      StartSearchKeyPntr;
+  bool                    Successful;
+  IterationWorkerPointer  WorkersArray;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  if (NumberOfThreads == 0)
+    NumberOfThreads = AVLDupGetDefaultThreadCount ();
+
+  /* Allocate the per-thread data and accumulators, the accumulators rounded
+  up to a multiple of the cache line size. */
+
+  AccumulatorSpacing = (AccumulatorSize + CACHE_LINE_SIZE - 1) &
+    ~(size_t) (CACHE_LINE_SIZE - 1);
+
+  memset (&Shared, 0, sizeof (Shared));
+  WorkersArray = malloc (NumberOfThreads * sizeof (IterationWorkerRecord));
+  AccumulatorsPntr = NULL;
+  if (AccumulatorSpacing > 0)
+    AccumulatorsPntr = calloc (NumberOfThreads, AccumulatorSpacing);
+
+  if (WorkersArray == NULL ||
+  (AccumulatorSpacing > 0 && AccumulatorsPntr == NULL))
+  {
+    Successful = false;
+    goto ExitWithoutLock;
+  }
+
+  for (i = 0; i < NumberOfThreads; i++)
+  {
+    WorkersArray[i].sharedPntr = &Shared;
+    WorkersArray[i].accumulatorPntr = (AccumulatorsPntr == NULL) ?
+      NULL : AccumulatorsPntr + i * AccumulatorSpacing;
+  }
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+  {
+    Successful = false; /* Semaphore was deleted or a signal interrupted. */
+    goto ExitWithoutLock;
+  }
+
+  /* Prepare the bounds once here, rather than in every worker, since they
+  all share the same arguments. */
+
+  StartSearchKeyPntr =
+    AVLDupPrepareSearchKey (TreePntr, StartKeyPntr, &PreparedStartKey);
+  EndSearchKeyPntr =
+    AVLDupPrepareSearchKey (TreePntr, EndKeyPntr, &PreparedEndKey);
+
+  AVLDupSetUpIterationArguments (TreePntr, &Shared.arguments,
+    StartSearchKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndSearchKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    NULL, NULL);
+  Shared.userCallback = CallbackFunctionPntr;
+  Shared.userExtraData = ExtraUserData;
+
+  Shared.splitDepth = ChooseSplitDepth (NumberOfThreads,
+    (TreePntr->rootPntr == NULL) ? 0 : TreePntr->rootPntr->height);
+
+  Shared.allocatedPieces = (2UL << Shared.splitDepth);
+  Shared.piecesArray =
+    malloc (Shared.allocatedPieces * sizeof (IterationPieceRecord));
+
+  if (Shared.piecesArray == NULL)
+  {
+    /* Not enough memory to split it up, just do it all in one piece. */
+
+    Shared.piecesArray = malloc (sizeof (IterationPieceRecord));
+    Shared.allocatedPieces = 1;
+    Shared.splitDepth = 0;
+    NumberOfThreads = 1;
+  }
+
+  if (Shared.piecesArray == NULL)
+    Successful = false;
+  else
+  {
+    AVLDUP_TRACE1 (iterate__start, TreePntr);
+    RecursivelyCollectPieces (&Shared, TreePntr->rootPntr,
+      StartKeyPntr != NULL, EndKeyPntr != NULL, 0);
+
+    AVLDUP_STATISTIC (Shared.arguments.counts.iterations = 1);
+    AVLDupAddOperationCounts (TreePntr, &Shared.arguments.counts);
+
+    if (NumberOfThreads > Shared.numberOfPieces)
+      NumberOfThreads = (Shared.numberOfPieces > 0) ?
+        Shared.numberOfPieces : 1;
+
+    AVLDupRunWorkers (IterationWorkerFunction, WorkersArray,
+      sizeof (IterationWorkerRecord), NumberOfThreads);
+
+    Successful = !Shared.aborted;
+    AVLDUP_TRACE3 (iterate__done, TreePntr,
+      (uint32) Shared.callbacksDone, Successful ? 1 : 0);
+    free (Shared.piecesArray);
+  }
+
+  AVLDupFreeSearchKey (TreePntr, StartKeyPntr, StartSearchKeyPntr);
+  AVLDupFreeSearchKey (TreePntr, EndKeyPntr, EndSearchKeyPntr);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "parallel iterate",
+    (uint32) Shared.callbacksDone);
+
+  /* Combine the results from the threads which were used. */
+
+  if (ReduceFunctionPntr != NULL)
+  {
+    for (i = 0; i < NumberOfThreads; i++)
+      ReduceFunctionPntr (WorkersArray[i].accumulatorPntr, ExtraUserData);
+  }
+
+ExitWithoutLock:
+  if (WorkersArray != NULL)
+    free (WorkersArray);
+  if (AccumulatorsPntr != NULL)
+    free (AccumulatorsPntr);
+
+  return Successful;
+}
+
+
+
+/******************************************************************************
+ * Parallel bulk adding.  The new nodes are allocated and sorted by several
+ * threads working on separate slices of the input, then the sorted slices are
+ * merged together in rounds (each pair of slices merged by a different
+ * thread).  Only then is the tree locked, and the new nodes merged with the
+ * existing ones and rebuilt into a balanced tree, again with several threads
+ * each building a separate subtree.
+ */
+
+/* Below this size, sorting is done by simple insertion. */
+
+#define INSERTION_SORT_LIMIT 16
+
+/* Don't bother starting another thread for less than this many items. */
+
+#define MIN_ITEMS_PER_THREAD 1024
+
+
+/* Data shared by all the threads doing a bulk add. */
+
+typedef struct BulkAddStruct
+{
+  AVLDupTreePointer  treePntr;
+  AVLDupThingPointer keyArray;
+  AVLDupThingPointer valueArray;
+  int32              ranOutOfMemory; /* Non-zero if any thread failed. */
+} BulkAddRecord, *BulkAddPointer;
+
+
+/* Each thread sorting or merging works on its own slice of the node arrays.
+When sorting, the source array holds the nodes and the destination array is
+scratch space.  When merging, the runs from startIndex to middleIndex and from
+middleIndex to endIndex in the source array get merged into the destination
+array. */
+
+typedef struct SortWorkerStruct
+{
+  BulkAddPointer     sharedPntr;
+  AVLDupNodePointer *sourceArray;
+  AVLDupNodePointer *destinationArray;
+  uint32             startIndex;
+  uint32             middleIndex;
+  uint32             endIndex;
+} SortWorkerRecord, *SortWorkerPointer;
+
+
+/* A subtree to be built by one of the threads from a slice of the sorted node
+array, and the resulting root node. */
+
+typedef struct BuildPieceStruct
+{
+  AVLDupNodePointer *nodeArray;
+  uint32             numberOfNodes;
+  AVLDupNodePointer  rootPntr;
+} BuildPieceRecord, *BuildPiecePointer;
+
+
+/* Data shared by all the threads building subtrees. */
+
+typedef struct ParallelBuildStruct
+{
+  BuildPiecePointer piecesArray;
+  uint32            numberOfPieces;
+  uint32            splitDepth;
+  int32             nextPieceIndex;
+} ParallelBuildRecord, *ParallelBuildPointer;
+
+
+
+/* Merges two sorted runs of nodes, the first LeftCount long starting at
+SourceArray and the second RightCount long right after it, into the
+DestinationArray.  Equal nodes stay in their original order. */
+
+static void MergeNodeRuns (
+  AVLDupTreePointer  TreePntr,
+  AVLDupNodePointer *SourceArray,
+  uint32             LeftCount,
+  uint32             RightCount,
+  AVLDupNodePointer *DestinationArray)
+{
+  AVLDupNodePointer *LeftPntr;
+  AVLDupNodePointer *LeftEndPntr;
+  AVLDupNodePointer *RightPntr;
+  AVLDupNodePointer *RightEndPntr;
+
+  LeftPntr = SourceArray;
+  LeftEndPntr = RightPntr = SourceArray + LeftCount;
+  RightEndPntr = RightPntr + RightCount;
+
+  while (LeftPntr < LeftEndPntr && RightPntr < RightEndPntr)
+  {
+    if (AVLDupCompareNodes (TreePntr, *RightPntr, *LeftPntr) < 0)
+      *DestinationArray++ = *RightPntr++;
+    else
+      *DestinationArray++ = *LeftPntr++;
+  }
+
+  while (LeftPntr < LeftEndPntr)
+    *DestinationArray++ = *LeftPntr++;
+  while (RightPntr < RightEndPntr)
+    *DestinationArray++ = *RightPntr++;
+}
+
+
+
+/* A plain merge sort of an array of nodes, using the scratch array (which is
+the same size) for merging.  The qsort library function can't be used since
+the comparison needs to know the tree's comparison functions.  Input which is
+already sorted only costs one comparison per half. */
+
+static void SortNodes (
+  AVLDupTreePointer  TreePntr,
+  AVLDupNodePointer *NodeArray,
+  AVLDupNodePointer *ScratchArray,
+  uint32             NumberOfNodes)
+{
+  uint32            HalfCount;
+  uint32            i;
+  uint32            j;
+  AVLDupNodePointer TempNode;
+
+  if (NumberOfNodes <= INSERTION_SORT_LIMIT)
+  {
+    for (i = 1; i < NumberOfNodes; i++)
+    {
+      TempNode = NodeArray[i];
+      for (j = i; j > 0 &&
+      AVLDupCompareNodes (TreePntr, TempNode, NodeArray[j-1]) < 0; j--)
+        NodeArray[j] = NodeArray[j-1];
+      NodeArray[j] = TempNode;
+    }
+    return;
+  }
+
+  HalfCount = NumberOfNodes / 2;
+  SortNodes (TreePntr, NodeArray, ScratchArray, HalfCount);
+  SortNodes (TreePntr, NodeArray + HalfCount, ScratchArray + HalfCount,
+    NumberOfNodes - HalfCount);
+
+  if (AVLDupCompareNodes (TreePntr,
+  NodeArray[HalfCount-1], NodeArray[HalfCount]) <= 0)
+    return; /* Halves are already in order. */
+
+  MergeNodeRuns (TreePntr, NodeArray, HalfCount, NumberOfNodes - HalfCount,
+    ScratchArray);
+  memcpy (NodeArray, ScratchArray, NumberOfNodes * sizeof (AVLDupNodePointer));
+}
+
+
+
+/* First stage of a bulk add, done by each thread on its own slice of the
+input.  Makes nodes for the user's key/value pairs, then sorts them. */
+
+static void AllocateAndSortWorkerFunction (void *WorkerData)
+{
+  uint32            i;
+  BulkAddPointer    SharedPntr;
+  SortWorkerPointer WorkerPntr;
+
+  WorkerPntr = (SortWorkerPointer) WorkerData;
+  SharedPntr = WorkerPntr->sharedPntr;
+
+  for (i = WorkerPntr->startIndex; i < WorkerPntr->endIndex; i++)
+  {
+    WorkerPntr->sourceArray[i] = AVLDupAllocateNode (SharedPntr->treePntr,
+      SharedPntr->keyArray + i, SharedPntr->valueArray + i);
+    if (WorkerPntr->sourceArray[i] == NULL)
+    {
+      atomic_or (&SharedPntr->ranOutOfMemory, 1);
+      return; /* Rest of the slice stays NULL. */
+    }
+  }
+
+  SortNodes (SharedPntr->treePntr,
+    WorkerPntr->sourceArray + WorkerPntr->startIndex,
+    WorkerPntr->destinationArray + WorkerPntr->startIndex,
+    WorkerPntr->endIndex - WorkerPntr->startIndex);
+}
+
+
+
+/* Later stages of a bulk add, merging pairs of sorted slices. */
+
+static void MergeWorkerFunction (void *WorkerData)
+{
+  SortWorkerPointer WorkerPntr;
+
+  WorkerPntr = (SortWorkerPointer) WorkerData;
+
+  MergeNodeRuns (WorkerPntr->sharedPntr->treePntr,
+    WorkerPntr->sourceArray + WorkerPntr->startIndex,
+    WorkerPntr->middleIndex - WorkerPntr->startIndex,
+    WorkerPntr->endIndex - WorkerPntr->middleIndex,
+    WorkerPntr->destinationArray + WorkerPntr->startIndex);
+}
+
+
+
+/* Cuts the job of building a balanced tree out of a sorted node array into
+pieces, one for each subtree at the split depth.  It has to split the array
+up the same way that AVLDupBuildBalancedSubtree does, so that the top part of
+the tree built later by RecursivelyBuildTop fits the pieces. */
+
+static void RecursivelyCollectBuildPieces (
+  ParallelBuildPointer SharedPntr,
+  AVLDupNodePointer   *NodeArray,
+  uint32               NumberOfNodes,
+  uint32               Depth)
+{
+  uint32            MiddleIndex;
+  BuildPiecePointer PiecePntr;
+
+  if (NumberOfNodes == 0)
+    return;
+
+  if (Depth >= SharedPntr->splitDepth)
+  {
+    PiecePntr = SharedPntr->piecesArray + SharedPntr->numberOfPieces++;
+    PiecePntr->nodeArray = NodeArray;
+    PiecePntr->numberOfNodes = NumberOfNodes;
+    PiecePntr->rootPntr = NULL;
+    return;
+  }
+
+  MiddleIndex = NumberOfNodes / 2;
+  RecursivelyCollectBuildPieces (SharedPntr, NodeArray, MiddleIndex,
+    Depth + 1);
+  RecursivelyCollectBuildPieces (SharedPntr, NodeArray + MiddleIndex + 1,
+    NumberOfNodes - MiddleIndex - 1, Depth + 1);
+}
+
+
+
+/* Builds the part of the tree above the split depth, after the worker
+threads have built the subtrees below it.  Uses up the pieces in the same
+order that RecursivelyCollectBuildPieces made them. */
+
+static AVLDupNodePointer RecursivelyBuildTop (
+  ParallelBuildPointer SharedPntr,
+  AVLDupNodePointer   *NodeArray,
+  uint32               NumberOfNodes,
+  uint32               Depth,
+  uint32              *PieceIndexPntr)
+{
+  unsigned int      LeftHeight;
+  uint32            MiddleIndex;
+  AVLDupNodePointer MiddleNode;
+  unsigned int      RightHeight;
+
+  if (NumberOfNodes == 0)
+    return NULL;
+
+  if (Depth >= SharedPntr->splitDepth)
+    return SharedPntr->piecesArray[(*PieceIndexPntr)++].rootPntr;
+
+  MiddleIndex = NumberOfNodes / 2;
+  MiddleNode = NodeArray[MiddleIndex];
+
+  MiddleNode->smallerChildPntr = RecursivelyBuildTop (SharedPntr,
+    NodeArray, MiddleIndex, Depth + 1, PieceIndexPntr);
+  MiddleNode->largerChildPntr = RecursivelyBuildTop (SharedPntr,
+    NodeArray + MiddleIndex + 1, NumberOfNodes - MiddleIndex - 1,
+    Depth + 1, PieceIndexPntr);
+
+  LeftHeight = (MiddleNode->smallerChildPntr == NULL) ?
+    0 : MiddleNode->smallerChildPntr->height;
+  RightHeight = (MiddleNode->largerChildPntr == NULL) ?
+    0 : MiddleNode->largerChildPntr->height;
+  MiddleNode->height = 1 + ((LeftHeight > RightHeight) ?
+    LeftHeight : RightHeight);
+
+  return MiddleNode;
+}
+
+
+
+/* Each building thread keeps on grabbing the next subtree to build until
+there are none left. */
+
+static void BuildWorkerFunction (void *WorkerData)
+{
+  int32                PieceIndex;
+  BuildPiecePointer    PiecePntr;
+  ParallelBuildPointer SharedPntr;
+
+  SharedPntr = *(ParallelBuildPointer *) WorkerData;
+
+  while (true)
+  {
+    PieceIndex = atomic_add (&SharedPntr->nextPieceIndex, 1);
+    if (PieceIndex >= (int32) SharedPntr->numberOfPieces)
+      break;
+
+    PiecePntr = SharedPntr->piecesArray + PieceIndex;
+    PiecePntr->rootPntr =
+      AVLDupBuildBalancedSubtree (PiecePntr->nodeArray,
+      PiecePntr->numberOfNodes);
+  }
+}
+
+
+
+/* Builds a balanced tree out of a sorted array of nodes using several
+threads.  Falls back to doing it all in the calling thread if the tree is
+small or there isn't enough memory to split up the work. */
+
+static AVLDupNodePointer ParallelBuildBalancedTree (
+  AVLDupNodePointer *SortedNodeArray,
+  uint32             NumberOfNodes,
+  uint32             NumberOfThreads)
+{
+  uint32               i;
+  uint32               PieceIndex;
+  AVLDupNodePointer    RootPntr;
+  ParallelBuildRecord  Shared;
+  ParallelBuildPointer  SharedPntr;
+  ParallelBuildPointer *SharedPntrArray;
+
+  if (NumberOfThreads > NumberOfNodes / MIN_ITEMS_PER_THREAD)
+    NumberOfThreads = NumberOfNodes / MIN_ITEMS_PER_THREAD;
+  if (NumberOfThreads <= 1)
+    return AVLDupBuildBalancedSubtree (SortedNodeArray, NumberOfNodes);
+
+  memset (&Shared, 0, sizeof (Shared));
+  Shared.splitDepth = ChooseSplitDepth (NumberOfThreads, 0);
+  Shared.piecesArray = malloc ((1UL << Shared.splitDepth) *
+    sizeof (BuildPieceRecord));
+  if (Shared.piecesArray == NULL)
+    return AVLDupBuildBalancedSubtree (SortedNodeArray, NumberOfNodes);
+
+  RecursivelyCollectBuildPieces (&Shared, SortedNodeArray, NumberOfNodes, 0);
+
+  /* All the workers just need a pointer to the shared data.  If there isn't
+  room for the array of them, the calling thread does all the pieces. */
+
+  SharedPntrArray = malloc (NumberOfThreads * sizeof (ParallelBuildPointer));
+  if (SharedPntrArray == NULL)
+  {
+    SharedPntr = &Shared;
+    BuildWorkerFunction (&SharedPntr);
+  }
+  else
+  {
+    for (i = 0; i < NumberOfThreads; i++)
+      SharedPntrArray[i] = &Shared;
+    AVLDupRunWorkers (BuildWorkerFunction, SharedPntrArray,
+      sizeof (ParallelBuildPointer), NumberOfThreads);
+    free (SharedPntrArray);
+  }
+
+  PieceIndex = 0;
+  RootPntr = RecursivelyBuildTop (&Shared, SortedNodeArray, NumberOfNodes, 0,
+    &PieceIndex);
+
+  free (Shared.piecesArray);
+  return RootPntr;
+}
+
+
+
+/* Adds a whole array of key/value pairs to the tree, the Nth key in KeyArray
+going with the Nth value in ValueArray.  The result is the same as calling
+AVLDupAdd for each pair (duplicates are ignored, and your keys and values are
+copied), but much faster for big arrays.  The new nodes are made and sorted
+using several threads before the tree gets locked, then the tree is locked
+for writing while the new nodes are merged with the existing ones and the
+whole thing is rebuilt as a perfectly balanced tree, again using several
+threads.  So readers are only locked out for a time proportional to the final
+size of the tree, not for the sorting.
+
+NumberOfThreads is the number of threads to use, including the calling
+thread.  Zero means one per CPU.  If the array is small compared to the tree,
+it isn't worth rebuilding the whole tree, so the pairs just get added one at
+a time (still only locking the tree once).
+
+Returns TRUE if successful.  Returns FALSE if it ran out of memory or
+couldn't lock the tree, in which case the tree is unchanged, except for the
+small array case where some of the pairs may have been added.  If the tree
+has a write-ahead log, the added pairs are logged and this waits for them to
+get to the disk, returning FALSE if that failed (the pairs are still in the
+tree). */
+
+bool AVLDupParallelAddArray (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyArray,
+  AVLDupThingPointer ValueArray,
+  uint32 NumberOfPairs,
+  uint32 NumberOfThreads)
+{
+  bigtime_t            ChangeTime;
+  int                  ComparisonResult;
+  status_t             ErrorCode;
+  AVLDupHeldLockRecord HeldLock;
+  AVLDupNodePointer   *ExistingEndPntr;
+  AVLDupNodePointer   *ExistingNodeArray;
+  AVLDupNodePointer   *ExistingPntr;
+  uint32               i;
+  uint32               j;
+  uint32               LogOfCount;
+  AVLDupLogPointer     LogPntr;
+  int64                LogPosition;
+  AVLDupNodePointer   *MergedEndPntr;
+  AVLDupNodePointer   *MergedNodeArray;
+  AVLDupNodePointer   *NewEndPntr;
+  AVLDupNodePointer   *NewNodeArray;
+  AVLDupNodePointer   *NewPntr;
+  uint32               NumberOfRuns;
+  AVLDupNodePointer   *ScratchNodeArray;
+  BulkAddRecord        Shared;
+  bool                 Successful;
+  AVLDupNodePointer   *TempArray;
+  SortWorkerPointer    WorkersArray;
+
+  if (TreePntr == NULL || KeyArray == NULL || ValueArray == NULL)
+    return false;
+  if (NumberOfPairs == 0)
+    return true;
+
+  if (NumberOfThreads == 0)
+    NumberOfThreads = AVLDupGetDefaultThreadCount ();
+  if (NumberOfThreads > NumberOfPairs / MIN_ITEMS_PER_THREAD)
+    NumberOfThreads = NumberOfPairs / MIN_ITEMS_PER_THREAD;
+  if (NumberOfThreads < 1)
+    NumberOfThreads = 1;
+
+  /* If adding them one at a time is cheaper than rebuilding the tree (N log
+  N versus the total size), do that.  The count is read without the lock, but
+  it's only a hint. */
+
+  LogOfCount = 1;
+  while ((1UL << LogOfCount) < TreePntr->count && LogOfCount < 31)
+    LogOfCount++;
+
+  if ((double) NumberOfPairs * LogOfCount < TreePntr->count)
+  {
+    ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+    if (ErrorCode < 0)
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+
+    Successful = true;
+    for (i = 0; i < NumberOfPairs && Successful; i++)
+      Successful = (AVLDupAddWithoutLocking (TreePntr,
+        KeyArray + i, ValueArray + i) != RAN_OUT_OF_MEMORY);
+
+    LogPntr = TreePntr->logPntr;
+    if (LogPntr != NULL)
+      LogPosition = AVLDupLogGetAppendedPosition (LogPntr);
+
+    AVLDupReleaseAccess (TreePntr, &HeldLock, "bulk add", NumberOfPairs);
+
+    if (LogPntr != NULL && !AVLDupLogWaitUntilDurable (LogPntr, LogPosition))
+      Successful = false;
+
+    return Successful;
+  }
+
+  Successful = false;
+  ExistingNodeArray = NULL;
+  LogPntr = NULL;
+  LogPosition = 0;
+  MergedNodeArray = NULL;
+  NewNodeArray = calloc (NumberOfPairs, sizeof (AVLDupNodePointer));
+  ScratchNodeArray = malloc (NumberOfPairs * sizeof (AVLDupNodePointer));
+  WorkersArray = malloc (NumberOfThreads * sizeof (SortWorkerRecord));
+  if (NewNodeArray == NULL || ScratchNodeArray == NULL || WorkersArray == NULL)
+    goto ErrorExit;
+
+  /* Make the nodes and sort them, each thread doing an equal slice. */
+
+  Shared.treePntr = TreePntr;
+  Shared.keyArray = KeyArray;
+  Shared.valueArray = ValueArray;
+  Shared.ranOutOfMemory = 0;
+
+  for (i = 0; i < NumberOfThreads; i++)
+  {
+    WorkersArray[i].sharedPntr = &Shared;
+    WorkersArray[i].sourceArray = NewNodeArray;
+    WorkersArray[i].destinationArray = ScratchNodeArray;
+    WorkersArray[i].startIndex =
+      (uint32) ((uint64) NumberOfPairs * i / NumberOfThreads);
+    WorkersArray[i].endIndex =
+      (uint32) ((uint64) NumberOfPairs * (i + 1) / NumberOfThreads);
+  }
+
+  AVLDupRunWorkers (AllocateAndSortWorkerFunction, WorkersArray,
+    sizeof (SortWorkerRecord), NumberOfThreads);
+
+  if (Shared.ranOutOfMemory)
+    goto ErrorExit;
+
+  /* Merge the sorted slices in pairs, halving the number of slices each
+  round, bouncing the nodes back and forth between the two arrays.  An odd
+  slice at the end gets "merged" with nothing, which just copies it. */
+
+  NumberOfRuns = NumberOfThreads;
+  while (NumberOfRuns > 1)
+  {
+    for (i = 0, j = 0; i < NumberOfRuns; i += 2, j++)
+    {
+      WorkersArray[j].sourceArray = NewNodeArray;
+      WorkersArray[j].destinationArray = ScratchNodeArray;
+      WorkersArray[j].startIndex = WorkersArray[i].startIndex;
+      if (i + 1 < NumberOfRuns)
+      {
+        WorkersArray[j].middleIndex = WorkersArray[i + 1].startIndex;
+        WorkersArray[j].endIndex = WorkersArray[i + 1].endIndex;
+      }
+      else
+      {
+        WorkersArray[j].middleIndex = WorkersArray[i].endIndex;
+        WorkersArray[j].endIndex = WorkersArray[i].endIndex;
+      }
+    }
+    NumberOfRuns = j;
+
+    AVLDupRunWorkers (MergeWorkerFunction, WorkersArray,
+      sizeof (SortWorkerRecord), NumberOfRuns);
+
+    TempArray = NewNodeArray;
+    NewNodeArray = ScratchNodeArray;
+    ScratchNodeArray = TempArray;
+  }
+
+  /* Get rid of duplicates within the new pairs, which are next to each other
+  now that they are sorted. */
+
+  for (i = 1, j = 1; i < NumberOfPairs; i++)
+  {
+    if (AVLDupCompareNodes (TreePntr, NewNodeArray[j-1], NewNodeArray[i]) == 0)
+      AVLDupDeallocateNode (TreePntr, NewNodeArray[i]);
+    else
+      NewNodeArray[j++] = NewNodeArray[i];
+  }
+  for (i = j; i < NumberOfPairs; i++)
+    NewNodeArray[i] = NULL; /* So the error cleanup doesn't free them. */
+  NumberOfPairs = j;
+
+  free (ScratchNodeArray);
+  ScratchNodeArray = NULL;
+
+  /* Now lock the tree and merge in the existing nodes. */
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+  if (ErrorCode < 0)
+    goto ErrorExit; /* Semaphore was deleted or a signal interrupted us. */
+
+  LogPntr = TreePntr->logPntr;
+
+  if (TreePntr->rootPntr == NULL)
+  {
+    TreePntr->rootPntr =
+      ParallelBuildBalancedTree (NewNodeArray, NumberOfPairs, NumberOfThreads);
+    TreePntr->count = NumberOfPairs;
+    Successful = true;
+  }
+  else
+  {
+    ExistingNodeArray = malloc (TreePntr->count * sizeof (AVLDupNodePointer));
+    MergedNodeArray = malloc (
+      (TreePntr->count + NumberOfPairs) * sizeof (AVLDupNodePointer));
+
+    if (ExistingNodeArray != NULL && MergedNodeArray != NULL)
+    {
+      AVLDupFlattenSubtree (TreePntr->rootPntr, ExistingNodeArray);
+
+      /* Merge the two sorted arrays.  When a new node matches an existing
+      one, the existing one is kept so that the tree's contents don't move
+      around in memory any more than needed. */
+
+      ExistingPntr = ExistingNodeArray;
+      ExistingEndPntr = ExistingNodeArray + TreePntr->count;
+      NewPntr = NewNodeArray;
+      NewEndPntr = NewNodeArray + NumberOfPairs;
+      MergedEndPntr = MergedNodeArray;
+
+      while (ExistingPntr < ExistingEndPntr && NewPntr < NewEndPntr)
+      {
+        ComparisonResult =
+          AVLDupCompareNodes (TreePntr, *NewPntr, *ExistingPntr);
+        if (ComparisonResult < 0)
+          *MergedEndPntr++ = *NewPntr++;
+        else if (ComparisonResult > 0)
+          *MergedEndPntr++ = *ExistingPntr++;
+        else /* Duplicate of an existing pair. */
+        {
+          AVLDupDeallocateNode (TreePntr, *NewPntr);
+          *NewPntr++ = NULL;
+          *MergedEndPntr++ = *ExistingPntr++;
+        }
+      }
+      while (ExistingPntr < ExistingEndPntr)
+        *MergedEndPntr++ = *ExistingPntr++;
+      while (NewPntr < NewEndPntr)
+        *MergedEndPntr++ = *NewPntr++;
+
+      TreePntr->count = MergedEndPntr - MergedNodeArray;
+      TreePntr->rootPntr = ParallelBuildBalancedTree (MergedNodeArray,
+        TreePntr->count, NumberOfThreads);
+      Successful = true;
+    }
+  }
+
+  /* Log and record the pairs which were actually added, the ones left in the
+  new node array after the duplicates were weeded out.  Adding them one at a
+  time above went through AVLDupAddWithoutLocking, which does this itself. */
+
+  if (Successful && LogPntr != NULL)
+  {
+    for (i = 0; i < NumberOfPairs; i++)
+      if (NewNodeArray[i] != NULL)
+        AVLDupLogChange (LogPntr, true,
+          &NewNodeArray[i]->key, &NewNodeArray[i]->value);
+    LogPosition = AVLDupLogGetAppendedPosition (LogPntr);
+  }
+
+  if (Successful && TreePntr->recorderPntr != NULL)
+  {
+    ChangeTime = system_time ();
+    for (i = 0; i < NumberOfPairs; i++)
+      if (NewNodeArray[i] != NULL)
+        AVLDupRecordChange (TreePntr->recorderPntr, true /* adding */,
+          ChangeTime, &NewNodeArray[i]->key, &NewNodeArray[i]->value);
+  }
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "bulk add", NumberOfPairs);
+
+ErrorExit:
+  if (!Successful && NewNodeArray != NULL)
+  {
+    /* The new nodes didn't make it into the tree, get rid of them. */
+
+    for (i = 0; i < NumberOfPairs; i++)
+      if (NewNodeArray[i] != NULL)
+        AVLDupDeallocateNode (TreePntr, NewNodeArray[i]);
+  }
+
+  if (NewNodeArray != NULL)
+    free (NewNodeArray);
+  if (ScratchNodeArray != NULL)
+    free (ScratchNodeArray);
+  if (WorkersArray != NULL)
+    free (WorkersArray);
+  if (ExistingNodeArray != NULL)
+    free (ExistingNodeArray);
+  if (MergedNodeArray != NULL)
+    free (MergedNodeArray);
+
+  if (Successful && LogPntr != NULL &&
+  !AVLDupLogWaitUntilDurable (LogPntr, LogPosition))
+    Successful = false;
+
+  return Successful;
+}
+
+
+
+/******************************************************************************
+ * Parallel freeing.  The tree is cut into subtrees a few levels down from the
+ * root, the same way as for iteration, and each thread frees whole subtrees.
+ * The nodes above the split depth are freed individually.
+ */
+
+/* A piece of work for a parallel free, either a whole subtree or just one
+node (whose children are in other pieces). */
+
+typedef struct FreePieceStruct
+{
+  AVLDupNodePointer nodePntr;
+  bool              singleNode;
+} FreePieceRecord, *FreePiecePointer;
+
+
+/* Data shared by all the threads in a parallel free.  The tree header is
+only used for the key and value types. */
+
+typedef struct ParallelFreeStruct
+{
+  AVLDupTreePointer treePntr;
+  FreePiecePointer  piecesArray;
+  uint32            numberOfPieces;
+  uint32            splitDepth;
+  int32             nextPieceIndex;
+} ParallelFreeRecord, *ParallelFreePointer;
+
+
+/* What the background freeing thread needs to know. */
+
+typedef struct BackgroundFreeStruct
+{
+  AVLDupTreePointer treePntr;
+  AVLDupNodePointer rootPntr;
+  uint32            numberOfThreads;
+} BackgroundFreeRecord, *BackgroundFreePointer;
+
+
+
+/* Cuts the tree into pieces for freeing.  All the pieces are found before
+any freeing starts, so nothing looks at a child pointer in a freed node. */
+
+static void RecursivelyCollectFreePieces (
+  ParallelFreePointer SharedPntr,
+  AVLDupNodePointer   CurrentNode,
+  uint32              Depth)
+{
+  FreePiecePointer PiecePntr;
+
+  if (CurrentNode == NULL)
+    return;
+
+  if (Depth < SharedPntr->splitDepth)
+  {
+    RecursivelyCollectFreePieces (SharedPntr, CurrentNode->smallerChildPntr,
+      Depth + 1);
+    RecursivelyCollectFreePieces (SharedPntr, CurrentNode->largerChildPntr,
+      Depth + 1);
+  }
+
+  PiecePntr = SharedPntr->piecesArray + SharedPntr->numberOfPieces++;
+  PiecePntr->nodePntr = CurrentNode;
+  PiecePntr->singleNode = (Depth < SharedPntr->splitDepth);
+}
+
+
+
+/* Each freeing thread keeps on grabbing the next piece until there are none
+left. */
+
+static void FreeWorkerFunction (void *WorkerData)
+{
+  int32               PieceIndex;
+  FreePiecePointer    PiecePntr;
+  ParallelFreePointer SharedPntr;
+
+  SharedPntr = *(ParallelFreePointer *) WorkerData;
+
+  while (true)
+  {
+    PieceIndex = atomic_add (&SharedPntr->nextPieceIndex, 1);
+    if (PieceIndex >= (int32) SharedPntr->numberOfPieces)
+      break;
+
+    PiecePntr = SharedPntr->piecesArray + PieceIndex;
+    if (PiecePntr->singleNode)
+      AVLDupDeallocateNode (SharedPntr->treePntr, PiecePntr->nodePntr);
+    else
+      AVLDupRecursiveDeallocateNodes (SharedPntr->treePntr,
+        PiecePntr->nodePntr);
+  }
+}
+
+
+
+/* Frees all the nodes of a detached tree using several threads, then frees
+the tree header. */
+
+static void ParallelDeallocateDetachedTree (BackgroundFreePointer JobPntr)
+{
+  uint32               i;
+  uint32               NumberOfThreads;
+  ParallelFreeRecord   Shared;
+  ParallelFreePointer *SharedPntrArray;
+
+  NumberOfThreads = JobPntr->numberOfThreads;
+
+  memset (&Shared, 0, sizeof (Shared));
+  Shared.treePntr = JobPntr->treePntr;
+  if (JobPntr->rootPntr != NULL && NumberOfThreads > 1)
+  {
+    Shared.splitDepth =
+      ChooseSplitDepth (NumberOfThreads, JobPntr->rootPntr->height);
+    Shared.piecesArray =
+      malloc ((2UL << Shared.splitDepth) * sizeof (FreePieceRecord));
+  }
+  SharedPntrArray = malloc (NumberOfThreads * sizeof (ParallelFreePointer));
+
+  if (Shared.piecesArray == NULL || SharedPntrArray == NULL)
+  {
+    /* Small tree or not enough memory to split it up, do it the usual way. */
+
+    AVLDupRecursiveDeallocateNodes (JobPntr->treePntr, JobPntr->rootPntr);
+  }
+  else
+  {
+    RecursivelyCollectFreePieces (&Shared, JobPntr->rootPntr, 0);
+
+    for (i = 0; i < NumberOfThreads; i++)
+      SharedPntrArray[i] = &Shared;
+    AVLDupRunWorkers (FreeWorkerFunction, SharedPntrArray,
+      sizeof (ParallelFreePointer), NumberOfThreads);
+  }
+
+  if (Shared.piecesArray != NULL)
+    free (Shared.piecesArray);
+  if (SharedPntrArray != NULL)
+    free (SharedPntrArray);
+
+  /* The header now has no nodes and no semaphore, so the usual function just
+  frees the name and the header itself. */
+
+  AVLDupFreeTree (JobPntr->treePntr);
+  free (JobPntr);
+}
+
+
+
+/* The function which the background freeing thread runs. */
+
+static int32 BackgroundFreeThreadEntry (void *DataPntr)
+{
+  ParallelDeallocateDetachedTree ((BackgroundFreePointer) DataPntr);
+  return 0;
+}
+
+
+
+/* Like AVLDupFreeTree, but uses several threads to free the nodes, which
+helps for big trees.  NumberOfThreads is the number of threads to use, zero
+for one per CPU.
+
+Waits for the tree to be unused (just like AVLDupFreeTree), then deletes the
+semaphore and detaches the root from the tree.  From then on, as far as the
+caller is concerned, the tree is gone.  If WaitUntilDone is TRUE the memory is
+all freed before this function returns.  If FALSE, the freeing is done by a
+low priority background thread (plus helper threads if NumberOfThreads is
+more than one) and this function returns right away, which is handy when a
+program wants to throw away a big index without stalling.  If the background
+thread can't be started, the freeing is done before returning anyway. */
+
+void AVLDupParallelFreeTree (
+  AVLDupTreePointer TreePntr,
+  uint32 NumberOfThreads,
+  bool WaitUntilDone)
+{
+  BackgroundFreePointer JobPntr;
+  thread_id             ThreadID;
+
+  if (TreePntr == NULL)
+    return;
+
+  if (NumberOfThreads == 0)
+    NumberOfThreads = AVLDupGetDefaultThreadCount ();
+
+  JobPntr = malloc (sizeof (BackgroundFreeRecord));
+  if (JobPntr == NULL)
+  {
+    AVLDupFreeTree (TreePntr); /* Out of memory, do it the simple way. */
+    return;
+  }
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    /* Wait for all readers and writers to leave, then delete the semaphore
+    so that any threads still waiting get an error and go away. */
+
+    acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are writer, grab all */, 0, 0);
+    delete_sem (TreePntr->accessSemaphoreID);
+    TreePntr->accessSemaphoreID = -1;
+  }
+
+  JobPntr->treePntr = TreePntr;
+  JobPntr->rootPntr = TreePntr->rootPntr;
+  JobPntr->numberOfThreads = NumberOfThreads;
+  TreePntr->rootPntr = NULL;
+  TreePntr->count = 0;
+
+  if (!WaitUntilDone)
+  {
+    ThreadID = spawn_thread (BackgroundFreeThreadEntry,
+      "AVLDup Background Free", B_LOW_PRIORITY, JobPntr);
+    if (ThreadID >= 0)
+    {
+      resume_thread (ThreadID);
+      return;
+    }
+  }
+
+  ParallelDeallocateDetachedTree (JobPntr);
+}
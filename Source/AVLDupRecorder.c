@@ -0,0 +1,641 @@
+/******************************************************************************
+ * AVLDupRecorder.c
+ *
+ * Records the calls made to a tree, so that a real workload (say from a file
+ * system's query engine) can be captured once and replayed later against a
+ * new version of the library, rather than relying on made up test loops.
+ * Once AVLDupStartRecording has been called, every addition, deletion and
+ * AVLDupIterate call on the tree is written to a trace file, with its key
+ * and value (or range bounds and flags for iterations), the thread that made
+ * it and the time.  That includes the additions and deletions made by
+ * AVLDupIterateDeferringChanges, AVLDupParallelAddArray and replaying the
+ * write-ahead log, not just AVLDupAdd and AVLDupDelete, so the replayed tree
+ * has the same contents.  Iterations also record how many items they passed
+ * to the callback, so that a replay can stop at the same point and check
+ * that it got the same number of items.  Optionally the current contents of
+ * the tree are written at the start of the trace, so it can be replayed
+ * starting from an empty tree.
+ *
+ * Reading a trace back is done with AVLDupOpenTrace, AVLDupReadTrace and
+ * AVLDupCloseTrace.  The AVLDupBenchmark program uses them to replay a trace
+ * as fast as possible or with the original timing.
+ *
+ * Unlike the write-ahead log (see AVLDupLog.c), a trace is just for
+ * measurements, so it isn't forced to disk and has no checksums, stdio
+ * buffering is good enough.  The file starts with a 16 byte header (magic
+ * number, version, key and value types).  Each record is the payload length
+ * followed by the payload: an operation code byte, a flags byte, the thread
+ * ID, the time in microseconds since recording started, the number of items
+ * iterated (for iterations only) and then whichever of the key, value, end
+ * key and end value are present according to the flags.  Numbers are stored
+ * 7 bits per byte with the high bit set on all but the last byte, things are
+ * stored the same way as in the write-ahead log.  Everything is little
+ * endian.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <ByteOrder.h>
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+#define AVLDUP_TRACE_MAGIC 0x524C5641 /* "AVLR" when read as bytes. */
+#define AVLDUP_TRACE_VERSION 1
+
+/* Bits in the flags byte of a record. */
+
+#define TRACE_FLAG_HAS_KEY 0x01
+#define TRACE_FLAG_HAS_VALUE 0x02
+#define TRACE_FLAG_INCLUDE_START 0x04
+#define TRACE_FLAG_HAS_END_KEY 0x08
+#define TRACE_FLAG_HAS_END_VALUE 0x10
+#define TRACE_FLAG_INCLUDE_END 0x20
+#define TRACE_FLAG_EXISTING_PAIR 0x40
+
+/* Room for the operation code, flags and the numbers (up to 10 bytes each)
+in a record, and for the payload length in front of it. */
+
+#define MAX_FIXED_PAYLOAD_SIZE 32
+#define MAX_LENGTH_SIZE 5
+
+/* Records smaller than this are encoded in a buffer on the stack. */
+
+#define STACK_BUFFER_SIZE 256
+
+/* Record payloads bigger than this are assumed to be garbage. */
+
+#define MAX_PAYLOAD_SIZE 0x40000000UL
+
+
+typedef struct AVLDupTraceHeaderStruct
+{
+  uint32 magic;
+  uint32 version;
+  uint32 keyType;
+  uint32 valueType;
+} AVLDupTraceHeaderRecord, *AVLDupTraceHeaderPointer;
+
+
+/* The recorder attached to a tree.  Readers can be recording their
+iterations at the same time, so writing to the file is protected by the
+write semaphore.  The recorder itself can only be attached or removed while
+holding the tree's writer lock. */
+
+struct AVLDupRecorderStruct
+{
+  FILE          *filePntr;
+  type_code      keyType;
+  type_code      valueType;
+  bigtime_t      startTime;
+  sem_id         writeSemaphoreID;
+  volatile bool  failed; /* Set if any record couldn't be written. */
+};
+
+
+/* An open trace being read.  The buffer holds the current record's payload
+followed by room for copies of its strings, which the things point to. */
+
+struct AVLDupTraceReaderStruct
+{
+  FILE      *filePntr;
+  type_code  keyType;
+  type_code  valueType;
+  uint8     *bufferPntr;
+  size_t     bufferSize;
+};
+
+
+
+/* Stores a number 7 bits per byte, returns the place just after it. */
+
+static uint8 *EncodeNumber (uint8 *DestPntr, uint64 Number)
+{
+  while (Number >= 0x80)
+  {
+    *DestPntr++ = (uint8) (Number | 0x80);
+    Number >>= 7;
+  }
+  *DestPntr++ = (uint8) Number;
+  return DestPntr;
+}
+
+
+
+/* Reads a number stored by EncodeNumber, returns the place just after it or
+NULL if it runs past the end. */
+
+static const uint8 *DecodeNumber (
+  const uint8 *SourcePntr,
+  const uint8 *EndPntr,
+  uint64      *NumberPntr)
+{
+  int Shift;
+
+  *NumberPntr = 0;
+  Shift = 0;
+  do
+  {
+    if (SourcePntr >= EndPntr || Shift > 63)
+      return NULL;
+    *NumberPntr |= (uint64) (*SourcePntr & 0x7F) << Shift;
+    Shift += 7;
+  } while (*SourcePntr++ & 0x80);
+
+  return SourcePntr;
+}
+
+
+
+/* Encodes a record and appends it to the trace file.  Things which aren't
+part of the record are NULL. */
+
+static void WriteRecord (
+  AVLDupRecorderPointer   RecorderPntr,
+  AVLDupRecordedOperation Operation,
+  uint8                   Flags,
+  bigtime_t               Time,
+  uint32                  ItemsIterated,
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  AVLDupThingConstPointer EndKeyPntr,
+  AVLDupThingConstPointer EndValuePntr)
+{
+  uint8 *BufferPntr;
+  uint8 *DestPntr;
+  uint8  LengthBuffer [MAX_LENGTH_SIZE];
+  size_t LengthSize;
+  uint8 *PayloadPntr;
+  size_t PayloadSize;
+  uint8 *RecordPntr;
+  uint8  StackBuffer [STACK_BUFFER_SIZE];
+
+  PayloadSize = MAX_FIXED_PAYLOAD_SIZE;
+  if (KeyPntr != NULL)
+    PayloadSize += AVLDupEncodedThingSize (KeyPntr, RecorderPntr->keyType);
+  if (ValuePntr != NULL)
+    PayloadSize += AVLDupEncodedThingSize (ValuePntr, RecorderPntr->valueType);
+  if (EndKeyPntr != NULL)
+    PayloadSize += AVLDupEncodedThingSize (EndKeyPntr, RecorderPntr->keyType);
+  if (EndValuePntr != NULL)
+    PayloadSize +=
+      AVLDupEncodedThingSize (EndValuePntr, RecorderPntr->valueType);
+
+  if (MAX_LENGTH_SIZE + PayloadSize <= STACK_BUFFER_SIZE)
+    BufferPntr = StackBuffer;
+  else
+  {
+    BufferPntr = malloc (MAX_LENGTH_SIZE + PayloadSize);
+    if (BufferPntr == NULL)
+    {
+      RecorderPntr->failed = true;
+      return;
+    }
+  }
+
+  /* Encode the payload after the space reserved for its length, then put
+  the actual length just in front of it. */
+
+  PayloadPntr = BufferPntr + MAX_LENGTH_SIZE;
+  DestPntr = PayloadPntr;
+  *DestPntr++ = (uint8) Operation;
+  *DestPntr++ = Flags;
+  DestPntr = EncodeNumber (DestPntr, (uint32) find_thread (NULL));
+  DestPntr = EncodeNumber (DestPntr, (Time > 0) ? (uint64) Time : 0);
+  if (Operation == AVLDUP_RECORDED_ITERATE)
+    DestPntr = EncodeNumber (DestPntr, ItemsIterated);
+  if (KeyPntr != NULL)
+    DestPntr = AVLDupEncodeThing (DestPntr, KeyPntr, RecorderPntr->keyType);
+  if (ValuePntr != NULL)
+    DestPntr = AVLDupEncodeThing (DestPntr, ValuePntr,
+      RecorderPntr->valueType);
+  if (EndKeyPntr != NULL)
+    DestPntr = AVLDupEncodeThing (DestPntr, EndKeyPntr,
+      RecorderPntr->keyType);
+  if (EndValuePntr != NULL)
+    DestPntr = AVLDupEncodeThing (DestPntr, EndValuePntr,
+      RecorderPntr->valueType);
+
+  PayloadSize = DestPntr - PayloadPntr;
+  LengthSize = EncodeNumber (LengthBuffer, PayloadSize) - LengthBuffer;
+  RecordPntr = PayloadPntr - LengthSize;
+  memcpy (RecordPntr, LengthBuffer, LengthSize);
+
+  if (acquire_sem (RecorderPntr->writeSemaphoreID) != B_OK)
+    RecorderPntr->failed = true;
+  else
+  {
+    if (fwrite (RecordPntr, DestPntr - RecordPntr, 1,
+    RecorderPntr->filePntr) != 1)
+      RecorderPntr->failed = true;
+    release_sem_etc (RecorderPntr->writeSemaphoreID, 1, B_DO_NOT_RESCHEDULE);
+  }
+
+  if (BufferPntr != StackBuffer)
+    free (BufferPntr);
+}
+
+
+
+/* Records an AVLDupAdd or AVLDupDelete call.  Called while holding the tree's
+writer lock. */
+
+void AVLDupRecordChange (
+  AVLDupRecorderPointer RecorderPntr,
+  bool                  IsAddition,
+  bigtime_t             LockedTime,
+  AVLDupThingPointer    Key,
+  AVLDupThingPointer    Value)
+{
+  WriteRecord (RecorderPntr,
+    IsAddition ? AVLDUP_RECORDED_ADD : AVLDUP_RECORDED_DELETE,
+    TRACE_FLAG_HAS_KEY | TRACE_FLAG_HAS_VALUE,
+    LockedTime - RecorderPntr->startTime, 0, Key, Value, NULL, NULL);
+}
+
+
+
+/* Records an AVLDupIterate call, after it is done so that the number of items
+iterated is known.  Called while holding the tree's reader lock.  Values
+without a key are ignored by the iteration, so they aren't recorded. */
+
+void AVLDupRecordIteration (
+  AVLDupRecorderPointer RecorderPntr,
+  bigtime_t             LockedTime,
+  AVLDupThingPointer    StartKeyPntr,
+  AVLDupThingPointer    StartValuePntr,
+  bool                  IncludeThingEqualToStart,
+  AVLDupThingPointer    EndKeyPntr,
+  AVLDupThingPointer    EndValuePntr,
+  bool                  IncludeThingEqualToEnd,
+  uint32                ItemsIterated)
+{
+  uint8 Flags = 0;
+
+  if (StartKeyPntr == NULL)
+    StartValuePntr = NULL;
+  if (EndKeyPntr == NULL)
+    EndValuePntr = NULL;
+
+  if (StartKeyPntr != NULL)
+    Flags |= TRACE_FLAG_HAS_KEY;
+  if (StartValuePntr != NULL)
+    Flags |= TRACE_FLAG_HAS_VALUE;
+  if (IncludeThingEqualToStart)
+    Flags |= TRACE_FLAG_INCLUDE_START;
+  if (EndKeyPntr != NULL)
+    Flags |= TRACE_FLAG_HAS_END_KEY;
+  if (EndValuePntr != NULL)
+    Flags |= TRACE_FLAG_HAS_END_VALUE;
+  if (IncludeThingEqualToEnd)
+    Flags |= TRACE_FLAG_INCLUDE_END;
+
+  WriteRecord (RecorderPntr, AVLDUP_RECORDED_ITERATE, Flags,
+    LockedTime - RecorderPntr->startTime, ItemsIterated,
+    StartKeyPntr, StartValuePntr, EndKeyPntr, EndValuePntr);
+}
+
+
+
+/* Iteration callback for writing out the tree's contents at the start of a
+trace.  Stops the iteration if writing fails. */
+
+static bool RecordExistingPair (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  AVLDupRecorderPointer RecorderPntr;
+
+  RecorderPntr = (AVLDupRecorderPointer) ExtraData;
+  WriteRecord (RecorderPntr, AVLDUP_RECORDED_ADD,
+    TRACE_FLAG_HAS_KEY | TRACE_FLAG_HAS_VALUE | TRACE_FLAG_EXISTING_PAIR,
+    0, 0, KeyPntr, ValuePntr, NULL, NULL);
+  return !RecorderPntr->failed;
+}
+
+
+
+/* Closes the trace file and deallocates the recorder.  Returns TRUE if all
+the records were written successfully. */
+
+bool AVLDupRecorderClose (AVLDupRecorderPointer RecorderPntr)
+{
+  bool ReturnCode;
+
+  if (RecorderPntr == NULL)
+    return false;
+
+  if (RecorderPntr->filePntr != NULL &&
+  fclose (RecorderPntr->filePntr) != 0)
+    RecorderPntr->failed = true;
+  if (RecorderPntr->writeSemaphoreID >= 0)
+    delete_sem (RecorderPntr->writeSemaphoreID);
+
+  ReturnCode = !RecorderPntr->failed;
+  free (RecorderPntr);
+  return ReturnCode;
+}
+
+
+
+/* Starts recording the operations done on the tree to a new trace file
+(replacing any existing file of that name).  If IncludeExistingPairs is TRUE
+then the pairs already in the tree are written at the start of the trace,
+marked as existing pairs, so that a replay can start with the same
+contents.  Returns TRUE if successful, FALSE if the file couldn't be
+written, the tree is already being recorded or there isn't enough memory. */
+
+bool AVLDupStartRecording (
+  AVLDupTreePointer TreePntr,
+  const char *TracePathName,
+  bool IncludeExistingPairs)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  status_t                    ErrorCode;
+  AVLDupTraceHeaderRecord     Header;
+  AVLDupRecorderPointer       RecorderPntr;
+
+  if (TreePntr == NULL || TracePathName == NULL)
+    return false;
+
+  RecorderPntr = malloc (sizeof (AVLDupRecorderRecord));
+  if (RecorderPntr == NULL)
+    return false;
+  memset (RecorderPntr, 0, sizeof (AVLDupRecorderRecord));
+  RecorderPntr->keyType = TreePntr->keyType;
+  RecorderPntr->valueType = TreePntr->valueType;
+  RecorderPntr->writeSemaphoreID = create_sem (1, "AVLDupRecorder Write");
+  if (RecorderPntr->writeSemaphoreID < 0)
+  {
+    AVLDupRecorderClose (RecorderPntr);
+    return false;
+  }
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+    {
+      AVLDupRecorderClose (RecorderPntr);
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+    }
+  }
+
+  if (TreePntr->recorderPntr != NULL)
+    goto ErrorExit;
+
+  RecorderPntr->filePntr = fopen (TracePathName, "wb");
+  if (RecorderPntr->filePntr == NULL)
+    goto ErrorExit;
+
+  Header.magic = B_HOST_TO_LENDIAN_INT32 (AVLDUP_TRACE_MAGIC);
+  Header.version = B_HOST_TO_LENDIAN_INT32 (AVLDUP_TRACE_VERSION);
+  Header.keyType = B_HOST_TO_LENDIAN_INT32 (TreePntr->keyType);
+  Header.valueType = B_HOST_TO_LENDIAN_INT32 (TreePntr->valueType);
+  if (fwrite (&Header, sizeof (Header), 1, RecorderPntr->filePntr) != 1)
+    goto ErrorExit;
+
+  if (IncludeExistingPairs)
+  {
+    AVLDupSetUpIterationArguments (TreePntr, &Arguments,
+      NULL, NULL, true, NULL, NULL, true,
+      RecordExistingPair, RecorderPntr);
+    AVLDupRecursiveRangeIterate (&Arguments, TreePntr->rootPntr,
+      false, false);
+    if (RecorderPntr->failed)
+      goto ErrorExit;
+  }
+
+  RecorderPntr->startTime = system_time ();
+  TreePntr->recorderPntr = RecorderPntr;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+  return true;
+
+ErrorExit:
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+  AVLDupRecorderClose (RecorderPntr);
+  return false;
+}
+
+
+
+/* Stops recording and closes the trace file.  Returns TRUE if every record
+was written successfully, FALSE if some were lost (out of memory or disk
+space) or the tree wasn't being recorded. */
+
+bool AVLDupStopRecording (AVLDupTreePointer TreePntr)
+{
+  status_t              ErrorCode;
+  AVLDupRecorderPointer RecorderPntr;
+
+  if (TreePntr == NULL)
+    return false;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
+    if (ErrorCode < 0)
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+  }
+
+  RecorderPntr = TreePntr->recorderPntr;
+  TreePntr->recorderPntr = NULL;
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    release_sem_etc (TreePntr->accessSemaphoreID,
+      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+  }
+
+  if (RecorderPntr == NULL)
+    return false;
+  return AVLDupRecorderClose (RecorderPntr);
+}
+
+
+
+/* Opens a trace file for reading with AVLDupReadTrace.  The key and value
+types of the recorded tree are returned through the pointers, so that a
+matching tree can be made for replaying it.  Returns NULL if the file can't
+be read, isn't a trace or there isn't enough memory. */
+
+AVLDupTraceReaderPointer AVLDupOpenTrace (
+  const char *TracePathName,
+  type_code *KeyTypePntr,
+  type_code *ValueTypePntr)
+{
+  AVLDupTraceHeaderRecord  Header;
+  AVLDupTraceReaderPointer ReaderPntr;
+
+  if (TracePathName == NULL)
+    return NULL;
+
+  ReaderPntr = malloc (sizeof (AVLDupTraceReaderRecord));
+  if (ReaderPntr == NULL)
+    return NULL;
+  memset (ReaderPntr, 0, sizeof (AVLDupTraceReaderRecord));
+
+  ReaderPntr->filePntr = fopen (TracePathName, "rb");
+  if (ReaderPntr->filePntr == NULL ||
+  fread (&Header, sizeof (Header), 1, ReaderPntr->filePntr) != 1 ||
+  B_LENDIAN_TO_HOST_INT32 (Header.magic) != AVLDUP_TRACE_MAGIC ||
+  B_LENDIAN_TO_HOST_INT32 (Header.version) != AVLDUP_TRACE_VERSION)
+    goto ErrorExit;
+
+  ReaderPntr->keyType = B_LENDIAN_TO_HOST_INT32 (Header.keyType);
+  ReaderPntr->valueType = B_LENDIAN_TO_HOST_INT32 (Header.valueType);
+  if (KeyTypePntr != NULL)
+    *KeyTypePntr = ReaderPntr->keyType;
+  if (ValueTypePntr != NULL)
+    *ValueTypePntr = ReaderPntr->valueType;
+  return ReaderPntr;
+
+ErrorExit:
+  AVLDupCloseTrace (ReaderPntr);
+  return NULL;
+}
+
+
+
+/* Reads the next call from a trace.  String things point into the reader's
+buffer, so they are only good until the next read.  Returns FALSE at the
+end of the trace, or if the next record is damaged or cut short (a program
+which crashed while recording leaves a partial record at the end). */
+
+bool AVLDupReadTrace (
+  AVLDupTraceReaderPointer ReaderPntr,
+  AVLDupRecordedCallPointer CallPntr)
+{
+  int          Character;
+  const uint8 *EndPntr;
+  uint8        Flags;
+  uint64       Number;
+  uint64       PayloadSize;
+  int          Shift;
+  const uint8 *SourcePntr;
+  char        *StringBufferPntr;
+  uint8       *TempPntr;
+
+  if (ReaderPntr == NULL || CallPntr == NULL)
+    return false;
+
+  /* Read the payload length, a byte at a time. */
+
+  PayloadSize = 0;
+  Shift = 0;
+  do
+  {
+    Character = getc (ReaderPntr->filePntr);
+    if (Character == EOF || Shift > 28)
+      return false;
+    PayloadSize |= (uint64) (Character & 0x7F) << Shift;
+    Shift += 7;
+  } while (Character & 0x80);
+
+  if (PayloadSize < 4 || PayloadSize > MAX_PAYLOAD_SIZE)
+    return false;
+
+  /* Make room for the payload and copies of up to four strings from it, each
+  with a NUL. */
+
+  if (ReaderPntr->bufferSize < 2 * PayloadSize + 4)
+  {
+    TempPntr = realloc (ReaderPntr->bufferPntr, 2 * PayloadSize + 4);
+    if (TempPntr == NULL)
+      return false;
+    ReaderPntr->bufferPntr = TempPntr;
+    ReaderPntr->bufferSize = 2 * PayloadSize + 4;
+  }
+
+  if (fread (ReaderPntr->bufferPntr, PayloadSize, 1,
+  ReaderPntr->filePntr) != 1)
+    return false;
+
+  memset (CallPntr, 0, sizeof (AVLDupRecordedCallRecord));
+  SourcePntr = ReaderPntr->bufferPntr;
+  EndPntr = SourcePntr + PayloadSize;
+  StringBufferPntr = (char *) ReaderPntr->bufferPntr + PayloadSize;
+
+  CallPntr->operation = (AVLDupRecordedOperation) *SourcePntr++;
+  if (CallPntr->operation != AVLDUP_RECORDED_ADD &&
+  CallPntr->operation != AVLDUP_RECORDED_DELETE &&
+  CallPntr->operation != AVLDUP_RECORDED_ITERATE)
+    return false;
+
+  Flags = *SourcePntr++;
+  CallPntr->existingPair = (Flags & TRACE_FLAG_EXISTING_PAIR) != 0;
+  CallPntr->hasKey = (Flags & TRACE_FLAG_HAS_KEY) != 0;
+  CallPntr->hasValue = (Flags & TRACE_FLAG_HAS_VALUE) != 0;
+  CallPntr->includeThingEqualToStart = (Flags & TRACE_FLAG_INCLUDE_START) != 0;
+  CallPntr->hasEndKey = (Flags & TRACE_FLAG_HAS_END_KEY) != 0;
+  CallPntr->hasEndValue = (Flags & TRACE_FLAG_HAS_END_VALUE) != 0;
+  CallPntr->includeThingEqualToEnd = (Flags & TRACE_FLAG_INCLUDE_END) != 0;
+
+  SourcePntr = DecodeNumber (SourcePntr, EndPntr, &Number);
+  if (SourcePntr == NULL)
+    return false;
+  CallPntr->threadID = (int32) Number;
+
+  SourcePntr = DecodeNumber (SourcePntr, EndPntr, &Number);
+  if (SourcePntr == NULL)
+    return false;
+  CallPntr->time = (bigtime_t) Number;
+
+  if (CallPntr->operation == AVLDUP_RECORDED_ITERATE)
+  {
+    SourcePntr = DecodeNumber (SourcePntr, EndPntr, &Number);
+    if (SourcePntr == NULL)
+      return false;
+    CallPntr->itemsIterated = (uint32) Number;
+  }
+
+  if (CallPntr->hasKey && SourcePntr != NULL)
+    SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr,
+      ReaderPntr->keyType, &StringBufferPntr, &CallPntr->key);
+  if (CallPntr->hasValue && SourcePntr != NULL)
+    SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr,
+      ReaderPntr->valueType, &StringBufferPntr, &CallPntr->value);
+  if (CallPntr->hasEndKey && SourcePntr != NULL)
+    SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr,
+      ReaderPntr->keyType, &StringBufferPntr, &CallPntr->endKey);
+  if (CallPntr->hasEndValue && SourcePntr != NULL)
+    SourcePntr = AVLDupDecodeThing (SourcePntr, EndPntr,
+      ReaderPntr->valueType, &StringBufferPntr, &CallPntr->endValue);
+
+  return (SourcePntr == EndPntr);
+}
+
+
+
+void AVLDupCloseTrace (AVLDupTraceReaderPointer ReaderPntr)
+{
+  if (ReaderPntr == NULL)
+    return;
+
+  if (ReaderPntr->filePntr != NULL)
+    fclose (ReaderPntr->filePntr);
+  free (ReaderPntr->bufferPntr);
+  free (ReaderPntr);
+}
@@ -0,0 +1,584 @@
+/******************************************************************************
+ * AVLDupSetOperations.c
+ *
+ * Combining the values found in several trees, for queries which AND and OR
+ * together conditions on several indices.  For example, with a file system
+ * which has an index of file names and another of file sizes (both with the
+ * file's inode number as the value), the files named "README" which are
+ * bigger than 10000 bytes are the intersection of the values for the key
+ * "README" in the name index and the values for keys above 10000 in the size
+ * index.  AVLDupCombineValues works out the intersection, union or
+ * difference of the values in any number of such (tree, key range) inputs
+ * and passes the resulting values to your callback function in ascending
+ * order, each value once.
+ *
+ * The values for each input are copied out of its tree (with the tree locked
+ * for reading just while copying, one tree at a time, so there's no chance
+ * of deadlocks between trees), sorted and made unique.  Values for a single
+ * key are already sorted, so the sorting is cheap for that common case.
+ * Then the sorted lists are combined.  Unions are a plain merge of all the
+ * lists.  For intersections the smallest list is gone through and each of
+ * its values is searched for in the other lists with a galloping search
+ * (doubling the step size until it goes past the value, then a binary
+ * search), which skips big stretches of a long list quickly and is still
+ * about as fast as a merge when the lists are similar in size.  Differences
+ * work the same way, with the first list's values searched for in the rest.
+ *
+ * If the values are int32s or int64s and a list is dense (its values are
+ * mostly close together), a bitmap with a bit for each possible value in
+ * its span can be made for it instead, so checking for a value is a single
+ * bit test rather than a search.  That's often the case for inode numbers
+ * and other allocated identifiers.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* A list gets a bitmap if its span (largest value minus smallest, plus one)
+is at most this many times the number of values in it.  Then the bitmap is at
+most half the size of the list itself, since each thing is 8 bytes. */
+
+#define BITMAP_MAXIMUM_SPARSENESS 32
+
+
+/* A bitmap is only worth making if the values searched for in a list are at
+least this fraction (one in N) of the values in the list.  Making the bitmap
+goes through the whole list, while galloping searches for a few values
+would skip most of it. */
+
+#define BITMAP_MINIMUM_SEARCH_FRACTION 4
+
+
+/* Below this size the sort uses an insertion sort rather than merging. */
+
+#define INSERTION_SORT_LIMIT 16
+
+
+/* The values from one input, sorted and without duplicates once it has been
+prepared.  Searches through it go forwards from the cursor, since the values
+being searched for come in ascending order. */
+
+typedef struct ValueListStruct
+{
+  type_code          valueType;
+  AVLDupThingPointer valuesArray;
+  uint32             count;
+  uint32             allocatedCount;
+  bool               ranOutOfMemory;
+  uint32             cursor;
+  uint8             *bitmapPntr; /* NULL if not using a bitmap. */
+  int64              bitmapBase; /* The value for bit zero. */
+  uint64             bitmapBits;
+} ValueListRecord, *ValueListPointer;
+
+
+
+/* Iteration callback for collecting the values from one input.  Copies the
+value (and its string) onto the end of the list, growing it as needed.
+Stops the iteration if it runs out of memory. */
+
+static bool CollectValueCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  ValueListPointer   ListPntr;
+  uint32             NewAllocatedCount;
+  AVLDupThingPointer NewValuesArray;
+
+  (void) KeyPntr; /* Only the values are wanted. */
+  ListPntr = ExtraData;
+
+  if (ListPntr->count >= ListPntr->allocatedCount)
+  {
+    NewAllocatedCount = (ListPntr->allocatedCount == 0) ?
+      64 : ListPntr->allocatedCount * 2;
+    NewValuesArray = realloc (ListPntr->valuesArray,
+      NewAllocatedCount * sizeof (AVLDupThingRecord));
+    if (NewValuesArray == NULL)
+      goto ErrorExit;
+    ListPntr->valuesArray = NewValuesArray;
+    ListPntr->allocatedCount = NewAllocatedCount;
+  }
+
+  if (!AVLDupCopyThingArray (ListPntr->valuesArray + ListPntr->count,
+  (AVLDupThingPointer) ValuePntr, ListPntr->valueType, 1))
+    goto ErrorExit;
+  ListPntr->count++;
+  return true;
+
+ErrorExit:
+  ListPntr->ranOutOfMemory = true;
+  return false;
+}
+
+
+
+/* A plain merge sort of the values in a list, using the scratch array (which
+is the same size) for merging.  Input which is already sorted only costs one
+comparison per half, which is the usual case for the values of one key. */
+
+static void SortValues (
+  AVLDupComparisonFunctionPointer CompareFunctionPntr,
+  AVLDupThingPointer              ValuesArray,
+  AVLDupThingPointer              ScratchArray,
+  uint32                          NumberOfValues)
+{
+  uint32             HalfCount;
+  uint32             i;
+  uint32             j;
+  AVLDupThingPointer LeftPntr;
+  AVLDupThingPointer LeftEndPntr;
+  AVLDupThingPointer OutputPntr;
+  AVLDupThingPointer RightPntr;
+  AVLDupThingPointer RightEndPntr;
+  AVLDupThingRecord  TempValue;
+
+  if (NumberOfValues <= INSERTION_SORT_LIMIT)
+  {
+    for (i = 1; i < NumberOfValues; i++)
+    {
+      TempValue = ValuesArray[i];
+      for (j = i; j > 0 &&
+      CompareFunctionPntr (&TempValue, ValuesArray + j - 1) < 0; j--)
+        ValuesArray[j] = ValuesArray[j-1];
+      ValuesArray[j] = TempValue;
+    }
+    return;
+  }
+
+  HalfCount = NumberOfValues / 2;
+  SortValues (CompareFunctionPntr, ValuesArray, ScratchArray, HalfCount);
+  SortValues (CompareFunctionPntr, ValuesArray + HalfCount,
+    ScratchArray + HalfCount, NumberOfValues - HalfCount);
+
+  if (CompareFunctionPntr (ValuesArray + HalfCount - 1,
+  ValuesArray + HalfCount) <= 0)
+    return; /* Halves are already in order. */
+
+  LeftPntr = ValuesArray;
+  LeftEndPntr = RightPntr = ValuesArray + HalfCount;
+  RightEndPntr = ValuesArray + NumberOfValues;
+  OutputPntr = ScratchArray;
+  while (LeftPntr < LeftEndPntr && RightPntr < RightEndPntr)
+  {
+    if (CompareFunctionPntr (RightPntr, LeftPntr) < 0)
+      *OutputPntr++ = *RightPntr++;
+    else
+      *OutputPntr++ = *LeftPntr++;
+  }
+  while (LeftPntr < LeftEndPntr)
+    *OutputPntr++ = *LeftPntr++;
+  while (RightPntr < RightEndPntr)
+    *OutputPntr++ = *RightPntr++;
+
+  memcpy (ValuesArray, ScratchArray,
+    NumberOfValues * sizeof (AVLDupThingRecord));
+}
+
+
+
+/* Sorts the list and removes duplicate values (which happen when the input's
+key range covers several keys with the same value).  Returns FALSE if it ran
+out of memory. */
+
+static bool SortAndRemoveDuplicates (
+  AVLDupComparisonFunctionPointer CompareFunctionPntr,
+  ValueListPointer                ListPntr)
+{
+  uint32             i;
+  uint32             NewCount;
+  AVLDupThingPointer ScratchArray;
+
+  if (ListPntr->count <= 1)
+    return true;
+
+  ScratchArray = malloc (ListPntr->count * sizeof (AVLDupThingRecord));
+  if (ScratchArray == NULL)
+    return false;
+  SortValues (CompareFunctionPntr, ListPntr->valuesArray, ScratchArray,
+    ListPntr->count);
+  free (ScratchArray);
+
+  NewCount = 1;
+  for (i = 1; i < ListPntr->count; i++)
+  {
+    if (CompareFunctionPntr (ListPntr->valuesArray + i,
+    ListPntr->valuesArray + NewCount - 1) == 0)
+      AVLDupFreeThingArray (ListPntr->valuesArray + i, ListPntr->valueType, 1);
+    else
+      ListPntr->valuesArray[NewCount++] = ListPntr->valuesArray[i];
+  }
+  ListPntr->count = NewCount;
+  return true;
+}
+
+
+
+static int64 IntegerValue (
+  AVLDupThingPointer ThingPntr,
+  type_code          ThingType)
+{
+  if (ThingType == B_INT32_TYPE)
+    return ThingPntr->int32Thing;
+  return ThingPntr->int64Thing;
+}
+
+
+
+/* Makes a bitmap for the list if it holds integers and is dense enough,
+otherwise leaves it without one.  Running out of memory isn't a problem,
+the list just doesn't get a bitmap. */
+
+static void MakeBitmapIfDense (ValueListPointer ListPntr)
+{
+  uint64 Bit;
+  uint32 i;
+  uint64 Span;
+
+  if ((ListPntr->valueType != B_INT32_TYPE &&
+  ListPntr->valueType != B_INT64_TYPE) || ListPntr->count == 0)
+    return;
+
+  ListPntr->bitmapBase =
+    IntegerValue (ListPntr->valuesArray, ListPntr->valueType);
+  Span = (uint64) IntegerValue (ListPntr->valuesArray + ListPntr->count - 1,
+    ListPntr->valueType) - (uint64) ListPntr->bitmapBase;
+  if (Span >= (uint64) ListPntr->count * BITMAP_MAXIMUM_SPARSENESS)
+    return;
+
+  ListPntr->bitmapBits = Span + 1;
+  ListPntr->bitmapPntr = calloc ((size_t) (Span / 8 + 1), 1);
+  if (ListPntr->bitmapPntr == NULL)
+    return;
+
+  for (i = 0; i < ListPntr->count; i++)
+  {
+    Bit = (uint64) IntegerValue (ListPntr->valuesArray + i,
+      ListPntr->valueType) - (uint64) ListPntr->bitmapBase;
+    ListPntr->bitmapPntr[Bit / 8] |= (uint8) (1 << (Bit % 8));
+  }
+}
+
+
+
+/* Returns TRUE if the value is in the list.  Values have to be asked about
+in ascending order, since the galloping search starts from where the last
+one left off.  Sets *ListFinishedPntr to TRUE if the value is above
+everything in the list, so later values won't be found either. */
+
+static bool ListContainsValue (
+  AVLDupComparisonFunctionPointer CompareFunctionPntr,
+  ValueListPointer                ListPntr,
+  AVLDupThingPointer              ValuePntr,
+  bool                           *ListFinishedPntr)
+{
+  uint64 Bit;
+  uint32 HighIndex;
+  uint32 LowIndex;
+  uint32 MiddleIndex;
+  uint32 Step;
+
+  *ListFinishedPntr = false;
+
+  if (ListPntr->bitmapPntr != NULL)
+  {
+    Bit = (uint64) IntegerValue (ValuePntr, ListPntr->valueType) -
+      (uint64) ListPntr->bitmapBase;
+    if (Bit >= ListPntr->bitmapBits)
+    {
+      /* Below the base wraps around to a huge number, so check which. */
+      if (IntegerValue (ValuePntr, ListPntr->valueType) >
+      ListPntr->bitmapBase)
+        *ListFinishedPntr = true;
+      return false;
+    }
+    return (ListPntr->bitmapPntr[Bit / 8] & (1 << (Bit % 8))) != 0;
+  }
+
+  /* Gallop forwards from the cursor (everything before it is known to be
+  smaller), doubling the step, until reaching a value at or above the one
+  wanted.  Then binary search the part skipped over by the last step. */
+
+  LowIndex = ListPntr->cursor;
+  HighIndex = LowIndex;
+  Step = 1;
+  while (HighIndex < ListPntr->count && CompareFunctionPntr (
+  ListPntr->valuesArray + HighIndex, ValuePntr) < 0)
+  {
+    LowIndex = HighIndex + 1;
+    HighIndex += Step;
+    Step *= 2;
+  }
+  if (HighIndex > ListPntr->count)
+    HighIndex = ListPntr->count;
+
+  while (LowIndex < HighIndex)
+  {
+    MiddleIndex = LowIndex + (HighIndex - LowIndex) / 2;
+    if (CompareFunctionPntr (ListPntr->valuesArray + MiddleIndex,
+    ValuePntr) < 0)
+      LowIndex = MiddleIndex + 1;
+    else
+      HighIndex = MiddleIndex;
+  }
+
+  ListPntr->cursor = LowIndex;
+  if (LowIndex >= ListPntr->count)
+  {
+    *ListFinishedPntr = true;
+    return false;
+  }
+  return CompareFunctionPntr (ListPntr->valuesArray + LowIndex,
+    ValuePntr) == 0;
+}
+
+
+
+/* Goes through the values of the driving list (the smallest list for an
+intersection, the first for a difference) and passes the ones that are in
+all the other lists (intersection) or none of them (difference) to the
+user's callback.  Returns FALSE if the callback stopped it. */
+
+static bool IntersectOrSubtract (
+  AVLDupComparisonFunctionPointer    CompareFunctionPntr,
+  ValueListPointer                   ListsArray,
+  uint32                             NumberOfLists,
+  uint32                             DrivingListIndex,
+  bool                               Intersecting,
+  AVLDupValueCallbackFunctionPointer CallbackFunctionPntr,
+  void                              *ExtraUserData)
+{
+  ValueListPointer   DrivingListPntr;
+  uint32             i;
+  uint32             j;
+  bool               ListFinished;
+  bool               Wanted;
+  AVLDupThingPointer ValuePntr;
+
+  DrivingListPntr = ListsArray + DrivingListIndex;
+
+  for (j = 0; j < NumberOfLists; j++)
+    if (j != DrivingListIndex &&
+    (uint64) DrivingListPntr->count * BITMAP_MINIMUM_SEARCH_FRACTION >=
+    ListsArray[j].count)
+      MakeBitmapIfDense (ListsArray + j);
+
+  for (i = 0; i < DrivingListPntr->count; i++)
+  {
+    ValuePntr = DrivingListPntr->valuesArray + i;
+    Wanted = true;
+
+    for (j = 0; j < NumberOfLists; j++)
+    {
+      if (j == DrivingListIndex)
+        continue;
+
+      if (ListContainsValue (CompareFunctionPntr, ListsArray + j, ValuePntr,
+      &ListFinished) != Intersecting)
+      {
+        /* Once any list runs out nothing more can be in the intersection. */
+        if (ListFinished && Intersecting)
+          return true;
+        Wanted = false;
+        break;
+      }
+    }
+
+    if (Wanted && !CallbackFunctionPntr (ValuePntr, ExtraUserData))
+      return false;
+  }
+
+  return true;
+}
+
+
+
+/* Merges all the lists, passing each different value to the user's callback
+once, in ascending order.  Returns FALSE if the callback stopped it.  With
+only a few lists, finding the smallest head value by looking at them all is
+faster than keeping a heap. */
+
+static bool MergeUnion (
+  AVLDupComparisonFunctionPointer    CompareFunctionPntr,
+  ValueListPointer                   ListsArray,
+  uint32                             NumberOfLists,
+  AVLDupValueCallbackFunctionPointer CallbackFunctionPntr,
+  void                              *ExtraUserData)
+{
+  uint32             j;
+  ValueListPointer   ListPntr;
+  AVLDupThingPointer SmallestPntr;
+  AVLDupThingRecord  SmallestValue;
+
+  while (true)
+  {
+    SmallestPntr = NULL;
+    for (j = 0; j < NumberOfLists; j++)
+    {
+      ListPntr = ListsArray + j;
+      if (ListPntr->cursor < ListPntr->count && (SmallestPntr == NULL ||
+      CompareFunctionPntr (ListPntr->valuesArray + ListPntr->cursor,
+      SmallestPntr) < 0))
+        SmallestPntr = ListPntr->valuesArray + ListPntr->cursor;
+    }
+
+    if (SmallestPntr == NULL)
+      return true; /* All lists used up. */
+
+    SmallestValue = *SmallestPntr;
+    if (!CallbackFunctionPntr (&SmallestValue, ExtraUserData))
+      return false;
+
+    /* Move past the value in every list which has it. */
+
+    for (j = 0; j < NumberOfLists; j++)
+    {
+      ListPntr = ListsArray + j;
+      if (ListPntr->cursor < ListPntr->count &&
+      CompareFunctionPntr (ListPntr->valuesArray + ListPntr->cursor,
+      &SmallestValue) == 0)
+        ListPntr->cursor++;
+    }
+  }
+}
+
+
+
+/* Finds the values in several trees, each restricted to a range of keys,
+and combines them.  Each input in InputArray has a tree and a key range
+(with the same meanings as for AVLDupIterate).  The values of all the trees
+have to be the same type.  The operation is one of:
+
+  AVLDUP_SET_INTERSECTION: values found in every one of the inputs.
+  AVLDUP_SET_UNION: values found in any of the inputs.
+  AVLDUP_SET_DIFFERENCE: values found in the first input but none of the
+  others.
+
+Each resulting value is passed to your callback function once, in ascending
+order, along with ExtraUserData.  Return FALSE from the callback to stop
+early.  The callback is called after all the trees have been unlocked, so it
+is allowed to change them.  Returns TRUE if it got through all the values,
+FALSE if your callback stopped it, it ran out of memory, a tree couldn't be
+locked or the inputs didn't make sense. */
+
+bool AVLDupCombineValues (
+  AVLDupSetOperation Operation,
+  AVLDupSetInputPointer InputArray,
+  uint32 NumberOfInputs,
+  AVLDupValueCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  AVLDupComparisonFunctionPointer CompareFunctionPntr;
+  uint32                          DrivingListIndex;
+  uint32                          i;
+  AVLDupSetInputPointer           InputPntr;
+  ValueListPointer                ListsArray;
+  ValueListPointer                ListPntr;
+  bool                            ReturnCode;
+  type_code                       ValueType;
+
+  if (InputArray == NULL || NumberOfInputs == 0 ||
+  CallbackFunctionPntr == NULL)
+    return false;
+
+  ValueType = 0;
+  for (i = 0; i < NumberOfInputs; i++)
+  {
+    if (InputArray[i].treePntr == NULL)
+      return false;
+    if (i == 0)
+      ValueType = InputArray[i].treePntr->valueType;
+    else if (InputArray[i].treePntr->valueType != ValueType)
+      return false; /* Can't compare values of different types. */
+  }
+  CompareFunctionPntr = AVLDupGetComparisonFunctionForType (ValueType);
+
+  ReturnCode = false;
+  ListsArray = calloc (NumberOfInputs, sizeof (ValueListRecord));
+  if (ListsArray == NULL)
+    return false;
+
+  /* Copy out and sort the values for each input. */
+
+  for (i = 0; i < NumberOfInputs; i++)
+  {
+    InputPntr = InputArray + i;
+    ListPntr = ListsArray + i;
+    ListPntr->valueType = ValueType;
+
+    if (!AVLDupIterate (InputPntr->treePntr,
+    InputPntr->range.startKeyPntr, InputPntr->range.startValuePntr,
+    InputPntr->range.includeThingEqualToStart,
+    InputPntr->range.endKeyPntr, InputPntr->range.endValuePntr,
+    InputPntr->range.includeThingEqualToEnd,
+    CollectValueCallback, ListPntr) || ListPntr->ranOutOfMemory)
+      goto ErrorExit;
+
+    if (!SortAndRemoveDuplicates (CompareFunctionPntr, ListPntr))
+      goto ErrorExit;
+
+    /* An empty list in an intersection means there's nothing to find. */
+
+    if (ListPntr->count == 0 && Operation == AVLDUP_SET_INTERSECTION)
+    {
+      ReturnCode = true;
+      goto ErrorExit;
+    }
+  }
+
+  switch (Operation)
+  {
+    case AVLDUP_SET_INTERSECTION:
+      DrivingListIndex = 0;
+      for (i = 1; i < NumberOfInputs; i++)
+        if (ListsArray[i].count < ListsArray[DrivingListIndex].count)
+          DrivingListIndex = i;
+      ReturnCode = IntersectOrSubtract (CompareFunctionPntr, ListsArray,
+        NumberOfInputs, DrivingListIndex, true /* intersecting */,
+        CallbackFunctionPntr, ExtraUserData);
+      break;
+
+    case AVLDUP_SET_UNION:
+      ReturnCode = MergeUnion (CompareFunctionPntr, ListsArray,
+        NumberOfInputs, CallbackFunctionPntr, ExtraUserData);
+      break;
+
+    case AVLDUP_SET_DIFFERENCE:
+      ReturnCode = IntersectOrSubtract (CompareFunctionPntr, ListsArray,
+        NumberOfInputs, 0, false /* subtracting */,
+        CallbackFunctionPntr, ExtraUserData);
+      break;
+
+    default:
+      ReturnCode = false;
+      break;
+  }
+
+ErrorExit:
+  for (i = 0; i < NumberOfInputs; i++)
+  {
+    ListPntr = ListsArray + i;
+    if (ListPntr->valuesArray != NULL)
+    {
+      AVLDupFreeThingArray (ListPntr->valuesArray, ValueType, ListPntr->count);
+      free (ListPntr->valuesArray);
+    }
+    if (ListPntr->bitmapPntr != NULL)
+      free (ListPntr->bitmapPntr);
+  }
+  free (ListsArray);
+  return ReturnCode;
+}
@@ -0,0 +1,842 @@
+/******************************************************************************
+ * AVLDupStringSearch.c
+ *
+ * Searches of trees with string keys which go by what the keys look like
+ * rather than by a range of keys.  AVLDupIteratePrefix and AVLDupCountPrefix
+ * find all the keys starting with a given prefix, like all the file paths
+ * starting with "/boot/home/" or all the MIME types starting with "image/".
+ *
+ * The keys with a given prefix are all together in the tree, but the range
+ * they cover is awkward to describe with an ordinary start and end key for
+ * AVLDupIterate, since the end has to be the first string which doesn't have
+ * the prefix, made by incrementing the last byte of the prefix (and dealing
+ * with carries when it is 255, which is common in UTF-8 text).  Instead the
+ * prefix is used as both the start and the end of the range, with a special
+ * comparison function which only compares as many bytes as the prefix has.
+ * All the keys with the prefix compare as equal to it, so the usual range
+ * iteration code descends straight to the first of them and stops after the
+ * last one.  Comparing bytes works for UTF-8 since it sorts in the same
+ * order as the characters (and strcmp compares bytes as unsigned values).
+ *
+ * AVLDupIteratePattern finds the keys matching a wildcard pattern, like
+ * "*.jpg" in a BeOS query.  It uses the same prefix trick for the literal
+ * text at the start of the pattern, and can use a second tree of reversed
+ * keys for patterns which only have literal text at the end.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See the AVLDupTree.c file for the rest of the license details.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
+
+
+/* Compares a prefix (A) with a key (B), looking only at as many bytes of the
+key as the prefix has.  So it returns zero for keys starting with the prefix,
+less than zero if the prefix sorts before the key and greater than zero if it
+sorts after it, just like a normal comparison function would for the range of
+keys starting with the prefix. */
+
+static int ComparePrefix (AVLDupThingPointer A, AVLDupThingPointer B)
+{
+  const char *KeyPntr;
+  const char *PrefixPntr;
+
+  PrefixPntr = AVLDupGetStringPntrFromThing (*A);
+  KeyPntr = AVLDupGetStringPntrFromThing (*B);
+  return strncmp (PrefixPntr, KeyPntr, strlen (PrefixPntr));
+}
+
+
+
+/* Sets up the arguments for iterating over the keys which start with
+something from LowerPrefix up to UpperPrefix, using the prefix comparison
+function.  So a key like "IMG_5.jpg" is in the range from "IMG_0" to "IMG_9"
+but "IMG_.jpg" isn't.  In a collated tree (see AVLDupCollation.c) the
+prefixes are compared in the tree's order instead, so ignoring case, a
+prefix of "img_" also finds "IMG_5.jpg".  The prefixes aren't copied, so
+the things made from them are only good for comparisons while the strings
+are still around.  Returns FALSE if the tree doesn't have string keys. */
+
+static bool SetUpPrefixBoundsArguments (
+  AVLDupTreePointer                      TreePntr,
+  NonRecursiveArgumentsPointer           ArgsPntr,
+  const char                            *LowerPrefix,
+  const char                            *UpperPrefix,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void                                  *ExtraUserData)
+{
+  AVLDupThingRecord LowerThing;
+  AVLDupThingRecord UpperThing;
+
+  if (TreePntr->keyType != B_STRING_TYPE)
+    return false;
+
+  memset (&LowerThing, 0, sizeof (LowerThing));
+  LowerThing.longStringThing.stringPntr = (char *) LowerPrefix;
+  LowerThing.longStringThing.isLongString = true;
+
+  memset (&UpperThing, 0, sizeof (UpperThing));
+  UpperThing.longStringThing.stringPntr = (char *) UpperPrefix;
+  UpperThing.longStringThing.isLongString = true;
+
+  AVLDupSetUpIterationArguments (TreePntr, ArgsPntr,
+    &LowerThing, NULL, true, &UpperThing, NULL, true,
+    CallbackFunctionPntr, ExtraUserData);
+  if (TreePntr->collation == AVLDUP_COLLATION_BINARY)
+    ArgsPntr->keyComparisonFunctionPntr = ComparePrefix;
+  else
+    ArgsPntr->keyComparisonFunctionPntr =
+      AVLDupGetCollatedPrefixComparison (TreePntr->collation);
+  return true;
+}
+
+
+
+/* Sets up the arguments for iterating over the keys starting with Prefix,
+using it as both bounds of the range. */
+
+static bool SetUpPrefixArguments (
+  AVLDupTreePointer                      TreePntr,
+  NonRecursiveArgumentsPointer           ArgsPntr,
+  const char                            *Prefix,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void                                  *ExtraUserData)
+{
+  return SetUpPrefixBoundsArguments (TreePntr, ArgsPntr, Prefix, Prefix,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+
+/* Counts all the nodes in a subtree, no comparisons needed but it still
+has to visit every node. */
+
+static uint32 CountSubtree (AVLDupNodePointer CurrentNode)
+{
+  if (CurrentNode == NULL)
+    return 0;
+  return 1 + CountSubtree (CurrentNode->smallerChildPntr) +
+    CountSubtree (CurrentNode->largerChildPntr);
+}
+
+
+
+/* Counts the nodes in a range, the same way that AVLDupRecursiveRangeIterate
+goes through them, but without any callbacks.  Subtrees which are known to
+be entirely inside the range are counted without doing any comparisons. */
+
+static uint32 RecursiveRangeCount (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer            CurrentNode,
+  bool                         TestLowerBound,
+  bool                         TestUpperBound)
+{
+  int    ComparisonLower;
+  int    ComparisonUpper;
+  uint32 Count;
+
+  if (CurrentNode == NULL)
+    return 0;
+
+  if (!(TestLowerBound || TestUpperBound))
+    return CountSubtree (CurrentNode);
+
+  AVLDupCompareNodeWithBounds (ArgsPntr, CurrentNode,
+    TestLowerBound, TestUpperBound, &ComparisonLower, &ComparisonUpper);
+
+  Count = 0;
+  if (ComparisonLower < 0)
+    Count += RecursiveRangeCount (ArgsPntr, CurrentNode->smallerChildPntr,
+      TestLowerBound, (ComparisonUpper >= 0) ? false : TestUpperBound);
+
+  if ((ComparisonLower < 0 ||
+  (ComparisonLower == 0 && ArgsPntr->includeThingEqualToStart)) &&
+  (ComparisonUpper > 0 ||
+  (ComparisonUpper == 0 && ArgsPntr->includeThingEqualToEnd)))
+    Count++;
+
+  if (ComparisonUpper > 0)
+    Count += RecursiveRangeCount (ArgsPntr, CurrentNode->largerChildPntr,
+      (ComparisonLower <= 0) ? false : TestLowerBound, TestUpperBound);
+
+  return Count;
+}
+
+
+
+/* Calls your callback function for every key/value pair whose key starts
+with Prefix, in ascending order, just like AVLDupIterate does for a range.
+An empty prefix matches all keys.  The tree has to have string keys.  If it
+is a collated tree, the prefix is matched the way the tree compares keys, so
+an AVLDUP_COLLATION_IGNORE_CASE tree finds keys starting with the prefix in
+any case.
+Returns TRUE if it got through all the matching pairs, FALSE if your
+callback stopped it early, the tree doesn't have string keys or the tree
+couldn't be locked. */
+
+bool AVLDupIteratePrefix (
+  AVLDupTreePointer TreePntr,
+  const char *Prefix,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  status_t                    ErrorCode;
+  AVLDupHeldLockRecord        HeldLock;
+  AVLDupLatencyPointer        LatencyPntr;
+  bigtime_t                   LockedTime;
+  bigtime_t                   StartTime;
+  bool                        Successful;
+
+  if (TreePntr == NULL || Prefix == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  if (!SetUpPrefixArguments (TreePntr, &Arguments, Prefix,
+  CallbackFunctionPntr, ExtraUserData))
+    return false;
+
+  LatencyPntr = AVLDupLatencyStart (TreePntr, &StartTime);
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL)
+    LockedTime = system_time ();
+
+  AVLDUP_TRACE1 (iterate__start, TreePntr);
+  Successful = AVLDupRecursiveRangeIterate (&Arguments, TreePntr->rootPntr,
+    true, true);
+  AVLDUP_TRACE3 (iterate__done, TreePntr,
+    Arguments.itemsDelivered, Successful ? 1 : 0);
+
+  AVLDUP_STATISTIC (Arguments.counts.iterations = 1);
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "iteratePrefix",
+    Arguments.itemsDelivered);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_ITERATE,
+      StartTime, LockedTime);
+
+  return Successful;
+}
+
+
+
+/* Counts the key/value pairs whose key starts with Prefix, putting the
+answer in *CountPntr.  It's faster than counting with AVLDupIteratePrefix
+since there are no callbacks, and the subtrees which are found to be
+entirely inside the range of matching keys are counted without doing any
+string comparisons.  But the nodes don't store the sizes of their subtrees,
+so it still visits every matching pair: the time taken grows with the
+number of matches (plus the depth of the tree), not just with the depth.
+It also holds the tree's read lock for all that time, so avoid it for
+prefixes matching a large part of a big tree.  Returns FALSE if the tree
+doesn't have string keys or couldn't be locked. */
+
+bool AVLDupCountPrefix (
+  AVLDupTreePointer TreePntr,
+  const char *Prefix,
+  uint32 *CountPntr)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  uint32                      Count;
+  status_t                    ErrorCode;
+  AVLDupHeldLockRecord        HeldLock;
+
+  if (TreePntr == NULL || Prefix == NULL || CountPntr == NULL)
+    return false;
+
+  if (!SetUpPrefixArguments (TreePntr, &Arguments, Prefix, NULL, NULL))
+    return false;
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  Count = RecursiveRangeCount (&Arguments, TreePntr->rootPntr, true, true);
+
+  AVLDUP_STATISTIC (Arguments.counts.iterations = 1);
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "countPrefix", Count);
+
+  *CountPntr = Count;
+  return true;
+}
+
+
+
+/******************************************************************************
+ * Pattern matching.  AVLDupIteratePattern finds the keys matching a wildcard
+ * pattern like the ones in BeOS queries, such as "IMG_2024*" or "*.jpg".
+ * The pattern is compiled once into a list of steps, rather than being parsed
+ * again for every key, and the parts of it which pin down the start of the
+ * key are turned into a range of prefixes so that subtrees of keys which
+ * can't match are never visited.
+ */
+
+typedef enum PatternStepKindEnum
+{
+  PATTERN_BYTE = 0, /* Matches one particular byte. */
+  PATTERN_ANY, /* A '?', matches any one character. */
+  PATTERN_CLASS, /* A [...] character class, matches one character. */
+  PATTERN_STAR /* A '*', matches zero or more characters. */
+} PatternStepKind;
+
+
+typedef struct PatternStepStruct
+{
+  PatternStepKind kind;
+  uint8           byte; /* For PATTERN_BYTE. */
+  uint8           classBits [32]; /* For PATTERN_CLASS, one bit per byte. */
+} PatternStepRecord, *PatternStepPointer;
+
+
+/* The compiled form of a pattern.  The prefix strings are the literal bytes
+at the start of the pattern, with the lowest and highest bytes of a character
+class added on if one comes right after them.  So "IMG_[0-9]*" gets the range
+from "IMG_0" to "IMG_9".  The suffix is the literal bytes at the end of the
+pattern, which every matching key has to end with. */
+
+typedef struct CompiledPatternStruct
+{
+  PatternStepPointer stepsArray;
+  uint32             numberOfSteps;
+  char              *stringsPntr; /* One buffer for all the strings below. */
+  char              *lowerPrefix;
+  char              *upperPrefix;
+  uint32             prefixLength; /* Literal bytes, not counting a class. */
+  char              *suffix;
+  char              *reversedSuffix; /* For searching a reversed key tree. */
+  uint32             suffixLength;
+  uint32             minimumLength; /* Fewest bytes a matching key can have. */
+  bool               matchesNothing; /* Has an empty character class. */
+} CompiledPatternRecord, *CompiledPatternPointer;
+
+
+/* Things the pattern filtering callback needs to know. */
+
+typedef struct PatternFilterStruct
+{
+  CompiledPatternPointer                 patternPntr;
+  AVLDupIterationCallbackFunctionPointer callbackFunctionPntr;
+  void                                  *extraUserData;
+  bool                                   keysAreReversed;
+  char                                  *reverseBufferPntr;
+  size_t                                 reverseBufferSize;
+  bool                                   outOfMemory;
+  uint32                                 itemsDelivered; /* Matches. */
+} PatternFilterRecord, *PatternFilterPointer;
+
+
+
+#define CLASS_BIT_SET(Bits, Byte) ((Bits)[(Byte) >> 3] |= 1 << ((Byte) & 7))
+#define CLASS_BIT_TEST(Bits, Byte) (((Bits)[(Byte) >> 3] >> ((Byte) & 7)) & 1)
+
+
+
+/* Moves past one UTF-8 character: the first byte and any continuation bytes
+after it. */
+
+static const uint8 *SkipCharacter (const uint8 *StringPntr)
+{
+  StringPntr++;
+  while ((*StringPntr & 0xC0) == 0x80)
+    StringPntr++;
+  return StringPntr;
+}
+
+
+
+/* Parses a character class starting just after the '[' and fills in the
+step's bits.  Returns a pointer to the ']' at the end, or NULL if there isn't
+one, in which case the '[' is just an ordinary character.  A leading '^' or
+'!' inverts the class, a ']' right at the start is part of the class and a
+backslash makes the next character literal.  Ranges like "a-z" go by byte
+value, so the class only really works for ASCII characters, though an
+inverted class matches any other character too. */
+
+static const char *CompileClass (
+  const char        *Pattern,
+  PatternStepPointer StepPntr)
+{
+  uint8 FirstByte;
+  int   i;
+  bool  Invert;
+  uint8 LastByte;
+
+  memset (StepPntr->classBits, 0, sizeof (StepPntr->classBits));
+  Invert = (*Pattern == '^' || *Pattern == '!');
+  if (Invert)
+    Pattern++;
+
+  if (*Pattern == ']')
+  {
+    CLASS_BIT_SET (StepPntr->classBits, ']');
+    Pattern++;
+  }
+
+  while (*Pattern != ']')
+  {
+    if (*Pattern == '\\' && Pattern[1] != 0)
+      Pattern++;
+    if (*Pattern == 0)
+      return NULL;
+    FirstByte = LastByte = (uint8) *Pattern++;
+    if (Pattern[0] == '-' && Pattern[1] != ']' && Pattern[1] != 0)
+    {
+      Pattern++;
+      if (*Pattern == '\\' && Pattern[1] != 0)
+        Pattern++;
+      LastByte = (uint8) *Pattern++;
+    }
+    for (i = FirstByte; i <= LastByte; i++)
+      CLASS_BIT_SET (StepPntr->classBits, i);
+  }
+
+  if (Invert)
+  {
+    for (i = 0; i < (int) sizeof (StepPntr->classBits); i++)
+      StepPntr->classBits[i] ^= 0xFF;
+  }
+  StepPntr->classBits[0] &= ~1; /* Never matches the NUL at the end. */
+  return Pattern;
+}
+
+
+
+/* Turns the pattern text into a list of steps and works out the prefixes
+and suffix used for pruning the search.  Returns FALSE if it ran out of
+memory. */
+
+static bool CompilePattern (
+  const char            *Pattern,
+  CompiledPatternPointer PatternPntr)
+{
+  const char        *ClassEndPntr;
+  int                HighestByte;
+  uint32             i;
+  int                LowestByte;
+  uint32             PatternLength;
+  PatternStepPointer StepPntr;
+
+  memset (PatternPntr, 0, sizeof (CompiledPatternRecord));
+  PatternLength = strlen (Pattern);
+
+  PatternPntr->stepsArray =
+    malloc ((PatternLength + 1) * sizeof (PatternStepRecord));
+  PatternPntr->stringsPntr = malloc (4 * (PatternLength + 2));
+  if (PatternPntr->stepsArray == NULL || PatternPntr->stringsPntr == NULL)
+    goto ErrorExit;
+
+  while (*Pattern != 0)
+  {
+    StepPntr = PatternPntr->stepsArray + PatternPntr->numberOfSteps;
+    switch (*Pattern)
+    {
+      case '*':
+        while (*Pattern == '*')
+          Pattern++; /* Several stars in a row are the same as one. */
+        StepPntr->kind = PATTERN_STAR;
+        break;
+
+      case '?':
+        Pattern++;
+        StepPntr->kind = PATTERN_ANY;
+        break;
+
+      case '[':
+        ClassEndPntr = CompileClass (Pattern + 1, StepPntr);
+        if (ClassEndPntr == NULL)
+          goto LiteralByte; /* No closing bracket, so it's just a '['. */
+        Pattern = ClassEndPntr + 1;
+        StepPntr->kind = PATTERN_CLASS;
+        break;
+
+      default:
+      LiteralByte:
+        if (*Pattern == '\\' && Pattern[1] != 0)
+          Pattern++;
+        StepPntr->kind = PATTERN_BYTE;
+        StepPntr->byte = (uint8) *Pattern++;
+        break;
+    }
+    if (StepPntr->kind != PATTERN_STAR)
+      PatternPntr->minimumLength++;
+    PatternPntr->numberOfSteps++;
+  }
+
+  /* The literal prefix, and a character class right after it adds its
+  lowest and highest bytes to the two ends of the range. */
+
+  PatternPntr->lowerPrefix = PatternPntr->stringsPntr;
+  PatternPntr->upperPrefix = PatternPntr->lowerPrefix + PatternLength + 2;
+  PatternPntr->suffix = PatternPntr->upperPrefix + PatternLength + 2;
+  PatternPntr->reversedSuffix = PatternPntr->suffix + PatternLength + 2;
+
+  for (i = 0; i < PatternPntr->numberOfSteps &&
+  PatternPntr->stepsArray[i].kind == PATTERN_BYTE; i++)
+  {
+    PatternPntr->lowerPrefix[i] = PatternPntr->upperPrefix[i] =
+      (char) PatternPntr->stepsArray[i].byte;
+  }
+  PatternPntr->prefixLength = i;
+
+  if (i < PatternPntr->numberOfSteps &&
+  PatternPntr->stepsArray[i].kind == PATTERN_CLASS)
+  {
+    StepPntr = PatternPntr->stepsArray + i;
+    for (LowestByte = 1; LowestByte < 256 &&
+    !CLASS_BIT_TEST (StepPntr->classBits, LowestByte); LowestByte++)
+      ;
+    for (HighestByte = 255; HighestByte > 0 &&
+    !CLASS_BIT_TEST (StepPntr->classBits, HighestByte); HighestByte--)
+      ;
+    if (LowestByte > HighestByte)
+      PatternPntr->matchesNothing = true;
+    else
+    {
+      PatternPntr->lowerPrefix[i] = (char) LowestByte;
+      PatternPntr->upperPrefix[i] = (char) HighestByte;
+      i++;
+    }
+  }
+  PatternPntr->lowerPrefix[i] = PatternPntr->upperPrefix[i] = 0;
+
+  /* The literal suffix, forwards and backwards. */
+
+  for (i = PatternPntr->numberOfSteps; i > 0 &&
+  PatternPntr->stepsArray[i - 1].kind == PATTERN_BYTE; i--)
+    ;
+  PatternPntr->suffixLength = PatternPntr->numberOfSteps - i;
+  for (i = 0; i < PatternPntr->suffixLength; i++)
+  {
+    PatternPntr->suffix[i] = PatternPntr->reversedSuffix[
+      PatternPntr->suffixLength - 1 - i] = (char) PatternPntr->stepsArray[
+      PatternPntr->numberOfSteps - PatternPntr->suffixLength + i].byte;
+  }
+  PatternPntr->suffix[i] = PatternPntr->reversedSuffix[i] = 0;
+
+  return true;
+
+ErrorExit:
+  if (PatternPntr->stepsArray != NULL)
+    free (PatternPntr->stepsArray);
+  if (PatternPntr->stringsPntr != NULL)
+    free (PatternPntr->stringsPntr);
+  return false;
+}
+
+
+
+static void FreePattern (CompiledPatternPointer PatternPntr)
+{
+  free (PatternPntr->stepsArray);
+  free (PatternPntr->stringsPntr);
+}
+
+
+
+/* Returns TRUE if the key matches the compiled pattern.  Quick checks of the
+length and the literal suffix get rid of most keys before the real matching.
+That goes through the steps in order, remembering the position after the
+most recent star.  When a step fails it goes back to that star and lets it
+eat one more character of the key, which is enough for these patterns (an
+earlier star never has to be revisited) and keeps the matching time close to
+linear in the length of the key. */
+
+static bool MatchPattern (CompiledPatternPointer PatternPntr, const char *Key)
+{
+  const uint8       *BacktrackKeyPntr;
+  uint32             BacktrackStep;
+  const uint8       *KeyPntr;
+  size_t             KeyLength;
+  bool               Matched;
+  uint32             StepIndex;
+  PatternStepPointer StepPntr;
+
+  KeyLength = strlen (Key);
+  if (KeyLength < PatternPntr->minimumLength)
+    return false;
+  if (memcmp (Key + KeyLength - PatternPntr->suffixLength,
+  PatternPntr->suffix, PatternPntr->suffixLength) != 0)
+    return false;
+
+  BacktrackKeyPntr = NULL;
+  BacktrackStep = 0;
+  KeyPntr = (const uint8 *) Key;
+  StepIndex = 0;
+
+  while (*KeyPntr != 0)
+  {
+    Matched = false;
+    if (StepIndex < PatternPntr->numberOfSteps)
+    {
+      StepPntr = PatternPntr->stepsArray + StepIndex;
+      switch (StepPntr->kind)
+      {
+        case PATTERN_STAR:
+          BacktrackStep = StepIndex + 1;
+          BacktrackKeyPntr = KeyPntr;
+          Matched = true;
+          break;
+
+        case PATTERN_BYTE:
+          if (*KeyPntr == StepPntr->byte)
+          {
+            KeyPntr++;
+            Matched = true;
+          }
+          break;
+
+        case PATTERN_CLASS:
+          if (CLASS_BIT_TEST (StepPntr->classBits, *KeyPntr))
+          {
+            KeyPntr = SkipCharacter (KeyPntr);
+            Matched = true;
+          }
+          break;
+
+        case PATTERN_ANY:
+          KeyPntr = SkipCharacter (KeyPntr);
+          Matched = true;
+          break;
+      }
+    }
+
+    if (Matched)
+      StepIndex++;
+    else if (BacktrackKeyPntr != NULL)
+    {
+      BacktrackKeyPntr = SkipCharacter (BacktrackKeyPntr);
+      KeyPntr = BacktrackKeyPntr;
+      StepIndex = BacktrackStep;
+    }
+    else
+      return false;
+  }
+
+  while (StepIndex < PatternPntr->numberOfSteps &&
+  PatternPntr->stepsArray[StepIndex].kind == PATTERN_STAR)
+    StepIndex++;
+  return (StepIndex == PatternPntr->numberOfSteps);
+}
+
+
+
+/* The iteration callback used for pattern searches.  It passes on the pairs
+whose keys match the pattern to the user's callback.  If the keys come from
+a tree of reversed keys, they get turned around first, so the user's
+callback sees the original key. */
+
+static bool PatternFilterCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void                   *ExtraData)
+{
+  PatternFilterPointer FilterPntr;
+  AVLDupThingRecord    ForwardKey;
+  size_t               i;
+  const char          *KeyString;
+  size_t               KeyLength;
+  char                *NewBufferPntr;
+
+  FilterPntr = (PatternFilterPointer) ExtraData;
+  KeyString = AVLDupGetStringPntrFromThing (*KeyPntr);
+
+  if (!FilterPntr->keysAreReversed)
+  {
+    if (!MatchPattern (FilterPntr->patternPntr, KeyString))
+      return true;
+    FilterPntr->itemsDelivered++;
+    return FilterPntr->callbackFunctionPntr (KeyPntr, ValuePntr,
+      FilterPntr->extraUserData);
+  }
+
+  KeyLength = strlen (KeyString);
+  if (KeyLength + 1 > FilterPntr->reverseBufferSize)
+  {
+    NewBufferPntr = realloc (FilterPntr->reverseBufferPntr, KeyLength + 64);
+    if (NewBufferPntr == NULL)
+    {
+      FilterPntr->outOfMemory = true;
+      return false;
+    }
+    FilterPntr->reverseBufferPntr = NewBufferPntr;
+    FilterPntr->reverseBufferSize = KeyLength + 64;
+  }
+  for (i = 0; i < KeyLength; i++)
+    FilterPntr->reverseBufferPntr[i] = KeyString[KeyLength - 1 - i];
+  FilterPntr->reverseBufferPntr[KeyLength] = 0;
+
+  if (!MatchPattern (FilterPntr->patternPntr, FilterPntr->reverseBufferPntr))
+    return true;
+
+  memset (&ForwardKey, 0, sizeof (ForwardKey));
+  ForwardKey.longStringThing.stringPntr = FilterPntr->reverseBufferPntr;
+  ForwardKey.longStringThing.isLongString = true;
+  FilterPntr->itemsDelivered++;
+  return FilterPntr->callbackFunctionPntr (&ForwardKey, ValuePntr,
+    FilterPntr->extraUserData);
+}
+
+
+
+/* Reverses the bytes of a string in place.  Use it for making the keys of a
+reversed key tree for AVLDupIteratePattern: add each key to it reversed,
+with the same value as in the main tree.  Multibyte UTF-8 characters get
+scrambled, but that doesn't matter since the reversed keys are only used for
+finding the keys with a given suffix and are put back before matching. */
+
+void AVLDupReverseString (char *StringPntr)
+{
+  char *EndPntr;
+  char  Letter;
+
+  if (StringPntr == NULL)
+    return;
+
+  EndPntr = StringPntr + strlen (StringPntr);
+  while (StringPntr + 1 < EndPntr)
+  {
+    EndPntr--;
+    Letter = *StringPntr;
+    *StringPntr++ = *EndPntr;
+    *EndPntr = Letter;
+  }
+}
+
+
+
+/* Calls your callback function for every key/value pair whose key matches
+the wildcard pattern, in ascending order of key.  In the pattern, '*' matches
+any number of characters, '?' matches exactly one (a whole UTF-8 character),
+"[a-z]" matches one of a set of characters ("[^a-z]" or "[!a-z]" for the
+characters not in the set) and a backslash makes the character after it
+an ordinary one.  Everything else has to match exactly.
+
+Only the keys starting with the literal part at the front of the pattern are
+looked at, so "IMG_2024*" is about as fast as AVLDupIteratePrefix.  Patterns
+which start with a wildcard, like "*.jpg", have to look at every key, unless
+you also keep a second tree with all the keys reversed (see
+AVLDupReverseString) and pass it in as ReversedTreePntr, otherwise pass NULL.
+Then when the pattern's literal suffix is longer than its literal prefix, the
+reversed tree is searched for keys starting with the reversed suffix
+instead.  The keys your callback gets are then in order of their reversed
+text and are temporary copies, so copy them if you need them later.  The
+pattern always matches the exact characters, even in a collated tree.
+
+The tree has to have string keys.  Returns TRUE if it got through all the
+matching pairs, FALSE if your callback stopped it early, the tree doesn't
+have string keys, it ran out of memory or the tree couldn't be locked. */
+
+bool AVLDupIteratePattern (
+  AVLDupTreePointer TreePntr,
+  const char *Pattern,
+  AVLDupTreePointer ReversedTreePntr,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  CompiledPatternRecord       CompiledPattern;
+  status_t                    ErrorCode;
+  PatternFilterRecord         Filter;
+  AVLDupHeldLockRecord        HeldLock;
+  AVLDupLatencyPointer        LatencyPntr;
+  bigtime_t                   LockedTime;
+  const char                 *LowerPrefix;
+  AVLDupTreePointer           SearchTreePntr;
+  bigtime_t                   StartTime;
+  bool                        Successful;
+  const char                 *UpperPrefix;
+
+  if (TreePntr == NULL || Pattern == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  if (!CompilePattern (Pattern, &CompiledPattern))
+    return false;
+
+  memset (&Filter, 0, sizeof (Filter));
+  Filter.patternPntr = &CompiledPattern;
+  Filter.callbackFunctionPntr = CallbackFunctionPntr;
+  Filter.extraUserData = ExtraUserData;
+
+  SearchTreePntr = TreePntr;
+  LowerPrefix = CompiledPattern.lowerPrefix;
+  UpperPrefix = CompiledPattern.upperPrefix;
+  if (ReversedTreePntr != NULL &&
+  CompiledPattern.suffixLength > CompiledPattern.prefixLength)
+  {
+    SearchTreePntr = ReversedTreePntr;
+    LowerPrefix = UpperPrefix = CompiledPattern.reversedSuffix;
+    Filter.keysAreReversed = true;
+  }
+  else if (TreePntr->collation != AVLDUP_COLLATION_BINARY)
+  {
+    /* The bytes of a character class aren't in the same order as the tree's
+    keys, just use the literal prefix. */
+
+    CompiledPattern.lowerPrefix[CompiledPattern.prefixLength] = 0;
+    UpperPrefix = LowerPrefix;
+  }
+
+  if (TreePntr->keyType != B_STRING_TYPE ||
+  !SetUpPrefixBoundsArguments (SearchTreePntr, &Arguments,
+  LowerPrefix, UpperPrefix, PatternFilterCallback, &Filter))
+    goto ErrorExit;
+
+  if (CompiledPattern.matchesNothing)
+  {
+    FreePattern (&CompiledPattern);
+    return true;
+  }
+
+  LatencyPntr = AVLDupLatencyStart (SearchTreePntr, &StartTime);
+
+  ErrorCode =
+    AVLDupAcquireAccess (SearchTreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    goto ErrorExit; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL)
+    LockedTime = system_time ();
+
+  AVLDUP_TRACE1 (iterate__start, SearchTreePntr);
+  Successful = AVLDupRecursiveRangeIterate (&Arguments,
+    SearchTreePntr->rootPntr, true, true);
+  AVLDUP_TRACE3 (iterate__done, SearchTreePntr,
+    Filter.itemsDelivered, Successful ? 1 : 0);
+
+  AVLDUP_STATISTIC (Arguments.counts.iterations = 1);
+  AVLDupAddOperationCounts (SearchTreePntr, &Arguments.counts);
+
+  AVLDupReleaseAccess (SearchTreePntr, &HeldLock, "iteratePattern",
+    Arguments.itemsDelivered);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_ITERATE,
+      StartTime, LockedTime);
+
+  FreePattern (&CompiledPattern);
+  if (Filter.reverseBufferPntr != NULL)
+    free (Filter.reverseBufferPntr);
+  return Successful && !Filter.outOfMemory;
+
+ErrorExit:
+  FreePattern (&CompiledPattern);
+  return false;
+}
@@ -50,7 +50,8 @@
  * It is also designed to work in a multitasking environment - allowing access
  * by multiple readers or a single writer (no, you can't have your reader's
  * callback function do a write operation - the write will deadlock waiting
- * for the number of readers to fall to zero).
+ * for the number of readers to fall to zero - but you can have it queue up
+ * changes to be done after the iteration, see AVLDupIterateDeferringChanges).
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -112,82 +113,12 @@
 #include <string.h>
 
 #include "AVLDupTree.h"
+#include "AVLDupTreePrivate.h"
 
 
-/* This structure is a node in the AVL tree.  The keys in the sub-tree at
-smallerChildPntr are all less than the node's key.  Keys in the sub-tree
-rooted at largerChildPntr are all larger than the node's key.  The height is
-the maximum of the height of the smaller and greater children, plus 1.  A node
-with no children has a height of 1, similarly a NULL pointer (empty tree) has a
-height of 0.  To keep the tree balanced, nodes are moved around so that the
-heights of the smaller and larger children differ by at most 1. */
-
-typedef struct AVLDupNodeStruct AVLDupNodeRecord, *AVLDupNodePointer;
-
-struct AVLDupNodeStruct
-{
-  AVLDupThingRecord key;
-  AVLDupThingRecord value;
-  AVLDupNodePointer smallerChildPntr;
-  AVLDupNodePointer largerChildPntr;
-  unsigned int      height; /* Only needs to be uint8, rest is for padding. */
-};
-
-
-/* Comparison functions for the various different data types use this function
-prototype.  It returns A - B in effect, so the result is >0 for A > B,
-<0 for A < B and 0 for A == B. */
-
-typedef int (* AVLDupComparisonFunctionPointer) (
-  AVLDupThingPointer A, AVLDupThingPointer B);
-
-
-/* The header for the AVLDupTree itself.  Besides pointing out the root node,
-it contains auxiliary information needed for comparing the associated data
-types, for collecting statistics, multitasking access, and for doing pool
-memory allocation. */
-
-struct AVLDupTreeStruct
-{
-  char *indexName; /* Copy of the user's name for this index. */
-  type_code keyType;
-  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
-  type_code valueType;
-  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
-  AVLDupNodePointer rootPntr; /* Root node of the tree or NULL. */
-  unsigned int count; /* Counts user provided key/value pairs in tree. */
-  sem_id accessSemaphoreID; /* Negative if no semaphore is being used. */
-  uint32 maxSimultaneousReaders;
-  /* Future work: add a memory pool for nodes and another for strings. */
-};
-
-
-/* This structure is used for keeping common data around during recursive
-function calls.  It is faster than the simple technique of having a separate
-argument for everything the recursive function might need (like the key and
-value you are searching for) - only a single pointer to this structure is
-passed into the recursive routines rather than many parameters.  It's also
-safer than using global variables, which limit multitasking access to the tree
-to 1 thread at a time (so by having one of these structures allocated by each
-calling thread, you can have several tree searches going on in parallel). */
-
-typedef struct NonRecursiveArgumentsStruct
-{
-  type_code keyType;
-  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
-  AVLDupThingRecord userKey1;
-  AVLDupThingRecord userKey2;
-  type_code valueType;
-  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
-  AVLDupThingRecord userValue1;
-  AVLDupThingRecord userValue2;
-  bool userValue1WasNULL;
-  bool userValue2WasNULL;
-  bool includeThingEqualToStart;
-  bool includeThingEqualToEnd;
-  AVLDupIterationCallbackFunctionPointer iterationCallback;
-  void *extraUserData;
-} NonRecursiveArgumentsRecord, *NonRecursiveArgumentsPointer;
+/* The node, tree header and recursive argument structures are in
+AVLDupTreePrivate.h, since the other source files in the library need them
+too. */
 
 
 /* Copy an array of things contents from one thing to another, allocating
@@ -232,9 +163,10 @@ bool AVLDupCopyThingArray (
     SourceStringPntr = AVLDupGetStringPntrFromThing (*SourceThingPntr);
 
     /* Clear out the Thing to entirely zero.  This makes it a short string,
-    containing a zero length string. */
+    containing a zero length string.  With 64 bit pointers the thing is
+    longer than the int64Thing field, so clear the whole thing. */
 
-    DestThingPntr->int64Thing = 0;
+    memset (DestThingPntr, 0, sizeof (AVLDupThingRecord));
 
     if (SourceStringPntr == NULL)
     {
@@ -304,15 +236,14 @@ void AVLDupFreeThingArray (
     i > 0;
     i--, FreePntr++)
     {
-      if (FreePntr->longStringThing.isLongString)
+      if (FreePntr->longStringThing.isLongString == AVLDUP_INTERNED_STRING)
+        AVLDupReleaseInternedString (FreePntr->longStringThing.stringPntr);
+      else if (FreePntr->longStringThing.isLongString)
         free (FreePntr->longStringThing.stringPntr);
     }
   }
 
-  if (NumberOfThings == 1)
-    ThingPntr->int64Thing = 0;
-  else
-    memset (ThingPntr, 0, NumberOfThings * sizeof (AVLDupThingRecord));
+  memset (ThingPntr, 0, NumberOfThings * sizeof (AVLDupThingRecord));
 }
 
 
@@ -477,6 +408,13 @@ static int CompareString (AVLDupThingPointer A, AVLDupThingPointer B)
   const char *StringAPntr;
   const char *StringBPntr;
 
+  /* Equal interned strings (see AVLDupIntern.c) are the same string, which
+  saves looking at all of it for long duplicate keys. */
+
+  if (A->longStringThing.isLongString && B->longStringThing.isLongString &&
+  A->longStringThing.stringPntr == B->longStringThing.stringPntr)
+    return 0;
+
   StringAPntr = AVLDupGetStringPntrFromThing (*A);
   StringBPntr = AVLDupGetStringPntrFromThing (*B);
 
@@ -495,8 +433,8 @@ static int CompareString (AVLDupThingPointer A, AVLDupThingPointer B)
 
   /* Use an ordinary strcmp for the rest of the comparison.  We are comparing
   UTF-8 strings, so the ordering of multibyte characters could be different
-  than what strcmp returns, but we'll leave it as it is for now.  Also, we
-  could implement a comparison which ignores case. */
+  than what a person would expect, and case matters.  Trees which need a
+  better order can use AVLDupAllocCollatedTree, see AVLDupCollation.c. */
 
   return strcmp (StringAPntr, StringBPntr);
 }
@@ -504,9 +442,10 @@ static int CompareString (AVLDupThingPointer A, AVLDupThingPointer B)
 
 
 /* Internal utility to find a comparison function which is appropriate for the
-specified type of data.  Returns NULL if none exists. */
+specified type of data.  Returns NULL if none exists.  Also used by the other
+source files in the library, so it isn't static. */
 
-static AVLDupComparisonFunctionPointer GetComparisonFunctionForType (
+AVLDupComparisonFunctionPointer AVLDupGetComparisonFunctionForType (
   type_code KeyType)
 {
   switch (KeyType)
@@ -546,6 +485,26 @@ AVLDupTreePointer AVLDupAllocTree (
   type_code   ValueType,
   const char *IndexName,
   uint32      MaxSimultaneousReaders)
+{
+  return AVLDupAllocCollatedTree (KeyType, ValueType, IndexName,
+    MaxSimultaneousReaders, AVLDUP_COLLATION_BINARY);
+}
+
+
+
+/* Like AVLDupAllocTree, but for string keys you can also pick the order
+they are sorted in, such as ignoring case.  Each key gets a sort key worked
+out when it is added, which takes some extra time and memory, but then
+comparing keys is as fast as for the usual strcmp order.  Collations other
+than AVLDUP_COLLATION_BINARY only work for B_STRING_TYPE keys, you get NULL
+for other key types.  See AVLDupCollation.c for the details. */
+
+AVLDupTreePointer AVLDupAllocCollatedTree (
+  type_code       KeyType,
+  type_code       ValueType,
+  const char     *IndexName,
+  uint32          MaxSimultaneousReaders,
+  AVLDupCollation CollationMode)
 {
   int                NameLength;
   AVLDupTreePointer  NewTree;
@@ -560,6 +519,15 @@ AVLDupTreePointer AVLDupAllocTree (
   NewTree->count = 0;
   NewTree->accessSemaphoreID = -1;
   NewTree->maxSimultaneousReaders = MaxSimultaneousReaders;
+  NewTree->logPntr = NULL;
+  memset (&NewTree->statistics, 0, sizeof (NewTree->statistics));
+  NewTree->latencyPntr = NULL;
+  NewTree->contentionPntr = NULL;
+  NewTree->recorderPntr = NULL;
+  NewTree->collation = CollationMode;
+  NewTree->internTablePntr = NULL;
+  NewTree->internKeys = false;
+  NewTree->internValues = false;
 
   /* Copy the user provided title string, if provided. */
 
@@ -586,12 +554,18 @@ AVLDupTreePointer AVLDupAllocTree (
 
   NewTree->keyType = KeyType;
   NewTree->keyComparisonFunctionPntr =
-    GetComparisonFunctionForType (KeyType);
+    AVLDupGetComparisonFunctionForType (KeyType);
+  if (CollationMode != AVLDUP_COLLATION_BINARY)
+  {
+    if (KeyType != B_STRING_TYPE) goto ErrorExit;
+    NewTree->keyComparisonFunctionPntr =
+      AVLDupGetComparisonFunctionForCollation (CollationMode);
+  }
   if (NewTree->keyComparisonFunctionPntr == NULL) goto ErrorExit;
 
   NewTree->valueType = ValueType;
   NewTree->valueComparisonFunctionPntr =
-    GetComparisonFunctionForType (ValueType);
+    AVLDupGetComparisonFunctionForType (ValueType);
   if (NewTree->valueComparisonFunctionPntr == NULL) goto ErrorExit;
 
   return NewTree;
@@ -604,12 +578,90 @@ ErrorExit: /* Deallocate partial allocations and return NULL. */
 
 
 
+/* Internal function for creating a new leaf node holding copies of the given
+key and value.  The types come from the tree.  Returns NULL if it ran out of
+memory, in which case nothing needs to be cleaned up.  The node isn't linked
+into anything, nor is the tree's count changed. */
+
+AVLDupNodePointer AVLDupAllocateNode (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  AVLDupNodePointer NewNode;
+  bool              Successful;
+
+  NewNode = malloc (sizeof (AVLDupNodeRecord));
+  if (NewNode == NULL)
+    return NULL;
+
+  /* Copy the key and value to the new node.  Keys in a collated tree get
+  their sort key added, and trees which intern their strings share them
+  rather than copying them. */
+
+  if (TreePntr->collation != AVLDUP_COLLATION_BINARY)
+    Successful = AVLDupCollateThing (TreePntr->collation, Key, &NewNode->key);
+  else if (TreePntr->internKeys)
+    Successful =
+      AVLDupInternThing (TreePntr->internTablePntr, Key, &NewNode->key);
+  else
+    Successful =
+      AVLDupCopyThingArray (&NewNode->key, Key, TreePntr->keyType, 1);
+  if (!Successful)
+  {
+    free (NewNode);
+    return NULL;
+  }
+  if (TreePntr->internValues)
+    Successful =
+      AVLDupInternThing (TreePntr->internTablePntr, Value, &NewNode->value);
+  else
+    Successful =
+      AVLDupCopyThingArray (&NewNode->value, Value, TreePntr->valueType, 1);
+  if (!Successful)
+  {
+    AVLDupFreeThingArray (&NewNode->key, TreePntr->keyType, 1);
+    free (NewNode);
+    return NULL;
+  }
+
+  /* Set up the remaining fields in the new node. */
+
+  NewNode->smallerChildPntr = NULL;
+  NewNode->largerChildPntr = NULL;
+  NewNode->height = 1;
+
+  return NewNode;
+}
+
+
+
+/* Internal function for getting rid of a single node, its key and its value.
+Doesn't look at the children. */
+
+void AVLDupDeallocateNode (
+  AVLDupTreePointer  TreePntr,
+  AVLDupNodePointer  CurrentNode)
+{
+  /* Deallocate associated data. */
+
+  AVLDupFreeThingArray (&CurrentNode->key, TreePntr->keyType, 1);
+  AVLDupFreeThingArray (&CurrentNode->value, TreePntr->valueType, 1);
+
+  /* Finally get rid of the node itself. */
+
+  memset (CurrentNode, 0, sizeof (AVLDupNodeRecord));
+  free (CurrentNode);
+}
+
+
+
 /* Internal function for removing nodes.  Deallocates the node's children,
 the node's key and value, and the node itself.  It needs the tree only for
 the types of the key and value.  It does not update the tree record at all,
 nor rebalance the tree, nor fix up parent nodes of the deleted nodes. */
 
-static void AVLDupRecursiveDeallocateNodes (
+void AVLDupRecursiveDeallocateNodes (
   AVLDupTreePointer  TreePntr,
   AVLDupNodePointer  CurrentNode)
 {
@@ -621,15 +673,86 @@ static void AVLDupRecursiveDeallocateNodes (
   AVLDupRecursiveDeallocateNodes (TreePntr, CurrentNode->smallerChildPntr);
   AVLDupRecursiveDeallocateNodes (TreePntr, CurrentNode->largerChildPntr);
 
-  /* Deallocate associated data. */
+  AVLDupDeallocateNode (TreePntr, CurrentNode);
+}
 
-  AVLDupFreeThingArray (&CurrentNode->key, TreePntr->keyType, 1);
-  AVLDupFreeThingArray (&CurrentNode->value, TreePntr->valueType, 1);
 
-  /* Finally get rid of the node itself. */
 
-  memset (CurrentNode, 0, sizeof (AVLDupNodeRecord));
-  free (CurrentNode);
+/* Internal function for comparing two nodes by key and then by value,
+returning the usual negative, zero or positive result. */
+
+int AVLDupCompareNodes (
+  AVLDupTreePointer TreePntr,
+  AVLDupNodePointer A,
+  AVLDupNodePointer B)
+{
+  int ComparisonResult;
+
+  ComparisonResult = TreePntr->keyComparisonFunctionPntr (&A->key, &B->key);
+  if (ComparisonResult == 0)
+    ComparisonResult =
+    TreePntr->valueComparisonFunctionPntr (&A->value, &B->value);
+
+  return ComparisonResult;
+}
+
+
+
+/* Internal function which puts the nodes of a subtree into an array, in
+sorted order.  Returns the position after the last one. */
+
+AVLDupNodePointer *AVLDupFlattenSubtree (
+  AVLDupNodePointer  CurrentNode,
+  AVLDupNodePointer *NodeArray)
+{
+  while (CurrentNode != NULL)
+  {
+    NodeArray = AVLDupFlattenSubtree (CurrentNode->smallerChildPntr, NodeArray);
+    *NodeArray++ = CurrentNode;
+    CurrentNode = CurrentNode->largerChildPntr;
+  }
+
+  return NodeArray;
+}
+
+
+
+/* Internal function for building a perfectly balanced subtree out of an array
+of nodes which are already in sorted order with no duplicates.  The middle node
+becomes the root and the halves on either side become its children, so the
+sizes of the two subtrees differ by at most one and the result is a valid AVL
+tree.  The child pointers and heights of all the nodes get overwritten.
+Returns the root of the new subtree, NULL if the array is empty.  Runs in
+linear time, compared to N log N for adding the nodes one at a time. */
+
+AVLDupNodePointer AVLDupBuildBalancedSubtree (
+  AVLDupNodePointer *SortedNodeArray,
+  uint32             NumberOfNodes)
+{
+  unsigned int      LeftHeight;
+  uint32            MiddleIndex;
+  AVLDupNodePointer MiddleNode;
+  unsigned int      RightHeight;
+
+  if (NumberOfNodes == 0)
+    return NULL;
+
+  MiddleIndex = NumberOfNodes / 2;
+  MiddleNode = SortedNodeArray[MiddleIndex];
+
+  MiddleNode->smallerChildPntr =
+    AVLDupBuildBalancedSubtree (SortedNodeArray, MiddleIndex);
+  MiddleNode->largerChildPntr = AVLDupBuildBalancedSubtree (
+    SortedNodeArray + MiddleIndex + 1, NumberOfNodes - MiddleIndex - 1);
+
+  LeftHeight = (MiddleNode->smallerChildPntr == NULL) ?
+    0 : MiddleNode->smallerChildPntr->height;
+  RightHeight = (MiddleNode->largerChildPntr == NULL) ?
+    0 : MiddleNode->largerChildPntr->height;
+  MiddleNode->height = 1 + ((LeftHeight > RightHeight) ?
+    LeftHeight : RightHeight);
+
+  return MiddleNode;
 }
 
 
@@ -656,12 +779,30 @@ void AVLDupFreeTree (AVLDupTreePointer TreePntr)
       delete_sem (TreePntr->accessSemaphoreID);
     }
 
+    /* Write out any log records still in memory.  Nobody else is using the
+    tree now, so there's nobody to report an error to. */
+
+    if (TreePntr->logPntr != NULL)
+      AVLDupLogClose (TreePntr->logPntr);
+
+    if (TreePntr->recorderPntr != NULL)
+      AVLDupRecorderClose (TreePntr->recorderPntr);
+
     if (TreePntr->rootPntr != NULL)
       AVLDupRecursiveDeallocateNodes (TreePntr, TreePntr->rootPntr);
 
     if (TreePntr->indexName != NULL)
       free (TreePntr->indexName);
 
+    if (TreePntr->latencyPntr != NULL)
+      free (TreePntr->latencyPntr);
+
+    if (TreePntr->contentionPntr != NULL)
+      AVLDupFreeContention (TreePntr->contentionPntr);
+
+    if (TreePntr->internTablePntr != NULL)
+      AVLDupFreeInternTable (TreePntr->internTablePntr);
+
     memset (TreePntr, 0, sizeof (AVLDupTreeRecord));
     free (TreePntr);
   }
@@ -694,6 +835,259 @@ const char *AVLDupGetTreeName (AVLDupTreePointer TreePntr)
 
 
 
+/* Adds the counts of the work done by one operation to the tree's totals.
+Atomic adds are used since readers run in parallel and each one adds its
+own counts as it finishes; the counts in the tree are only totals so there
+is no need to update them all together. */
+
+void AVLDupAddOperationCounts (
+  AVLDupTreePointer TreePntr,
+  AVLDupOperationCountsPointer CountsPntr)
+{
+#ifndef AVLDUP_NO_STATISTICS
+  int64  *CountPntr;
+  int     i;
+  int64  *TotalPntr;
+
+  CountPntr = (int64 *) CountsPntr;
+  TotalPntr = (int64 *) &TreePntr->statistics;
+  for (i = sizeof (AVLDupOperationCountsRecord) / sizeof (int64); i > 0; i--)
+  {
+    if (*CountPntr != 0)
+      atomic_add64 (TotalPntr, *CountPntr);
+    CountPntr++;
+    TotalPntr++;
+  }
+#endif
+}
+
+
+
+/* Internal state for examining the shape of a tree for AVLDupGetStats.  The
+duplicate key runs are found by comparing each key with the previous one in
+the in-order traversal. */
+
+typedef struct ShapeExaminationStruct
+{
+  AVLDupTreePointer       treePntr;
+  AVLDupStatisticsPointer statsPntr;
+  AVLDupThingPointer      previousKeyPntr;
+  uint32                  runLength;
+} ShapeExaminationRecord, *ShapeExaminationPointer;
+
+
+static void AVLDupFinishDuplicateRun (ShapeExaminationPointer ShapePntr)
+{
+  int    Bucket;
+  uint32 Length;
+
+  if (ShapePntr->runLength == 0)
+    return;
+
+  /* Bucket N holds runs of length 2^N to 2^(N+1)-1. */
+
+  Bucket = 0;
+  for (Length = ShapePntr->runLength; Length > 1; Length >>= 1)
+    Bucket++;
+  if (Bucket >= AVLDUP_STATS_RUN_BUCKETS)
+    Bucket = AVLDUP_STATS_RUN_BUCKETS - 1;
+
+  ShapePntr->statsPntr->duplicateRunHistogram[Bucket]++;
+  if (ShapePntr->runLength > ShapePntr->statsPntr->longestDuplicateRun)
+    ShapePntr->statsPntr->longestDuplicateRun = ShapePntr->runLength;
+  ShapePntr->runLength = 0;
+}
+
+
+/* Estimates the memory malloc wastes on a block of the given size, for the
+header it puts in front of each block and for rounding the size up.  The
+defaults match the GNU C library on 64 bit systems (8 byte header, 16 byte
+steps, 32 byte minimum), define them differently when compiling for other
+allocators. */
+
+#ifndef AVLDUP_MALLOC_HEADER_SIZE
+#define AVLDUP_MALLOC_HEADER_SIZE 8
+#endif
+#ifndef AVLDUP_MALLOC_ALIGNMENT
+#define AVLDUP_MALLOC_ALIGNMENT 16
+#endif
+#ifndef AVLDUP_MALLOC_MINIMUM_SIZE
+#define AVLDUP_MALLOC_MINIMUM_SIZE 32
+#endif
+
+static uint32 AVLDupAllocatorOverhead (size_t Size)
+{
+  size_t BlockSize;
+
+  BlockSize = (Size + AVLDUP_MALLOC_HEADER_SIZE + AVLDUP_MALLOC_ALIGNMENT - 1) &
+    ~((size_t) AVLDUP_MALLOC_ALIGNMENT - 1);
+  if (BlockSize < AVLDUP_MALLOC_MINIMUM_SIZE)
+    BlockSize = AVLDUP_MALLOC_MINIMUM_SIZE;
+  return (uint32) (BlockSize - Size);
+}
+
+
+static void AVLDupCountLongString (
+  AVLDupStatisticsPointer StatsPntr,
+  AVLDupThingPointer      ThingPntr)
+{
+  size_t Size;
+
+  if (!ThingPntr->longStringThing.isLongString ||
+  ThingPntr->longStringThing.isLongString == AVLDUP_INTERNED_STRING)
+    return; /* Interned strings are counted once, from their table. */
+
+  if (ThingPntr->longStringThing.isLongString == AVLDUP_COLLATED_STRING)
+    Size = AVLDupCollatedStringSize (ThingPntr);
+  else
+    Size = strlen (ThingPntr->longStringThing.stringPntr) + 1;
+  StatsPntr->longStringBytes += Size;
+  StatsPntr->longStrings++;
+  StatsPntr->allocatorOverheadBytes += AVLDupAllocatorOverhead (Size);
+}
+
+
+static void AVLDupRecursiveExamineShape (
+  ShapeExaminationPointer ShapePntr,
+  AVLDupNodePointer       CurrentNode,
+  int                     Depth)
+{
+  AVLDupStatisticsPointer StatsPntr;
+
+  if (CurrentNode == NULL)
+    return;
+
+  StatsPntr = ShapePntr->statsPntr;
+
+  AVLDupRecursiveExamineShape (ShapePntr, CurrentNode->smallerChildPntr,
+    Depth + 1);
+
+  StatsPntr->depthHistogram[(Depth < AVLDUP_STATS_MAX_DEPTH) ?
+    Depth : AVLDUP_STATS_MAX_DEPTH - 1]++;
+
+  if (ShapePntr->treePntr->keyType == B_STRING_TYPE)
+    AVLDupCountLongString (StatsPntr, &CurrentNode->key);
+  if (ShapePntr->treePntr->valueType == B_STRING_TYPE)
+    AVLDupCountLongString (StatsPntr, &CurrentNode->value);
+
+  if (ShapePntr->previousKeyPntr == NULL ||
+  ShapePntr->treePntr->keyComparisonFunctionPntr (ShapePntr->previousKeyPntr,
+  &CurrentNode->key) != 0)
+  {
+    AVLDupFinishDuplicateRun (ShapePntr);
+    StatsPntr->distinctKeys++;
+  }
+  ShapePntr->runLength++;
+  ShapePntr->previousKeyPntr = &CurrentNode->key;
+
+  AVLDupRecursiveExamineShape (ShapePntr, CurrentNode->largerChildPntr,
+    Depth + 1);
+}
+
+
+
+/* Fills in the user provided statistics record with the operation counts
+and a description of the tree's shape.  The operation counts are cheap to
+get.  If ExamineTree is TRUE then the whole tree is traversed (with the tree
+locked for reading) to find the depth histogram, memory used and duplicate
+key runs, otherwise those fields are set to zero.  The memory used is broken
+down into nodes, long strings, the tree header and an estimate of what
+malloc adds to each block (see AVLDupAllocatorOverhead), which together
+give a prediction of the memory an index of a given size will need.  The
+duplicate run histogram has the number of keys with 1 value in bucket 0, 2
+to 3 values in bucket 1, 4 to 7 values in bucket 2 and so on.  Returns FALSE
+if the tree lock couldn't be obtained. */
+
+bool AVLDupGetStats (
+  AVLDupTreePointer TreePntr,
+  AVLDupStatisticsPointer StatsPntr,
+  bool ExamineTree)
+{
+  status_t               ErrorCode;
+  uint32                 InternedStrings;
+  uint64                 InternedStringBytes;
+  uint64                 InternTableBytes;
+  ShapeExaminationRecord Shape;
+
+  if (TreePntr == NULL || StatsPntr == NULL)
+    return false;
+
+  memset (StatsPntr, 0, sizeof (AVLDupStatisticsRecord));
+
+  if (TreePntr->accessSemaphoreID >= 0)
+  {
+    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
+      1 /* we are a reader, grab just 1 unit */, 0, 0);
+    if (ErrorCode < 0)
+      return false; /* Semaphore was deleted or a signal interrupted us. */
+  }
+
+  StatsPntr->adds = atomic_get64 (&TreePntr->statistics.adds);
+  StatsPntr->deletes = atomic_get64 (&TreePntr->statistics.deletes);
+  StatsPntr->iterations = atomic_get64 (&TreePntr->statistics.iterations);
+  StatsPntr->callbacks = atomic_get64 (&TreePntr->statistics.callbacks);
+  StatsPntr->keyComparisons =
+    atomic_get64 (&TreePntr->statistics.keyComparisons);
+  StatsPntr->valueComparisons =
+    atomic_get64 (&TreePntr->statistics.valueComparisons);
+  StatsPntr->singleRotations =
+    atomic_get64 (&TreePntr->statistics.singleRotations);
+  StatsPntr->doubleRotations =
+    atomic_get64 (&TreePntr->statistics.doubleRotations);
+
+  StatsPntr->count = TreePntr->count;
+  if (TreePntr->rootPntr != NULL)
+    StatsPntr->height = TreePntr->rootPntr->height;
+
+  if (ExamineTree)
+  {
+    memset (&Shape, 0, sizeof (Shape));
+    Shape.treePntr = TreePntr;
+    Shape.statsPntr = StatsPntr;
+    AVLDupRecursiveExamineShape (&Shape, TreePntr->rootPntr, 0);
+    AVLDupFinishDuplicateRun (&Shape);
+    StatsPntr->nodeBytes =
+      (uint64) TreePntr->count * sizeof (AVLDupNodeRecord);
+    StatsPntr->allocatorOverheadBytes += (uint64) TreePntr->count *
+      AVLDupAllocatorOverhead (sizeof (AVLDupNodeRecord));
+
+    StatsPntr->headerBytes = sizeof (AVLDupTreeRecord);
+    StatsPntr->allocatorOverheadBytes +=
+      AVLDupAllocatorOverhead (sizeof (AVLDupTreeRecord));
+    if (TreePntr->indexName != NULL)
+    {
+      StatsPntr->headerBytes += strlen (TreePntr->indexName) + 1;
+      StatsPntr->allocatorOverheadBytes +=
+        AVLDupAllocatorOverhead (strlen (TreePntr->indexName) + 1);
+    }
+
+    if (TreePntr->internTablePntr != NULL)
+    {
+      AVLDupGetInternTableSizes (TreePntr->internTablePntr, &InternedStrings,
+        &InternedStringBytes, &InternTableBytes);
+      StatsPntr->longStrings += InternedStrings;
+      StatsPntr->longStringBytes += InternedStringBytes;
+      if (InternedStrings > 0)
+        StatsPntr->allocatorOverheadBytes += (uint64) InternedStrings *
+          AVLDupAllocatorOverhead (InternedStringBytes / InternedStrings);
+      StatsPntr->headerBytes += InternTableBytes;
+      StatsPntr->allocatorOverheadBytes +=
+        AVLDupAllocatorOverhead (InternTableBytes);
+    }
+
+    StatsPntr->totalBytes = StatsPntr->nodeBytes +
+      StatsPntr->longStringBytes + StatsPntr->headerBytes +
+      StatsPntr->allocatorOverheadBytes;
+  }
+
+  if (TreePntr->accessSemaphoreID >= 0)
+    release_sem_etc (TreePntr->accessSemaphoreID, 1, B_DO_NOT_RESCHEDULE);
+
+  return true;
+}
+
+
+
 /* Internal function for setting the height of a node to be the larger of
 the child nodes' heights, plus one. */
 
@@ -767,6 +1161,7 @@ static void AVLDupRaiseLeftChild (AVLDupNodePointer *ParentNodePntrPntr)
   *ParentNodePntrPntr = Node1Pntr;
   Node2Pntr->smallerChildPntr = Node1Pntr->largerChildPntr;
   Node1Pntr->largerChildPntr = Node2Pntr;
+  AVLDUP_TRACE2 (raise__left, Node2Pntr, Node1Pntr);
 
   /* Fix up the heights of the nodes which have been changed, except for
   the parent node, which the caller should fix up.  Do it in order of
@@ -811,6 +1206,7 @@ static void AVLDupRaiseRightChild (AVLDupNodePointer *ParentNodePntrPntr)
   *ParentNodePntrPntr = Node2Pntr;
   Node1Pntr->largerChildPntr = Node2Pntr->smallerChildPntr;
   Node2Pntr->smallerChildPntr = Node1Pntr;
+  AVLDUP_TRACE2 (raise__right, Node1Pntr, Node2Pntr);
 
   /* Fix up the heights of the nodes which have been changed. */
 
@@ -825,9 +1221,13 @@ heights differ by more than 1 so that they end up differing by at most 1.
 It also updates the height of the node in all cases.  This function is called
 after an addition or deletion is made to the tree, as part of the
 addition/deletion recursive chain so that it rebalances the changed parts all
-the way from the added/deleted node up to the root. */
+the way from the added/deleted node up to the root.  The rotations done are
+counted in the arguments record for AVLDupGetStats.  Not static so that the
+microbenchmarks can time it on its own. */
 
-static void AVLDupFixupSubtrees (AVLDupNodePointer *ParentNodePntrPntr)
+void AVLDupFixupSubtrees (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer           *ParentNodePntrPntr)
 {
   AVLDupNodePointer CurrentNode;
   int               Delta;
@@ -870,7 +1270,12 @@ static void AVLDupFixupSubtrees (AVLDupNodePointer *ParentNodePntrPntr)
     RightHeight = (RaiseNode->largerChildPntr == NULL) ?
       0 : RaiseNode->largerChildPntr->height;
     if (RightHeight < LeftHeight)
+    {
       AVLDupRaiseLeftChild (&CurrentNode->largerChildPntr);
+      AVLDUP_STATISTIC (ArgsPntr->counts.doubleRotations++);
+    }
+    else
+      AVLDUP_STATISTIC (ArgsPntr->counts.singleRotations++);
 
     AVLDupRaiseRightChild (ParentNodePntrPntr);
   }
@@ -884,7 +1289,12 @@ static void AVLDupFixupSubtrees (AVLDupNodePointer *ParentNodePntrPntr)
     RightHeight = (RaiseNode->largerChildPntr == NULL) ?
       0 : RaiseNode->largerChildPntr->height;
     if (LeftHeight < RightHeight) /* Avoid AVL grandchild problem. */
+    {
       AVLDupRaiseRightChild (&CurrentNode->smallerChildPntr);
+      AVLDUP_STATISTIC (ArgsPntr->counts.doubleRotations++);
+    }
+    else
+      AVLDUP_STATISTIC (ArgsPntr->counts.singleRotations++);
 
     AVLDupRaiseLeftChild (ParentNodePntrPntr);
   }
@@ -911,13 +1321,8 @@ rearranged as part of the balancing, without knowing if the parent is a node
 (left or right subree) or the tree header.  Returns RAN_ADDED_A_NODE if it
 added a node, RAN_ALREADY_IN_TREE if it found a duplicate key/value (does
 nothing to tree), and RAN_OUT_OF_MEMORY if it ran out of memory (also does
-nothing to the existing tree). */
-
-typedef enum RecursiveAddNodeReturnCodesEnum {
-  RAN_OUT_OF_MEMORY = -1,
-  RAN_ALREADY_IN_TREE = 0,
-  RAN_ADDED_A_NODE = 1
-} RANReturnCode;
+nothing to the existing tree).  The return codes are defined in
+AVLDupTreePrivate.h. */
 
 static RANReturnCode AVLDupRecursiveAddNode (
   NonRecursiveArgumentsPointer ArgsPntr,
@@ -933,32 +1338,11 @@ static RANReturnCode AVLDupRecursiveAddNode (
   {
     /* Create a new node and add it to the tree. */
 
-    NewNode = malloc (sizeof (AVLDupNodeRecord));
+    NewNode = AVLDupAllocateNode (ArgsPntr->treePntr,
+      &ArgsPntr->userKey1, &ArgsPntr->userValue1);
     if (NewNode == NULL)
       return RAN_OUT_OF_MEMORY;
 
-    /* Copy the key and value to the new node. */
-
-    if (!AVLDupCopyThingArray (&NewNode->key, &ArgsPntr->userKey1,
-    ArgsPntr->keyType, 1))
-    {
-      free (NewNode);
-      return RAN_OUT_OF_MEMORY;
-    }
-    if (!AVLDupCopyThingArray (&NewNode->value, &ArgsPntr->userValue1,
-    ArgsPntr->valueType, 1))
-    {
-      AVLDupFreeThingArray (&NewNode->key, ArgsPntr->keyType, 1);
-      free (NewNode);
-      return RAN_OUT_OF_MEMORY;
-    }
-
-    /* Set up the remaining fields in the new node. */
-
-    NewNode->smallerChildPntr = NULL;
-    NewNode->largerChildPntr = NULL;
-    NewNode->height = 1;
-
     *ParentsChildPntrPntr = NewNode;
     return RAN_ADDED_A_NODE;
   }
@@ -969,10 +1353,14 @@ static RANReturnCode AVLDupRecursiveAddNode (
 
   ComparisonResult = ArgsPntr->keyComparisonFunctionPntr (
     &ArgsPntr->userKey1, &CurrentNode->key);
+  AVLDUP_STATISTIC (ArgsPntr->counts.keyComparisons++);
 
   if (ComparisonResult == 0) /* Equal keys, use the value to decide. */
+  {
     ComparisonResult = ArgsPntr->valueComparisonFunctionPntr (
     &ArgsPntr->userValue1, &CurrentNode->value);
+    AVLDUP_STATISTIC (ArgsPntr->counts.valueComparisons++);
+  }
 
   /* Key/value pair is totally equal to the current node.  Just do nothing. */
 
@@ -1006,74 +1394,201 @@ static RANReturnCode AVLDupRecursiveAddNode (
   /* A new node was added as a child.  Do post-addition fixups.  Recompute
   heights and rebalance the tree if needed. */
 
-  AVLDupFixupSubtrees (ParentsChildPntrPntr);
+  AVLDupFixupSubtrees (ArgsPntr, ParentsChildPntrPntr);
 
   return RAN_ADDED_A_NODE;
 }
 
 
 
-/* Adds a key/value pair to the AVLDupTree.  Returns TRUE if successful, FALSE
-if it ran out of memory or something else went wrong (program interrupted while
-waiting on a semaphore, or tree deleted while waiting).  Also returns TRUE and
-does nothing if you specified an existing key/value pair.  The types of the key
-and value are assumed to be the same as defined in the tree header record.  The
-key and value are copied so that you can deallocate your values after calling
-this function.  If you specified a string thing, the string will be copied by
-the tree routines, so you can free your string too.  It will also convert
-internally between short and long strings, so you can always pass in a long
-string if you wish. */
+/* Gets a search key ready for comparing with the keys in the tree.  A
+collated tree gets a collated copy, and a tree which interns its keys gets a
+reference to the shared copy of the string, if there is one, so that the
+comparisons with equal keys are just a pointer check.  Returns KeyPntr itself
+if neither was done, otherwise PreparedKeyPntr.  The caller has to hold the
+tree's lock (see AVLDupInternSearchThing) and free the key afterwards with
+AVLDupFreeSearchKey. */
 
-bool AVLDupAdd (
+AVLDupThingPointer AVLDupPrepareSearchKey (
   AVLDupTreePointer  TreePntr,
-  AVLDupThingPointer Key,
-  AVLDupThingPointer Value)
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer PreparedKeyPntr)
 {
-  NonRecursiveArgumentsRecord Arguments;
-  status_t                    ErrorCode;
-  RANReturnCode               ReturnCode;
-
-  if (TreePntr == NULL || Key == NULL || Value == NULL)
-    return false;
+  if (TreePntr->internKeys)
+    return AVLDupInternSearchThing (TreePntr->internTablePntr, KeyPntr,
+      PreparedKeyPntr);
 
-  if (TreePntr->accessSemaphoreID >= 0)
-  {
-    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
-      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
-    if (ErrorCode < 0)
-      return false; /* Semaphore was deleted or a signal interrupted us. */
-  }
+  return AVLDupCollateSearchKey (TreePntr, KeyPntr, PreparedKeyPntr);
+}
 
-  Arguments.keyType = TreePntr->keyType;
-  Arguments.keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
-  Arguments.userKey1 = *Key;
-  Arguments.valueType = TreePntr->valueType;
-  Arguments.valueComparisonFunctionPntr= TreePntr->valueComparisonFunctionPntr;
-  Arguments.userValue1 = *Value;
 
-  ReturnCode = AVLDupRecursiveAddNode (&Arguments, &TreePntr->rootPntr);
 
-  if (ReturnCode == RAN_ADDED_A_NODE)
-    TreePntr->count++;
+/* The same for a search value, which only needs interning, so there is
+nothing to free afterwards. */
 
-  if (TreePntr->accessSemaphoreID >= 0)
-  {
-    release_sem_etc (TreePntr->accessSemaphoreID,
-      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
-  }
+static AVLDupThingPointer AVLDupPrepareSearchValue (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer ValuePntr,
+  AVLDupThingPointer PreparedValuePntr)
+{
+  if (TreePntr->internValues)
+    return AVLDupInternSearchThing (TreePntr->internTablePntr, ValuePntr,
+      PreparedValuePntr);
 
-  return (ReturnCode != RAN_OUT_OF_MEMORY);
+  return ValuePntr;
 }
 
 
 
-/* An internal recursive function for finding the successor to some distant
-parent node (just follow the left links until NULL is encountered), and remove
-it from the tree (don't deallocate, just unlink and fix up its children).
+/* Frees a search key from AVLDupPrepareSearchKey.  Only a collated copy
+needs freeing, an interned one just points at the tree's string without
+owning a reference to it (and after a delete, that string may be gone). */
+
+void AVLDupFreeSearchKey (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer SearchKeyPntr)
+{
+  if (SearchKeyPntr != KeyPntr &&
+  SearchKeyPntr->longStringThing.isLongString != AVLDUP_INTERNED_STRING)
+    AVLDupFreeThingArray (SearchKeyPntr, TreePntr->keyType, 1);
+}
+
+
+
+/* Internal function which adds a key/value pair, assuming that the caller
+has already taken care of locking the tree for writing.  If the tree has a
+write-ahead log, the addition is appended to it but not necessarily written
+to disk yet, see AVLDupLogWaitUntilDurable.  If it is being recorded, the
+call goes in the trace, even if the pair was already there.  Doing both here
+catches the changes made by AVLDupIterateDeferringChanges,
+AVLDupParallelAddArray and so on, not just AVLDupAdd. */
+
+RANReturnCode AVLDupAddWithoutLocking (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  AVLDupThingRecord           PreparedKey;
+  AVLDupThingRecord           PreparedValue;
+  RANReturnCode               ReturnCode;
+  AVLDupThingPointer          SearchKeyPntr;
+  AVLDupThingPointer          SearchValuePntr;
+
+  SearchKeyPntr = AVLDupPrepareSearchKey (TreePntr, Key, &PreparedKey);
+  SearchValuePntr = AVLDupPrepareSearchValue (TreePntr, Value, &PreparedValue);
+
+  Arguments.treePntr = TreePntr;
+  Arguments.keyType = TreePntr->keyType;
+  Arguments.keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
+  Arguments.userKey1 = *SearchKeyPntr;
+  Arguments.valueType = TreePntr->valueType;
+  Arguments.valueComparisonFunctionPntr= TreePntr->valueComparisonFunctionPntr;
+  Arguments.userValue1 = *SearchValuePntr;
+  memset (&Arguments.counts, 0, sizeof (Arguments.counts));
+
+  ReturnCode = AVLDupRecursiveAddNode (&Arguments, &TreePntr->rootPntr);
+
+  AVLDupFreeSearchKey (TreePntr, Key, SearchKeyPntr);
+
+  if (ReturnCode == RAN_ADDED_A_NODE)
+  {
+    TreePntr->count++;
+    AVLDUP_STATISTIC (Arguments.counts.adds = 1);
+    if (TreePntr->logPntr != NULL)
+      AVLDupLogChange (TreePntr->logPntr, true, Key, Value);
+  }
+
+  if (TreePntr->recorderPntr != NULL)
+    AVLDupRecordChange (TreePntr->recorderPntr, true /* adding */,
+      system_time (), Key, Value);
+
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  return ReturnCode;
+}
+
+
+
+/* Adds a key/value pair to the AVLDupTree.  Returns TRUE if successful, FALSE
+if it ran out of memory or something else went wrong (program interrupted while
+waiting on a semaphore, or tree deleted while waiting).  Also returns TRUE and
+does nothing if you specified an existing key/value pair.  The types of the key
+and value are assumed to be the same as defined in the tree header record.  The
+key and value are copied so that you can deallocate your values after calling
+this function.  If you specified a string thing, the string will be copied by
+the tree routines, so you can free your string too.  It will also convert
+internally between short and long strings, so you can always pass in a long
+string if you wish.  If the tree has a write-ahead log (see AVLDupAttachLog)
+this function doesn't return until the addition (or an earlier addition of
+the same pair by some other thread) has been written to disk, and returns
+FALSE if that failed (the pair is still added to the tree in memory). */
+
+bool AVLDupAdd (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  status_t             ErrorCode;
+  AVLDupHeldLockRecord HeldLock;
+  AVLDupLatencyPointer LatencyPntr;
+  bigtime_t            LockedTime;
+  AVLDupLogPointer     LogPntr;
+  int64                LogPosition;
+  RANReturnCode        ReturnCode;
+  bigtime_t            StartTime;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  AVLDUP_TRACE1 (add__entry, TreePntr);
+  LatencyPntr = AVLDupLatencyStart (TreePntr, &StartTime);
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL)
+    LockedTime = system_time ();
+
+  ReturnCode = AVLDupAddWithoutLocking (TreePntr, Key, Value);
+  AVLDUP_TRACE2 (add__return, TreePntr, (int) ReturnCode);
+
+  LogPntr = TreePntr->logPntr;
+  if (LogPntr != NULL)
+    LogPosition = AVLDupLogGetAppendedPosition (LogPntr);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "add",
+    (ReturnCode == RAN_ADDED_A_NODE) ? 1 : 0);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_ADD,
+      StartTime, LockedTime);
+
+  /* Wait for the log record to hit the disk without holding the lock, so
+  that other writers can get their records into the same batch.  Even if the
+  pair was already there, wait anyway since another writer may have added it
+  and not yet got its record to the disk, and we're promising that it is
+  stored. */
+
+  if (LogPntr != NULL && !AVLDupLogWaitUntilDurable (LogPntr, LogPosition))
+    return false;
+
+  return (ReturnCode != RAN_OUT_OF_MEMORY);
+}
+
+
+
+/* An internal recursive function for finding the successor to some distant
+parent node (just follow the left links until NULL is encountered), and remove
+it from the tree (don't deallocate, just unlink and fix up its children).
 Returns the removed node. */
 
 static AVLDupNodePointer AVLDupRecursiveRipOutSuccessor (
-  AVLDupNodePointer *ParentsChildPntrPntr)
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer           *ParentsChildPntrPntr)
 {
   AVLDupNodePointer CurrentNode;
   AVLDupNodePointer RippedOutNode;
@@ -1094,12 +1609,13 @@ static AVLDupNodePointer AVLDupRecursiveRipOutSuccessor (
   /* Not at the successor yet, continue on down. */
 
   RippedOutNode =
-    AVLDupRecursiveRipOutSuccessor (&CurrentNode->smallerChildPntr);
+    AVLDupRecursiveRipOutSuccessor (ArgsPntr,
+    &CurrentNode->smallerChildPntr);
 
   /* Since child trees may have been modified, need to recalculate our
   height and do rebalancing. */
 
-  AVLDupFixupSubtrees (ParentsChildPntrPntr);
+  AVLDupFixupSubtrees (ArgsPntr, ParentsChildPntrPntr);
 
   return RippedOutNode;
 }
@@ -1137,10 +1653,14 @@ static bool AVLDupRecursiveDeleteNodeFindIt (
 
   ComparisonResult = ArgsPntr->keyComparisonFunctionPntr (
     &ArgsPntr->userKey1, &CurrentNode->key);
+  AVLDUP_STATISTIC (ArgsPntr->counts.keyComparisons++);
 
   if (ComparisonResult == 0) /* Equal keys, use the value to decide. */
+  {
     ComparisonResult = ArgsPntr->valueComparisonFunctionPntr (
     &ArgsPntr->userValue1, &CurrentNode->value);
+    AVLDUP_STATISTIC (ArgsPntr->counts.valueComparisons++);
+  }
 
   if (ComparisonResult < 0)
     ReturnCode =
@@ -1164,7 +1684,7 @@ static bool AVLDupRecursiveDeleteNodeFindIt (
     }
     else /* Has 2 children.  Replace with successor node. */
     {
-      SuccessorNode = AVLDupRecursiveRipOutSuccessor (
+      SuccessorNode = AVLDupRecursiveRipOutSuccessor (ArgsPntr,
         &CurrentNode->largerChildPntr);
 
       SuccessorNode->smallerChildPntr = CurrentNode->smallerChildPntr;
@@ -1174,65 +1694,124 @@ static bool AVLDupRecursiveDeleteNodeFindIt (
 
     /* Deallocate the old node, which matched our key/value pair. */
 
-    AVLDupFreeThingArray (&CurrentNode->key, ArgsPntr->keyType, 1);
-    AVLDupFreeThingArray (&CurrentNode->value, ArgsPntr->valueType, 1);
-    memset (CurrentNode, 0, sizeof (AVLDupNodeRecord));
-    free (CurrentNode);
+    AVLDupDeallocateNode (ArgsPntr->treePntr, CurrentNode);
     ReturnCode = true;
   }
 
   /* Recompute heights and rebalance the tree if needed. */
 
-  AVLDupFixupSubtrees (ParentsChildPntrPntr);
+  AVLDupFixupSubtrees (ArgsPntr, ParentsChildPntrPntr);
 
   return ReturnCode;
 }
 
 
 
-/* Deletes the given key/value pair.  Yes, you need to specify a value since
-duplicate keys can't otherwise be distinguished.  Returns FALSE if it can't
-find the key/value pair or was interupted, TRUE if it deleted it. */
+/* Internal function which deletes a key/value pair, assuming that the caller
+has already locked the tree for writing.  Returns TRUE if it deleted it.
+Like AVLDupAddWithoutLocking, the deletion is appended to the tree's log if
+it has one, and goes in the trace if the tree is being recorded. */
 
-bool AVLDupDelete (
-  AVLDupTreePointer TreePntr,
+bool AVLDupDeleteWithoutLocking (
+  AVLDupTreePointer  TreePntr,
   AVLDupThingPointer Key,
   AVLDupThingPointer Value)
 {
   NonRecursiveArgumentsRecord Arguments;
-  status_t                    ErrorCode;
+  AVLDupThingRecord           PreparedKey;
+  AVLDupThingRecord           PreparedValue;
+  AVLDupThingPointer          SearchKeyPntr;
+  AVLDupThingPointer          SearchValuePntr;
   bool                        Successful;
 
-  if (TreePntr == NULL || Key == NULL || Value == NULL)
-    return false;
-
-  if (TreePntr->accessSemaphoreID >= 0)
-  {
-    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
-      TreePntr->maxSimultaneousReaders /* we are a writer, grab all */, 0, 0);
-    if (ErrorCode < 0)
-      return false; /* Semaphore was deleted or a signal interrupted us. */
-  }
+  SearchKeyPntr = AVLDupPrepareSearchKey (TreePntr, Key, &PreparedKey);
+  SearchValuePntr = AVLDupPrepareSearchValue (TreePntr, Value, &PreparedValue);
 
+  Arguments.treePntr = TreePntr;
   Arguments.keyType = TreePntr->keyType;
   Arguments.keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
-  Arguments.userKey1 = *Key;
+  Arguments.userKey1 = *SearchKeyPntr;
   Arguments.valueType = TreePntr->valueType;
   Arguments.valueComparisonFunctionPntr= TreePntr->valueComparisonFunctionPntr;
-  Arguments.userValue1 = *Value;
+  Arguments.userValue1 = *SearchValuePntr;
+  memset (&Arguments.counts, 0, sizeof (Arguments.counts));
 
   Successful =
     AVLDupRecursiveDeleteNodeFindIt (&Arguments, &TreePntr->rootPntr);
 
-  if (Successful)
-    TreePntr->count--;
+  AVLDupFreeSearchKey (TreePntr, Key, SearchKeyPntr);
 
-  if (TreePntr->accessSemaphoreID >= 0)
+  if (Successful)
   {
-    release_sem_etc (TreePntr->accessSemaphoreID,
-      TreePntr->maxSimultaneousReaders, B_DO_NOT_RESCHEDULE);
+    TreePntr->count--;
+    AVLDUP_STATISTIC (Arguments.counts.deletes = 1);
+    if (TreePntr->logPntr != NULL)
+      AVLDupLogChange (TreePntr->logPntr, false, Key, Value);
   }
 
+  if (TreePntr->recorderPntr != NULL)
+    AVLDupRecordChange (TreePntr->recorderPntr, false /* deleting */,
+      system_time (), Key, Value);
+
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  return Successful;
+}
+
+
+
+/* Deletes the given key/value pair.  Yes, you need to specify a value since
+duplicate keys can't otherwise be distinguished.  Returns FALSE if it can't
+find the key/value pair or was interupted, TRUE if it deleted it.  As with
+AVLDupAdd, a logged tree waits for the deletion to get to the disk. */
+
+bool AVLDupDelete (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value)
+{
+  status_t             ErrorCode;
+  AVLDupHeldLockRecord HeldLock;
+  AVLDupLatencyPointer LatencyPntr;
+  bigtime_t            LockedTime;
+  AVLDupLogPointer     LogPntr;
+  int64                LogPosition;
+  bigtime_t            StartTime;
+  bool                 Successful;
+
+  if (TreePntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  AVLDUP_TRACE1 (delete__entry, TreePntr);
+  LatencyPntr = AVLDupLatencyStart (TreePntr, &StartTime);
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL)
+    LockedTime = system_time ();
+
+  Successful = AVLDupDeleteWithoutLocking (TreePntr, Key, Value);
+  AVLDUP_TRACE2 (delete__return, TreePntr, Successful ? 1 : 0);
+
+  LogPntr = TreePntr->logPntr;
+  if (LogPntr != NULL)
+    LogPosition = AVLDupLogGetAppendedPosition (LogPntr);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "delete", Successful ? 1 : 0);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_DELETE,
+      StartTime, LockedTime);
+
+  /* Like AVLDupAdd, wait even if nothing was deleted, since the pair may be
+  missing because of another writer's deletion which isn't on disk yet. */
+
+  if (LogPntr != NULL && !AVLDupLogWaitUntilDurable (LogPntr, LogPosition))
+    return false;
+
   return Successful;
 }
 
@@ -1257,6 +1836,8 @@ static bool AVLDupRecursiveSimpleIterate (
 
   /* Output the middle node. */
 
+  AVLDUP_STATISTIC (ArgsPntr->counts.callbacks++);
+  ArgsPntr->itemsDelivered++;
   if (!ArgsPntr->iterationCallback (&CurrentNode->key, &CurrentNode->value,
   ArgsPntr->extraUserData))
     return false; /* The user requested an early abort of the iteration. */
@@ -1275,46 +1856,41 @@ static bool AVLDupRecursiveSimpleIterate (
 
 
 
-/* Recursively iterate over the tree, cutting off traversals which don't fit
-in the given range of keys.  Returns TRUE if it got to the end of the range.
-If TestLowerBound is TRUE then tests will be done against userKey1 (the lower
-bound key).  If it is FALSE then we will assume that the node and all its
-children are greater than or equal to userKey1 and avoid the test.  Similarly
-if TestUpperBound is FALSE then we assume everything is less than or equal to
-the upper bound.  If both are false, we revert to a simple tree traversal and
-do no tests. */
+/* Compares the current node with the lower and upper bounds of the range
+being iterated over.  For convenience in understanding the code, both high and
+low comparisons are done as (BoundsLimit - CurrentNodeKey).  Meaning the
+comparison result is less than zero for key bigger than the bounds limit, and
+so on.  If TestLowerBound is FALSE, the node is assumed to be above the lower
+bound, similarly for TestUpperBound.  Also used by the other range traversal
+functions in the library. */
 
-static bool AVLDupRecursiveRangeIterate (
+void AVLDupCompareNodeWithBounds (
   NonRecursiveArgumentsPointer ArgsPntr,
   AVLDupNodePointer CurrentNode,
   bool TestLowerBound,
-  bool TestUpperBound)
+  bool TestUpperBound,
+  int *ComparisonLowerPntr,
+  int *ComparisonUpperPntr)
 {
   int ComparisonLower;
   int ComparisonUpper;
 
-  if (CurrentNode == NULL)
-    return true; /* Successfully finished iterating the NULL tree. */
-
-  if (!(TestLowerBound || TestUpperBound))
-    return AVLDupRecursiveSimpleIterate (ArgsPntr, CurrentNode);
-
-  /* For convenience in understanding the code, both high and low comparisons
-  are done as (BoundsLimit - CurrentNodeKey).  Meaning ComparisonResult is
-  less than zero for key bigger than the bounds limit, and so on. */
-
   if (TestLowerBound)
   {
     ComparisonLower = ArgsPntr->keyComparisonFunctionPntr (
     &ArgsPntr->userKey1, &CurrentNode->key);
+    AVLDUP_STATISTIC (ArgsPntr->counts.keyComparisons++);
 
     if (ComparisonLower == 0) /* Equal keys, use the value to decide. */
     {
       if (ArgsPntr->userValue1WasNULL)
         ComparisonLower = -1; /* Effectively lower bound is -infinity. */
       else
+      {
         ComparisonLower = ArgsPntr->valueComparisonFunctionPntr (
         &ArgsPntr->userValue1, &CurrentNode->value);
+        AVLDUP_STATISTIC (ArgsPntr->counts.valueComparisons++);
+      }
     }
   }
   else /* No comparison, current is always larger. */
@@ -1324,19 +1900,56 @@ static bool AVLDupRecursiveRangeIterate (
   {
     ComparisonUpper = ArgsPntr->keyComparisonFunctionPntr (
     &ArgsPntr->userKey2, &CurrentNode->key);
+    AVLDUP_STATISTIC (ArgsPntr->counts.keyComparisons++);
 
     if (ComparisonUpper == 0) /* Equal keys, use the value to decide. */
     {
       if (ArgsPntr->userValue2WasNULL)
         ComparisonUpper = 1; /* Effectively upper bound is +infinity. */
       else
+      {
         ComparisonUpper = ArgsPntr->valueComparisonFunctionPntr (
         &ArgsPntr->userValue2, &CurrentNode->value);
+        AVLDUP_STATISTIC (ArgsPntr->counts.valueComparisons++);
+      }
     }
   }
   else /* No comparison, current is always smaller. */
     ComparisonUpper = 1;
 
+  *ComparisonLowerPntr = ComparisonLower;
+  *ComparisonUpperPntr = ComparisonUpper;
+}
+
+
+
+/* Recursively iterate over the tree, cutting off traversals which don't fit
+in the given range of keys.  Returns TRUE if it got to the end of the range.
+If TestLowerBound is TRUE then tests will be done against userKey1 (the lower
+bound key).  If it is FALSE then we will assume that the node and all its
+children are greater than or equal to userKey1 and avoid the test.  Similarly
+if TestUpperBound is FALSE then we assume everything is less than or equal to
+the upper bound.  If both are false, we revert to a simple tree traversal and
+do no tests.  Not static since the parallel iteration code uses it too. */
+
+bool AVLDupRecursiveRangeIterate (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer CurrentNode,
+  bool TestLowerBound,
+  bool TestUpperBound)
+{
+  int ComparisonLower;
+  int ComparisonUpper;
+
+  if (CurrentNode == NULL)
+    return true; /* Successfully finished iterating the NULL tree. */
+
+  if (!(TestLowerBound || TestUpperBound))
+    return AVLDupRecursiveSimpleIterate (ArgsPntr, CurrentNode);
+
+  AVLDupCompareNodeWithBounds (ArgsPntr, CurrentNode,
+    TestLowerBound, TestUpperBound, &ComparisonLower, &ComparisonUpper);
+
   /* Examine the left subtree.  The lower limit of the range has to be less
   than the current node's key otherwise the lower tree is outside the bounds
   and doesn't need to be traversed.  If the upper limit is greater than or
@@ -1359,6 +1972,8 @@ static bool AVLDupRecursiveRangeIterate (
   (ComparisonUpper > 0 ||
   (ComparisonUpper == 0 && ArgsPntr->includeThingEqualToEnd)))
   {
+    AVLDUP_STATISTIC (ArgsPntr->counts.callbacks++);
+    ArgsPntr->itemsDelivered++;
     if (!ArgsPntr->iterationCallback (&CurrentNode->key, &CurrentNode->value,
     ArgsPntr->extraUserData))
       return false; /* The user requested an early abort of the iteration. */
@@ -1381,6 +1996,71 @@ static bool AVLDupRecursiveRangeIterate (
 
 
 
+/* Fills in the NonRecursiveArgumentsRecord for an iteration over a range,
+using the same conventions for the range as AVLDupIterate (see below).  Used
+by the other range iteration functions in the library too.  If TreePntr is
+NULL, the types and comparison functions are left alone, for callers (like the
+memory mapped tree) which don't have a tree header and fill them in first. */
+
+void AVLDupSetUpIterationArguments (
+  AVLDupTreePointer TreePntr,
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  ArgsPntr->treePntr = TreePntr;
+  if (TreePntr != NULL)
+  {
+    ArgsPntr->keyType = TreePntr->keyType;
+    ArgsPntr->keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
+    ArgsPntr->valueType = TreePntr->valueType;
+    ArgsPntr->valueComparisonFunctionPntr =
+      TreePntr->valueComparisonFunctionPntr;
+  }
+  ArgsPntr->includeThingEqualToStart = IncludeThingEqualToStart;
+  ArgsPntr->includeThingEqualToEnd = IncludeThingEqualToEnd;
+  ArgsPntr->iterationCallback = CallbackFunctionPntr;
+  ArgsPntr->extraUserData = ExtraUserData;
+  memset (&ArgsPntr->counts, 0, sizeof (ArgsPntr->counts));
+  ArgsPntr->itemsDelivered = 0;
+
+  /* Copy the starting key and value, if present, to our semi-global data. */
+
+  if (StartKeyPntr != NULL)
+  {
+    ArgsPntr->userKey1 = *StartKeyPntr;
+    if (StartValuePntr == NULL)
+      ArgsPntr->userValue1WasNULL = true;
+    else
+    {
+      ArgsPntr->userValue1 = *StartValuePntr;
+      ArgsPntr->userValue1WasNULL = false;
+    }
+  }
+
+  /* Copy the ending key and value, if present. */
+
+  if (EndKeyPntr != NULL)
+  {
+    ArgsPntr->userKey2 = *EndKeyPntr;
+    if (EndValuePntr == NULL)
+      ArgsPntr->userValue2WasNULL = true;
+    else
+    {
+      ArgsPntr->userValue2 = *EndValuePntr;
+      ArgsPntr->userValue2WasNULL = false;
+    }
+  }
+}
+
+
+
 /* This function will call the user provided callback function for every
 key/value pair in the given range, optionally including ones which equal the
 start and end keys.  AVLDupIterate will return TRUE if it reached the end of
@@ -1420,64 +2100,582 @@ bool AVLDupIterate (
   void *ExtraUserData)
 {
   NonRecursiveArgumentsRecord Arguments;
+  AVLDupThingPointer          EndSearchKeyPntr;
   status_t                    ErrorCode;
+  AVLDupHeldLockRecord        HeldLock;
+  AVLDupLatencyPointer        LatencyPntr;
+  bigtime_t                   LockedTime;
+  AVLDupThingRecord           PreparedEndKey;
+  AVLDupThingRecord           PreparedStartKey;
+  AVLDupThingPointer          StartSearchKeyPntr;
+  bigtime_t                   StartTime;
   bool                        Successful;
 
   if (TreePntr == NULL || CallbackFunctionPntr == NULL)
     return false;
 
-  if (TreePntr->accessSemaphoreID >= 0)
+  LatencyPntr = AVLDupLatencyStart (TreePntr, &StartTime);
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL || TreePntr->recorderPntr != NULL)
+    LockedTime = system_time ();
+
+  StartSearchKeyPntr =
+    AVLDupPrepareSearchKey (TreePntr, StartKeyPntr, &PreparedStartKey);
+  EndSearchKeyPntr =
+    AVLDupPrepareSearchKey (TreePntr, EndKeyPntr, &PreparedEndKey);
+
+  AVLDupSetUpIterationArguments (TreePntr, &Arguments,
+    StartSearchKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndSearchKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+
+  /* Start off the big recursive iteration. */
+
+  AVLDUP_TRACE1 (iterate__start, TreePntr);
+  Successful = AVLDupRecursiveRangeIterate (&Arguments, TreePntr->rootPntr,
+    StartKeyPntr != NULL, EndKeyPntr != NULL);
+  AVLDUP_TRACE3 (iterate__done, TreePntr,
+    Arguments.itemsDelivered, Successful ? 1 : 0);
+
+  AVLDupFreeSearchKey (TreePntr, StartKeyPntr, StartSearchKeyPntr);
+  AVLDupFreeSearchKey (TreePntr, EndKeyPntr, EndSearchKeyPntr);
+
+  AVLDUP_STATISTIC (Arguments.counts.iterations = 1);
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  if (TreePntr->recorderPntr != NULL)
+    AVLDupRecordIteration (TreePntr->recorderPntr, LockedTime,
+      StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+      EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+      Arguments.itemsDelivered);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "iterate",
+    Arguments.itemsDelivered);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_ITERATE,
+      StartTime, LockedTime);
+
+  return Successful;
+}
+
+
+
+/* Copies one of the ranges for AVLDupIterateRanges into the iteration
+arguments, so that the usual range comparison functions can be used on it. */
+
+static void AVLDupLoadRangeIntoArguments (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupRangePointer           RangePntr)
+{
+  if (RangePntr->startKeyPntr != NULL)
   {
-    ErrorCode = acquire_sem_etc (TreePntr->accessSemaphoreID,
-      1 /* we are a reader, grab just 1 unit */, 0, 0);
-    if (ErrorCode < 0)
-      return false; /* Semaphore was deleted or a signal interrupted us. */
+    ArgsPntr->userKey1 = *RangePntr->startKeyPntr;
+    ArgsPntr->userValue1WasNULL = (RangePntr->startValuePntr == NULL);
+    if (RangePntr->startValuePntr != NULL)
+      ArgsPntr->userValue1 = *RangePntr->startValuePntr;
+  }
+  if (RangePntr->endKeyPntr != NULL)
+  {
+    ArgsPntr->userKey2 = *RangePntr->endKeyPntr;
+    ArgsPntr->userValue2WasNULL = (RangePntr->endValuePntr == NULL);
+    if (RangePntr->endValuePntr != NULL)
+      ArgsPntr->userValue2 = *RangePntr->endValuePntr;
   }
+  ArgsPntr->includeThingEqualToStart = RangePntr->includeThingEqualToStart;
+  ArgsPntr->includeThingEqualToEnd = RangePntr->includeThingEqualToEnd;
+}
 
-  Arguments.keyType = TreePntr->keyType;
-  Arguments.keyComparisonFunctionPntr = TreePntr->keyComparisonFunctionPntr;
-  Arguments.valueType = TreePntr->valueType;
-  Arguments.valueComparisonFunctionPntr= TreePntr->valueComparisonFunctionPntr;
-  Arguments.includeThingEqualToStart = IncludeThingEqualToStart;
-  Arguments.includeThingEqualToEnd = IncludeThingEqualToEnd;
-  Arguments.iterationCallback = CallbackFunctionPntr;
-  Arguments.extraUserData = ExtraUserData;
 
-  /* Copy the starting key and value, if present, to our semi-global data. */
 
-  if (StartKeyPntr != NULL)
+/* Compares the current node with one of the ranges, see
+AVLDupCompareNodeWithBounds for what the comparison results mean. */
+
+static void AVLDupCompareNodeWithRange (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupRangePointer           RangePntr,
+  AVLDupNodePointer            CurrentNode,
+  bool                         TestLowerBound,
+  bool                         TestUpperBound,
+  int                         *ComparisonLowerPntr,
+  int                         *ComparisonUpperPntr)
+{
+  AVLDupLoadRangeIntoArguments (ArgsPntr, RangePntr);
+  AVLDupCompareNodeWithBounds (ArgsPntr, CurrentNode,
+    TestLowerBound && RangePntr->startKeyPntr != NULL,
+    TestUpperBound && RangePntr->endKeyPntr != NULL,
+    ComparisonLowerPntr, ComparisonUpperPntr);
+}
+
+
+
+/* Returns TRUE if the current node is inside the given range. */
+
+static bool AVLDupNodeIsInRange (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupRangePointer           RangePntr,
+  AVLDupNodePointer            CurrentNode)
+{
+  int ComparisonLower;
+  int ComparisonUpper;
+
+  AVLDupCompareNodeWithRange (ArgsPntr, RangePntr, CurrentNode, true, true,
+    &ComparisonLower, &ComparisonUpper);
+  return (ComparisonLower < 0 ||
+    (ComparisonLower == 0 && RangePntr->includeThingEqualToStart)) &&
+    (ComparisonUpper > 0 ||
+    (ComparisonUpper == 0 && RangePntr->includeThingEqualToEnd));
+}
+
+
+
+/* Recursively iterates over the parts of the subtree which are in the ranges
+numbered FirstRange up to but not including LastRange, which are the only
+ranges that can overlap this subtree.  Since the ranges are sorted and don't
+overlap, their starts and ends are both in ascending order, so binary
+searches can find the ranges which start below the current node (only they
+can overlap the smaller subtree) and the ranges which end above it (only they
+can overlap the larger subtree).  Subtrees in the gaps between ranges get
+no ranges at all and are skipped.  Once there is just one range left, the
+ordinary single range iteration takes over, which stops testing the bounds
+once it knows a subtree is inside them.  Returns FALSE if the user's
+callback stopped the iteration. */
+
+static bool AVLDupRecursiveMultiRangeIterate (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupRangePointer           RangeArray,
+  AVLDupNodePointer            CurrentNode,
+  uint32                       FirstRange,
+  uint32                       LastRange)
+{
+  int    ComparisonLower;
+  int    ComparisonUpper;
+  uint32 HighIndex;
+  bool   InRange;
+  uint32 LargerFirstRange;
+  uint32 LowIndex;
+  uint32 MiddleIndex;
+  uint32 SmallerLastRange;
+
+  if (CurrentNode == NULL || FirstRange >= LastRange)
+    return true;
+
+  if (LastRange - FirstRange == 1)
   {
-    Arguments.userKey1 = *StartKeyPntr;
-    if (StartValuePntr == NULL)
-      Arguments.userValue1WasNULL = true;
+    AVLDupLoadRangeIntoArguments (ArgsPntr, RangeArray + FirstRange);
+    return AVLDupRecursiveRangeIterate (ArgsPntr, CurrentNode,
+      RangeArray[FirstRange].startKeyPntr != NULL,
+      RangeArray[FirstRange].endKeyPntr != NULL);
+  }
+
+  /* Find the first range which doesn't start below the current node. */
+
+  LowIndex = FirstRange;
+  HighIndex = LastRange;
+  while (LowIndex < HighIndex)
+  {
+    MiddleIndex = LowIndex + (HighIndex - LowIndex) / 2;
+    AVLDupCompareNodeWithRange (ArgsPntr, RangeArray + MiddleIndex,
+      CurrentNode, true, false, &ComparisonLower, &ComparisonUpper);
+    if (ComparisonLower < 0)
+      LowIndex = MiddleIndex + 1;
+    else
+      HighIndex = MiddleIndex;
+  }
+  SmallerLastRange = LowIndex;
+
+  /* Find the first range which ends above the current node.  Ranges after
+  the first one starting at or above the node start (and end) above it, so
+  the search doesn't need to look past that one. */
+
+  LowIndex = FirstRange;
+  HighIndex = (SmallerLastRange < LastRange) ?
+    SmallerLastRange + 1 : LastRange;
+  while (LowIndex < HighIndex)
+  {
+    MiddleIndex = LowIndex + (HighIndex - LowIndex) / 2;
+    AVLDupCompareNodeWithRange (ArgsPntr, RangeArray + MiddleIndex,
+      CurrentNode, false, true, &ComparisonLower, &ComparisonUpper);
+    if (ComparisonUpper > 0)
+      HighIndex = MiddleIndex;
     else
+      LowIndex = MiddleIndex + 1;
+  }
+  LargerFirstRange = LowIndex;
+
+  if (!AVLDupRecursiveMultiRangeIterate (ArgsPntr, RangeArray,
+  CurrentNode->smallerChildPntr, FirstRange, SmallerLastRange))
+    return false; /* The user requested an early abort of the iteration. */
+
+  /* The node can only be in the last range starting below it or the first
+  one starting at or above it (if that one starts exactly at the node). */
+
+  InRange = (SmallerLastRange > FirstRange && AVLDupNodeIsInRange (ArgsPntr,
+    RangeArray + SmallerLastRange - 1, CurrentNode)) ||
+    (SmallerLastRange < LastRange && AVLDupNodeIsInRange (ArgsPntr,
+    RangeArray + SmallerLastRange, CurrentNode));
+  if (InRange)
+  {
+    AVLDUP_STATISTIC (ArgsPntr->counts.callbacks++);
+    ArgsPntr->itemsDelivered++;
+    if (!ArgsPntr->iterationCallback (&CurrentNode->key, &CurrentNode->value,
+    ArgsPntr->extraUserData))
+      return false; /* The user requested an early abort of the iteration. */
+  }
+
+  return AVLDupRecursiveMultiRangeIterate (ArgsPntr, RangeArray,
+    CurrentNode->largerChildPntr, LargerFirstRange, LastRange);
+}
+
+
+
+/* Like AVLDupIterate, but for several ranges at once, such as for a query
+wanting keys below 10 or above 1000000, or a list of particular keys.  The
+tree is only locked once and traversed once, in ascending order, skipping
+subtrees which fall between the ranges.  Each range in RangeArray has the
+same start and end settings as the arguments to AVLDupIterate, so use the
+same key for the start and end (with NULL values) to get all the values for
+a key, or NULL keys for ranges with no lower or upper limit.  The ranges must
+be sorted in ascending order and must not overlap (a pair in two ranges may
+be skipped or passed to the callback twice).  Returns TRUE if it reached the
+end of the last range, FALSE if your callback stopped it early or the tree
+couldn't be locked. */
+
+bool AVLDupIterateRanges (
+  AVLDupTreePointer TreePntr,
+  AVLDupRangePointer RangeArray,
+  uint32 NumberOfRanges,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  NonRecursiveArgumentsRecord Arguments;
+  status_t                    ErrorCode;
+  AVLDupHeldLockRecord        HeldLock;
+  uint32                      i;
+  AVLDupLatencyPointer        LatencyPntr;
+  bigtime_t                   LockedTime;
+  AVLDupThingPointer          PreparedKeyArray;
+  AVLDupRangePointer          PreparedRangeArray;
+  AVLDupRangePointer          SearchRangeArray;
+  bigtime_t                   StartTime;
+  bool                        Successful;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL ||
+  (RangeArray == NULL && NumberOfRanges > 0))
+    return false;
+
+  LatencyPntr = AVLDupLatencyStart (TreePntr, &StartTime);
+
+  ErrorCode = AVLDupAcquireAccess (TreePntr, false /* reader */, &HeldLock);
+  if (ErrorCode < 0)
+    return false; /* Semaphore was deleted or a signal interrupted us. */
+
+  LockedTime = 0;
+  if (LatencyPntr != NULL)
+    LockedTime = system_time ();
+
+  /* Prepare the range bounds once, like AVLDupIterate does, rather than
+  having every comparison on the way down collate them again or miss the
+  interned string shortcut.  The prepared ranges are copies of the user's,
+  with their keys following them in the same block of memory.  If there
+  isn't enough memory the user's ranges get used as they are, which still
+  works, just more slowly. */
+
+  PreparedRangeArray = NULL;
+  if (NumberOfRanges > 0 && (TreePntr->internKeys ||
+  TreePntr->collation != AVLDUP_COLLATION_BINARY))
+    PreparedRangeArray = malloc (NumberOfRanges *
+      (sizeof (AVLDupRangeRecord) + 2 * sizeof (AVLDupThingRecord)));
+
+  SearchRangeArray = RangeArray;
+  if (PreparedRangeArray != NULL)
+  {
+    PreparedKeyArray = (AVLDupThingPointer) (PreparedRangeArray +
+      NumberOfRanges);
+    for (i = 0; i < NumberOfRanges; i++)
     {
-      Arguments.userValue1 = *StartValuePntr;
-      Arguments.userValue1WasNULL = false;
+      PreparedRangeArray[i] = RangeArray[i];
+      PreparedRangeArray[i].startKeyPntr = AVLDupPrepareSearchKey (TreePntr,
+        RangeArray[i].startKeyPntr, PreparedKeyArray + 2 * i);
+      PreparedRangeArray[i].endKeyPntr = AVLDupPrepareSearchKey (TreePntr,
+        RangeArray[i].endKeyPntr, PreparedKeyArray + 2 * i + 1);
     }
+    SearchRangeArray = PreparedRangeArray;
   }
 
-  /* Copy the ending key and value, if present. */
+  AVLDupSetUpIterationArguments (TreePntr, &Arguments,
+    NULL, NULL, false, NULL, NULL, false,
+    CallbackFunctionPntr, ExtraUserData);
 
-  if (EndKeyPntr != NULL)
+  AVLDUP_TRACE1 (iterate__start, TreePntr);
+  Successful = AVLDupRecursiveMultiRangeIterate (&Arguments,
+    SearchRangeArray, TreePntr->rootPntr, 0, NumberOfRanges);
+  AVLDUP_TRACE3 (iterate__done, TreePntr,
+    Arguments.itemsDelivered, Successful ? 1 : 0);
+
+  if (PreparedRangeArray != NULL)
   {
-    Arguments.userKey2 = *EndKeyPntr;
-    if (EndValuePntr == NULL)
-      Arguments.userValue2WasNULL = true;
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+      AVLDupFreeSearchKey (TreePntr, RangeArray[i].startKeyPntr,
+        PreparedRangeArray[i].startKeyPntr);
+      AVLDupFreeSearchKey (TreePntr, RangeArray[i].endKeyPntr,
+        PreparedRangeArray[i].endKeyPntr);
+    }
+    free (PreparedRangeArray);
+  }
+
+  AVLDUP_STATISTIC (Arguments.counts.iterations = 1);
+  AVLDupAddOperationCounts (TreePntr, &Arguments.counts);
+
+  AVLDupReleaseAccess (TreePntr, &HeldLock, "iterateRanges",
+    Arguments.itemsDelivered);
+
+  if (LatencyPntr != NULL)
+    AVLDupLatencyRecordTimes (LatencyPntr, AVLDUP_LATENCY_ITERATE,
+      StartTime, LockedTime);
+
+  return Successful;
+}
+
+
+
+/* This structure holds one change queued up by the callback function of an
+AVLDupIterateDeferringChanges iteration.  The key and value are copies, since
+the originals may belong to the tree. */
+
+typedef struct AVLDupDeferredChangeStruct
+{
+  AVLDupThingRecord key;
+  AVLDupThingRecord value;
+  bool              isAddition; /* TRUE for add, FALSE for delete. */
+} AVLDupDeferredChangeRecord, *AVLDupDeferredChangePointer;
+
+
+/* The queue of deferred changes, an array which grows as needed.  It also
+holds the user's callback function and data, so that an internal callback
+function can pass them along to the user's callback during the iteration. */
+
+struct AVLDupDeferredChangesStruct
+{
+  AVLDupTreePointer treePntr;
+  AVLDupDeferredChangePointer changesArray;
+  uint32 numberOfChanges;
+  uint32 allocatedChanges;
+  bool ranOutOfMemory;
+  AVLDupDeferredIterationCallbackFunctionPointer userCallback;
+  void *userExtraData;
+};
+
+
+
+/* Internal function for adding a change to the queue.  Returns FALSE if it
+ran out of memory. */
+
+static bool AVLDupQueueDeferredChange (
+  AVLDupDeferredChangesPointer ChangesPntr,
+  AVLDupThingConstPointer      Key,
+  AVLDupThingConstPointer      Value,
+  bool                         IsAddition)
+{
+  AVLDupDeferredChangePointer ChangePntr;
+  uint32                      NewSize;
+  AVLDupDeferredChangePointer NewArray;
+
+  if (ChangesPntr == NULL || Key == NULL || Value == NULL)
+    return false;
+
+  if (ChangesPntr->numberOfChanges >= ChangesPntr->allocatedChanges)
+  {
+    NewSize = (ChangesPntr->allocatedChanges == 0) ?
+      32 : ChangesPntr->allocatedChanges * 2;
+    NewArray = realloc (ChangesPntr->changesArray,
+      NewSize * sizeof (AVLDupDeferredChangeRecord));
+    if (NewArray == NULL)
+      goto ErrorExit;
+    ChangesPntr->changesArray = NewArray;
+    ChangesPntr->allocatedChanges = NewSize;
+  }
+
+  ChangePntr = ChangesPntr->changesArray + ChangesPntr->numberOfChanges;
+
+  if (!AVLDupCopyThingArray (&ChangePntr->key, (AVLDupThingPointer) Key,
+  ChangesPntr->treePntr->keyType, 1))
+    goto ErrorExit;
+
+  if (!AVLDupCopyThingArray (&ChangePntr->value, (AVLDupThingPointer) Value,
+  ChangesPntr->treePntr->valueType, 1))
+  {
+    AVLDupFreeThingArray (&ChangePntr->key, ChangesPntr->treePntr->keyType, 1);
+    goto ErrorExit;
+  }
+
+  ChangePntr->isAddition = IsAddition;
+  ChangesPntr->numberOfChanges++;
+  return true;
+
+
+ErrorExit:
+  ChangesPntr->ranOutOfMemory = true;
+  return false;
+}
+
+
+
+/* Call these from inside your AVLDupIterateDeferringChanges callback
+function to queue up an addition or deletion of a key/value pair.  The change
+will be done after the iteration has finished.  The key and value are copied,
+so you can pass in the key and value given to your callback or your own
+temporary things.  Returns FALSE if it ran out of memory. */
+
+bool AVLDupDeferAdd (
+  AVLDupDeferredChangesPointer ChangesPntr,
+  AVLDupThingConstPointer      Key,
+  AVLDupThingConstPointer      Value)
+{
+  return AVLDupQueueDeferredChange (ChangesPntr, Key, Value, true);
+}
+
+
+bool AVLDupDeferDelete (
+  AVLDupDeferredChangesPointer ChangesPntr,
+  AVLDupThingConstPointer      Key,
+  AVLDupThingConstPointer      Value)
+{
+  return AVLDupQueueDeferredChange (ChangesPntr, Key, Value, false);
+}
+
+
+
+/* Internal callback used during the iteration, it passes the queue on to the
+user's callback function. */
+
+static bool AVLDupDeferredIterationCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  AVLDupDeferredChangesPointer ChangesPntr;
+
+  ChangesPntr = (AVLDupDeferredChangesPointer) ExtraData;
+
+  return ChangesPntr->userCallback (KeyPntr, ValuePntr, ChangesPntr,
+    ChangesPntr->userExtraData);
+}
+
+
+
+/* Just like AVLDupIterate, except that your callback function gets an extra
+argument, a queue of changes.  Your callback can use AVLDupDeferAdd and
+AVLDupDeferDelete to add changes to the queue (it still isn't allowed to call
+AVLDupAdd or AVLDupDelete directly, since that would deadlock).  When the
+iteration is finished (or your callback stops it early), the queued changes
+are all done in the order they were queued, in one batch while the tree is
+locked for writing.  That way a "scan and purge" job can be done in a single
+pass over the tree.
+
+Note that the reader lock is released before the writer lock is obtained
+(otherwise two threads doing this at the same time would deadlock), so other
+writers may sneak in a change between the end of the iteration and the start
+of the batch of changes.  Adding something which is already there and
+deleting something which is already gone are harmless, so that usually
+doesn't matter.
+
+Returns TRUE if the iteration reached the end and all the changes were done,
+FALSE if your callback stopped the iteration early, if it ran out of memory
+while queueing changes or if something went wrong with the locking.  Changes
+queued before an early stop or an out of memory problem are still done. */
+
+bool AVLDupIterateDeferringChanges (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupDeferredIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  AVLDupDeferredChangePointer ChangePntr;
+  AVLDupDeferredChangesRecord Changes;
+  status_t                    ErrorCode;
+  AVLDupHeldLockRecord        HeldLock;
+  uint32                      i;
+  AVLDupLogPointer            LogPntr;
+  int64                       LogPosition;
+  bool                        Successful;
+
+  if (TreePntr == NULL || CallbackFunctionPntr == NULL)
+    return false;
+
+  memset (&Changes, 0, sizeof (Changes));
+  Changes.treePntr = TreePntr;
+  Changes.userCallback = CallbackFunctionPntr;
+  Changes.userExtraData = ExtraUserData;
+
+  Successful = AVLDupIterate (TreePntr,
+    StartKeyPntr, StartValuePntr, IncludeThingEqualToStart,
+    EndKeyPntr, EndValuePntr, IncludeThingEqualToEnd,
+    AVLDupDeferredIterationCallback, &Changes);
+
+  if (Changes.ranOutOfMemory)
+    Successful = false;
+
+  /* Do all the queued up changes while holding the writer lock. */
+
+  if (Changes.numberOfChanges > 0)
+  {
+    ErrorCode = AVLDupAcquireAccess (TreePntr, true /* writer */, &HeldLock);
+
+    if (ErrorCode < 0)
+      Successful = false; /* Semaphore was deleted or we were interrupted. */
     else
     {
-      Arguments.userValue2 = *EndValuePntr;
-      Arguments.userValue2WasNULL = false;
+      for (i = 0, ChangePntr = Changes.changesArray;
+      i < Changes.numberOfChanges;
+      i++, ChangePntr++)
+      {
+        if (ChangePntr->isAddition)
+        {
+          if (AVLDupAddWithoutLocking (TreePntr, &ChangePntr->key,
+          &ChangePntr->value) == RAN_OUT_OF_MEMORY)
+            Successful = false;
+        }
+        else
+          AVLDupDeleteWithoutLocking (TreePntr, &ChangePntr->key,
+            &ChangePntr->value);
+      }
+
+      LogPntr = TreePntr->logPntr;
+      if (LogPntr != NULL)
+        LogPosition = AVLDupLogGetAppendedPosition (LogPntr);
+
+      AVLDupReleaseAccess (TreePntr, &HeldLock, "deferred changes",
+        Changes.numberOfChanges);
+
+      if (LogPntr != NULL && !AVLDupLogWaitUntilDurable (LogPntr, LogPosition))
+        Successful = false;
     }
   }
 
-  /* Start off the big recursive iteration. */
+  /* Deallocate the queue and the copies of the keys and values. */
 
-  Successful = AVLDupRecursiveRangeIterate (&Arguments, TreePntr->rootPntr,
-    StartKeyPntr != NULL, EndKeyPntr != NULL);
+  for (i = 0, ChangePntr = Changes.changesArray;
+  i < Changes.numberOfChanges;
+  i++, ChangePntr++)
+  {
+    AVLDupFreeThingArray (&ChangePntr->key, TreePntr->keyType, 1);
+    AVLDupFreeThingArray (&ChangePntr->value, TreePntr->valueType, 1);
+  }
 
-  if (TreePntr->accessSemaphoreID >= 0)
-    release_sem_etc (TreePntr->accessSemaphoreID, 1, B_DO_NOT_RESCHEDULE);
+  if (Changes.changesArray != NULL)
+    free (Changes.changesArray);
 
   return Successful;
 }
@@ -47,6 +47,7 @@
 #define _AVL_DUP_TREE_H 1
 
 #include <SupportDefs.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -132,6 +133,30 @@ AVLDupTreePointer AVLDupAllocTree (
   const char *IndexName,
   uint32 MaxSimultaneousReaders);
 
+/* Orders for string keys, for AVLDupAllocCollatedTree.  The binary order is
+the plain strcmp one, which AVLDupAllocTree uses.  See AVLDupCollation.c. */
+
+typedef enum AVLDupCollationEnum {
+  AVLDUP_COLLATION_BINARY = 0,
+  AVLDUP_COLLATION_IGNORE_CASE, /* Keys differing only by case are equal. */
+  AVLDUP_COLLATION_DICTIONARY /* Case and accents only used to break ties. */
+} AVLDupCollation;
+
+AVLDupTreePointer AVLDupAllocCollatedTree (
+  type_code KeyType,
+  type_code ValueType,
+  const char *IndexName,
+  uint32 MaxSimultaneousReaders,
+  AVLDupCollation CollationMode);
+
+/* Sharing one copy of each long string among all the entries of a tree which
+use it, for trees with many duplicate keys or repeated values.  See
+AVLDupIntern.c. */
+
+bool AVLDupEnableInterning (
+  AVLDupTreePointer TreePntr,
+  bool Enable);
+
 void AVLDupFreeTree (AVLDupTreePointer TreePntr);
 
 unsigned int AVLDupGetTreeCount (AVLDupTreePointer TreePntr);
@@ -164,6 +189,498 @@ bool AVLDupIterate (
   AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
   void *ExtraUserData);
 
+
+/* Iterating over several ranges at once, with one traversal of the tree.
+The ranges are sorted in ascending order and don't overlap, each one has the
+same meaning as the range arguments of AVLDupIterate. */
+
+typedef struct AVLDupRangeStruct
+{
+  AVLDupThingPointer startKeyPntr; /* NULL for no lower limit. */
+  AVLDupThingPointer startValuePntr;
+  bool includeThingEqualToStart;
+  AVLDupThingPointer endKeyPntr; /* NULL for no upper limit. */
+  AVLDupThingPointer endValuePntr;
+  bool includeThingEqualToEnd;
+} AVLDupRangeRecord, *AVLDupRangePointer;
+
+bool AVLDupIterateRanges (
+  AVLDupTreePointer TreePntr,
+  AVLDupRangePointer RangeArray,
+  uint32 NumberOfRanges,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+/* Intersections, unions and differences of the values found in key ranges
+of several trees, whose values are all the same type.  The resulting values
+are passed to the callback in ascending order.  See AVLDupSetOperations.c. */
+
+typedef enum AVLDupSetOperationEnum {
+  AVLDUP_SET_INTERSECTION = 0,
+  AVLDUP_SET_UNION,
+  AVLDUP_SET_DIFFERENCE /* Values in the first input but none of the rest. */
+} AVLDupSetOperation;
+
+typedef struct AVLDupSetInputStruct
+{
+  AVLDupTreePointer treePntr;
+  AVLDupRangeRecord range; /* The keys whose values are wanted. */
+} AVLDupSetInputRecord, *AVLDupSetInputPointer;
+
+typedef bool (* AVLDupValueCallbackFunctionPointer) (
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData);
+
+bool AVLDupCombineValues (
+  AVLDupSetOperation Operation,
+  AVLDupSetInputPointer InputArray,
+  uint32 NumberOfInputs,
+  AVLDupValueCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+
+/* Finding the keys which start with a prefix or match a wildcard pattern,
+for trees with string keys.  See AVLDupStringSearch.c.  Note that
+AVLDupCountPrefix visits every matching pair, so it takes time in
+proportion to the number of matches. */
+
+bool AVLDupIteratePrefix (
+  AVLDupTreePointer TreePntr,
+  const char *Prefix,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+bool AVLDupCountPrefix (
+  AVLDupTreePointer TreePntr,
+  const char *Prefix,
+  uint32 *CountPntr);
+
+bool AVLDupIteratePattern (
+  AVLDupTreePointer TreePntr,
+  const char *Pattern,
+  AVLDupTreePointer ReversedTreePntr,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+void AVLDupReverseString (char *StringPntr);
+
+
+/* Statistics about a tree, see AVLDupGetStats in AVLDupTree.c. */
+
+#define AVLDUP_STATS_MAX_DEPTH 64
+#define AVLDUP_STATS_RUN_BUCKETS 32
+
+typedef struct AVLDupStatisticsStruct
+{
+  /* Work done since the tree was created, all zero if the library was
+  compiled with AVLDUP_NO_STATISTICS. */
+
+  uint64 adds; /* Pairs actually added, not counting ones already there. */
+  uint64 deletes; /* Pairs actually deleted. */
+  uint64 iterations;
+  uint64 callbacks; /* Calls to iteration callback functions. */
+  uint64 keyComparisons;
+  uint64 valueComparisons;
+  uint64 singleRotations;
+  uint64 doubleRotations;
+
+  /* The shape of the tree.  Only count and height are filled in unless
+  you ask for the tree to be examined. */
+
+  uint32 count;
+  uint32 height;
+  uint32 depthHistogram [AVLDUP_STATS_MAX_DEPTH]; /* Nodes at each depth. */
+  uint64 nodeBytes;
+  uint64 longStringBytes; /* Separately allocated strings, including NULs. */
+  uint32 longStrings; /* Number of separately allocated strings. */
+  uint64 headerBytes; /* The tree record and its name. */
+  uint64 allocatorOverheadBytes; /* Estimated malloc headers and rounding. */
+  uint64 totalBytes; /* Sum of the four kinds of bytes above. */
+  uint32 distinctKeys;
+  uint32 longestDuplicateRun; /* Most values for a single key. */
+  uint32 duplicateRunHistogram [AVLDUP_STATS_RUN_BUCKETS];
+} AVLDupStatisticsRecord, *AVLDupStatisticsPointer;
+
+bool AVLDupGetStats (
+  AVLDupTreePointer TreePntr,
+  AVLDupStatisticsPointer StatsPntr,
+  bool ExamineTree);
+
+/* Iteration with the ability to queue up changes to the tree from inside the
+callback function, which are done after the iteration finishes. */
+
+typedef struct AVLDupDeferredChangesStruct
+  AVLDupDeferredChangesRecord, *AVLDupDeferredChangesPointer;
+
+typedef bool (* AVLDupDeferredIterationCallbackFunctionPointer) (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  AVLDupDeferredChangesPointer ChangesPntr,
+  void *ExtraData);
+
+bool AVLDupDeferAdd (
+  AVLDupDeferredChangesPointer ChangesPntr,
+  AVLDupThingConstPointer Key,
+  AVLDupThingConstPointer Value);
+
+bool AVLDupDeferDelete (
+  AVLDupDeferredChangesPointer ChangesPntr,
+  AVLDupThingConstPointer Key,
+  AVLDupThingConstPointer Value);
+
+bool AVLDupIterateDeferringChanges (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupDeferredIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+/* Iteration using several threads at once.  The callback gets called from
+all the threads, each with its own accumulator.  See AVLDupParallel.c. */
+
+typedef bool (* AVLDupParallelCallbackFunctionPointer) (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *AccumulatorPntr,
+  void *ExtraData);
+
+typedef void (* AVLDupParallelReduceFunctionPointer) (
+  void *AccumulatorPntr,
+  void *ExtraData);
+
+bool AVLDupParallelIterate (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupParallelCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData,
+  uint32 NumberOfThreads,
+  size_t AccumulatorSize,
+  AVLDupParallelReduceFunctionPointer ReduceFunctionPntr);
+
+/* Adding a big array of key/value pairs and freeing a big tree using several
+threads.  See AVLDupParallel.c. */
+
+bool AVLDupParallelAddArray (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyArray,
+  AVLDupThingPointer ValueArray,
+  uint32 NumberOfPairs,
+  uint32 NumberOfThreads);
+
+void AVLDupParallelFreeTree (
+  AVLDupTreePointer TreePntr,
+  uint32 NumberOfThreads,
+  bool WaitUntilDone);
+
+/* Looking up a batch of keys (or key/value pairs) at once, with the tree
+locked just once.  See AVLDupBatch.c. */
+
+bool AVLDupLookupBatch (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyArray,
+  AVLDupThingPointer ValueArray,
+  uint32 NumberOfKeys,
+  uint32 *CountArray);
+
+/* Saving a tree to a file and loading it back.  See AVLDupFile.c. */
+
+bool AVLDupSaveTree (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName);
+
+AVLDupTreePointer AVLDupLoadTree (
+  const char *FilePathName,
+  uint32 MaxSimultaneousReaders);
+
+bool AVLDupSaveTreeForMapping (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName);
+
+/* An optional write-ahead log of additions and deletions, so that changes
+survive a crash without saving the whole tree each time.  See AVLDupLog.c. */
+
+bool AVLDupAttachLog (
+  AVLDupTreePointer TreePntr,
+  const char *LogPathName);
+
+bool AVLDupDetachLog (AVLDupTreePointer TreePntr);
+
+bool AVLDupCheckpointTree (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName);
+
+/* A read-only tree which works directly on a memory mapped index file.  See
+AVLDupMappedTree.c.  The iteration arguments are the same as AVLDupIterate. */
+
+typedef struct AVLDupMappedTreeStruct
+  AVLDupMappedTreeRecord, *AVLDupMappedTreePointer;
+
+AVLDupMappedTreePointer AVLDupOpenMappedTree (const char *FilePathName);
+
+void AVLDupCloseMappedTree (AVLDupMappedTreePointer TreePntr);
+
+unsigned int AVLDupMappedGetTreeCount (AVLDupMappedTreePointer TreePntr);
+
+const char *AVLDupMappedGetTreeName (AVLDupMappedTreePointer TreePntr);
+
+bool AVLDupMappedIterate (
+  AVLDupMappedTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+/* A variant of the tree which allows many readers and writers to work on it
+at the same time, using fine grained locking rather than a single semaphore
+for the whole tree.  See AVLDupConcurrentTree.c for details.  The arguments
+and results are the same as for the corresponding regular tree functions. */
+
+typedef struct AVLDupConcurrentTreeStruct
+  AVLDupConcurrentTreeRecord, *AVLDupConcurrentTreePointer;
+
+AVLDupConcurrentTreePointer AVLDupConcurrentAllocTree (
+  type_code KeyType,
+  type_code ValueType,
+  const char *IndexName);
+
+void AVLDupConcurrentFreeTree (AVLDupConcurrentTreePointer TreePntr);
+
+unsigned int AVLDupConcurrentGetTreeCount (
+  AVLDupConcurrentTreePointer TreePntr);
+
+bool AVLDupConcurrentAdd (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+bool AVLDupConcurrentDelete (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+bool AVLDupConcurrentIterate (
+  AVLDupConcurrentTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+/* A variant of the tree for indices with lots of additions, which collects
+changes in a small tree and turns it into sorted arrays when it fills up,
+merging those in the background.  String keys in the sorted arrays are front
+coded, so keys with long common prefixes (like file paths) take up little
+memory.  See AVLDupLSMTree.c for details.  The arguments and results are
+the same as for the corresponding regular tree functions, other than
+MemtableSize (zero for the default). */
+
+typedef struct AVLDupLSMTreeStruct
+  AVLDupLSMTreeRecord, *AVLDupLSMTreePointer;
+
+AVLDupLSMTreePointer AVLDupLSMAllocTree (
+  type_code KeyType,
+  type_code ValueType,
+  const char *IndexName,
+  uint32 MaxSimultaneousReaders,
+  uint32 MemtableSize);
+
+void AVLDupLSMFreeTree (AVLDupLSMTreePointer TreePntr);
+
+bool AVLDupLSMAdd (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+bool AVLDupLSMDelete (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+bool AVLDupLSMIterate (
+  AVLDupLSMTreePointer TreePntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+/* Optional latency histograms for the basic operations, split into the time
+spent waiting for the tree lock and the time spent doing the work.  Times
+are in microseconds, in logarithmic buckets with 4 linear sub-buckets for
+each power of two, so a recorded time is within 25% of its true value.  See
+AVLDupLatency.c for details. */
+
+typedef enum AVLDupLatencyOperationEnum {
+  AVLDUP_LATENCY_ADD = 0,
+  AVLDUP_LATENCY_DELETE,
+  AVLDUP_LATENCY_ITERATE,
+  AVLDUP_LATENCY_OPERATIONS /* Number of operation types, keep it last. */
+} AVLDupLatencyOperation;
+
+#define AVLDUP_LATENCY_BUCKETS 160
+
+typedef struct AVLDupLatencyHistogramStruct
+{
+  uint32    counts [AVLDUP_LATENCY_BUCKETS];
+  uint64    totalCount;
+  bigtime_t totalTime;
+  bigtime_t maximumTime;
+} AVLDupLatencyHistogramRecord, *AVLDupLatencyHistogramPointer;
+
+typedef struct AVLDupLatencySnapshotStruct
+{
+  AVLDupLatencyHistogramRecord lockWait [AVLDUP_LATENCY_OPERATIONS];
+  AVLDupLatencyHistogramRecord work [AVLDUP_LATENCY_OPERATIONS];
+  bigtime_t startTime; /* When the histograms were last reset. */
+  bigtime_t endTime; /* When this snapshot was taken. */
+} AVLDupLatencySnapshotRecord, *AVLDupLatencySnapshotPointer;
+
+bool AVLDupEnableLatencyHistograms (
+  AVLDupTreePointer TreePntr,
+  bool Enable);
+
+bool AVLDupGetLatencySnapshot (
+  AVLDupTreePointer TreePntr,
+  AVLDupLatencySnapshotPointer SnapshotPntr,
+  bool ResetAfterwards);
+
+void AVLDupAddToLatencyHistogram (
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  bigtime_t Time);
+
+bigtime_t AVLDupLatencyPercentile (
+  AVLDupLatencyHistogramPointer HistogramPntr,
+  double Percentile);
+
+bool AVLDupPrintLatencySnapshot (
+  AVLDupLatencySnapshotPointer SnapshotPntr,
+  const char *IndexName,
+  bool AsJSON,
+  FILE *OutputFile);
+
+/* Optional profiling of the tree's access lock, showing how long readers and
+writers wait for each other and which operations hold the lock longest.
+Times are in microseconds.  See AVLDupContention.c for details. */
+
+#define AVLDUP_CONTENTION_HOLDERS 8
+
+typedef struct AVLDupLockWaitStatsStruct
+{
+  uint64    acquisitions;
+  uint64    contendedAcquisitions; /* Ones which had to wait. */
+  bigtime_t totalWaitTime;
+  bigtime_t maximumWaitTime;
+} AVLDupLockWaitStatsRecord, *AVLDupLockWaitStatsPointer;
+
+typedef struct AVLDupLockHolderStruct
+{
+  const char *operationName; /* Like "add" or "iterate". */
+  bool        isWriter;
+  bigtime_t   lockedTime; /* system_time() when it got the lock. */
+  bigtime_t   heldTime;
+  uint32      rangeSize; /* Items added, deleted or iterated over. */
+  int32       threadID;
+} AVLDupLockHolderRecord, *AVLDupLockHolderPointer;
+
+typedef struct AVLDupContentionSnapshotStruct
+{
+  AVLDupLockWaitStatsRecord readers;
+  AVLDupLockWaitStatsRecord writers;
+  bigtime_t starvationThreshold;
+  uint64    starvationEvents; /* Writer waits of at least the threshold. */
+  uint32    numberOfHolders;
+  AVLDupLockHolderRecord longestHolders [AVLDUP_CONTENTION_HOLDERS];
+  bigtime_t startTime; /* When the measurements were last reset. */
+  bigtime_t endTime; /* When this snapshot was taken. */
+} AVLDupContentionSnapshotRecord, *AVLDupContentionSnapshotPointer;
+
+bool AVLDupEnableContentionProfiling (
+  AVLDupTreePointer TreePntr,
+  bool Enable,
+  bigtime_t StarvationThreshold);
+
+bool AVLDupGetContentionSnapshot (
+  AVLDupTreePointer TreePntr,
+  AVLDupContentionSnapshotPointer SnapshotPntr,
+  bool ResetAfterwards);
+
+bool AVLDupPrintContentionSnapshot (
+  AVLDupContentionSnapshotPointer SnapshotPntr,
+  const char *IndexName,
+  bool AsJSON,
+  FILE *OutputFile);
+
+/* Recording every AVLDupAdd, AVLDupDelete and AVLDupIterate call on a tree to
+a compact binary trace file, so that real workloads can be replayed later
+(the benchmark program has a replay mode).  See AVLDupRecorder.c.  Reading a
+trace gives one AVLDupRecordedCallRecord per call, its strings stay valid
+until the next read. */
+
+typedef enum AVLDupRecordedOperationEnum {
+  AVLDUP_RECORDED_ADD = 1,
+  AVLDUP_RECORDED_DELETE,
+  AVLDUP_RECORDED_ITERATE
+} AVLDupRecordedOperation;
+
+typedef struct AVLDupRecordedCallStruct
+{
+  AVLDupRecordedOperation operation;
+  bool      existingPair; /* An addition describing the starting contents. */
+  int32     threadID;
+  bigtime_t time; /* When it got the tree lock, microseconds from the start. */
+  bool      hasKey; /* Additions and deletions always have a key and value. */
+  bool      hasValue;
+  bool      includeThingEqualToStart;
+  bool      hasEndKey;
+  bool      hasEndValue;
+  bool      includeThingEqualToEnd;
+  uint32    itemsIterated; /* Items passed to the callback. */
+  AVLDupThingRecord key; /* Or the starting key of an iteration. */
+  AVLDupThingRecord value;
+  AVLDupThingRecord endKey;
+  AVLDupThingRecord endValue;
+} AVLDupRecordedCallRecord, *AVLDupRecordedCallPointer;
+
+typedef struct AVLDupTraceReaderStruct
+  AVLDupTraceReaderRecord, *AVLDupTraceReaderPointer;
+
+bool AVLDupStartRecording (
+  AVLDupTreePointer TreePntr,
+  const char *TracePathName,
+  bool IncludeExistingPairs);
+
+bool AVLDupStopRecording (AVLDupTreePointer TreePntr);
+
+AVLDupTraceReaderPointer AVLDupOpenTrace (
+  const char *TracePathName,
+  type_code *KeyTypePntr,
+  type_code *ValueTypePntr);
+
+bool AVLDupReadTrace (
+  AVLDupTraceReaderPointer ReaderPntr,
+  AVLDupRecordedCallPointer CallPntr);
+
+void AVLDupCloseTrace (AVLDupTraceReaderPointer ReaderPntr);
+
 #ifdef __cplusplus
 }
 #endif
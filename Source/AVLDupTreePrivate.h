@@ -0,0 +1,546 @@
+/******************************************************************************
+ * AVLDupTreePrivate.h
+ *
+ * Internal declarations shared between the source files that make up the
+ * AVLDupTree library.  End users should only include AVLDupTree.h, the things
+ * in here can change at any time.
+ *
+ * See the AVLDupTree.c file for API descriptions, license, algorithm and
+ * contact details.  Copyright © 2001 by Alexander G. M. Smith.
+ */
+
+#ifndef _AVL_DUP_TREE_PRIVATE_H
+#define _AVL_DUP_TREE_PRIVATE_H 1
+
+#include <OS.h>
+
+#include "AVLDupTree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Comparison functions for the various different data types use this function
+prototype.  It returns A - B in effect, so the result is >0 for A > B,
+<0 for A < B and 0 for A == B. */
+
+typedef int (* AVLDupComparisonFunctionPointer) (
+  AVLDupThingPointer A, AVLDupThingPointer B);
+
+
+/* Static tracepoints for tracing tools like perf and bpftrace on Linux, using
+the <sys/sdt.h> macros from SystemTap.  Compile with AVLDUP_TRACEPOINTS
+defined to put them in, otherwise they turn into nothing.  Each one puts just
+a no-op instruction in the code, which the tracer patches when attached.
+The probes are in the "avldup" provider, with the double underscores in the
+names turning into dashes, like avldup:add-entry.  They are:
+
+  add__entry (tree), add__return (tree, 1 added, 0 already there, -1 no memory)
+  delete__entry (tree), delete__return (tree, 1 if deleted)
+  raise__left, raise__right (tree node which was pushed down, node raised)
+  lock__acquire (tree, is writer), lock__acquired (tree, is writer)
+  lock__release (tree, is writer)
+  iterate__start (tree), iterate__done (tree, items delivered, 1 if finished)
+
+The items delivered are counted whether or not AVLDUP_NO_STATISTICS is
+defined.  Only the locking which goes through AVLDupAcquireAccess has lock
+probes.  When tracepoints are turned off the macros are still statements,
+so they can be the body of an if or else. */
+
+#ifdef AVLDUP_TRACEPOINTS
+#include <sys/sdt.h>
+#define AVLDUP_TRACE1(Name, A) DTRACE_PROBE1 (avldup, Name, A)
+#define AVLDUP_TRACE2(Name, A, B) DTRACE_PROBE2 (avldup, Name, A, B)
+#define AVLDUP_TRACE3(Name, A, B, C) DTRACE_PROBE3 (avldup, Name, A, B, C)
+#else
+#define AVLDUP_TRACE1(Name, A) do {} while (0)
+#define AVLDUP_TRACE2(Name, A, B) do {} while (0)
+#define AVLDUP_TRACE3(Name, A, B, C) do {} while (0)
+#endif
+
+
+/* Counts of the work done by the tree operations, for AVLDupGetStats.  Each
+operation counts into its own copy (in the NonRecursiveArgumentsRecord) and
+adds them to the tree's totals with atomic adds once it is done, so that
+readers running in parallel don't fight over the cache line with the totals.
+Compile with AVLDUP_NO_STATISTICS defined to leave out the counting code.
+Either way AVLDUP_STATISTIC (...); is a single statement, like the ones used
+as the else part of the rotation choices when rebalancing. */
+
+#ifndef AVLDUP_NO_STATISTICS
+#define AVLDUP_STATISTIC(Statement) do { Statement; } while (0)
+#else
+#define AVLDUP_STATISTIC(Statement) do {} while (0)
+#endif
+
+typedef struct AVLDupOperationCountsStruct
+{
+  int64 adds;
+  int64 deletes;
+  int64 iterations;
+  int64 callbacks;
+  int64 keyComparisons;
+  int64 valueComparisons;
+  int64 singleRotations;
+  int64 doubleRotations;
+} AVLDupOperationCountsRecord, *AVLDupOperationCountsPointer;
+
+
+/* This structure is a node in the AVL tree.  The keys in the sub-tree at
+smallerChildPntr are all less than the node's key.  Keys in the sub-tree
+rooted at largerChildPntr are all larger than the node's key.  The height is
+the maximum of the height of the smaller and greater children, plus 1.  A node
+with no children has a height of 1, similarly a NULL pointer (empty tree) has a
+height of 0.  To keep the tree balanced, nodes are moved around so that the
+heights of the smaller and larger children differ by at most 1. */
+
+typedef struct AVLDupNodeStruct AVLDupNodeRecord, *AVLDupNodePointer;
+
+typedef struct AVLDupLogStruct AVLDupLogRecord, *AVLDupLogPointer;
+
+typedef struct AVLDupLatencyStruct
+  AVLDupLatencyRecord, *AVLDupLatencyPointer;
+
+typedef struct AVLDupContentionStruct
+  AVLDupContentionRecord, *AVLDupContentionPointer;
+
+typedef struct AVLDupRecorderStruct
+  AVLDupRecorderRecord, *AVLDupRecorderPointer;
+
+typedef struct AVLDupInternTableStruct
+  AVLDupInternTableRecord, *AVLDupInternTablePointer;
+
+struct AVLDupNodeStruct
+{
+  AVLDupThingRecord key;
+  AVLDupThingRecord value;
+  AVLDupNodePointer smallerChildPntr;
+  AVLDupNodePointer largerChildPntr;
+  unsigned int      height; /* Only needs to be uint8, rest is for padding. */
+};
+
+
+/* The header for the AVLDupTree itself.  Besides pointing out the root node,
+it contains auxiliary information needed for comparing the associated data
+types, for collecting statistics, multitasking access, and for doing pool
+memory allocation. */
+
+struct AVLDupTreeStruct
+{
+  char *indexName; /* Copy of the user's name for this index. */
+  type_code keyType;
+  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
+  type_code valueType;
+  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
+  AVLDupNodePointer rootPntr; /* Root node of the tree or NULL. */
+  unsigned int count; /* Counts user provided key/value pairs in tree. */
+  sem_id accessSemaphoreID; /* Negative if no semaphore is being used. */
+  uint32 maxSimultaneousReaders;
+  AVLDupLogPointer logPntr; /* Write-ahead log or NULL, see AVLDupLog.c. */
+  AVLDupOperationCountsRecord statistics; /* Totals, updated atomically. */
+  AVLDupLatencyPointer latencyPntr; /* NULL if never enabled. */
+  AVLDupContentionPointer contentionPntr; /* NULL if never enabled. */
+  AVLDupRecorderPointer recorderPntr; /* Operation trace or NULL. */
+  AVLDupCollation collation; /* Order of string keys, see AVLDupCollation.c. */
+  AVLDupInternTablePointer internTablePntr; /* Shared strings or NULL. */
+  bool internKeys; /* New long string keys get interned, see AVLDupIntern.c. */
+  bool internValues; /* Same for long string values. */
+  /* Future work: add a memory pool for nodes and another for strings. */
+};
+
+
+/* This structure is used for keeping common data around during recursive
+function calls.  It is faster than the simple technique of having a separate
+argument for everything the recursive function might need (like the key and
+value you are searching for) - only a single pointer to this structure is
+passed into the recursive routines rather than many parameters.  It's also
+safer than using global variables, which limit multitasking access to the tree
+to 1 thread at a time (so by having one of these structures allocated by each
+calling thread, you can have several tree searches going on in parallel). */
+
+typedef struct NonRecursiveArgumentsStruct
+{
+  AVLDupTreePointer treePntr; /* Tree being worked on, for node allocation. */
+  type_code keyType;
+  AVLDupComparisonFunctionPointer keyComparisonFunctionPntr;
+  AVLDupThingRecord userKey1;
+  AVLDupThingRecord userKey2;
+  type_code valueType;
+  AVLDupComparisonFunctionPointer valueComparisonFunctionPntr;
+  AVLDupThingRecord userValue1;
+  AVLDupThingRecord userValue2;
+  bool userValue1WasNULL;
+  bool userValue2WasNULL;
+  bool includeThingEqualToStart;
+  bool includeThingEqualToEnd;
+  AVLDupIterationCallbackFunctionPointer iterationCallback;
+  void *extraUserData;
+  AVLDupOperationCountsRecord counts; /* Work done by this operation. */
+  uint32 itemsDelivered; /* Callbacks made, even without statistics. */
+} NonRecursiveArgumentsRecord, *NonRecursiveArgumentsPointer;
+
+
+/* Finds a comparison function which is appropriate for the specified type of
+data.  Returns NULL if none exists. */
+
+AVLDupComparisonFunctionPointer AVLDupGetComparisonFunctionForType (
+  type_code ThingType);
+
+
+/* Collated string keys, see AVLDupCollation.c.  A key in a collated tree is
+always a long string with this value in its isLongString byte, and has its
+sort key stored after the string's NUL. */
+
+#define AVLDUP_COLLATED_STRING 2
+
+AVLDupComparisonFunctionPointer AVLDupGetComparisonFunctionForCollation (
+  AVLDupCollation CollationMode);
+
+AVLDupComparisonFunctionPointer AVLDupGetCollatedPrefixComparison (
+  AVLDupCollation CollationMode);
+
+bool AVLDupCollateThing (
+  AVLDupCollation CollationMode,
+  AVLDupThingPointer SourcePntr,
+  AVLDupThingPointer DestPntr);
+
+size_t AVLDupCollatedStringSize (AVLDupThingPointer ThingPntr);
+
+AVLDupThingPointer AVLDupCollateSearchKey (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer CollatedKeyPntr);
+
+
+/* Interned strings, see AVLDupIntern.c.  A string shared between entries of
+a tree has this value in its isLongString byte, and a reference count in a
+header in front of the string. */
+
+#define AVLDUP_INTERNED_STRING 3
+
+AVLDupInternTablePointer AVLDupAllocInternTable (void);
+
+void AVLDupFreeInternTable (AVLDupInternTablePointer TablePntr);
+
+bool AVLDupInternThing (
+  AVLDupInternTablePointer TablePntr,
+  AVLDupThingPointer SourcePntr,
+  AVLDupThingPointer DestPntr);
+
+AVLDupThingPointer AVLDupInternSearchThing (
+  AVLDupInternTablePointer TablePntr,
+  AVLDupThingPointer ThingPntr,
+  AVLDupThingPointer InternedThingPntr);
+
+void AVLDupReleaseInternedString (char *StringPntr);
+
+void AVLDupGetInternTableSizes (
+  AVLDupInternTablePointer TablePntr,
+  uint32 *NumberOfStringsPntr,
+  uint64 *StringBytesPntr,
+  uint64 *TableBytesPntr);
+
+
+/* Node allocation and bulk building internals from AVLDupTree.c. */
+
+AVLDupNodePointer AVLDupAllocateNode (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+void AVLDupDeallocateNode (
+  AVLDupTreePointer  TreePntr,
+  AVLDupNodePointer  CurrentNode);
+
+void AVLDupRecursiveDeallocateNodes (
+  AVLDupTreePointer  TreePntr,
+  AVLDupNodePointer  CurrentNode);
+
+int AVLDupCompareNodes (
+  AVLDupTreePointer TreePntr,
+  AVLDupNodePointer A,
+  AVLDupNodePointer B);
+
+void AVLDupFixupSubtrees (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer           *ParentNodePntrPntr);
+
+AVLDupNodePointer *AVLDupFlattenSubtree (
+  AVLDupNodePointer  CurrentNode,
+  AVLDupNodePointer *NodeArray);
+
+AVLDupNodePointer AVLDupBuildBalancedSubtree (
+  AVLDupNodePointer *SortedNodeArray,
+  uint32             NumberOfNodes);
+
+void AVLDupAddOperationCounts (
+  AVLDupTreePointer TreePntr,
+  AVLDupOperationCountsPointer CountsPntr);
+
+
+/* Adding and deleting without touching the access semaphore, for use by
+library functions which already hold the write lock.  See AVLDupTree.c. */
+
+typedef enum RecursiveAddNodeReturnCodesEnum {
+  RAN_OUT_OF_MEMORY = -1,
+  RAN_ALREADY_IN_TREE = 0,
+  RAN_ADDED_A_NODE = 1
+} RANReturnCode;
+
+RANReturnCode AVLDupAddWithoutLocking (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+bool AVLDupDeleteWithoutLocking (
+  AVLDupTreePointer  TreePntr,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+
+/* Range iteration internals from AVLDupTree.c, see there for details. */
+
+AVLDupThingPointer AVLDupPrepareSearchKey (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer PreparedKeyPntr);
+
+void AVLDupFreeSearchKey (
+  AVLDupTreePointer TreePntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer SearchKeyPntr);
+
+void AVLDupSetUpIterationArguments (
+  AVLDupTreePointer TreePntr,
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupThingPointer StartKeyPntr,
+  AVLDupThingPointer StartValuePntr,
+  bool IncludeThingEqualToStart,
+  AVLDupThingPointer EndKeyPntr,
+  AVLDupThingPointer EndValuePntr,
+  bool IncludeThingEqualToEnd,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData);
+
+void AVLDupCompareNodeWithBounds (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer CurrentNode,
+  bool TestLowerBound,
+  bool TestUpperBound,
+  int *ComparisonLowerPntr,
+  int *ComparisonUpperPntr);
+
+bool AVLDupRecursiveRangeIterate (
+  NonRecursiveArgumentsPointer ArgsPntr,
+  AVLDupNodePointer CurrentNode,
+  bool TestLowerBound,
+  bool TestUpperBound);
+
+/* The on-disk index file format, see AVLDupFile.c for details.  All numbers
+in the file are little endian.  The file starts with the header, followed by
+the index name (with a NUL at the end), then the string section holding the
+long strings (each with a NUL) and finally the key/value entries, sorted in
+ascending order or in Eytzinger order.  Each section starts on a multiple of
+8 bytes. */
+
+#define AVLDUP_FILE_MAGIC 0x444C5641 /* "AVLD" when read as bytes. */
+#define AVLDUP_FILE_VERSION 1
+
+/* Bits in the header flags.  With EYTZINGER_ORDER the entries are stored
+breadth first as an implicit binary tree rather than in sorted order, see
+AVLDupFirstEytzingerIndex in AVLDupFile.c. */
+
+#define AVLDUP_FILE_FLAG_EYTZINGER_ORDER 1
+
+typedef struct AVLDupFileHeaderStruct
+{
+  uint32 magic;
+  uint32 version;
+  uint32 flags; /* AVLDUP_FILE_FLAG_* bits. */
+  uint32 keyType;
+  uint32 valueType;
+  uint32 count; /* Number of key/value entries. */
+  uint32 nameLength; /* Length of the index name, not counting the NUL. */
+  uint32 collation; /* AVLDupCollation of the keys, zero in older files. */
+  uint64 stringsOffset; /* Position of the string section in the file. */
+  uint64 stringsSize;
+  uint64 entriesOffset; /* Position of the first key/value entry. */
+  uint64 fileSize;
+} AVLDupFileHeaderRecord, *AVLDupFileHeaderPointer;
+
+/* A thing as stored in the file, always 8 bytes.  Numbers are stored as is
+(floats and doubles by their bit patterns), int32s and floats in the first 4
+bytes.  Strings of up to 7 bytes are stored in place with byte 7 zero, longer
+ones have the offset of the string in the string section and byte 7 set to
+one. */
+
+typedef union AVLDupFileThingUnion
+{
+  uint32 int32Thing;
+  uint64 int64Thing;
+  char   shortStringThing [8];
+  struct FileLongStringStruct
+  {
+    uint32 stringOffset;
+    uint8  filler1;
+    uint8  filler2;
+    uint8  filler3;
+    uint8  isLongString;
+  } longStringThing;
+} AVLDupFileThingRecord, *AVLDupFileThingPointer;
+
+typedef struct AVLDupFileEntryStruct
+{
+  AVLDupFileThingRecord key;
+  AVLDupFileThingRecord value;
+} AVLDupFileEntryRecord, *AVLDupFileEntryPointer;
+
+bool AVLDupDecodeFileThing (
+  const AVLDupFileThingRecord *FileThingPntr,
+  type_code ThingType,
+  const char *StringsPntr,
+  uint64 StringsSize,
+  AVLDupThingPointer ThingPntr);
+
+bool AVLDupDecodeFileHeader (
+  const AVLDupFileHeaderRecord *FileHeaderPntr,
+  AVLDupFileHeaderPointer HeaderPntr);
+
+bool AVLDupSaveTreeWithoutLocking (
+  AVLDupTreePointer TreePntr,
+  const char *FilePathName);
+
+uint32 AVLDupFirstEytzingerIndex (uint32 Count);
+
+uint32 AVLDupNextEytzingerIndex (
+  uint32 Index,
+  uint32 Count);
+
+
+/* Write-ahead log internals from AVLDupLog.c.  Changes are appended with
+AVLDupLogChange while holding the tree's writer lock.  The writer notes the
+position with AVLDupLogGetAppendedPosition, releases the lock and then calls
+AVLDupLogWaitUntilDurable to wait for the group commit. */
+
+void AVLDupLogChange (
+  AVLDupLogPointer   LogPntr,
+  bool               IsAddition,
+  AVLDupThingPointer Key,
+  AVLDupThingPointer Value);
+
+int64 AVLDupLogGetAppendedPosition (AVLDupLogPointer LogPntr);
+
+bool AVLDupLogWaitUntilDurable (
+  AVLDupLogPointer LogPntr,
+  int64 Position);
+
+bool AVLDupLogClose (AVLDupLogPointer LogPntr);
+
+size_t AVLDupEncodedThingSize (
+  AVLDupThingConstPointer ThingPntr,
+  type_code Type);
+
+uint8 *AVLDupEncodeThing (
+  uint8 *DestPntr,
+  AVLDupThingConstPointer ThingPntr,
+  type_code Type);
+
+const uint8 *AVLDupDecodeThing (
+  const uint8 *SourcePntr,
+  const uint8 *EndPntr,
+  type_code Type,
+  char **StringBufferPntrPntr,
+  AVLDupThingPointer ThingPntr);
+
+
+/* Latency histogram internals from AVLDupLatency.c.  An operation calls
+AVLDupLatencyStart before trying to lock the tree, which returns NULL if
+timing isn't turned on, otherwise it notes the start time and returns the
+histograms to record into with AVLDupLatencyRecordTimes. */
+
+AVLDupLatencyPointer AVLDupLatencyStart (
+  AVLDupTreePointer TreePntr,
+  bigtime_t *StartTimePntr);
+
+void AVLDupLatencyRecordTimes (
+  AVLDupLatencyPointer LatencyPntr,
+  AVLDupLatencyOperation Operation,
+  bigtime_t StartTime,
+  bigtime_t LockedTime);
+
+void AVLDupPrintJSONString (
+  const char *StringPntr,
+  FILE *OutputFile);
+
+
+/* Profiled locking from AVLDupContention.c.  AVLDupAcquireAccess locks the
+tree for reading or writing (or does nothing if the tree has no semaphore)
+and fills in a AVLDupHeldLockRecord on the caller's stack, which gets passed
+to AVLDupReleaseAccess to unlock it again. */
+
+typedef struct AVLDupHeldLockStruct
+{
+  AVLDupContentionPointer contentionPntr; /* NULL if not being profiled. */
+  bigtime_t               lockedTime;
+  bool                    isWriter;
+} AVLDupHeldLockRecord, *AVLDupHeldLockPointer;
+
+status_t AVLDupAcquireAccess (
+  AVLDupTreePointer     TreePntr,
+  bool                  IsWriter,
+  AVLDupHeldLockPointer HeldPntr);
+
+void AVLDupReleaseAccess (
+  AVLDupTreePointer     TreePntr,
+  AVLDupHeldLockPointer HeldPntr,
+  const char           *OperationName,
+  uint32                RangeSize);
+
+void AVLDupFreeContention (AVLDupContentionPointer ContentionPntr);
+
+
+/* Operation trace recording from AVLDupRecorder.c.  The tree operations call
+these while still holding the tree lock (which keeps the recorder from being
+stopped underneath them), passing the time they got the lock. */
+
+void AVLDupRecordChange (
+  AVLDupRecorderPointer RecorderPntr,
+  bool                  IsAddition,
+  bigtime_t             LockedTime,
+  AVLDupThingPointer    Key,
+  AVLDupThingPointer    Value);
+
+void AVLDupRecordIteration (
+  AVLDupRecorderPointer RecorderPntr,
+  bigtime_t             LockedTime,
+  AVLDupThingPointer    StartKeyPntr,
+  AVLDupThingPointer    StartValuePntr,
+  bool                  IncludeThingEqualToStart,
+  AVLDupThingPointer    EndKeyPntr,
+  AVLDupThingPointer    EndValuePntr,
+  bool                  IncludeThingEqualToEnd,
+  uint32                ItemsIterated);
+
+bool AVLDupRecorderClose (AVLDupRecorderPointer RecorderPntr);
+
+
+/* Thread utilities from AVLDupParallel.c.  AVLDupRunWorkers calls the worker
+function once for each element of the worker data array, in parallel, and
+returns when they are all done. */
+
+typedef void (* AVLDupWorkerFunctionPointer) (void *WorkerData);
+
+uint32 AVLDupGetDefaultThreadCount (void);
+
+void AVLDupRunWorkers (
+  AVLDupWorkerFunctionPointer WorkerFunction,
+  void *WorkerDataArray,
+  size_t WorkerDataSize,
+  uint32 NumberOfWorkers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_DUP_TREE_PRIVATE_H */
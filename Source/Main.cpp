@@ -96,7 +96,8 @@
 
 /* Copies of the node and tree structure definitions, normally they are secret
 but we want to display the secret values and do our own traversal to help with
-the debugging.  So, if they get changed in AVLDupTree.c, change these too. */
+the debugging.  So, if they get changed in AVLDupTreePrivate.h, change these
+too. */
 
 typedef struct AVLDupNodeStruct AVLDupNodeRecord, *AVLDupNodePointer;
 
@@ -0,0 +1,2907 @@
+/******************************************************************************
+ * AVLDupTest.c
+ *
+ * A command line test program for the AVLDupTree library, mostly for the
+ * features that were added after the original tree: the concurrent and LSM
+ * trees, deferred changes, the parallel functions, saving, loading, mapping
+ * and logging, statistics, recording, batches, ranges, set operations,
+ * string searches, collation and interning.  The idea is to do the same
+ * things with the feature being tested and with a plain AVLDupTree (which
+ * has been in use for a long time and which the AGMSAVLTest program checks
+ * in detail), and compare the key/value pairs that come out of the two.  The
+ * pairs are turned into lines of text ("key", a tab and the value), which
+ * makes them easy to compare, sort and print when something goes wrong.
+ *
+ * The file tests also try damaged files: the saved file cut short at every
+ * interesting length, and with bytes changed all through it.  A damaged tree
+ * file should be turned down, or at least not crash anything or come up with
+ * a tree whose count disagrees with its contents.  A damaged log should give
+ * back the changes up to the damage and none after it.
+ *
+ * The tests using several threads at once (the concurrent tree, the
+ * parallel functions and the LSM tree with its merging thread) check that no
+ * changes get lost and that every iteration sees its pairs in order.  They
+ * can be run by themselves with --threads, which is what the "tsan-test"
+ * target in Makefile.linux does under GCC or Clang's thread sanitizer.  Use:
+ *
+ *	AVLDupTest [--threads] [ScratchDirectory]
+ *
+ * The scratch directory (default /tmp) gets the files the tests save, which
+ * are deleted afterwards.  It prints a line for each test and exits with 1
+ * if anything failed.  Everything uses fixed random number seeds, so a
+ * failure will happen again the same way on the next run.
+ *
+ * This program is released into the public domain, like AGMSAVLTest.
+ */
+
+#include <OS.h>
+#include <TypeConstants.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "AVLDupTree.h"
+
+
+/* Keys are made from numbers less than KEY_SPACE (see MakeKeyString), and
+values are numbers less than VALUE_SPACE, so there are plenty of duplicate
+keys and the occasional duplicate pair. */
+
+#define KEY_SPACE 400
+#define VALUE_SPACE 50
+
+/* Only the first few failures get described, after that they are just
+counted, so that one bug doesn't scroll everything else away. */
+
+#define MAX_FAILURES_PRINTED 25
+
+#define MAX_KEY_LENGTH 64
+#define MAX_WORKERS 40
+
+
+/* A list of key/value pairs as lines of text, "key<tab>value<newline>". */
+
+typedef struct ResultListStruct
+{
+  char   *textPntr; /* NUL terminated, NULL if nothing added yet. */
+  size_t  textLength;
+  size_t  textAllocated;
+  uint32  count;
+  uint32  stopAfter; /* Callbacks return FALSE after this many, 0 for never. */
+} ResultListRecord, *ResultListPointer;
+
+
+/* A randomly chosen range, with the things it points to. */
+
+typedef struct TestRangeStruct
+{
+  AVLDupRangeRecord range;
+  AVLDupThingRecord startKey;
+  AVLDupThingRecord startValue;
+  AVLDupThingRecord endKey;
+  AVLDupThingRecord endValue;
+} TestRangeRecord, *TestRangePointer;
+
+
+/* The threaded tests run the same worker threads on the concurrent and LSM
+trees, through these wrapper functions with a void pointer for the tree, a
+bit like the engines in the benchmark program. */
+
+typedef struct TreeFunctionsStruct
+{
+  bool (* addFunction) (void *TreePntr,
+    AVLDupThingPointer Key, AVLDupThingPointer Value);
+  bool (* deleteFunction) (void *TreePntr,
+    AVLDupThingPointer Key, AVLDupThingPointer Value);
+  bool (* iterateFunction) (void *TreePntr,
+    AVLDupRangePointer RangePntr,
+    AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+    void *ExtraUserData);
+} TreeFunctionsRecord, *TreeFunctionsPointer;
+
+
+/* Each worker thread changes only the pairs whose value is its own value,
+so it can tell exactly what its changes should do, even with other threads
+changing the same tree at the same time.  The plain reference tree gets the
+same changes, so at the end it should have the same contents. */
+
+typedef struct WorkerStruct
+{
+  TreeFunctionsPointer functionsPntr;
+  void                *treePntr;
+  AVLDupTreePointer    referenceTreePntr;
+  int32                ownValue;
+  uint32               seed;
+  uint32               operations; /* Changes, or iterations for readers. */
+  bool                 changeInCallback; /* Readers toggle their own pairs. */
+  uint32               errors; /* Results which disagree with the reference. */
+  uint32               outOfOrder; /* Iterated pairs not in ascending order. */
+  bool                 havePrevious;
+  char                 previousKey [MAX_KEY_LENGTH];
+  int32                previousValue;
+} WorkerRecord, *WorkerPointer;
+
+
+typedef struct TestStruct
+{
+  const char *name;
+  void (* testFunction) (void);
+  bool usesThreads; /* Run by --threads, under the thread sanitizer. */
+} TestRecord, *TestPointer;
+
+
+static uint32 g_Failures;
+static const char *g_ScratchDirectory = "/tmp";
+static AVLDupRangeRecord g_WholeTree; /* All NULL, no limits. */
+
+
+
+/******************************************************************************
+ * Checking results and keeping track of failures.
+ */
+
+/* Counts a failure and describes it (printf style) if Condition is FALSE.
+Returns Condition, so the test can give up on a hopeless case. */
+
+static bool Check (bool Condition, const char *FormatPntr, ...)
+{
+  va_list ArgumentList;
+
+  if (Condition)
+    return true;
+
+  g_Failures++;
+  if (g_Failures <= MAX_FAILURES_PRINTED)
+  {
+    printf ("\n  FAILED: ");
+    va_start (ArgumentList, FormatPntr);
+    vprintf (FormatPntr, ArgumentList);
+    va_end (ArgumentList);
+  }
+  return false;
+}
+
+
+
+/* A small, fast random number generator (xorshift), so that the tests come
+out the same on every system. */
+
+static uint32 RandomNumber (uint32 *SeedPntr)
+{
+  uint32 Number;
+
+  Number = *SeedPntr;
+  if (Number == 0)
+    Number = 0x12345678;
+  Number ^= Number << 13;
+  Number ^= Number >> 17;
+  Number ^= Number << 5;
+  *SeedPntr = Number;
+  return Number;
+}
+
+
+
+/* Makes the key string for a key number.  Every fourth one is a short string
+(stored inside the thing) and the rest are long file paths with a common
+prefix, and every seventh one has a capital letter in it, so that the
+collated orders differ from the binary one. */
+
+static void MakeKeyString (uint32 KeyNumber, char *BufferPntr)
+{
+  char *LetterPntr;
+
+  if (KeyNumber % 4 == 0)
+  {
+    sprintf (BufferPntr, "k%u", (unsigned int) KeyNumber);
+    LetterPntr = BufferPntr;
+  }
+  else
+  {
+    sprintf (BufferPntr, "/boot/home/config/settings/%c%05u",
+      'a' + (int) (KeyNumber % 26), (unsigned int) KeyNumber);
+    LetterPntr = strrchr (BufferPntr, '/') + 1;
+  }
+  if (KeyNumber % 7 == 0)
+    *LetterPntr = toupper (*LetterPntr);
+}
+
+
+
+static void SetKeyThing (AVLDupThingPointer ThingPntr, uint32 KeyNumber)
+{
+  char Buffer [MAX_KEY_LENGTH];
+
+  MakeKeyString (KeyNumber, Buffer);
+  ThingPntr->int64Thing = 0;
+  if (!AVLDupConvertStringToThing (Buffer, ThingPntr, B_STRING_TYPE))
+  {
+    fprintf (stderr, "Out of memory making a key.\n");
+    exit (2);
+  }
+}
+
+
+
+static void SetValueThing (AVLDupThingPointer ThingPntr, int32 Value)
+{
+  ThingPntr->int64Thing = 0;
+  ThingPntr->int32Thing = Value;
+}
+
+
+
+static void FreeKeyThing (AVLDupThingPointer ThingPntr)
+{
+  AVLDupFreeThingArray (ThingPntr, B_STRING_TYPE, 1);
+}
+
+
+
+/* Makes up a random range.  Usually both ends have a key, sometimes just a
+key without a value, occasionally no limit at all.  The keys are put in
+ascending binary order, so most ranges aren't empty (in a collated tree
+some will be). */
+
+static void MakeRandomRange (TestRangePointer TestRangePntr, uint32 *SeedPntr)
+{
+  AVLDupThingRecord TempThing;
+
+  memset (TestRangePntr, 0, sizeof (TestRangeRecord));
+  SetKeyThing (&TestRangePntr->startKey, RandomNumber (SeedPntr) % KEY_SPACE);
+  SetKeyThing (&TestRangePntr->endKey, RandomNumber (SeedPntr) % KEY_SPACE);
+  if (strcmp (AVLDupGetStringPntrFromThing (TestRangePntr->startKey),
+  AVLDupGetStringPntrFromThing (TestRangePntr->endKey)) > 0)
+  {
+    TempThing = TestRangePntr->startKey;
+    TestRangePntr->startKey = TestRangePntr->endKey;
+    TestRangePntr->endKey = TempThing;
+  }
+  SetValueThing (&TestRangePntr->startValue,
+    RandomNumber (SeedPntr) % VALUE_SPACE);
+  SetValueThing (&TestRangePntr->endValue,
+    RandomNumber (SeedPntr) % VALUE_SPACE);
+
+  if (RandomNumber (SeedPntr) % 8 != 0)
+  {
+    TestRangePntr->range.startKeyPntr = &TestRangePntr->startKey;
+    if (RandomNumber (SeedPntr) % 2 != 0)
+      TestRangePntr->range.startValuePntr = &TestRangePntr->startValue;
+  }
+  TestRangePntr->range.includeThingEqualToStart =
+    (RandomNumber (SeedPntr) % 2 != 0);
+
+  if (RandomNumber (SeedPntr) % 8 != 0)
+  {
+    TestRangePntr->range.endKeyPntr = &TestRangePntr->endKey;
+    if (RandomNumber (SeedPntr) % 2 != 0)
+      TestRangePntr->range.endValuePntr = &TestRangePntr->endValue;
+  }
+  TestRangePntr->range.includeThingEqualToEnd =
+    (RandomNumber (SeedPntr) % 2 != 0);
+}
+
+
+
+static void FreeTestRange (TestRangePointer TestRangePntr)
+{
+  FreeKeyThing (&TestRangePntr->startKey);
+  FreeKeyThing (&TestRangePntr->endKey);
+}
+
+
+
+/******************************************************************************
+ * Result lists.
+ */
+
+static void AppendText (ResultListPointer ListPntr, const char *TextPntr)
+{
+  size_t  Length;
+  size_t  NewSize;
+  char   *NewTextPntr;
+
+  Length = strlen (TextPntr);
+  if (ListPntr->textLength + Length + 1 > ListPntr->textAllocated)
+  {
+    NewSize = ListPntr->textAllocated * 2 + Length + 256;
+    NewTextPntr = realloc (ListPntr->textPntr, NewSize);
+    if (NewTextPntr == NULL)
+    {
+      fprintf (stderr, "Out of memory for a result list.\n");
+      exit (2);
+    }
+    ListPntr->textPntr = NewTextPntr;
+    ListPntr->textAllocated = NewSize;
+  }
+  memcpy (ListPntr->textPntr + ListPntr->textLength, TextPntr, Length + 1);
+  ListPntr->textLength += Length;
+}
+
+
+
+static void AppendPair (
+  ResultListPointer ListPntr,
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr)
+{
+  char Line [MAX_KEY_LENGTH + 32];
+
+  snprintf (Line, sizeof (Line), "%s\t%ld\n",
+    AVLDupGetStringPntrFromThing (*KeyPntr), (long) ValuePntr->int32Thing);
+  AppendText (ListPntr, Line);
+  ListPntr->count++;
+}
+
+
+
+static const char *ResultText (ResultListPointer ListPntr)
+{
+  return (ListPntr->textPntr == NULL) ? "" : ListPntr->textPntr;
+}
+
+
+
+static void EmptyResultList (ResultListPointer ListPntr)
+{
+  if (ListPntr->textPntr != NULL)
+    free (ListPntr->textPntr);
+  memset (ListPntr, 0, sizeof (ResultListRecord));
+}
+
+
+
+/* The iteration callback for collecting pairs in a result list. */
+
+static bool CollectCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  ResultListPointer ListPntr = ExtraData;
+
+  AppendPair (ListPntr, KeyPntr, ValuePntr);
+  return (ListPntr->stopAfter == 0 || ListPntr->count < ListPntr->stopAfter);
+}
+
+
+
+static int CompareLines (const void *APntr, const void *BPntr)
+{
+  return strcmp (*(char * const *) APntr, *(char * const *) BPntr);
+}
+
+
+
+/* Sorts the lines of a result list in binary order, for comparing results
+which come out in no particular order (parallel iteration) or in an order
+which is hard to predict (reversed pattern searches). */
+
+static void SortResultList (ResultListPointer ListPntr)
+{
+  uint32             i;
+  char              *LinePntr;
+  char             **LinesArray;
+  ResultListRecord   SortedList;
+
+  if (ListPntr->count < 2)
+    return;
+  LinesArray = malloc (ListPntr->count * sizeof (char *));
+  if (LinesArray == NULL)
+  {
+    fprintf (stderr, "Out of memory sorting a result list.\n");
+    exit (2);
+  }
+
+  LinePntr = ListPntr->textPntr;
+  for (i = 0; i < ListPntr->count; i++)
+  {
+    LinesArray[i] = LinePntr;
+    LinePntr = strchr (LinePntr, '\n');
+    *LinePntr++ = 0;
+  }
+  qsort (LinesArray, ListPntr->count, sizeof (char *), CompareLines);
+
+  memset (&SortedList, 0, sizeof (SortedList));
+  for (i = 0; i < ListPntr->count; i++)
+  {
+    AppendText (&SortedList, LinesArray[i]);
+    AppendText (&SortedList, "\n");
+  }
+  SortedList.count = ListPntr->count;
+  SortedList.stopAfter = ListPntr->stopAfter;
+  free (LinesArray);
+  EmptyResultList (ListPntr);
+  *ListPntr = SortedList;
+}
+
+
+
+/* Gets the key and value from the next line of a result list, advancing the
+cursor.  Returns FALSE at the end of the list. */
+
+static bool ReadResultLine (
+  const char **CursorPntr,
+  char *KeyBuffer,
+  int32 *ValuePntr)
+{
+  const char *TabPntr;
+  size_t      Length;
+
+  if (**CursorPntr == 0)
+    return false;
+  TabPntr = strchr (*CursorPntr, '\t');
+  Length = TabPntr - *CursorPntr;
+  if (Length >= MAX_KEY_LENGTH)
+    Length = MAX_KEY_LENGTH - 1;
+  memcpy (KeyBuffer, *CursorPntr, Length);
+  KeyBuffer[Length] = 0;
+  *ValuePntr = atol (TabPntr + 1);
+  *CursorPntr = strchr (TabPntr, '\n') + 1;
+  return true;
+}
+
+
+
+/* Compares the expected and actual results, describing the first
+difference if there is one. */
+
+static bool SameResults (
+  const char *Description,
+  ResultListPointer ExpectedPntr,
+  ResultListPointer ActualPntr)
+{
+  const char *ActualTextPntr;
+  const char *EndPntr;
+  const char *ExpectedTextPntr;
+  int         Length;
+  uint32      LineNumber;
+
+  ExpectedTextPntr = ResultText (ExpectedPntr);
+  ActualTextPntr = ResultText (ActualPntr);
+  if (ExpectedPntr->count == ActualPntr->count &&
+  strcmp (ExpectedTextPntr, ActualTextPntr) == 0)
+    return true;
+
+  /* Find the first line that differs. */
+
+  LineNumber = 0;
+  while (*ExpectedTextPntr != 0 && *ExpectedTextPntr == *ActualTextPntr)
+  {
+    if (*ExpectedTextPntr == '\n')
+      LineNumber++;
+    ExpectedTextPntr++;
+    ActualTextPntr++;
+  }
+  while (LineNumber > 0 && ExpectedTextPntr[-1] != '\n')
+  {
+    ExpectedTextPntr--;
+    ActualTextPntr--;
+  }
+  while (LineNumber == 0 && ExpectedTextPntr != ResultText (ExpectedPntr) &&
+  ExpectedTextPntr[-1] != '\n')
+  {
+    ExpectedTextPntr--;
+    ActualTextPntr--;
+  }
+
+  EndPntr = strchr (ExpectedTextPntr, '\n');
+  Length = (EndPntr == NULL) ? (int) strlen (ExpectedTextPntr) :
+    (int) (EndPntr - ExpectedTextPntr);
+  Check (false, "%s: expected %lu pairs, got %lu.  "
+    "First difference at pair %lu, expected \"%.*s\"",
+    Description, (unsigned long) ExpectedPntr->count,
+    (unsigned long) ActualPntr->count, (unsigned long) LineNumber,
+    Length, ExpectedTextPntr);
+  EndPntr = strchr (ActualTextPntr, '\n');
+  Length = (EndPntr == NULL) ? (int) strlen (ActualTextPntr) :
+    (int) (EndPntr - ActualTextPntr);
+  if (g_Failures <= MAX_FAILURES_PRINTED)
+    printf (", got \"%.*s\".", Length, ActualTextPntr);
+  return false;
+}
+
+
+
+/******************************************************************************
+ * Helpers for the plain tree and for files.
+ */
+
+static AVLDupTreePointer AllocReferenceTree (void)
+{
+  AVLDupTreePointer TreePntr;
+
+  /* Readers allowed, so that the tree has a lock and the threaded tests can
+  change it from several threads. */
+
+  TreePntr = AVLDupAllocTree (B_STRING_TYPE, B_INT32_TYPE, "Reference", 10);
+  if (TreePntr == NULL)
+  {
+    fprintf (stderr, "Unable to allocate a tree.\n");
+    exit (2);
+  }
+  return TreePntr;
+}
+
+
+
+static void IterateTree (
+  AVLDupTreePointer TreePntr,
+  AVLDupRangePointer RangePntr,
+  ResultListPointer ListPntr)
+{
+  AVLDupIterate (TreePntr,
+    RangePntr->startKeyPntr, RangePntr->startValuePntr,
+    RangePntr->includeThingEqualToStart,
+    RangePntr->endKeyPntr, RangePntr->endValuePntr,
+    RangePntr->includeThingEqualToEnd,
+    CollectCallback, ListPntr);
+}
+
+
+
+/* Adds some random pairs to a tree and to its reference tree (which can be
+NULL). */
+
+static void AddRandomPairs (
+  AVLDupTreePointer TreePntr,
+  AVLDupTreePointer ReferenceTreePntr,
+  uint32 NumberOfPairs,
+  uint32 *SeedPntr)
+{
+  uint32            i;
+  AVLDupThingRecord Key;
+  AVLDupThingRecord Value;
+
+  for (i = 0; i < NumberOfPairs; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (SeedPntr) % KEY_SPACE);
+    SetValueThing (&Value, RandomNumber (SeedPntr) % VALUE_SPACE);
+    Check (AVLDupAdd (TreePntr, &Key, &Value), "adding pair %lu",
+      (unsigned long) i);
+    if (ReferenceTreePntr != NULL)
+      AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+}
+
+
+
+/* Checks that two plain trees have the same pairs, in full and in some
+random ranges. */
+
+static bool SameTrees (
+  const char *Description,
+  AVLDupTreePointer ExpectedTreePntr,
+  AVLDupTreePointer ActualTreePntr,
+  uint32 NumberOfRanges,
+  uint32 *SeedPntr)
+{
+  ResultListRecord Actual;
+  ResultListRecord Expected;
+  uint32           i;
+  bool             Same;
+  TestRangeRecord  TestRange;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  IterateTree (ExpectedTreePntr, &g_WholeTree, &Expected);
+  IterateTree (ActualTreePntr, &g_WholeTree, &Actual);
+  Same = SameResults (Description, &Expected, &Actual);
+  Same = Check (AVLDupGetTreeCount (ActualTreePntr) == Expected.count,
+    "%s: tree count %u, should be %lu", Description,
+    AVLDupGetTreeCount (ActualTreePntr), (unsigned long) Expected.count) &&
+    Same;
+
+  for (i = 0; Same && i < NumberOfRanges; i++)
+  {
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    MakeRandomRange (&TestRange, SeedPntr);
+    IterateTree (ExpectedTreePntr, &TestRange.range, &Expected);
+    IterateTree (ActualTreePntr, &TestRange.range, &Actual);
+    Same = SameResults (Description, &Expected, &Actual);
+    FreeTestRange (&TestRange);
+  }
+
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  return Same;
+}
+
+
+
+static void MakeScratchPath (const char *FileName, char *PathBuffer)
+{
+  snprintf (PathBuffer, PATH_MAX, "%s/AVLDupTest-%s", g_ScratchDirectory,
+    FileName);
+}
+
+
+
+/* Reads a whole file into a newly allocated buffer, NULL if it can't. */
+
+static unsigned char *ReadWholeFile (const char *PathName, size_t *SizePntr)
+{
+  unsigned char *BufferPntr;
+  FILE          *FilePntr;
+  long           Size;
+
+  BufferPntr = NULL;
+  FilePntr = fopen (PathName, "rb");
+  if (FilePntr == NULL)
+    return NULL;
+  if (fseek (FilePntr, 0, SEEK_END) != 0 || (Size = ftell (FilePntr)) < 0 ||
+  fseek (FilePntr, 0, SEEK_SET) != 0)
+    goto ErrorExit;
+  BufferPntr = malloc (Size + 1);
+  if (BufferPntr == NULL)
+    goto ErrorExit;
+  if (fread (BufferPntr, 1, Size, FilePntr) != (size_t) Size)
+  {
+    free (BufferPntr);
+    BufferPntr = NULL;
+    goto ErrorExit;
+  }
+  *SizePntr = Size;
+
+ErrorExit:
+  fclose (FilePntr);
+  return BufferPntr;
+}
+
+
+
+static bool WriteWholeFile (
+  const char *PathName,
+  const unsigned char *BufferPntr,
+  size_t Size)
+{
+  FILE *FilePntr;
+  bool  ReturnCode;
+
+  FilePntr = fopen (PathName, "wb");
+  if (FilePntr == NULL)
+    return false;
+  ReturnCode = (fwrite (BufferPntr, 1, Size, FilePntr) == Size);
+  if (fclose (FilePntr) != 0)
+    ReturnCode = false;
+  return ReturnCode;
+}
+
+
+
+/* The lengths and positions to try when damaging a file: every one near the
+start (where the headers are), then evenly spaced ones through the rest, and
+every one near the end. */
+
+static size_t NextDamagePosition (size_t Position, size_t Size)
+{
+  size_t Step;
+
+  if (Position < 80 || Position + 8 >= Size)
+    return Position + 1;
+  Step = Size / 150 + 1;
+  if (Position + Step + 8 >= Size)
+    return Size - 8;
+  return Position + Step;
+}
+
+
+
+/******************************************************************************
+ * The worker threads, for the concurrent and LSM trees.
+ */
+
+static bool ConcurrentAdd (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupConcurrentAdd (TreePntr, Key, Value);
+}
+
+
+
+static bool ConcurrentDelete (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupConcurrentDelete (TreePntr, Key, Value);
+}
+
+
+
+static bool ConcurrentIterate (void *TreePntr,
+  AVLDupRangePointer RangePntr,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  return AVLDupConcurrentIterate (TreePntr,
+    RangePntr->startKeyPntr, RangePntr->startValuePntr,
+    RangePntr->includeThingEqualToStart,
+    RangePntr->endKeyPntr, RangePntr->endValuePntr,
+    RangePntr->includeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+
+static bool LSMAdd (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupLSMAdd (TreePntr, Key, Value);
+}
+
+
+
+static bool LSMDelete (void *TreePntr,
+  AVLDupThingPointer Key, AVLDupThingPointer Value)
+{
+  return AVLDupLSMDelete (TreePntr, Key, Value);
+}
+
+
+
+static bool LSMIterate (void *TreePntr,
+  AVLDupRangePointer RangePntr,
+  AVLDupIterationCallbackFunctionPointer CallbackFunctionPntr,
+  void *ExtraUserData)
+{
+  return AVLDupLSMIterate (TreePntr,
+    RangePntr->startKeyPntr, RangePntr->startValuePntr,
+    RangePntr->includeThingEqualToStart,
+    RangePntr->endKeyPntr, RangePntr->endValuePntr,
+    RangePntr->includeThingEqualToEnd,
+    CallbackFunctionPntr, ExtraUserData);
+}
+
+
+
+static TreeFunctionsRecord g_ConcurrentFunctions =
+  {ConcurrentAdd, ConcurrentDelete, ConcurrentIterate};
+
+static TreeFunctionsRecord g_LSMFunctions =
+  {LSMAdd, LSMDelete, LSMIterate};
+
+
+
+/* Adds the pair if it isn't there, deletes it if it is, and does the same to
+the reference tree, which should agree about whether it was there. */
+
+static void TogglePair (
+  WorkerPointer WorkerPntr,
+  AVLDupThingPointer KeyPntr,
+  AVLDupThingPointer ValuePntr)
+{
+  bool WasThere;
+
+  WasThere = WorkerPntr->functionsPntr->deleteFunction (WorkerPntr->treePntr,
+    KeyPntr, ValuePntr);
+  if (AVLDupDelete (WorkerPntr->referenceTreePntr, KeyPntr, ValuePntr) !=
+  WasThere)
+    WorkerPntr->errors++;
+  if (!WasThere)
+  {
+    if (!WorkerPntr->functionsPntr->addFunction (WorkerPntr->treePntr,
+    KeyPntr, ValuePntr))
+      WorkerPntr->errors++;
+    AVLDupAdd (WorkerPntr->referenceTreePntr, KeyPntr, ValuePntr);
+  }
+}
+
+
+
+/* Checks that the pairs come in ascending order, and sometimes toggles the
+worker's own pair for the key being visited, which can delete or add a node
+right where the iteration is. */
+
+static bool OrderCheckCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *ExtraData)
+{
+  int               Comparison;
+  AVLDupThingRecord Key;
+  const char       *KeyStringPntr;
+  AVLDupThingRecord Value;
+  WorkerPointer     WorkerPntr = ExtraData;
+
+  KeyStringPntr = AVLDupGetStringPntrFromThing (*KeyPntr);
+  if (WorkerPntr->havePrevious)
+  {
+    Comparison = strcmp (WorkerPntr->previousKey, KeyStringPntr);
+    if (Comparison > 0 ||
+    (Comparison == 0 && WorkerPntr->previousValue >= ValuePntr->int32Thing))
+      WorkerPntr->outOfOrder++;
+  }
+  strncpy (WorkerPntr->previousKey, KeyStringPntr, MAX_KEY_LENGTH - 1);
+  WorkerPntr->previousKey[MAX_KEY_LENGTH - 1] = 0;
+  WorkerPntr->previousValue = ValuePntr->int32Thing;
+  WorkerPntr->havePrevious = true;
+
+  if (WorkerPntr->changeInCallback && RandomNumber (&WorkerPntr->seed) % 8 == 0)
+  {
+    Key.int64Thing = 0;
+    AVLDupConvertStringToThing (KeyStringPntr, &Key, B_STRING_TYPE);
+    SetValueThing (&Value, WorkerPntr->ownValue);
+    TogglePair (WorkerPntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+  return true;
+}
+
+
+
+static int32 WriterThread (void *DataPntr)
+{
+  uint32            i;
+  AVLDupThingRecord Key;
+  AVLDupThingRecord Value;
+  WorkerPointer     WorkerPntr = DataPntr;
+
+  SetValueThing (&Value, WorkerPntr->ownValue);
+  for (i = 0; i < WorkerPntr->operations; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&WorkerPntr->seed) % KEY_SPACE);
+    TogglePair (WorkerPntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+  return 0;
+}
+
+
+
+static int32 ReaderThread (void *DataPntr)
+{
+  uint32          i;
+  TestRangeRecord TestRange;
+  WorkerPointer   WorkerPntr = DataPntr;
+
+  for (i = 0; i < WorkerPntr->operations; i++)
+  {
+    MakeRandomRange (&TestRange, &WorkerPntr->seed);
+    WorkerPntr->havePrevious = false;
+    if (!WorkerPntr->functionsPntr->iterateFunction (WorkerPntr->treePntr,
+    &TestRange.range, OrderCheckCallback, WorkerPntr))
+      WorkerPntr->errors++;
+    FreeTestRange (&TestRange);
+  }
+  return 0;
+}
+
+
+
+/* Runs some writer and reader threads on a tree at the same time, then
+checks what they found.  Writers have values 0 and up, readers have values
+VALUE_SPACE and up (so they don't disturb the writers' pairs). */
+
+static void RunWorkers (
+  TreeFunctionsPointer FunctionsPntr,
+  void *TreePntr,
+  AVLDupTreePointer ReferenceTreePntr,
+  uint32 NumberOfWriters,
+  uint32 NumberOfReaders,
+  uint32 WriterOperations,
+  uint32 ReaderOperations,
+  bool ChangeInCallback)
+{
+  status_t      ExitValue;
+  uint32        i;
+  uint32        NumberOfWorkers;
+  thread_id     ThreadIDs [MAX_WORKERS];
+  WorkerRecord  Workers [MAX_WORKERS];
+
+  NumberOfWorkers = NumberOfWriters + NumberOfReaders;
+  memset (Workers, 0, sizeof (Workers));
+  for (i = 0; i < NumberOfWorkers; i++)
+  {
+    Workers[i].functionsPntr = FunctionsPntr;
+    Workers[i].treePntr = TreePntr;
+    Workers[i].referenceTreePntr = ReferenceTreePntr;
+    Workers[i].seed = 1000 + i;
+    if (i < NumberOfWriters)
+    {
+      Workers[i].ownValue = i;
+      Workers[i].operations = WriterOperations;
+      ThreadIDs[i] = spawn_thread (WriterThread, "Writer",
+        B_NORMAL_PRIORITY, &Workers[i]);
+    }
+    else
+    {
+      Workers[i].ownValue = VALUE_SPACE + i;
+      Workers[i].operations = ReaderOperations;
+      Workers[i].changeInCallback = ChangeInCallback;
+      ThreadIDs[i] = spawn_thread (ReaderThread, "Reader",
+        B_NORMAL_PRIORITY, &Workers[i]);
+    }
+    if (!Check (ThreadIDs[i] >= 0, "starting worker thread %lu",
+    (unsigned long) i))
+    {
+      NumberOfWorkers = i;
+      break;
+    }
+    resume_thread (ThreadIDs[i]);
+  }
+
+  for (i = 0; i < NumberOfWorkers; i++)
+  {
+    wait_for_thread (ThreadIDs[i], &ExitValue);
+    Check (Workers[i].errors == 0,
+      "worker %lu had %lu results disagreeing with the plain tree",
+      (unsigned long) i, (unsigned long) Workers[i].errors);
+    Check (Workers[i].outOfOrder == 0,
+      "worker %lu saw %lu pairs out of order",
+      (unsigned long) i, (unsigned long) Workers[i].outOfOrder);
+  }
+}
+
+
+
+/******************************************************************************
+ * The tests, in the order the features were added.
+ */
+
+/* The concurrent tree, by itself and then with lots of threads. */
+
+static void TestConcurrentTree (void)
+{
+  ResultListRecord            Actual;
+  AVLDupConcurrentTreePointer ConcurrentTreePntr;
+  ResultListRecord            Expected;
+  uint32                      i;
+  AVLDupThingRecord           Key;
+  AVLDupTreePointer           ReferenceTreePntr;
+  uint32                      Seed = 26;
+  TestRangeRecord             TestRange;
+  AVLDupThingRecord           Value;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  ReferenceTreePntr = AllocReferenceTree ();
+  ConcurrentTreePntr =
+    AVLDupConcurrentAllocTree (B_STRING_TYPE, B_INT32_TYPE, "Concurrent");
+  if (!Check (ConcurrentTreePntr != NULL, "allocating the concurrent tree"))
+    goto ErrorExit;
+
+  for (i = 0; i < 20000; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&Value, RandomNumber (&Seed) % VALUE_SPACE);
+    if (RandomNumber (&Seed) % 3 != 0)
+    {
+      Check (AVLDupConcurrentAdd (ConcurrentTreePntr, &Key, &Value),
+        "adding pair %lu", (unsigned long) i);
+      AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+    }
+    else
+      Check (AVLDupConcurrentDelete (ConcurrentTreePntr, &Key, &Value) ==
+        AVLDupDelete (ReferenceTreePntr, &Key, &Value),
+        "deleting pair %lu disagrees with the plain tree", (unsigned long) i);
+    FreeKeyThing (&Key);
+  }
+
+  IterateTree (ReferenceTreePntr, &g_WholeTree, &Expected);
+  ConcurrentIterate (ConcurrentTreePntr, &g_WholeTree, CollectCallback,
+    &Actual);
+  SameResults ("whole concurrent tree", &Expected, &Actual);
+  Check (AVLDupConcurrentGetTreeCount (ConcurrentTreePntr) == Expected.count,
+    "concurrent tree count %u, should be %lu",
+    AVLDupConcurrentGetTreeCount (ConcurrentTreePntr),
+    (unsigned long) Expected.count);
+
+  for (i = 0; i < 100; i++)
+  {
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    MakeRandomRange (&TestRange, &Seed);
+    Actual.stopAfter = Expected.stopAfter = (i % 10 == 0) ? 7 : 0;
+    IterateTree (ReferenceTreePntr, &TestRange.range, &Expected);
+    ConcurrentIterate (ConcurrentTreePntr, &TestRange.range, CollectCallback,
+      &Actual);
+    SameResults ("concurrent tree range", &Expected, &Actual);
+    FreeTestRange (&TestRange);
+  }
+
+ErrorExit:
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  if (ConcurrentTreePntr != NULL)
+    AVLDupConcurrentFreeTree (ConcurrentTreePntr);
+  AVLDupFreeTree (ReferenceTreePntr);
+}
+
+
+
+/* More readers than there are epoch slots to spare, so some iterations hold
+their slots and others let go after each pair, all toggling pairs from
+inside their callbacks while writers change the tree. */
+
+static void TestConcurrentTreeThreads (void)
+{
+  ResultListRecord            Actual;
+  AVLDupConcurrentTreePointer ConcurrentTreePntr;
+  ResultListRecord            Expected;
+  uint32                      i;
+  AVLDupThingRecord           Key;
+  AVLDupTreePointer           ReferenceTreePntr;
+  uint32                      Seed = 126;
+  AVLDupThingRecord           Value;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  ReferenceTreePntr = AllocReferenceTree ();
+  ConcurrentTreePntr =
+    AVLDupConcurrentAllocTree (B_STRING_TYPE, B_INT32_TYPE, "Concurrent");
+  if (!Check (ConcurrentTreePntr != NULL, "allocating the concurrent tree"))
+    goto ErrorExit;
+
+  /* Start with some pairs the workers won't touch. */
+
+  for (i = 0; i < 2000; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&Value, 10 + RandomNumber (&Seed) % (VALUE_SPACE - 10));
+    AVLDupConcurrentAdd (ConcurrentTreePntr, &Key, &Value);
+    AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+
+  RunWorkers (&g_ConcurrentFunctions, ConcurrentTreePntr, ReferenceTreePntr,
+    4, MAX_WORKERS - 4, 3000, 10, true);
+
+  IterateTree (ReferenceTreePntr, &g_WholeTree, &Expected);
+  ConcurrentIterate (ConcurrentTreePntr, &g_WholeTree, CollectCallback,
+    &Actual);
+  SameResults ("concurrent tree after the threads", &Expected, &Actual);
+  Check (AVLDupConcurrentGetTreeCount (ConcurrentTreePntr) == Expected.count,
+    "concurrent tree count %u, should be %lu",
+    AVLDupConcurrentGetTreeCount (ConcurrentTreePntr),
+    (unsigned long) Expected.count);
+
+ErrorExit:
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  if (ConcurrentTreePntr != NULL)
+    AVLDupConcurrentFreeTree (ConcurrentTreePntr);
+  AVLDupFreeTree (ReferenceTreePntr);
+}
+
+
+
+/* Deferred changes.  Each round deletes the odd values it sees and adds a
+new value (one not in the tree yet) for the ones divisible by three, so the
+result doesn't depend on the order the changes are done in. */
+
+typedef struct DeferredRoundStruct
+{
+  ResultListRecord seen;
+  int32            round;
+} DeferredRoundRecord, *DeferredRoundPointer;
+
+static bool DeferringCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  AVLDupDeferredChangesPointer ChangesPntr,
+  void *ExtraData)
+{
+  AVLDupThingRecord    NewValue;
+  DeferredRoundPointer RoundPntr = ExtraData;
+
+  AppendPair (&RoundPntr->seen, KeyPntr, ValuePntr);
+  if (ValuePntr->int32Thing % 2 != 0)
+    Check (AVLDupDeferDelete (ChangesPntr, KeyPntr, ValuePntr),
+      "deferring a deletion");
+  if (ValuePntr->int32Thing < VALUE_SPACE && ValuePntr->int32Thing % 3 == 0)
+  {
+    SetValueThing (&NewValue,
+      ValuePntr->int32Thing + VALUE_SPACE * (RoundPntr->round + 1));
+    Check (AVLDupDeferAdd (ChangesPntr, KeyPntr, &NewValue),
+      "deferring an addition");
+  }
+  return true;
+}
+
+
+
+static void TestDeferredChanges (void)
+{
+  const char         *CursorPntr;
+  ResultListRecord    Expected;
+  AVLDupThingRecord   Key;
+  char                KeyString [MAX_KEY_LENGTH];
+  AVLDupTreePointer   ReferenceTreePntr;
+  DeferredRoundRecord Round;
+  uint32              Seed = 27;
+  TestRangeRecord     TestRange;
+  AVLDupTreePointer   TreePntr;
+  AVLDupThingRecord   Value;
+  int32               ValueNumber;
+
+  memset (&Expected, 0, sizeof (Expected));
+  memset (&Round, 0, sizeof (Round));
+  ReferenceTreePntr = AllocReferenceTree ();
+  TreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, ReferenceTreePntr, 3000, &Seed);
+
+  for (Round.round = 0; Round.round < 6; Round.round++)
+  {
+    MakeRandomRange (&TestRange, &Seed);
+    EmptyResultList (&Round.seen);
+    Check (AVLDupIterateDeferringChanges (TreePntr,
+      TestRange.range.startKeyPntr, TestRange.range.startValuePntr,
+      TestRange.range.includeThingEqualToStart,
+      TestRange.range.endKeyPntr, TestRange.range.endValuePntr,
+      TestRange.range.includeThingEqualToEnd,
+      DeferringCallback, &Round), "iterating with deferred changes");
+
+    /* The iteration should see the tree as it was before the changes, then
+    the same changes get done to the reference tree one at a time. */
+
+    EmptyResultList (&Expected);
+    IterateTree (ReferenceTreePntr, &TestRange.range, &Expected);
+    SameResults ("pairs seen while deferring changes", &Expected,
+      &Round.seen);
+    CursorPntr = ResultText (&Expected);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+    {
+      Key.int64Thing = 0;
+      AVLDupConvertStringToThing (KeyString, &Key, B_STRING_TYPE);
+      SetValueThing (&Value, ValueNumber);
+      if (ValueNumber % 2 != 0)
+        AVLDupDelete (ReferenceTreePntr, &Key, &Value);
+      if (ValueNumber < VALUE_SPACE && ValueNumber % 3 == 0)
+      {
+        SetValueThing (&Value,
+          ValueNumber + VALUE_SPACE * (Round.round + 1));
+        AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+      }
+      FreeKeyThing (&Key);
+    }
+    FreeTestRange (&TestRange);
+    SameTrees ("tree after deferred changes", ReferenceTreePntr, TreePntr,
+      5, &Seed);
+  }
+
+  EmptyResultList (&Expected);
+  EmptyResultList (&Round.seen);
+  AVLDupFreeTree (TreePntr);
+  AVLDupFreeTree (ReferenceTreePntr);
+}
+
+
+
+/* Parallel iteration, on a plain tree and on the kinds of trees whose
+search keys need preparing (interned and collated), compared with a single
+threaded iteration of the same tree.  Each thread collects its pairs in its
+own accumulator, a result list, and the reduce function puts them all
+together.  They come out in no particular order, so both lists get sorted. */
+
+typedef struct ParallelResultsStruct
+{
+  ResultListRecord results;
+  uint32           stopAfter; /* For each thread's accumulator. */
+} ParallelResultsRecord, *ParallelResultsPointer;
+
+static bool ParallelCallback (
+  AVLDupThingConstPointer KeyPntr,
+  AVLDupThingConstPointer ValuePntr,
+  void *AccumulatorPntr,
+  void *ExtraData)
+{
+  ResultListPointer      ListPntr = AccumulatorPntr;
+  ParallelResultsPointer ResultsPntr = ExtraData;
+
+  AppendPair (ListPntr, KeyPntr, ValuePntr);
+  return (ResultsPntr->stopAfter == 0 ||
+    ListPntr->count < ResultsPntr->stopAfter);
+}
+
+
+
+static void ParallelReduce (void *AccumulatorPntr, void *ExtraData)
+{
+  ResultListPointer      ListPntr = AccumulatorPntr;
+  ParallelResultsPointer ResultsPntr = ExtraData;
+
+  AppendText (&ResultsPntr->results, ResultText (ListPntr));
+  ResultsPntr->results.count += ListPntr->count;
+  EmptyResultList (ListPntr);
+}
+
+
+
+static void TestParallelIterate (void)
+{
+  ParallelResultsRecord Actual;
+  ResultListRecord      Expected;
+  bool                  Finished;
+  uint32                i;
+  uint32                Kind;
+  uint32                Seed = 28;
+  TestRangeRecord       TestRange;
+  uint32                Threads;
+  AVLDupTreePointer     TreePntr;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  for (Kind = 0; Kind < 3; Kind++)
+  {
+    if (Kind == 2)
+      TreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+        "Collated", 10, AVLDUP_COLLATION_IGNORE_CASE);
+    else
+      TreePntr = AllocReferenceTree ();
+    if (!Check (TreePntr != NULL, "allocating tree kind %lu",
+    (unsigned long) Kind))
+      continue;
+    if (Kind == 1)
+      AVLDupEnableInterning (TreePntr, true);
+    AddRandomPairs (TreePntr, NULL, 5000, &Seed);
+
+    for (i = 0; i < 40; i++)
+    {
+      MakeRandomRange (&TestRange, &Seed);
+      if (i == 0)
+        TestRange.range = g_WholeTree;
+      Threads = 1 + i % 8;
+      EmptyResultList (&Actual.results);
+      EmptyResultList (&Expected);
+      Actual.stopAfter = (i % 10 == 9) ? 5 : 0;
+      IterateTree (TreePntr, &TestRange.range, &Expected);
+      Finished = AVLDupParallelIterate (TreePntr,
+        TestRange.range.startKeyPntr, TestRange.range.startValuePntr,
+        TestRange.range.includeThingEqualToStart,
+        TestRange.range.endKeyPntr, TestRange.range.endValuePntr,
+        TestRange.range.includeThingEqualToEnd,
+        ParallelCallback, &Actual, Threads, sizeof (ResultListRecord),
+        ParallelReduce);
+      if (Actual.stopAfter == 0)
+      {
+        Check (Finished, "parallel iteration didn't finish");
+        SortResultList (&Expected);
+        SortResultList (&Actual.results);
+        SameResults ("parallel iteration", &Expected, &Actual.results);
+      }
+      else /* Returns FALSE if stopped, after some thread got enough. */
+        Check (Actual.results.count <= Expected.count &&
+          Actual.results.count <= Actual.stopAfter * Threads &&
+          (Finished || Actual.results.count >= Actual.stopAfter),
+          "parallel iteration stopping early gave %lu pairs",
+          (unsigned long) Actual.results.count);
+      FreeTestRange (&TestRange);
+    }
+    AVLDupFreeTree (TreePntr);
+  }
+  EmptyResultList (&Actual.results);
+  EmptyResultList (&Expected);
+}
+
+
+
+/* Adding arrays of pairs with several threads, both a big array (which gets
+merged and the tree rebuilt) and a small one (added a pair at a time), then
+freeing the trees with several threads, waiting and in the background. */
+
+static void TestParallelAddAndFree (void)
+{
+  uint32             i;
+  AVLDupThingPointer KeyArray;
+  uint32             Kind;
+  uint32             NumberOfPairs;
+  AVLDupTreePointer  ReferenceTreePntr;
+  uint32             Round;
+  uint32             Seed = 29;
+  AVLDupTreePointer  TreePntr;
+  AVLDupThingPointer ValueArray;
+
+  for (Kind = 0; Kind < 2; Kind++)
+  {
+    ReferenceTreePntr = AllocReferenceTree ();
+    TreePntr = AllocReferenceTree ();
+    if (Kind == 1)
+      AVLDupEnableInterning (TreePntr, true);
+    AddRandomPairs (TreePntr, ReferenceTreePntr, 3000, &Seed);
+
+    for (Round = 0; Round < 3; Round++)
+    {
+      NumberOfPairs = (Round == 1) ? 50 : 20000;
+      KeyArray = malloc (NumberOfPairs * sizeof (AVLDupThingRecord));
+      ValueArray = malloc (NumberOfPairs * sizeof (AVLDupThingRecord));
+      if (KeyArray == NULL || ValueArray == NULL)
+      {
+        fprintf (stderr, "Out of memory for the pair arrays.\n");
+        exit (2);
+      }
+      for (i = 0; i < NumberOfPairs; i++)
+      {
+        SetKeyThing (&KeyArray[i], RandomNumber (&Seed) % KEY_SPACE);
+        SetValueThing (&ValueArray[i],
+          RandomNumber (&Seed) % (4 * VALUE_SPACE));
+      }
+      Check (AVLDupParallelAddArray (TreePntr, KeyArray, ValueArray,
+        NumberOfPairs, 1 + Round * 3), "adding an array of %lu pairs",
+        (unsigned long) NumberOfPairs);
+      for (i = 0; i < NumberOfPairs; i++)
+        AVLDupAdd (ReferenceTreePntr, &KeyArray[i], &ValueArray[i]);
+      AVLDupFreeThingArray (KeyArray, B_STRING_TYPE, NumberOfPairs);
+      free (KeyArray);
+      free (ValueArray);
+      SameTrees ("tree after adding an array", ReferenceTreePntr, TreePntr,
+        10, &Seed);
+    }
+
+    AVLDupParallelFreeTree (TreePntr, 4, Kind == 0);
+    AVLDupFreeTree (ReferenceTreePntr);
+  }
+}
+
+
+
+/* Checks that a tree loaded from a damaged file is at least self consistent,
+with its pairs in order and as many of them as it says it has. */
+
+static void CheckDamagedTree (AVLDupTreePointer TreePntr, size_t Position)
+{
+  ResultListRecord List;
+  WorkerRecord     Worker;
+
+  memset (&List, 0, sizeof (List));
+  memset (&Worker, 0, sizeof (Worker));
+  IterateTree (TreePntr, &g_WholeTree, &List);
+  AVLDupIterate (TreePntr, NULL, NULL, false, NULL, NULL, false,
+    OrderCheckCallback, &Worker);
+  Check (AVLDupGetTreeCount (TreePntr) == List.count,
+    "tree loaded from a file damaged at byte %lu says it has %u pairs "
+    "but has %lu", (unsigned long) Position, AVLDupGetTreeCount (TreePntr),
+    (unsigned long) List.count);
+  Check (Worker.outOfOrder == 0,
+    "tree loaded from a file damaged at byte %lu has %lu pairs out of order",
+    (unsigned long) Position, (unsigned long) Worker.outOfOrder);
+  EmptyResultList (&List);
+}
+
+
+
+/* Saving and loading, then loading every way of cutting the file short
+(which should all fail) and files with changed bytes. */
+
+static void TestSaveAndLoad (void)
+{
+  unsigned char     *BufferPntr;
+  char               BadPath [PATH_MAX];
+  uint32             Kind;
+  size_t             Length;
+  AVLDupTreePointer  LoadedTreePntr;
+  char               Path [PATH_MAX];
+  unsigned char      Pattern;
+  uint32             Seed = 30;
+  size_t             Size;
+  AVLDupTreePointer  TreePntr;
+
+  MakeScratchPath ("saved.avl", Path);
+  MakeScratchPath ("damaged.avl", BadPath);
+
+  /* A plain tree, a collated one and an empty one. */
+
+  for (Kind = 0; Kind < 3; Kind++)
+  {
+    if (Kind == 1)
+      TreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+        "Collated", 10, AVLDUP_COLLATION_DICTIONARY);
+    else
+      TreePntr = AllocReferenceTree ();
+    if (Kind != 2)
+      AddRandomPairs (TreePntr, NULL, 3000, &Seed);
+    if (!Check (AVLDupSaveTree (TreePntr, Path), "saving tree kind %lu",
+    (unsigned long) Kind))
+    {
+      AVLDupFreeTree (TreePntr);
+      continue;
+    }
+    LoadedTreePntr = AVLDupLoadTree (Path, 10);
+    if (Check (LoadedTreePntr != NULL, "loading tree kind %lu",
+    (unsigned long) Kind))
+    {
+      Check (strcmp (AVLDupGetTreeName (LoadedTreePntr),
+        AVLDupGetTreeName (TreePntr)) == 0, "loaded tree's name is \"%s\"",
+        AVLDupGetTreeName (LoadedTreePntr));
+      SameTrees ("loaded tree", TreePntr, LoadedTreePntr, 20, &Seed);
+      AVLDupFreeTree (LoadedTreePntr);
+    }
+    AVLDupFreeTree (TreePntr);
+    if (Kind == 0)
+      rename (Path, BadPath);
+  }
+
+  /* Damage the plain tree's file. */
+
+  rename (BadPath, Path);
+  BufferPntr = ReadWholeFile (Path, &Size);
+  if (!Check (BufferPntr != NULL, "reading back the saved file"))
+    goto ErrorExit;
+
+  for (Length = 0; Length < Size; Length = NextDamagePosition (Length, Size))
+  {
+    WriteWholeFile (BadPath, BufferPntr, Length);
+    LoadedTreePntr = AVLDupLoadTree (BadPath, 10);
+    if (!Check (LoadedTreePntr == NULL,
+    "loaded a file cut short to %lu of %lu bytes",
+    (unsigned long) Length, (unsigned long) Size))
+      AVLDupFreeTree (LoadedTreePntr);
+  }
+
+  for (Length = 0; Length < Size; Length = NextDamagePosition (Length, Size))
+  {
+    Pattern = (Length % 3 == 0) ? 0x01 : ((Length % 3 == 1) ? 0x80 : 0xFF);
+    BufferPntr[Length] ^= Pattern;
+    WriteWholeFile (BadPath, BufferPntr, Size);
+    BufferPntr[Length] ^= Pattern;
+    LoadedTreePntr = AVLDupLoadTree (BadPath, 10);
+    if (LoadedTreePntr != NULL)
+    {
+      CheckDamagedTree (LoadedTreePntr, Length);
+      AVLDupFreeTree (LoadedTreePntr);
+    }
+  }
+  free (BufferPntr);
+
+ErrorExit:
+  unlink (Path);
+  unlink (BadPath);
+}
+
+
+
+static void IterateMappedTree (
+  AVLDupMappedTreePointer TreePntr,
+  AVLDupRangePointer RangePntr,
+  ResultListPointer ListPntr)
+{
+  AVLDupMappedIterate (TreePntr,
+    RangePntr->startKeyPntr, RangePntr->startValuePntr,
+    RangePntr->includeThingEqualToStart,
+    RangePntr->endKeyPntr, RangePntr->endValuePntr,
+    RangePntr->includeThingEqualToEnd,
+    CollectCallback, ListPntr);
+}
+
+
+
+/* Memory mapped trees, from files saved in both orders.  Files cut short
+should all be turned down, files with changed bytes should at least not
+crash anything. */
+
+static void TestMappedTree (void)
+{
+  ResultListRecord         Actual;
+  unsigned char           *BufferPntr;
+  char                     BadPath [PATH_MAX];
+  AVLDupTreePointer        CollatedTreePntr;
+  ResultListRecord         Expected;
+  uint32                   i;
+  uint32                   Kind;
+  size_t                   Length;
+  AVLDupMappedTreePointer  MappedTreePntr;
+  char                     Path [PATH_MAX];
+  unsigned char            Pattern;
+  uint32                   Seed = 31;
+  size_t                   Size;
+  TestRangeRecord          TestRange;
+  AVLDupTreePointer        TreePntr;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  MakeScratchPath ("mapped.avl", Path);
+  MakeScratchPath ("damaged.avl", BadPath);
+  TreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, NULL, 3000, &Seed);
+
+  for (Kind = 0; Kind < 2; Kind++)
+  {
+    if (!Check (Kind == 0 ? AVLDupSaveTreeForMapping (TreePntr, Path) :
+    AVLDupSaveTree (TreePntr, Path), "saving the tree for mapping"))
+      continue;
+    MappedTreePntr = AVLDupOpenMappedTree (Path);
+    if (!Check (MappedTreePntr != NULL, "opening mapped tree kind %lu",
+    (unsigned long) Kind))
+      continue;
+    Check (strcmp (AVLDupMappedGetTreeName (MappedTreePntr),
+      AVLDupGetTreeName (TreePntr)) == 0, "mapped tree's name is \"%s\"",
+      AVLDupMappedGetTreeName (MappedTreePntr));
+    Check (AVLDupMappedGetTreeCount (MappedTreePntr) ==
+      AVLDupGetTreeCount (TreePntr), "mapped tree count %u, should be %u",
+      AVLDupMappedGetTreeCount (MappedTreePntr),
+      AVLDupGetTreeCount (TreePntr));
+    for (i = 0; i < 50; i++)
+    {
+      MakeRandomRange (&TestRange, &Seed);
+      if (i == 0)
+        TestRange.range = g_WholeTree;
+      EmptyResultList (&Actual);
+      EmptyResultList (&Expected);
+      IterateTree (TreePntr, &TestRange.range, &Expected);
+      IterateMappedTree (MappedTreePntr, &TestRange.range, &Actual);
+      SameResults ("mapped tree", &Expected, &Actual);
+      FreeTestRange (&TestRange);
+    }
+    AVLDupCloseMappedTree (MappedTreePntr);
+
+    BufferPntr = ReadWholeFile (Path, &Size);
+    if (!Check (BufferPntr != NULL, "reading back the saved file"))
+      continue;
+
+    for (Length = 0; Length < Size;
+    Length = NextDamagePosition (Length, Size))
+    {
+      WriteWholeFile (BadPath, BufferPntr, Length);
+      MappedTreePntr = AVLDupOpenMappedTree (BadPath);
+      if (!Check (MappedTreePntr == NULL,
+      "mapped a file cut short to %lu of %lu bytes",
+      (unsigned long) Length, (unsigned long) Size))
+        AVLDupCloseMappedTree (MappedTreePntr);
+    }
+
+    for (Length = 0; Length < Size;
+    Length = NextDamagePosition (Length, Size))
+    {
+      Pattern = (Length % 3 == 0) ? 0x01 : ((Length % 3 == 1) ? 0x80 : 0xFF);
+      BufferPntr[Length] ^= Pattern;
+      WriteWholeFile (BadPath, BufferPntr, Size);
+      BufferPntr[Length] ^= Pattern;
+      MappedTreePntr = AVLDupOpenMappedTree (BadPath);
+      if (MappedTreePntr == NULL)
+        continue;
+      for (i = 0; i < 5; i++)
+      {
+        MakeRandomRange (&TestRange, &Seed);
+        if (i == 0)
+          TestRange.range = g_WholeTree;
+        EmptyResultList (&Actual);
+        IterateMappedTree (MappedTreePntr, &TestRange.range, &Actual);
+        Check (Actual.count <= AVLDupMappedGetTreeCount (MappedTreePntr),
+          "mapped file damaged at byte %lu gave %lu pairs out of %u",
+          (unsigned long) Length, (unsigned long) Actual.count,
+          AVLDupMappedGetTreeCount (MappedTreePntr));
+        FreeTestRange (&TestRange);
+      }
+      AVLDupCloseMappedTree (MappedTreePntr);
+    }
+    free (BufferPntr);
+  }
+
+  /* Collated trees can't be mapped, their order needs the collation code. */
+
+  CollatedTreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+    "Collated", 10, AVLDUP_COLLATION_IGNORE_CASE);
+  if (CollatedTreePntr != NULL)
+  {
+    AddRandomPairs (CollatedTreePntr, NULL, 100, &Seed);
+    if (AVLDupSaveTreeForMapping (CollatedTreePntr, Path))
+    {
+      MappedTreePntr = AVLDupOpenMappedTree (Path);
+      if (!Check (MappedTreePntr == NULL, "mapped a collated tree"))
+        AVLDupCloseMappedTree (MappedTreePntr);
+    }
+    AVLDupFreeTree (CollatedTreePntr);
+  }
+
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  AVLDupFreeTree (TreePntr);
+  unlink (Path);
+  unlink (BadPath);
+}
+
+
+
+/* The write-ahead log.  A log damaged anywhere after its header should give
+back the changes up to the damage, so the tree should match the reference
+tree after some number of the changes, found by comparing with the contents
+after each one. */
+
+#define LOG_CHANGES 200
+
+typedef struct LogChangesStruct
+{
+  uint32           keyNumbers [LOG_CHANGES];
+  int32            values [LOG_CHANGES];
+  bool             isAddition [LOG_CHANGES];
+  ResultListRecord contentsAfter [LOG_CHANGES + 1]; /* [N] is after N. */
+} LogChangesRecord, *LogChangesPointer;
+
+static void DoLogChange (
+  AVLDupTreePointer TreePntr,
+  LogChangesPointer ChangesPntr,
+  uint32 Index)
+{
+  AVLDupThingRecord Key;
+  AVLDupThingRecord Value;
+
+  SetKeyThing (&Key, ChangesPntr->keyNumbers[Index]);
+  SetValueThing (&Value, ChangesPntr->values[Index]);
+  if (ChangesPntr->isAddition[Index])
+    Check (AVLDupAdd (TreePntr, &Key, &Value), "logged addition %lu",
+      (unsigned long) Index);
+  else
+    AVLDupDelete (TreePntr, &Key, &Value);
+  FreeKeyThing (&Key);
+}
+
+
+
+/* Attaches a damaged log to an empty tree.  Returns TRUE if the log was
+accepted, and checks that it gave back a prefix of the changes. */
+
+static bool AttachDamagedLog (
+  const char *LogPath,
+  LogChangesPointer ChangesPntr,
+  const char *Description,
+  size_t Position)
+{
+  ResultListRecord  Contents;
+  uint32            i;
+  AVLDupTreePointer TreePntr;
+
+  memset (&Contents, 0, sizeof (Contents));
+  TreePntr = AllocReferenceTree ();
+  if (!AVLDupAttachLog (TreePntr, LogPath))
+  {
+    AVLDupFreeTree (TreePntr);
+    return false;
+  }
+  AVLDupDetachLog (TreePntr);
+  IterateTree (TreePntr, &g_WholeTree, &Contents);
+  for (i = 0; i <= LOG_CHANGES; i++)
+  {
+    if (Contents.count == ChangesPntr->contentsAfter[i].count &&
+    strcmp (ResultText (&Contents),
+    ResultText (&ChangesPntr->contentsAfter[i])) == 0)
+      break;
+  }
+  Check (i <= LOG_CHANGES, "log %s at byte %lu didn't give back the first "
+    "few changes", Description, (unsigned long) Position);
+  EmptyResultList (&Contents);
+  AVLDupFreeTree (TreePntr);
+  return true;
+}
+
+
+
+static void TestWriteAheadLog (void)
+{
+  char              BadLogPath [PATH_MAX];
+  unsigned char    *BufferPntr;
+  LogChangesPointer ChangesPntr;
+  char              CheckpointPath [PATH_MAX];
+  uint32            i;
+  size_t            Length;
+  char              LogPath [PATH_MAX];
+  unsigned char     Pattern;
+  AVLDupTreePointer RecoveredTreePntr;
+  AVLDupTreePointer ReferenceTreePntr;
+  uint32            Seed = 32;
+  size_t            Size;
+  AVLDupTreePointer TreePntr;
+
+  MakeScratchPath ("changes.log", LogPath);
+  MakeScratchPath ("damaged.log", BadLogPath);
+  MakeScratchPath ("checkpoint.avl", CheckpointPath);
+  unlink (LogPath);
+  unlink (CheckpointPath);
+  ChangesPntr = calloc (1, sizeof (LogChangesRecord));
+  if (ChangesPntr == NULL)
+  {
+    fprintf (stderr, "Out of memory for the log changes.\n");
+    exit (2);
+  }
+
+  /* Make some changes with the log attached, remembering the contents
+  after each one. */
+
+  TreePntr = AllocReferenceTree ();
+  ReferenceTreePntr = AllocReferenceTree ();
+  if (!Check (AVLDupAttachLog (TreePntr, LogPath), "attaching a new log"))
+    goto ErrorExit;
+  for (i = 0; i < LOG_CHANGES; i++)
+  {
+    ChangesPntr->keyNumbers[i] = RandomNumber (&Seed) % 20;
+    ChangesPntr->values[i] = RandomNumber (&Seed) % 5;
+    ChangesPntr->isAddition[i] = (RandomNumber (&Seed) % 3 != 0);
+    DoLogChange (TreePntr, ChangesPntr, i);
+    IterateTree (TreePntr, &g_WholeTree, &ChangesPntr->contentsAfter[i + 1]);
+  }
+  Check (AVLDupDetachLog (TreePntr), "detaching the log");
+
+  /* Replay the whole log. */
+
+  RecoveredTreePntr = AllocReferenceTree ();
+  if (Check (AVLDupAttachLog (RecoveredTreePntr, LogPath),
+  "attaching the log for replay"))
+  {
+    AVLDupDetachLog (RecoveredTreePntr);
+    SameTrees ("tree replayed from the log", TreePntr, RecoveredTreePntr,
+      5, &Seed);
+  }
+  AVLDupFreeTree (RecoveredTreePntr);
+
+  /* Damage it. */
+
+  BufferPntr = ReadWholeFile (LogPath, &Size);
+  if (!Check (BufferPntr != NULL, "reading back the log"))
+    goto ErrorExit;
+  for (Length = 0; Length < Size; Length = NextDamagePosition (Length, Size))
+  {
+    WriteWholeFile (BadLogPath, BufferPntr, Length);
+    Check (AttachDamagedLog (BadLogPath, ChangesPntr, "cut short", Length) ||
+      Length < 16, "log cut short to %lu bytes wasn't accepted",
+      (unsigned long) Length);
+  }
+  for (Length = 0; Length < Size; Length = NextDamagePosition (Length, Size))
+  {
+    Pattern = (Length % 3 == 0) ? 0x01 : ((Length % 3 == 1) ? 0x80 : 0xFF);
+    BufferPntr[Length] ^= Pattern;
+    WriteWholeFile (BadLogPath, BufferPntr, Size);
+    BufferPntr[Length] ^= Pattern;
+    Check (AttachDamagedLog (BadLogPath, ChangesPntr, "damaged", Length) ||
+      Length < 16, "log damaged at byte %lu wasn't accepted",
+      (unsigned long) Length);
+  }
+  free (BufferPntr);
+
+  /* A checkpoint in the middle, then recovering from the checkpoint file and
+  the rest of the log. */
+
+  unlink (LogPath);
+  if (!Check (AVLDupAttachLog (ReferenceTreePntr, LogPath),
+  "attaching a log to the checkpointed tree"))
+    goto ErrorExit;
+  AddRandomPairs (ReferenceTreePntr, NULL, 100, &Seed);
+  Check (AVLDupCheckpointTree (ReferenceTreePntr, CheckpointPath),
+    "checkpointing the tree");
+  AddRandomPairs (ReferenceTreePntr, NULL, 100, &Seed);
+  for (i = 0; i < 50; i++)
+  {
+    ChangesPntr->keyNumbers[i] = RandomNumber (&Seed) % KEY_SPACE;
+    ChangesPntr->values[i] = RandomNumber (&Seed) % VALUE_SPACE;
+    ChangesPntr->isAddition[i] = false;
+    DoLogChange (ReferenceTreePntr, ChangesPntr, i);
+  }
+  AVLDupDetachLog (ReferenceTreePntr);
+  RecoveredTreePntr = AVLDupLoadTree (CheckpointPath, 10);
+  if (Check (RecoveredTreePntr != NULL, "loading the checkpoint"))
+  {
+    Check (AVLDupAttachLog (RecoveredTreePntr, LogPath),
+      "attaching the log after the checkpoint");
+    AVLDupDetachLog (RecoveredTreePntr);
+    SameTrees ("tree recovered from a checkpoint and the log",
+      ReferenceTreePntr, RecoveredTreePntr, 10, &Seed);
+    AVLDupFreeTree (RecoveredTreePntr);
+  }
+
+ErrorExit:
+  for (i = 0; i <= LOG_CHANGES; i++)
+    EmptyResultList (&ChangesPntr->contentsAfter[i]);
+  free (ChangesPntr);
+  AVLDupFreeTree (TreePntr);
+  AVLDupFreeTree (ReferenceTreePntr);
+  unlink (LogPath);
+  unlink (BadLogPath);
+  unlink (CheckpointPath);
+}
+
+
+
+/* The LSM tree with a small memtable, so that there are lots of sorted runs
+and merges, without and with the background merging thread. */
+
+static bool SameLSMTree (
+  const char *Description,
+  AVLDupTreePointer ReferenceTreePntr,
+  AVLDupLSMTreePointer LSMTreePntr,
+  uint32 NumberOfRanges,
+  uint32 *SeedPntr)
+{
+  ResultListRecord Actual;
+  ResultListRecord Expected;
+  uint32           i;
+  bool             Same;
+  TestRangeRecord  TestRange;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  Same = true;
+  for (i = 0; Same && i <= NumberOfRanges; i++)
+  {
+    MakeRandomRange (&TestRange, SeedPntr);
+    if (i == 0)
+      TestRange.range = g_WholeTree;
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    IterateTree (ReferenceTreePntr, &TestRange.range, &Expected);
+    LSMIterate (LSMTreePntr, &TestRange.range, CollectCallback, &Actual);
+    Same = SameResults (Description, &Expected, &Actual);
+    FreeTestRange (&TestRange);
+  }
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  return Same;
+}
+
+
+
+static void TestLSMTree (void)
+{
+  uint32               i;
+  AVLDupThingRecord    Key;
+  AVLDupLSMTreePointer LSMTreePntr;
+  uint32               MaxReaders;
+  AVLDupTreePointer    ReferenceTreePntr;
+  uint32               Seed = 33;
+  AVLDupThingRecord    Value;
+
+  for (MaxReaders = 0; MaxReaders <= 10; MaxReaders += 10)
+  {
+    ReferenceTreePntr = AllocReferenceTree ();
+    LSMTreePntr = AVLDupLSMAllocTree (B_STRING_TYPE, B_INT32_TYPE, "LSM",
+      MaxReaders, 64);
+    if (!Check (LSMTreePntr != NULL, "allocating the LSM tree"))
+    {
+      AVLDupFreeTree (ReferenceTreePntr);
+      continue;
+    }
+    for (i = 1; i <= 20000; i++)
+    {
+      SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+      SetValueThing (&Value, RandomNumber (&Seed) % VALUE_SPACE);
+      if (RandomNumber (&Seed) % 3 != 0)
+      {
+        Check (AVLDupLSMAdd (LSMTreePntr, &Key, &Value), "adding pair %lu",
+          (unsigned long) i);
+        AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+      }
+      else
+        Check (AVLDupLSMDelete (LSMTreePntr, &Key, &Value) ==
+          AVLDupDelete (ReferenceTreePntr, &Key, &Value),
+          "deleting pair %lu disagrees with the plain tree",
+          (unsigned long) i);
+      FreeKeyThing (&Key);
+      if (i % 2500 == 0)
+        SameLSMTree ("LSM tree", ReferenceTreePntr, LSMTreePntr, 5, &Seed);
+    }
+    AVLDupLSMFreeTree (LSMTreePntr);
+    AVLDupFreeTree (ReferenceTreePntr);
+  }
+}
+
+
+
+static void TestLSMTreeThreads (void)
+{
+  AVLDupLSMTreePointer LSMTreePntr;
+  AVLDupTreePointer    ReferenceTreePntr;
+  uint32               Seed = 133;
+
+  ReferenceTreePntr = AllocReferenceTree ();
+  LSMTreePntr = AVLDupLSMAllocTree (B_STRING_TYPE, B_INT32_TYPE, "LSM",
+    10, 64);
+  if (Check (LSMTreePntr != NULL, "allocating the LSM tree"))
+  {
+    RunWorkers (&g_LSMFunctions, LSMTreePntr, ReferenceTreePntr,
+      4, 4, 3000, 20, false);
+    SameLSMTree ("LSM tree after the threads", ReferenceTreePntr,
+      LSMTreePntr, 10, &Seed);
+    AVLDupLSMFreeTree (LSMTreePntr);
+  }
+  AVLDupFreeTree (ReferenceTreePntr);
+}
+
+
+
+/* Statistics, compared with what can be worked out from the pairs. */
+
+static void TestStatistics (void)
+{
+  const char             *CursorPntr;
+  uint32                  DepthTotal;
+  uint32                  DistinctKeys;
+  ResultListRecord        Expected;
+  uint32                  i;
+  AVLDupThingRecord       Key;
+  char                    KeyString [MAX_KEY_LENGTH];
+  uint32                  LongestRun;
+  uint32                  MinimumNodes [AVLDUP_STATS_MAX_DEPTH + 1];
+  char                    PreviousKey [MAX_KEY_LENGTH];
+  uint32                  Run;
+  uint32                  Seed = 34;
+  AVLDupStatisticsRecord  Stats;
+  AVLDupTreePointer       TreePntr;
+  AVLDupThingRecord       Value;
+  int32                   ValueNumber;
+
+  memset (&Expected, 0, sizeof (Expected));
+  TreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, NULL, 5000, &Seed);
+  for (i = 0; i < 2000; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&Value, RandomNumber (&Seed) % VALUE_SPACE);
+    AVLDupDelete (TreePntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+
+  IterateTree (TreePntr, &g_WholeTree, &Expected);
+  DistinctKeys = LongestRun = Run = 0;
+  PreviousKey[0] = 0;
+  CursorPntr = ResultText (&Expected);
+  while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+  {
+    if (DistinctKeys == 0 || strcmp (KeyString, PreviousKey) != 0)
+    {
+      DistinctKeys++;
+      Run = 0;
+      strcpy (PreviousKey, KeyString);
+    }
+    Run++;
+    if (Run > LongestRun)
+      LongestRun = Run;
+  }
+
+  memset (&Stats, 0, sizeof (Stats));
+  if (!Check (AVLDupGetStats (TreePntr, &Stats, true), "getting the stats"))
+    goto ErrorExit;
+  Check (Stats.count == Expected.count, "stats count %lu, should be %lu",
+    (unsigned long) Stats.count, (unsigned long) Expected.count);
+  Check (Stats.distinctKeys == DistinctKeys,
+    "stats have %lu distinct keys, should be %lu",
+    (unsigned long) Stats.distinctKeys, (unsigned long) DistinctKeys);
+  Check (Stats.longestDuplicateRun == LongestRun,
+    "stats longest run %lu, should be %lu",
+    (unsigned long) Stats.longestDuplicateRun, (unsigned long) LongestRun);
+
+  /* Every node is at some depth less than the height, and an AVL tree of
+  that height needs at least a Fibonacci-like number of nodes. */
+
+  DepthTotal = 0;
+  for (i = 0; i < AVLDUP_STATS_MAX_DEPTH; i++)
+  {
+    DepthTotal += Stats.depthHistogram[i];
+    if (i >= Stats.height)
+      Check (Stats.depthHistogram[i] == 0, "nodes at depth %lu, below the "
+        "height of %lu", (unsigned long) i, (unsigned long) Stats.height);
+  }
+  Check (DepthTotal == Stats.count, "depth histogram has %lu nodes, "
+    "should be %lu", (unsigned long) DepthTotal, (unsigned long) Stats.count);
+  MinimumNodes[0] = 0;
+  MinimumNodes[1] = 1;
+  for (i = 2; i <= AVLDUP_STATS_MAX_DEPTH; i++)
+    MinimumNodes[i] = MinimumNodes[i - 1] + MinimumNodes[i - 2] + 1;
+  Check (Stats.height <= AVLDUP_STATS_MAX_DEPTH &&
+    Stats.count >= MinimumNodes[Stats.height],
+    "height %lu is too much for %lu nodes", (unsigned long) Stats.height,
+    (unsigned long) Stats.count);
+
+  Check (Stats.totalBytes == Stats.nodeBytes + Stats.longStringBytes +
+    Stats.headerBytes + Stats.allocatorOverheadBytes,
+    "the stats byte counts don't add up");
+  if (Stats.adds != 0 || Stats.deletes != 0) /* Not AVLDUP_NO_STATISTICS. */
+    Check (Stats.adds - Stats.deletes == Stats.count,
+      "stats have %lu additions and %lu deletions for %lu pairs",
+      (unsigned long) Stats.adds, (unsigned long) Stats.deletes,
+      (unsigned long) Stats.count);
+
+ErrorExit:
+  EmptyResultList (&Expected);
+  AVLDupFreeTree (TreePntr);
+}
+
+
+
+/* Latency histograms and contention profiling, which should count every
+operation once. */
+
+static void TestLatencyAndContention (void)
+{
+  ResultListRecord               Actual;
+  AVLDupContentionSnapshotRecord Contention;
+  FILE                          *FilePntr;
+  AVLDupLatencyHistogramRecord   Histogram;
+  uint32                         i;
+  AVLDupThingRecord              Key;
+  AVLDupLatencySnapshotRecord    Latency;
+  bigtime_t                      Median;
+  uint32                         Seed = 35;
+  TestRangeRecord                TestRange;
+  AVLDupTreePointer              TreePntr;
+  AVLDupThingRecord              Value;
+
+  memset (&Actual, 0, sizeof (Actual));
+  TreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, NULL, 500, &Seed);
+  if (!Check (AVLDupEnableLatencyHistograms (TreePntr, true),
+  "turning on latency histograms") ||
+  !Check (AVLDupEnableContentionProfiling (TreePntr, true, 0),
+  "turning on contention profiling"))
+    goto ErrorExit;
+  AVLDupGetLatencySnapshot (TreePntr, &Latency, true);
+  AVLDupGetContentionSnapshot (TreePntr, &Contention, true);
+
+  for (i = 0; i < 150; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&Value, RandomNumber (&Seed) % VALUE_SPACE);
+    if (i < 100)
+      AVLDupAdd (TreePntr, &Key, &Value);
+    else
+      AVLDupDelete (TreePntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+  for (i = 0; i < 30; i++)
+  {
+    MakeRandomRange (&TestRange, &Seed);
+    IterateTree (TreePntr, &TestRange.range, &Actual);
+    FreeTestRange (&TestRange);
+  }
+
+  Check (AVLDupGetLatencySnapshot (TreePntr, &Latency, false),
+    "getting the latency snapshot");
+  Check (Latency.lockWait[AVLDUP_LATENCY_ADD].totalCount == 100 &&
+    Latency.work[AVLDUP_LATENCY_ADD].totalCount == 100 &&
+    Latency.lockWait[AVLDUP_LATENCY_DELETE].totalCount == 50 &&
+    Latency.work[AVLDUP_LATENCY_DELETE].totalCount == 50 &&
+    Latency.lockWait[AVLDUP_LATENCY_ITERATE].totalCount == 30 &&
+    Latency.work[AVLDUP_LATENCY_ITERATE].totalCount == 30,
+    "latency counts %lu/%lu adds, %lu/%lu deletes and %lu/%lu iterations, "
+    "should be 100, 50 and 30",
+    (unsigned long) Latency.lockWait[AVLDUP_LATENCY_ADD].totalCount,
+    (unsigned long) Latency.work[AVLDUP_LATENCY_ADD].totalCount,
+    (unsigned long) Latency.lockWait[AVLDUP_LATENCY_DELETE].totalCount,
+    (unsigned long) Latency.work[AVLDUP_LATENCY_DELETE].totalCount,
+    (unsigned long) Latency.lockWait[AVLDUP_LATENCY_ITERATE].totalCount,
+    (unsigned long) Latency.work[AVLDUP_LATENCY_ITERATE].totalCount);
+  Check (AVLDupGetContentionSnapshot (TreePntr, &Contention, false),
+    "getting the contention snapshot");
+  Check (Contention.writers.acquisitions == 150 &&
+    Contention.readers.acquisitions == 30,
+    "lock acquisitions %lu by writers and %lu by readers, "
+    "should be 150 and 30", (unsigned long) Contention.writers.acquisitions,
+    (unsigned long) Contention.readers.acquisitions);
+
+  FilePntr = tmpfile ();
+  if (FilePntr != NULL)
+  {
+    Check (AVLDupPrintLatencySnapshot (&Latency, "Test", true, FilePntr) &&
+      AVLDupPrintLatencySnapshot (&Latency, "Test", false, FilePntr) &&
+      AVLDupPrintContentionSnapshot (&Contention, "Test", true, FilePntr) &&
+      AVLDupPrintContentionSnapshot (&Contention, "Test", false, FilePntr),
+      "printing the snapshots");
+    fclose (FilePntr);
+  }
+
+  /* The percentiles should be within the 25% accuracy of the buckets. */
+
+  memset (&Histogram, 0, sizeof (Histogram));
+  for (i = 1; i <= 1000; i++)
+    AVLDupAddToLatencyHistogram (&Histogram, i);
+  Median = AVLDupLatencyPercentile (&Histogram, 50);
+  Check (Histogram.totalCount == 1000 && Histogram.maximumTime == 1000 &&
+    Median >= 500 && Median <= 625, "histogram of 1 to 1000 has a median "
+    "of %ld", (long) Median);
+  Check (AVLDupLatencyPercentile (&Histogram, 100) == 1000,
+    "histogram of 1 to 1000 has a 100th percentile of %ld",
+    (long) AVLDupLatencyPercentile (&Histogram, 100));
+
+ErrorExit:
+  EmptyResultList (&Actual);
+  AVLDupFreeTree (TreePntr);
+}
+
+
+
+/* Recording, then replaying the trace on a new tree, which should end up
+the same, with each recorded iteration finding the same number of pairs. */
+
+static void TestRecording (void)
+{
+  ResultListRecord         Actual;
+  AVLDupRecordedCallRecord Call;
+  uint32                   Calls [AVLDUP_RECORDED_ITERATE + 1];
+  uint32                   i;
+  AVLDupThingRecord        KeyArray [2000];
+  type_code                KeyType;
+  AVLDupTraceReaderPointer ReaderPntr;
+  AVLDupTreePointer        ReplayedTreePntr;
+  DeferredRoundRecord      Round;
+  uint32                   Seed = 40;
+  TestRangeRecord          TestRange;
+  char                     TracePath [PATH_MAX];
+  AVLDupTreePointer        TreePntr;
+  AVLDupThingRecord        ValueArray [2000];
+  type_code                ValueType;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Round, 0, sizeof (Round));
+  memset (Calls, 0, sizeof (Calls));
+  MakeScratchPath ("recorded.trace", TracePath);
+  TreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, NULL, 500, &Seed);
+  if (!Check (AVLDupStartRecording (TreePntr, TracePath, true),
+  "starting the recording"))
+    goto ErrorExit;
+
+  /* Some of everything, including the functions which change the tree
+  without going through AVLDupAdd and AVLDupDelete. */
+
+  AddRandomPairs (TreePntr, NULL, 200, &Seed);
+  for (i = 0; i < 100; i++)
+  {
+    SetKeyThing (&KeyArray[0], RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&ValueArray[0], RandomNumber (&Seed) % VALUE_SPACE);
+    AVLDupDelete (TreePntr, &KeyArray[0], &ValueArray[0]);
+    FreeKeyThing (&KeyArray[0]);
+  }
+  for (i = 0; i < 20; i++)
+  {
+    MakeRandomRange (&TestRange, &Seed);
+    IterateTree (TreePntr, &TestRange.range, &Actual);
+    FreeTestRange (&TestRange);
+  }
+  AVLDupIterateDeferringChanges (TreePntr, NULL, NULL, false, NULL, NULL,
+    false, DeferringCallback, &Round);
+  for (i = 0; i < 2000; i++)
+  {
+    SetKeyThing (&KeyArray[i], RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&ValueArray[i], RandomNumber (&Seed) % (3 * VALUE_SPACE));
+  }
+  AVLDupParallelAddArray (TreePntr, KeyArray, ValueArray, 2000, 3);
+  AVLDupParallelAddArray (TreePntr, KeyArray + 1000, ValueArray, 10, 3);
+  AVLDupFreeThingArray (KeyArray, B_STRING_TYPE, 2000);
+  Check (AVLDupStopRecording (TreePntr), "stopping the recording");
+
+  /* Replay it. */
+
+  ReaderPntr = AVLDupOpenTrace (TracePath, &KeyType, &ValueType);
+  if (!Check (ReaderPntr != NULL, "opening the trace"))
+    goto ErrorExit;
+  Check (KeyType == B_STRING_TYPE && ValueType == B_INT32_TYPE,
+    "trace has the wrong types");
+  ReplayedTreePntr = AllocReferenceTree ();
+  while (AVLDupReadTrace (ReaderPntr, &Call))
+  {
+    if (Call.operation >= AVLDUP_RECORDED_ADD &&
+    Call.operation <= AVLDUP_RECORDED_ITERATE)
+      Calls[Call.operation]++;
+    if (Call.operation == AVLDUP_RECORDED_ADD)
+      AVLDupAdd (ReplayedTreePntr, &Call.key, &Call.value);
+    else if (Call.operation == AVLDUP_RECORDED_DELETE)
+      AVLDupDelete (ReplayedTreePntr, &Call.key, &Call.value);
+    else if (Call.operation == AVLDUP_RECORDED_ITERATE)
+    {
+      EmptyResultList (&Actual);
+      AVLDupIterate (ReplayedTreePntr,
+        Call.hasKey ? &Call.key : NULL, Call.hasValue ? &Call.value : NULL,
+        Call.includeThingEqualToStart,
+        Call.hasEndKey ? &Call.endKey : NULL,
+        Call.hasEndValue ? &Call.endValue : NULL,
+        Call.includeThingEqualToEnd, CollectCallback, &Actual);
+      Check (Actual.count == Call.itemsIterated,
+        "replayed iteration %lu found %lu pairs, recorded %lu",
+        (unsigned long) Calls[AVLDUP_RECORDED_ITERATE],
+        (unsigned long) Actual.count, (unsigned long) Call.itemsIterated);
+    }
+  }
+  AVLDupCloseTrace (ReaderPntr);
+  Check (Calls[AVLDUP_RECORDED_ITERATE] == 21,
+    "trace has %lu iterations, should be 21",
+    (unsigned long) Calls[AVLDUP_RECORDED_ITERATE]);
+  SameTrees ("replayed tree", TreePntr, ReplayedTreePntr, 10, &Seed);
+  AVLDupFreeTree (ReplayedTreePntr);
+
+ErrorExit:
+  EmptyResultList (&Actual);
+  EmptyResultList (&Round.seen);
+  AVLDupFreeTree (TreePntr);
+  unlink (TracePath);
+}
+
+
+
+/* Batch lookups, compared with iterating over each key or pair. */
+
+static void TestLookupBatch (void)
+{
+  uint32            CountArray [500];
+  ResultListRecord  Expected;
+  uint32            i;
+  AVLDupThingRecord KeyArray [500];
+  uint32            Kind;
+  AVLDupRangeRecord Range;
+  uint32            Seed = 43;
+  AVLDupTreePointer TreePntr;
+  AVLDupThingRecord ValueArray [500];
+
+  memset (&Expected, 0, sizeof (Expected));
+  for (Kind = 0; Kind < 3; Kind++)
+  {
+    if (Kind == 2)
+      TreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+        "Collated", 10, AVLDUP_COLLATION_IGNORE_CASE);
+    else
+      TreePntr = AllocReferenceTree ();
+    if (!Check (TreePntr != NULL, "allocating tree kind %lu",
+    (unsigned long) Kind))
+      continue;
+    if (Kind == 1)
+      AVLDupEnableInterning (TreePntr, true);
+    AddRandomPairs (TreePntr, NULL, 3000, &Seed);
+    for (i = 0; i < 500; i++)
+    {
+      SetKeyThing (&KeyArray[i], RandomNumber (&Seed) % (KEY_SPACE + 50));
+      SetValueThing (&ValueArray[i], RandomNumber (&Seed) % VALUE_SPACE);
+    }
+
+    Check (AVLDupLookupBatch (TreePntr, KeyArray, NULL, 500, CountArray),
+      "looking up a batch of keys");
+    for (i = 0; i < 500; i++)
+    {
+      memset (&Range, 0, sizeof (Range));
+      Range.startKeyPntr = Range.endKeyPntr = &KeyArray[i];
+      Range.includeThingEqualToStart = Range.includeThingEqualToEnd = true;
+      EmptyResultList (&Expected);
+      IterateTree (TreePntr, &Range, &Expected);
+      Check (CountArray[i] == Expected.count,
+        "batch found %lu values for key \"%s\", should be %lu",
+        (unsigned long) CountArray[i],
+        AVLDupGetStringPntrFromThing (KeyArray[i]),
+        (unsigned long) Expected.count);
+    }
+
+    Check (AVLDupLookupBatch (TreePntr, KeyArray, ValueArray, 500,
+      CountArray), "looking up a batch of pairs");
+    for (i = 0; i < 500; i++)
+    {
+      memset (&Range, 0, sizeof (Range));
+      Range.startKeyPntr = Range.endKeyPntr = &KeyArray[i];
+      Range.startValuePntr = Range.endValuePntr = &ValueArray[i];
+      Range.includeThingEqualToStart = Range.includeThingEqualToEnd = true;
+      EmptyResultList (&Expected);
+      IterateTree (TreePntr, &Range, &Expected);
+      Check (CountArray[i] == Expected.count,
+        "batch found %lu of pair \"%s\" %ld, should be %lu",
+        (unsigned long) CountArray[i],
+        AVLDupGetStringPntrFromThing (KeyArray[i]),
+        (long) ValueArray[i].int32Thing, (unsigned long) Expected.count);
+    }
+
+    AVLDupFreeThingArray (KeyArray, B_STRING_TYPE, 500);
+    AVLDupFreeTree (TreePntr);
+  }
+  EmptyResultList (&Expected);
+}
+
+
+
+/* Iterating over several ranges at once, compared with iterating over each
+one separately.  The range ends are keys taken from the tree in its own
+order, so that they are sorted and don't overlap even in a collated tree. */
+
+#define MAX_TEST_RANGES 8
+
+static int CompareNumbers (const void *APntr, const void *BPntr)
+{
+  uint32 A = *(const uint32 *) APntr;
+  uint32 B = *(const uint32 *) BPntr;
+
+  return (A < B) ? -1 : ((A > B) ? 1 : 0);
+}
+
+
+
+static void TestIterateRanges (void)
+{
+  ResultListRecord  Actual;
+  const char       *CursorPntr;
+  ResultListRecord  Expected;
+  uint32            i;
+  uint32            Indices [2 * MAX_TEST_RANGES];
+  uint32            j;
+  AVLDupThingRecord KeyThings [2 * MAX_TEST_RANGES];
+  char              KeyString [MAX_KEY_LENGTH];
+  char            (*KeysArray) [MAX_KEY_LENGTH];
+  uint32            Kind;
+  uint32            NumberOfKeys;
+  uint32            NumberOfRanges;
+  AVLDupRangeRecord Ranges [MAX_TEST_RANGES];
+  uint32            Seed = 44;
+  uint32            Trial;
+  AVLDupTreePointer TreePntr;
+  AVLDupThingRecord ValueThings [2 * MAX_TEST_RANGES];
+  int32             ValueNumber;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  KeysArray = malloc (KEY_SPACE * MAX_KEY_LENGTH);
+  if (KeysArray == NULL)
+  {
+    fprintf (stderr, "Out of memory for the keys.\n");
+    exit (2);
+  }
+
+  for (Kind = 0; Kind < 3; Kind++)
+  {
+    if (Kind == 2)
+      TreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+        "Collated", 10, AVLDUP_COLLATION_IGNORE_CASE);
+    else
+      TreePntr = AllocReferenceTree ();
+    if (!Check (TreePntr != NULL, "allocating tree kind %lu",
+    (unsigned long) Kind))
+      continue;
+    if (Kind == 1)
+      AVLDupEnableInterning (TreePntr, true);
+    AddRandomPairs (TreePntr, NULL, 3000, &Seed);
+
+    /* Get the distinct keys, in the tree's order. */
+
+    EmptyResultList (&Expected);
+    IterateTree (TreePntr, &g_WholeTree, &Expected);
+    NumberOfKeys = 0;
+    CursorPntr = ResultText (&Expected);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+    {
+      if (NumberOfKeys == 0 ||
+      strcmp (KeysArray[NumberOfKeys - 1], KeyString) != 0)
+        strcpy (KeysArray[NumberOfKeys++], KeyString);
+    }
+
+    for (Trial = 0; Trial < 50; Trial++)
+    {
+      /* Pick distinct, sorted key indices, a pair for each range. */
+
+      NumberOfRanges = 1 + RandomNumber (&Seed) % MAX_TEST_RANGES;
+      for (i = 0; i < 2 * NumberOfRanges; i++)
+        Indices[i] = RandomNumber (&Seed) % NumberOfKeys;
+      qsort (Indices, 2 * NumberOfRanges, sizeof (uint32), CompareNumbers);
+      for (i = j = 0; i < 2 * NumberOfRanges; i++)
+        if (j == 0 || Indices[i] != Indices[j - 1])
+          Indices[j++] = Indices[i];
+      NumberOfRanges = j / 2;
+      if (NumberOfRanges == 0)
+        continue;
+
+      memset (Ranges, 0, sizeof (Ranges));
+      for (i = 0; i < 2 * NumberOfRanges; i++)
+      {
+        KeyThings[i].int64Thing = 0;
+        AVLDupConvertStringToThing (KeysArray[Indices[i]], &KeyThings[i],
+          B_STRING_TYPE);
+        SetValueThing (&ValueThings[i], RandomNumber (&Seed) % VALUE_SPACE);
+      }
+      for (i = 0; i < NumberOfRanges; i++)
+      {
+        Ranges[i].startKeyPntr = &KeyThings[2 * i];
+        Ranges[i].endKeyPntr = &KeyThings[2 * i + 1];
+        if (RandomNumber (&Seed) % 2 != 0)
+          Ranges[i].startValuePntr = &ValueThings[2 * i];
+        if (RandomNumber (&Seed) % 2 != 0)
+          Ranges[i].endValuePntr = &ValueThings[2 * i + 1];
+        Ranges[i].includeThingEqualToStart = (RandomNumber (&Seed) % 2 != 0);
+        Ranges[i].includeThingEqualToEnd = (RandomNumber (&Seed) % 2 != 0);
+      }
+      if (RandomNumber (&Seed) % 4 == 0)
+        Ranges[0].startKeyPntr = Ranges[0].startValuePntr = NULL;
+      if (RandomNumber (&Seed) % 4 == 0)
+        Ranges[NumberOfRanges - 1].endKeyPntr =
+          Ranges[NumberOfRanges - 1].endValuePntr = NULL;
+
+      EmptyResultList (&Actual);
+      EmptyResultList (&Expected);
+      for (i = 0; i < NumberOfRanges; i++)
+        IterateTree (TreePntr, &Ranges[i], &Expected);
+      Check (AVLDupIterateRanges (TreePntr, Ranges, NumberOfRanges,
+        CollectCallback, &Actual), "iterating over %lu ranges",
+        (unsigned long) NumberOfRanges);
+      SameResults ("multiple ranges", &Expected, &Actual);
+      AVLDupFreeThingArray (KeyThings, B_STRING_TYPE, 2 * NumberOfRanges);
+    }
+    AVLDupFreeTree (TreePntr);
+  }
+
+  free (KeysArray);
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+}
+
+
+
+/* Set operations on the values of key ranges of three trees, compared with
+working out the answers from the values of each range. */
+
+#define SET_VALUE_SPACE 2000
+
+typedef struct ValueListStruct
+{
+  int32  values [SET_VALUE_SPACE];
+  uint32 count;
+  bool   overflowed;
+} ValueListRecord, *ValueListPointer;
+
+static bool ValueCallback (AVLDupThingConstPointer ValuePntr, void *ExtraData)
+{
+  ValueListPointer ListPntr = ExtraData;
+
+  if (ListPntr->count >= SET_VALUE_SPACE)
+    ListPntr->overflowed = true;
+  else
+    ListPntr->values[ListPntr->count++] = ValuePntr->int32Thing;
+  return true;
+}
+
+
+
+static void TestCombineValues (void)
+{
+  ValueListRecord      Actual;
+  const char          *CursorPntr;
+  ValueListRecord      Expected;
+  uint32               i;
+  AVLDupSetInputRecord Inputs [3];
+  AVLDupThingRecord    Key;
+  char                 KeyString [MAX_KEY_LENGTH];
+  uint32               NumberOfInputs;
+  AVLDupSetOperation   Operation;
+  bool                 Present;
+  uint8               *PresentArray [3];
+  ResultListRecord     RangeList;
+  uint32               Seed = 45;
+  TestRangeRecord      TestRanges [3];
+  uint32               Tree;
+  AVLDupTreePointer    TreePntrs [3];
+  uint32               Trial;
+  AVLDupThingRecord    Value;
+  int32                ValueNumber;
+
+  memset (&RangeList, 0, sizeof (RangeList));
+  for (Tree = 0; Tree < 3; Tree++)
+  {
+    TreePntrs[Tree] = AllocReferenceTree ();
+    PresentArray[Tree] = malloc (SET_VALUE_SPACE);
+    if (PresentArray[Tree] == NULL)
+    {
+      fprintf (stderr, "Out of memory for the value sets.\n");
+      exit (2);
+    }
+    for (i = 0; i < 3000; i++)
+    {
+      /* The third tree has fewer, spread out values. */
+
+      SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+      SetValueThing (&Value, (Tree == 2) ?
+        (RandomNumber (&Seed) % 40) * (SET_VALUE_SPACE / 40) :
+        RandomNumber (&Seed) % SET_VALUE_SPACE);
+      AVLDupAdd (TreePntrs[Tree], &Key, &Value);
+      FreeKeyThing (&Key);
+    }
+  }
+
+  for (Trial = 0; Trial < 60; Trial++)
+  {
+    Operation = (AVLDupSetOperation) (Trial % 3);
+    NumberOfInputs = 1 + (Trial / 3) % 3;
+    for (Tree = 0; Tree < NumberOfInputs; Tree++)
+    {
+      MakeRandomRange (&TestRanges[Tree], &Seed);
+      Inputs[Tree].treePntr = TreePntrs[Tree];
+      Inputs[Tree].range = TestRanges[Tree].range;
+      memset (PresentArray[Tree], 0, SET_VALUE_SPACE);
+      EmptyResultList (&RangeList);
+      IterateTree (TreePntrs[Tree], &Inputs[Tree].range, &RangeList);
+      CursorPntr = ResultText (&RangeList);
+      while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+        PresentArray[Tree][ValueNumber] = 1;
+    }
+
+    Expected.count = 0;
+    for (i = 0; i < SET_VALUE_SPACE; i++)
+    {
+      Present = PresentArray[0][i];
+      for (Tree = 1; Tree < NumberOfInputs; Tree++)
+      {
+        if (Operation == AVLDUP_SET_INTERSECTION)
+          Present = Present && PresentArray[Tree][i];
+        else if (Operation == AVLDUP_SET_UNION)
+          Present = Present || PresentArray[Tree][i];
+        else
+          Present = Present && !PresentArray[Tree][i];
+      }
+      if (Present)
+        Expected.values[Expected.count++] = i;
+    }
+
+    Actual.count = 0;
+    Actual.overflowed = false;
+    Check (AVLDupCombineValues (Operation, Inputs, NumberOfInputs,
+      ValueCallback, &Actual), "combining values");
+    if (Check (!Actual.overflowed && Actual.count == Expected.count,
+    "set operation %d on %lu inputs gave %lu values, should be %lu",
+    (int) Operation, (unsigned long) NumberOfInputs,
+    (unsigned long) Actual.count, (unsigned long) Expected.count))
+      Check (memcmp (Actual.values, Expected.values,
+        Expected.count * sizeof (int32)) == 0,
+        "set operation %d on %lu inputs gave the wrong values",
+        (int) Operation, (unsigned long) NumberOfInputs);
+
+    for (Tree = 0; Tree < NumberOfInputs; Tree++)
+      FreeTestRange (&TestRanges[Tree]);
+  }
+
+  for (Tree = 0; Tree < 3; Tree++)
+  {
+    AVLDupFreeTree (TreePntrs[Tree]);
+    free (PresentArray[Tree]);
+  }
+  EmptyResultList (&RangeList);
+}
+
+
+
+/* Prefix and pattern searches, compared with picking out the matching keys
+from the whole tree with strncmp and fnmatch.  Pattern searches are done
+with and without a tree of reversed keys, which finds the pairs in a
+different order, so those get sorted. */
+
+static const char *g_TestPrefixes [] = {"", "/", "/boot/home/config/",
+  "/boot/home/config/settings/b", "/boot/home/config/settings/B", "k1", "K",
+  "k", "zzz", "/boot/home/config/settings/q0001", NULL};
+
+static const char *g_TestPatterns [] = {"*", "k*", "K*", "*5", "*00?",
+  "/boot/*/settings/[a-c]*", "/boot/home/config/settings/[!a-m]*",
+  "*[0-9]7", "k?", "?1*", "k\\1*", "*settings/?0001*", "[k/]*9", "*[]]",
+  "", "k12", "*s/*3*", NULL};
+
+static void TestStringSearch (void)
+{
+  ResultListRecord  Actual;
+  uint32            Count;
+  const char       *CursorPntr;
+  ResultListRecord  Expected;
+  uint32            i;
+  AVLDupThingRecord Key;
+  char              KeyString [MAX_KEY_LENGTH];
+  size_t            PrefixLength;
+  AVLDupTreePointer ReversedTreePntr;
+  uint32            Seed = 46;
+  AVLDupTreePointer TreePntr;
+  AVLDupThingRecord Value;
+  int32             ValueNumber;
+  ResultListRecord  WholeTree;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  memset (&WholeTree, 0, sizeof (WholeTree));
+  TreePntr = AllocReferenceTree ();
+  ReversedTreePntr = AllocReferenceTree ();
+  AddRandomPairs (TreePntr, NULL, 3000, &Seed);
+  IterateTree (TreePntr, &g_WholeTree, &WholeTree);
+  CursorPntr = ResultText (&WholeTree);
+  while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+  {
+    AVLDupReverseString (KeyString);
+    Key.int64Thing = 0;
+    AVLDupConvertStringToThing (KeyString, &Key, B_STRING_TYPE);
+    SetValueThing (&Value, ValueNumber);
+    AVLDupAdd (ReversedTreePntr, &Key, &Value);
+    FreeKeyThing (&Key);
+  }
+
+  for (i = 0; g_TestPrefixes[i] != NULL; i++)
+  {
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    PrefixLength = strlen (g_TestPrefixes[i]);
+    CursorPntr = ResultText (&WholeTree);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+      if (strncmp (KeyString, g_TestPrefixes[i], PrefixLength) == 0)
+      {
+        AppendText (&Expected, KeyString);
+        sprintf (KeyString, "\t%ld\n", (long) ValueNumber);
+        AppendText (&Expected, KeyString);
+        Expected.count++;
+      }
+    Check (AVLDupIteratePrefix (TreePntr, g_TestPrefixes[i], CollectCallback,
+      &Actual), "iterating over prefix \"%s\"", g_TestPrefixes[i]);
+    SameResults (g_TestPrefixes[i], &Expected, &Actual);
+    Count = 0;
+    Check (AVLDupCountPrefix (TreePntr, g_TestPrefixes[i], &Count) &&
+      Count == Expected.count, "counted %lu pairs with prefix \"%s\", "
+      "should be %lu", (unsigned long) Count, g_TestPrefixes[i],
+      (unsigned long) Expected.count);
+  }
+
+  for (i = 0; g_TestPatterns[i] != NULL; i++)
+  {
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    CursorPntr = ResultText (&WholeTree);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+      if (fnmatch (g_TestPatterns[i], KeyString, 0) == 0)
+      {
+        AppendText (&Expected, KeyString);
+        sprintf (KeyString, "\t%ld\n", (long) ValueNumber);
+        AppendText (&Expected, KeyString);
+        Expected.count++;
+      }
+    Check (AVLDupIteratePattern (TreePntr, g_TestPatterns[i], NULL,
+      CollectCallback, &Actual), "matching pattern \"%s\"",
+      g_TestPatterns[i]);
+    SameResults (g_TestPatterns[i], &Expected, &Actual);
+
+    EmptyResultList (&Actual);
+    Check (AVLDupIteratePattern (TreePntr, g_TestPatterns[i],
+      ReversedTreePntr, CollectCallback, &Actual),
+      "matching pattern \"%s\" with reversed keys", g_TestPatterns[i]);
+    SortResultList (&Actual);
+    SortResultList (&Expected);
+    SameResults (g_TestPatterns[i], &Expected, &Actual);
+  }
+
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+  EmptyResultList (&WholeTree);
+  AVLDupFreeTree (TreePntr);
+  AVLDupFreeTree (ReversedTreePntr);
+}
+
+
+
+/* Collated trees should have the same pairs as a plain tree (keys which are
+equal ignoring case are still separate keys, since the values differ), in
+case insensitive order, and should find keys regardless of case. */
+
+static const char *g_TestWords [] = {"apple", "Apple", "APPLE", "apricot",
+  "Apricot", "banana", "Banana", "b", "B", "a", "A", "cherry", "zebra",
+  "Zebra", "ZEBRA", "applesauce", "AppleSauce", NULL};
+
+static void TestCollation (void)
+{
+  ResultListRecord  Actual;
+  AVLDupCollation   Collation;
+  const char       *CursorPntr;
+  ResultListRecord  Expected;
+  uint32            i;
+  AVLDupThingRecord Key;
+  char              KeyString [MAX_KEY_LENGTH];
+  uint32            NumberOfWords;
+  uint32            OutOfOrder;
+  uint32            PrefixCount;
+  char              PreviousKey [MAX_KEY_LENGTH];
+  int32             PreviousValue;
+  AVLDupTreePointer ReferenceTreePntr;
+  AVLDupTreePointer TreePntr;
+  AVLDupThingRecord Value;
+  int32             ValueNumber;
+
+  memset (&Actual, 0, sizeof (Actual));
+  memset (&Expected, 0, sizeof (Expected));
+  for (NumberOfWords = 0; g_TestWords[NumberOfWords] != NULL; NumberOfWords++)
+    ;
+
+  for (Collation = AVLDUP_COLLATION_IGNORE_CASE;
+  Collation <= AVLDUP_COLLATION_DICTIONARY; Collation++)
+  {
+    TreePntr = AVLDupAllocCollatedTree (B_STRING_TYPE, B_INT32_TYPE,
+      "Collated", 10, Collation);
+    if (!Check (TreePntr != NULL, "allocating collated tree %d",
+    (int) Collation))
+      continue;
+    ReferenceTreePntr = AllocReferenceTree ();
+    for (i = 0; i < 20 * NumberOfWords; i++)
+    {
+      if (i < NumberOfWords)
+        strcpy (KeyString, g_TestWords[i]);
+      else
+        sprintf (KeyString, "%s%lu", g_TestWords[i % NumberOfWords],
+          (unsigned long) (i / NumberOfWords % 4));
+      Key.int64Thing = 0;
+      AVLDupConvertStringToThing (KeyString, &Key, B_STRING_TYPE);
+      SetValueThing (&Value, i);
+      Check (AVLDupAdd (TreePntr, &Key, &Value), "adding \"%s\"", KeyString);
+      AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+      FreeKeyThing (&Key);
+    }
+
+    EmptyResultList (&Actual);
+    EmptyResultList (&Expected);
+    IterateTree (TreePntr, &g_WholeTree, &Actual);
+    IterateTree (ReferenceTreePntr, &g_WholeTree, &Expected);
+    Check (AVLDupGetTreeCount (TreePntr) == Expected.count,
+      "collated tree count %u, should be %lu", AVLDupGetTreeCount (TreePntr),
+      (unsigned long) Expected.count);
+
+    OutOfOrder = 0;
+    PreviousKey[0] = 0;
+    PreviousValue = -1;
+    CursorPntr = ResultText (&Actual);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+    {
+      if (strcasecmp (PreviousKey, KeyString) > 0 ||
+      (Collation == AVLDUP_COLLATION_IGNORE_CASE &&
+      strcasecmp (PreviousKey, KeyString) == 0 &&
+      PreviousValue >= ValueNumber))
+        OutOfOrder++;
+      strcpy (PreviousKey, KeyString);
+      PreviousValue = ValueNumber;
+    }
+    Check (OutOfOrder == 0, "collated tree %d has %lu pairs out of order",
+      (int) Collation, (unsigned long) OutOfOrder);
+    SortResultList (&Actual);
+    SortResultList (&Expected);
+    SameResults ("collated tree", &Expected, &Actual);
+
+    /* The prefix search goes by the tree's collation too. */
+
+    EmptyResultList (&Actual);
+    AVLDupIteratePrefix (TreePntr, "ap", CollectCallback, &Actual);
+    PrefixCount = 0;
+    CursorPntr = ResultText (&Expected);
+    while (ReadResultLine (&CursorPntr, KeyString, &ValueNumber))
+      if (strncasecmp (KeyString, "ap", 2) == 0)
+        PrefixCount++;
+    Check (Actual.count == PrefixCount, "collated tree %d found %lu keys "
+      "starting with \"ap\", should be %lu", (int) Collation,
+      (unsigned long) Actual.count, (unsigned long) PrefixCount);
+
+    /* Deleting using a key with different capitals. */
+
+    if (Collation == AVLDUP_COLLATION_IGNORE_CASE)
+    {
+      Key.int64Thing = 0;
+      AVLDupConvertStringToThing ("ApPlE", &Key, B_STRING_TYPE);
+      SetValueThing (&Value, 0); /* "apple" was added with value 0. */
+      Check (AVLDupDelete (TreePntr, &Key, &Value),
+        "deleting \"apple\" as \"ApPlE\"");
+      Check (!AVLDupDelete (TreePntr, &Key, &Value),
+        "deleting \"apple\" as \"ApPlE\" a second time");
+      FreeKeyThing (&Key);
+    }
+
+    AVLDupFreeTree (TreePntr);
+    AVLDupFreeTree (ReferenceTreePntr);
+  }
+  EmptyResultList (&Actual);
+  EmptyResultList (&Expected);
+}
+
+
+
+/* Interning, turned off and on again part way through, which shouldn't
+change what is in the tree. */
+
+static void TestInterning (void)
+{
+  uint32            i;
+  AVLDupThingRecord Key;
+  AVLDupTreePointer ReferenceTreePntr;
+  uint32            Seed = 50;
+  AVLDupTreePointer TreePntr;
+  AVLDupThingRecord Value;
+
+  ReferenceTreePntr = AllocReferenceTree ();
+  TreePntr = AllocReferenceTree ();
+  Check (AVLDupEnableInterning (TreePntr, true), "turning on interning");
+  for (i = 1; i <= 15000; i++)
+  {
+    SetKeyThing (&Key, RandomNumber (&Seed) % KEY_SPACE);
+    SetValueThing (&Value, RandomNumber (&Seed) % VALUE_SPACE);
+    if (RandomNumber (&Seed) % 3 != 0)
+    {
+      Check (AVLDupAdd (TreePntr, &Key, &Value), "adding pair %lu",
+        (unsigned long) i);
+      AVLDupAdd (ReferenceTreePntr, &Key, &Value);
+    }
+    else
+      Check (AVLDupDelete (TreePntr, &Key, &Value) ==
+        AVLDupDelete (ReferenceTreePntr, &Key, &Value),
+        "deleting pair %lu disagrees with the plain tree",
+        (unsigned long) i);
+    FreeKeyThing (&Key);
+    if (i % 5000 == 0)
+    {
+      SameTrees ("interned tree", ReferenceTreePntr, TreePntr, 10, &Seed);
+      Check (AVLDupEnableInterning (TreePntr, i != 5000),
+        "turning interning %s", (i != 5000) ? "on" : "off");
+    }
+  }
+  AVLDupFreeTree (TreePntr);
+  AVLDupFreeTree (ReferenceTreePntr);
+}
+
+
+
+/******************************************************************************
+ * The main program.
+ */
+
+static TestRecord g_Tests [] =
+{
+  {"concurrent tree", TestConcurrentTree, false},
+  {"concurrent tree with threads", TestConcurrentTreeThreads, true},
+  {"deferred changes", TestDeferredChanges, false},
+  {"parallel iteration", TestParallelIterate, true},
+  {"parallel adding and freeing", TestParallelAddAndFree, true},
+  {"saving and loading", TestSaveAndLoad, false},
+  {"mapped trees", TestMappedTree, false},
+  {"write-ahead log", TestWriteAheadLog, false},
+  {"LSM tree", TestLSMTree, false},
+  {"LSM tree with threads", TestLSMTreeThreads, true},
+  {"statistics", TestStatistics, false},
+  {"latency and contention", TestLatencyAndContention, false},
+  {"recording", TestRecording, false},
+  {"batch lookups", TestLookupBatch, false},
+  {"multiple ranges", TestIterateRanges, false},
+  {"set operations", TestCombineValues, false},
+  {"prefix and pattern searches", TestStringSearch, false},
+  {"collation", TestCollation, false},
+  {"interning", TestInterning, false},
+  {NULL, NULL, false}
+};
+
+
+
+int main (int argc, char **argv)
+{
+  uint32 FailuresBefore;
+  int    i;
+  uint32 TestsFailed;
+  uint32 TestsRun;
+  bool   ThreadsOnly;
+
+  ThreadsOnly = false;
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp (argv[i], "--threads") == 0)
+      ThreadsOnly = true;
+    else if (argv[i][0] == '-')
+    {
+      printf ("Usage: %s [--threads] [ScratchDirectory]\n"
+        "Tests the AVLDupTree library, see AVLDupTest.c for details.\n"
+        "--threads runs just the tests which use several threads.\n"
+        "Files are saved in the scratch directory, /tmp by default.\n",
+        argv[0]);
+      return (strcmp (argv[i], "--help") == 0) ? 0 : 2;
+    }
+    else
+      g_ScratchDirectory = argv[i];
+  }
+
+  TestsFailed = TestsRun = 0;
+  for (i = 0; g_Tests[i].name != NULL; i++)
+  {
+    if (ThreadsOnly && !g_Tests[i].usesThreads)
+      continue;
+    printf ("%s: ", g_Tests[i].name);
+    fflush (stdout);
+    FailuresBefore = g_Failures;
+    g_Tests[i].testFunction ();
+    TestsRun++;
+    if (g_Failures == FailuresBefore)
+      printf ("ok\n");
+    else
+    {
+      TestsFailed++;
+      printf ("\n%s: %lu FAILED\n", g_Tests[i].name,
+        (unsigned long) (g_Failures - FailuresBefore));
+    }
+    fflush (stdout);
+  }
+
+  if (TestsFailed == 0)
+    printf ("All %lu tests passed.\n", (unsigned long) TestsRun);
+  else
+    printf ("%lu of %lu tests failed.\n", (unsigned long) TestsFailed,
+      (unsigned long) TestsRun);
+  return (TestsFailed == 0) ? 0 : 1;
+}